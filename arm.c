@@ -2,6 +2,9 @@
 
 #include "config.h"
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "tcasm.h"
 
 /* arm arch and cpu                                      ISAs
@@ -44,6 +47,14 @@ enum asm_arm_mode_e
   ARM_RLIST7   = 0x2000, /* list of regs in range r0..r7*/
   ARM_LABEL8   = 0x4000,
   ARM_LABEL11  = 0x8000,
+  ARM_IMM      = 0x00010000, /* any #value */
+  ARM_MEM      = 0x00020000, /* [rn], [rn, #val], [rn, rm{, lsl #n}] */
+  ARM_LIST     = 0x00040000, /* {reg, reg-reg, ...} */
+  ARM_LABEL    = 0x00080000, /* a symbol with an optional +/- offset */
+  ARM_SHIFT    = 0x00100000, /* lsl, lsr, asr or ror #value */
+  ARM_WBACK    = 0x00200000, /* rn! or [...]! */
+  ARM_RSHIFT   = 0x00400000, /* lsl, lsr, asr or ror rs */
+  ARM_POOL     = 0x00800000, /* =value or =label, for ldr */
 };
 
 /* instruction formats */
@@ -52,11 +63,11 @@ enum arm_format_e
   /* Thumb Instructions formats */
 
   FMT_TR3,      /* ooooooommmnnnddd     1    opcode Rld, Rln, Rlm | Rld, [Rln, Rlm]*/
-  FMT_TI3R2,    /* oooooooiiinnnddd     2    opcode Rld, [Rln, #imm3] */
+  FMT_TI3R2,    /* oooooooiiinnnddd     2    opcode Rld, Rln, #imm3 */
   FMT_TR1I8,    /* ooooodddiiiiiiii     3    opcode Rld, #imm8 */
   FMT_TI5R2,    /* oooooiiiiinnnddd     4    opcode Rld, [RLn, #imm5] */
-  FMT_TR2,      /* oooooooooommmddd     5    opcode Rlm, Rld */
-  FMT_TR1PCI8,  /* ooooodddiiiiiiii     6    opcode Rld, [PC, #imm8*4] */
+  FMT_TR2,      /* oooooooooommmddd     5    opcode Rld, Rlm */
+  FMT_TR1PCI8,  /* ooooodddiiiiiiii     6    opcode Rld, [PC, #imm8*4] | Rld, label */
   FMT_TR1SPI8,  /* ooooodddiiiiiiii     6    opcode Rld, [SP, #imm8*4] */
   FMT_TSPI7,    /* oooooooooiiiiiii     7    opcode SP, #imm7 */
   FMT_TRH2,     /* ooooooooDMmmmddd     8    opcode Rhd, Rhm */
@@ -69,10 +80,48 @@ enum arm_format_e
   FMT_TPCRL8,   /* oooooooRllllllll   MISC   opcode {Rl...[,PC]} */
   FMT_TLRRL8,   /* oooooooRllllllll   MISC   opcode {Rl...[,LR]} */
   FMT_TSETE,    /* 101101100101E000   MISC   setend */
-  FMT_TLI22,    /* 11110IIIIIIIIIII 111HHiiiiiiiiiii UB opcode imm22 */
+  FMT_TLI22,    /* 11110Siiiiiiiiii 11J1Jiiiiiiiiiii UB opcode imm24 */
+  FMT_TSHIFT,   /* oooooiiiiimmmddd     1    opcode Rld, Rlm, #imm5 */
+  FMT_TCB,      /* oooooioiiiiinnn    MISC   opcode Rln, label */
+  FMT_TNONE,    /* oooooooooooooooo          opcode */
+
+  /* Thumb-2 32-bit formats, first halfword then second one */
+
+  FMT_WDPI,     /* 11110i0ooooSnnnn 0iiiddddiiiiiiii  opcode Rd, Rn, #const */
+  FMT_WDPI12,   /* 11110i10ooo0nnnn 0iiiddddiiiiiiii  opcode Rd, Rn, #imm12 */
+  FMT_WMOV16,   /* 11110i10o100iiii 0iiiddddiiiiiiii  opcode Rd, #imm16 */
+  FMT_WADR,     /* 11110i10o0o01111 0iiiddddiiiiiiii  opcode Rd, label */
+  FMT_WDPR,     /* 1110101ooooSnnnn 0iiiddddiittmmmm  opcode Rd, Rn, Rm{, shift #n} */
+  FMT_WSHI,     /* 11101010010S1111 0iiiddddiittmmmm  opcode Rd, Rm, #n */
+  FMT_WSHR,     /* 111110100ttSnnnn 1111dddd0000mmmm  opcode Rd, Rn, Rm */
+  FMT_WMUL,     /* 111110110ooonnnn 1111ddddoooommmm  opcode Rd, Rn, Rm */
+  FMT_WMLA,     /* 111110110000nnnn aaaaddddoooommmm  opcode Rd, Rn, Rm, Ra */
+  FMT_WMULL,    /* 111110111ooonnnn llllhhhh0000mmmm  opcode RdLo, RdHi, Rn, Rm */
+  FMT_WLSI,     /* 1111100o1ooonnnn ttttiiiiiiiiiiii  opcode Rt, [Rn, #imm12] */
+  FMT_WLSI8,    /* 1111100o0ooonnnn tttt1PUWiiiiiiii  opcode Rt, [Rn, #+-imm8]{!} | Rt, [Rn], #+-imm8 */
+  FMT_WLSR,     /* 1111100o0ooonnnn tttt000000ssmmmm  opcode Rt, [Rn, Rm{, lsl #n}] */
+  FMT_WLSL,     /* 1111100oUoo11111 ttttiiiiiiiiiiii  opcode Rt, label */
+  FMT_WLDM,     /* 1110100ooLoWnnnn llllllllllllllll  opcode Rn{!}, {R...} */
+  FMT_WBCC,     /* 11110Scccciiiiii 10J0Jiiiiiiiiiii  opcode cond, imm20 */
+  FMT_WB,       /* 11110Siiiiiiiiii 10J1Jiiiiiiiiiii  opcode imm24 */
 
   /* ARM Instruction formats */
-  FMT_A,
+
+  FMT_ADP,      /* cccc00Ioooo Snnnnddddssssssssssss  opcode Rd, Rn, #const | Rm{, shift} */
+  FMT_AMOV16,   /* cccc00110o00iiiiddddiiiiiiiiiiii   opcode Rd, #imm16 */
+  FMT_AADR,     /* cccc0010o0o01111ddddiiiiiiiiiiii   opcode Rd, label */
+  FMT_ASH,      /* cccc0001101S0000ddddsssss tt0mmmm  opcode Rd, Rm, #n | Rs */
+  FMT_AMUL,     /* cccc000000ASddddnnnnssss1001mmmm   opcode Rd, Rm, Rs{, Rn} */
+  FMT_AMULL,    /* cccc00001UASHhhhlllllssss1001mmmm  opcode RdLo, RdHi, Rm, Rs */
+  FMT_AR2,      /* cccc0110oooo1111dddd1111oooommmm   opcode Rd, Rm */
+  FMT_ALS,      /* cccc01IPUBWLnnnnddddoooooooooooo   opcode Rd, [Rn...] | label | =value */
+  FMT_ALSH,     /* cccc000PUIWLnnnnddddiiii1SH1iiii   opcode Rd, [Rn...] */
+  FMT_ALDM,     /* cccc100PUSWLnnnnllllllllllllllll   opcode Rn{!}, {R...} */
+  FMT_AB,       /* cccc101Liiiiiiiiiiiiiiiiiiiiiiii   opcode label */
+  FMT_ABX,      /* cccc000100101111111111110o11mmmm   opcode Rm */
+  FMT_ASVC,     /* cccc1111iiiiiiiiiiiiiiiiiiiiiiii   opcode #imm24 */
+  FMT_ABKPT,    /* 111000010010iiiiiiiiiiii0111iiii   opcode #imm16 */
+  FMT_ANONE,    /* cccc0011001000001111000000000ooo   opcode */
 
 };
 
@@ -88,6 +137,41 @@ enum arm_format_e
 #define IT5T  0x0100 /* Thumb instructions (armv5t)*/
 #define IT6   0x0200 /* Thumb instructions (armv6)*/
 #define IT2   0x0400 /* Thumb-2 instructions (armv6m)*/
+#define IT7M  0x0800 /* Thumb-2 32-bit instructions (armv7m) */
+#define IA7   0x1000 /* ARM instructions (armv6t2/armv7) */
+#define IT7D  0x2000 /* Thumb-2 hardware divide (armv7-m, armv7-r, some armv7-a) */
+#define IT6A  0x4000 /* Thumb instructions (armv6, not in the m profiles) */
+
+#define ISA_THUMB (IT4T | IT5T | IT6 | IT6A | IT2 | IT7M | IT7D)
+#define ISA_ARM   (IA4 | IA4T | IA5T | IA5TE | IA5TJ | IA6 | IA6D | IA7)
+
+/* encoding modes, in state->mode */
+#define ARM_MODE_ARM   0
+#define ARM_MODE_THUMB 1
+
+/* backend relocations, named after the field they patch */
+enum arm_reloc_e
+{
+  ARM_RELOC_THM_B8 = ASM_RELOC_BACKEND, /* b<cond> */
+  ARM_RELOC_THM_B11,   /* b */
+  ARM_RELOC_THM_B20,   /* b<cond>.w */
+  ARM_RELOC_THM_B24,   /* b.w, bl */
+  ARM_RELOC_THM_CB,    /* cbz, cbnz */
+  ARM_RELOC_THM_PC8,   /* ldr Rt, label and adr */
+  ARM_RELOC_THM_PC12,  /* ldr.w Rt, label */
+  ARM_RELOC_THM_ADR12, /* adr.w */
+  ARM_RELOC_ARM_B24,   /* b, bl */
+  ARM_RELOC_ARM_PC12,  /* ldr Rt, label */
+  ARM_RELOC_ARM_ADR,   /* adr */
+};
+
+#define ARM_MAXOPS 4
+
+#define ARM_INDEX_HASH 128 /* buckets of the mnemonic index */
+#define ARM_ALIAS_HASH 32  /* buckets of the .req aliases */
+
+#define ARM_CORES  3 /* cores of the cycle tables */
+#define ARM_REFILL 2 /* pipeline refill after a taken branch, P in the TRMs */
 
 #define COUNT(tab) (sizeof(tab)/sizeof(tab[0]))
 
@@ -97,10 +181,15 @@ enum arm_format_e
 
 struct arm_operand_s
 {
-  uint16_t type;     /*recognized types*/
+  uint32_t type;     /*recognized types*/
   uint8_t  reg  : 4; /*recognized register (main)*/
   uint8_t  regd : 4; /*recognized register (displacement)*/
-  uint32_t value;    /*immediate value, label, or reg list */
+  uint8_t  shift;    /* shift type: lsl, lsr, asr, ror */
+  uint8_t  amount;   /* shift amount */
+  uint32_t value;    /*immediate value, displacement, or reg list */
+  const char *name;  /* label, in the line */
+  uint16_t namelen;
+  int32_t  addend;   /* label offset */
 };
 
 /*****************************************************************************/
@@ -115,6 +204,118 @@ struct arm_inst
   uint32_t opcode; /* bits with fixed values */
 };
 
+/*****************************************************************************/
+/* an instruction being encoded */
+
+struct arm_enc_s
+{
+  struct arm_operand_s *ops;
+  int      nops;
+  int      cond;    /* condition from the mnemonic, -1 if none */
+  int      width;   /* 2 or 4 from .n or .w, 0 for the narrowest form */
+  int      haswide; /* TRUE if a 32-bit form is a candidate */
+  uint32_t addr;    /* section offset of the instruction */
+  uint32_t reloc;   /* relocation to record, 0 if none */
+  int      relax;   /* TRUE if the narrow form may have to grow */
+  char     label[CONFIG_ASM_INBUF_SIZE]; /* its symbol */
+  int32_t  addend;
+  uint32_t next;    /* second instruction of a pair, 0 if none */
+  int      pool;    /* TRUE if the operand goes to the literal pool */
+  uint16_t isa;     /* available instruction sets */
+  const char *why;  /* why the last candidate did not match */
+};
+
+/*****************************************************************************/
+/* a literal, dumped by .ltorg or at the end of the input */
+
+struct arm_literal_s
+{
+  struct arm_literal_s *next;
+  struct asm_section_s *section; /* of the instructions that load it */
+  uint32_t value;
+  int32_t  addend;
+  char     *label;               /* symbol for =label, NULL for =value */
+  char     name[16];             /* where it is dumped */
+};
+
+/*****************************************************************************/
+/* backend state, in state->backenddata */
+
+struct arm_state_s
+{
+  struct arm_literal_s *pool;    /* pending literals, all sections */
+  struct arm_literal_s **last;
+  uint32_t nliterals;            /* for unique names */
+  uint16_t isa;                  /* instruction sets of the target */
+  char     target[24];           /* -mcpu or -march name, empty if none */
+  int16_t  *chain;               /* next entry of the same bucket, NULL until indexed */
+  int16_t  head[2][ARM_INDEX_HASH]; /* first entry of a bucket, per mode */
+  uint32_t naliases;
+  struct arm_alias_s *aliases[ARM_ALIAS_HASH];
+  int      cycles;               /* core of --cycles plus one, 0 if none */
+  int      stack;                /* TRUE for --stack-usage */
+  struct arm_rec_s *recs;        /* instructions, for the analyses */
+  uint32_t nrecs;
+  uint32_t maxrecs;
+};
+
+/* A register alias defined by name .req reg */
+
+struct arm_alias_s
+{
+  struct arm_alias_s *next;      /* same bucket */
+  int reg;
+  char name[1];                  /* allocated with the name */
+};
+
+/*****************************************************************************/
+/* -mcpu and -march names */
+
+struct arm_target_s
+{
+  const char *name;
+  uint16_t   isa;
+};
+
+/*****************************************************************************/
+/* An encoded instruction, recorded for the analyses of the report */
+
+struct arm_rec_s
+{
+  struct asm_section_s *section;
+  uint32_t offset;
+  uint16_t inst;     /* index in the instruction table */
+  uint8_t  cond;     /* TRUE if conditional */
+  uint8_t  nregs;    /* registers of a list */
+  uint16_t uses;     /* registers read */
+  uint16_t defs;     /* registers written */
+  int32_t  sp;       /* bytes taken on the stack, negative when freed */
+  uint8_t  spdyn;    /* TRUE if sp changes by an amount not known here */
+  char     *target;  /* symbol of a branch or call, NULL if none */
+  int      unit;     /* input, to resolve target */
+};
+
+/*****************************************************************************/
+/* Cycle cost of a format on each core of arm_cores */
+
+enum arm_cost_e
+{
+  COST_NONE,   /* not timed: ARM state */
+  COST_ALU,    /* +P if it writes pc */
+  COST_LDST,   /* ldr and str names, pipelined after another one */
+  COST_LIST,   /* +1 per register, +P with pc */
+  COST_BRANCH, /* +P when taken */
+  COST_CALL,
+  COST_BX,
+  COST_MUL,
+};
+
+struct arm_cost_s
+{
+  uint8_t kind;
+  uint8_t cycles[ARM_CORES];
+};
+
 /*****************************************************************************/
 /* forward declarations */
 
@@ -122,29 +323,176 @@ int arm_getinfos(struct asm_backend_infos_s *infos);
 int arm_directive(const struct asm_backend_s *backend, struct asm_state_s *state, char *buf);
 int arm_instruction(const struct asm_backend_s *backend, struct asm_state_s *state, char *buf);
 int arm_option(const struct asm_backend_s *backend, struct asm_state_s *state, char *buf);
+int arm_relocate(const struct asm_backend_s *backend, struct asm_state_s *state, const struct asm_reloc_s *reloc,
+                 const struct asm_symbol_s *sym, uint32_t value, uint32_t pc, uint8_t *data);
+int arm_finish(const struct asm_backend_s *backend, struct asm_state_s *state);
+void arm_release(const struct asm_backend_s *backend, struct asm_state_s *state);
+int arm_nop(const struct asm_backend_s *backend, struct asm_state_s *state,
+            uint32_t offset, uint8_t *buf, uint32_t size);
+int arm_report(const struct asm_backend_s *backend, struct asm_state_s *state, FILE *out);
+int arm_relax(const struct asm_backend_s *backend, struct asm_state_s *state, struct asm_section_s *sec,
+              struct asm_reloc_s *reloc, const struct asm_symbol_s *sym, uint32_t value, uint32_t *grow);
+void arm_move(const struct asm_backend_s *backend, struct asm_state_s *state, struct asm_section_s *sec,
+              uint32_t offset, int32_t delta);
+uint32_t arm_save(const struct asm_backend_s *backend, struct asm_state_s *state, uint8_t *buf);
+int arm_restore(const struct asm_backend_s *backend, struct asm_state_s *state, const uint8_t *buf, uint32_t len);
 
 /*****************************************************************************/
 
-const struct asm_backend_s arm_backend = 
+const struct asm_backend_s arm_backend =
 {
   arm_getinfos,
   arm_directive,
   arm_instruction,
   arm_option,
+  arm_relocate,
+  arm_finish,
+  arm_release,
+  arm_nop,
+  arm_report,
+  arm_relax,
+  arm_move,
+  arm_save,
+  arm_restore,
 };
 
 /*****************************************************************************
  * Variables
  *****************************************************************************/
 
-/* ARM7TDMI THUMB instructions */
+/* Thumb then ARM instructions */
 
-struct arm_inst arm_thumb_instructions[] = /* DDI 0100i */
+static const struct arm_inst arm_thumb_instructions[] = /* DDI 0100i */
 {
 #include "arm_inst_thumb.h"
 #include "arm_inst_code32.h"
 };
 
+static const char * const arm_conds[] =
+{
+  "eq", "ne", "cs", "cc", "mi", "pl", "vs", "vc",
+  "hi", "ls", "ge", "lt", "gt", "le", "al", "hs", "lo"
+};
+
+static const char * const arm_shifts[] = { "lsl", "lsr", "asr", "ror" };
+
+/* instructions that write their first operand without reading it, besides
+ * loads
+ */
+
+static const char * const arm_moves[] =
+{
+  "mov", "movs", "mvn", "mvns", "movw", "adr", "negs", "rev", "rev16",
+  "revsh", "sxtb", "sxth", "uxtb", "uxth"
+};
+
+#define ISA_V4T  (IA4 | IA6D | IA4T | IT4T)
+#define ISA_V5T  (ISA_V4T | IA5T | IT5T)
+#define ISA_V5TE (ISA_V5T | IA5TE | IA5TJ)
+#define ISA_V6   (IA4 | IA4T | IA5T | IA5TE | IA5TJ | IA6 | IT4T | IT5T | IT6 | IT6A)
+#define ISA_V6M  (IT4T | IT5T | IT6 | IT2)
+#define ISA_V7M  (ISA_V6M | IT7M | IT7D)
+#define ISA_V7   (ISA_V6 | IA7 | ISA_V6M | IT7M) /* divide in Thumb is optional */
+#define ISA_V7R  (ISA_V7 | IT7D)
+
+static const struct arm_target_s arm_archs[] =
+{
+  { "armv4",    IA4 | IA6D },
+  { "armv4t",   ISA_V4T },
+  { "armv5t",   ISA_V5T },
+  { "armv5te",  ISA_V5TE },
+  { "armv5tej", ISA_V5TE },
+  { "armv6",    ISA_V6 },
+  { "armv6k",   ISA_V6 },
+  { "armv6t2",  ISA_V7 },
+  { "armv6-m",  ISA_V6M },
+  { "armv7",    ISA_V7 },
+  { "armv7-a",  ISA_V7 },
+  { "armv7-r",  ISA_V7R },
+  { "armv7-m",  ISA_V7M },
+  { "armv7e-m", ISA_V7M },
+};
+
+static const struct arm_target_s arm_cpus[] =
+{
+  { "strongarm",    IA4 | IA6D },
+  { "arm7tdmi",     ISA_V4T },
+  { "arm9tdmi",     ISA_V4T },
+  { "arm920t",      ISA_V4T },
+  { "arm10tdmi",    ISA_V5T },
+  { "arm9e",        ISA_V5TE },
+  { "arm926ej-s",   ISA_V5TE },
+  { "xscale",       ISA_V5TE },
+  { "arm1136j-s",   ISA_V6 },
+  { "arm1176jzf-s", ISA_V6 },
+  { "arm1156t2-s",  ISA_V7 },
+  { "cortex-m0",    ISA_V6M },
+  { "cortex-m0plus",ISA_V6M },
+  { "cortex-m1",    ISA_V6M },
+  { "cortex-m3",    ISA_V7M },
+  { "cortex-m4",    ISA_V7M },
+  { "cortex-m7",    ISA_V7M },
+  { "cortex-r4",    ISA_V7R },
+  { "cortex-r5",    ISA_V7R },
+  { "cortex-a5",    ISA_V7 },
+  { "cortex-a7",    ISA_V7R },
+  { "cortex-a8",    ISA_V7 },
+  { "cortex-a9",    ISA_V7 },
+  { "cortex-a15",   ISA_V7R },
+};
+
+/* --cycles cores, and the costs of the formats on each. From the technical
+ * reference manuals: P is ARM_REFILL, division is at its worst case, muls
+ * is single cycle on the cortex-m0 (fast multiplier). Formats that also
+ * hold ldr and str names cost COST_LDST for them.
+ */
+
+static const char * const arm_cores[ARM_CORES] = { "cortex-m0", "cortex-m3", "cortex-m4" };
+
+static const struct arm_cost_s arm_costs[] =
+{
+  [FMT_TR3]     = { COST_ALU,    { 1, 1, 1 } },
+  [FMT_TI3R2]   = { COST_ALU,    { 1, 1, 1 } },
+  [FMT_TR1I8]   = { COST_ALU,    { 1, 1, 1 } },
+  [FMT_TI5R2]   = { COST_LDST,   { 2, 2, 2 } },
+  [FMT_TR2]     = { COST_ALU,    { 1, 1, 1 } },
+  [FMT_TR1PCI8] = { COST_ALU,    { 1, 1, 1 } },
+  [FMT_TR1SPI8] = { COST_ALU,    { 1, 1, 1 } },
+  [FMT_TSPI7]   = { COST_ALU,    { 1, 1, 1 } },
+  [FMT_TRH2]    = { COST_ALU,    { 1, 1, 1 } },
+  [FMT_TC4I8]   = { COST_BRANCH, { 1, 1, 1 } },
+  [FMT_TI11]    = { COST_BRANCH, { 1, 1, 1 } },
+  [FMT_TI8]     = { COST_ALU,    { 1, 1, 1 } },
+  [FMT_TRB]     = { COST_BX,     { 3, 3, 3 } },
+  [FMT_CPS]     = { COST_ALU,    { 1, 1, 1 } },
+  [FMT_TR1RL8]  = { COST_LIST,   { 1, 1, 1 } },
+  [FMT_TPCRL8]  = { COST_LIST,   { 1, 1, 1 } },
+  [FMT_TLRRL8]  = { COST_LIST,   { 1, 1, 1 } },
+  [FMT_TSETE]   = { COST_ALU,    { 1, 1, 1 } },
+  [FMT_TLI22]   = { COST_CALL,   { 4, 3, 3 } },
+  [FMT_TSHIFT]  = { COST_ALU,    { 1, 1, 1 } },
+  [FMT_TCB]     = { COST_BRANCH, { 1, 1, 1 } },
+  [FMT_TNONE]   = { COST_ALU,    { 1, 1, 1 } },
+  [FMT_WDPI]    = { COST_ALU,    { 1, 1, 1 } },
+  [FMT_WDPI12]  = { COST_ALU,    { 1, 1, 1 } },
+  [FMT_WMOV16]  = { COST_ALU,    { 1, 1, 1 } },
+  [FMT_WADR]    = { COST_ALU,    { 1, 1, 1 } },
+  [FMT_WDPR]    = { COST_ALU,    { 1, 1, 1 } },
+  [FMT_WSHI]    = { COST_ALU,    { 1, 1, 1 } },
+  [FMT_WSHR]    = { COST_ALU,    { 1, 1, 1 } },
+  [FMT_WMUL]    = { COST_MUL,    { 1, 1, 1 } }, /* sdiv, udiv: 12 */
+  [FMT_WMLA]    = { COST_MUL,    { 2, 2, 1 } },
+  [FMT_WMULL]   = { COST_MUL,    { 5, 5, 1 } },
+  [FMT_WLSI]    = { COST_LDST,   { 2, 2, 2 } },
+  [FMT_WLSI8]   = { COST_LDST,   { 2, 2, 2 } },
+  [FMT_WLSR]    = { COST_LDST,   { 2, 2, 2 } },
+  [FMT_WLSL]    = { COST_LDST,   { 2, 2, 2 } },
+  [FMT_WLDM]    = { COST_LIST,   { 1, 1, 1 } },
+  [FMT_WBCC]    = { COST_BRANCH, { 1, 1, 1 } },
+  [FMT_WB]      = { COST_BRANCH, { 1, 1, 1 } },
+  [FMT_ANONE]   = { COST_NONE,   { 0, 0, 0 } }, /* ARM formats are not timed */
+};
+
 /*****************************************************************************
  * Functions
  *****************************************************************************/
@@ -155,211 +503,3776 @@ int arm_getinfos(struct asm_backend_infos_s *infos)
   infos->endianess = ASM_ENDIAN_LITTLE;
   infos->wordsize = 4; /* 32-bit int and longs */
   infos->align_p2 = 1; /* align boundaries to power of twos */
+  infos->elf_machine = 40;         /* EM_ARM */
+  infos->elf_flags   = 0x05000000; /* EABI version 5 */
   return ASM_OK;
 }
 
-
 /*****************************************************************************/
+/* ARM modified immediate: an 8-bit value rotated right by an even amount.
+ * The rotation is given by the trailing zeros, rounded down to even, so
+ * there is no need to try the 16 of them. Values that wrap around bit 31
+ * are tried again rotated left by 8. Returns -1 if there is no encoding.
+ */
 
-/* https://gcc.gnu.org/onlinedocs/gcc/ARM-Options.html */
-
-int arm_option(const struct asm_backend_s *backend, struct asm_state_s *state, char *buf)
+static int arm_a32_modimm(uint32_t val, uint32_t *bits)
 {
-  printf("arm option: %s\n",buf);
-  return ASM_OK;
-}
+  uint32_t rol;
+  int sh;
 
-/* https://sourceware.org/binutils/docs/as/ARM-Directives.html */
-int arm_directive(const struct asm_backend_s *backend, struct asm_state_s *state, char *dir)
-{
-  int ret = ASM_UNHANDLED;
-  printf("arm directive: %s\n",dir);
-  if(!strcmp(dir, ".thumb"))
+  if (val <= 0xFF)
     {
-      ret = ASM_OK;
+      *bits = val;
+      return 0;
     }
-  else if(!strcmp(dir, ".arm"))
+  sh = __builtin_ctz(val) & ~1;
+  if ((val >> sh) <= 0xFF)
     {
-      ret = ASM_OK;
+      *bits = ((32 - sh) / 2) << 8 | val >> sh;
+      return 0;
     }
-  else if(!strcmp(dir, ".code")) /*[16|32]*/
+  rol = val << 8 | val >> 24;
+  sh  = __builtin_ctz(rol) & ~1;
+  if ((rol >> sh) <= 0xFF)
     {
-      ret = ASM_OK;
+      *bits = (((40 - sh) / 2) & 15) << 8 | rol >> sh;
+      return 0;
     }
-  /*
-   * .even -> .align 2 
-   * .pool/.ltorg : http://infocenter.arm.com/help/index.jsp?topic=/com.arm.doc.dui0041c/Chedgddh.html
-   * .syntax unified|divided : https://sourceware.org/binutils/docs/as/ARM_002dInstruction_002dSet.html#ARM_002dInstruction_002dSet
-   * .req .unreq -> special treatment, label is not a label but a reg name ! may have to remove the last label 
-   */ 
- 
-  return ret;
+  return -1;
 }
 
-
 /*****************************************************************************/
+/* Insert a pc relative offset in an opcode. The fields must be zero.
+ * Returns -1 if the offset cannot be encoded.
+ */
 
-char * arm_parse_operand(struct asm_state_s *state, char *buf, struct arm_operand_s *op)
+static int arm_target(uint32_t *opcode, uint32_t kind, int32_t off)
 {
-  char *arg;
-  long val;
+  uint32_t u = (uint32_t)off;
+  uint32_t s = (off < 0);
+  uint32_t a = s ? -u : u;
 
-  /* eat separators */
-  while(*buf && (*buf==' ' || *buf=='\t' || *buf==',')) buf++;
-  arg = buf;
-
-  if (*arg=='r' || *arg=='p' || *arg=='s' || *arg=='l' || *arg=='#')
+  switch (kind)
     {
-      /*reg,pc,sp,lr*/
-      while(*buf && !(*buf==' ' || *buf=='\t' || *buf==',')) buf++;
-      if(*buf)
+    case ARM_RELOC_THM_B8:
+      if ((off & 1) || off < -256 || off > 254)
         {
-          *buf = 0;
-          buf++;
+          return -1;
         }
-      if (*arg=='r')
+      *opcode |= (u >> 1) & 0xFF;
+      break;
+
+    case ARM_RELOC_THM_B11:
+      if ((off & 1) || off < -2048 || off > 2046)
         {
-          val = strtol(arg+1, NULL, 10);
-          if (val<0 || val>15)
-            {
-              goto linvalidreg;
-            }
-lvalidreg:
-          op->type = ARM_REG;
-          op->reg = val;
-          /* check special regs */
-          if(val<8)
-            {
-              op->type |= ARM_REG8;
-            }
-          else if(val==13)
-            {
-              op->type |= ARM_SP;
-            }
-          else if(val==15)
-            {
-              op->type |= ARM_PC;
-            }
-          printf("register %d, flags %04X\n", op->reg, op->type);
+          return -1;
+        }
+      *opcode |= (u >> 1) & 0x7FF;
+      break;
+
+    case ARM_RELOC_THM_B20:
+      if ((off & 1) || off < -1048576 || off > 1048574)
+        {
+          return -1;
+        }
+      *opcode |= s << 26 | ((u >> 12) & 0x3F) << 16 | ((u >> 18) & 1) << 13 |
+                 ((u >> 19) & 1) << 11 | ((u >> 1) & 0x7FF);
+      break;
+
+    case ARM_RELOC_THM_B24:
+      if ((off & 1) || off < -16777216 || off > 16777214)
+        {
+          return -1;
+        }
+      /* J1 = NOT(I1 EOR S), J2 = NOT(I2 EOR S) */
+      *opcode |= s << 26 | ((u >> 12) & 0x3FF) << 16 | (((u >> 23) & 1) ^ s ^ 1) << 13 |
+                 (((u >> 22) & 1) ^ s ^ 1) << 11 | ((u >> 1) & 0x7FF);
+      break;
+
+    case ARM_RELOC_THM_CB:
+      if ((off & 1) || off < 0 || off > 126)
+        {
+          return -1;
+        }
+      *opcode |= ((u >> 6) & 1) << 9 | ((u >> 1) & 0x1F) << 3;
+      break;
+
+    case ARM_RELOC_THM_PC8:
+      if ((off & 3) || off < 0 || off > 1020)
+        {
+          return -1;
+        }
+      *opcode |= u >> 2;
+      break;
+
+    case ARM_RELOC_THM_PC12:
+    case ARM_RELOC_ARM_PC12:
+      if (a > 4095)
+        {
+          return -1;
+        }
+      *opcode |= (s ? 0 : 1 << 23) | a;
+      break;
+
+    case ARM_RELOC_THM_ADR12:
+      if (a > 4095)
+        {
+          return -1;
+        }
+      if (s)
+        {
+          *opcode ^= 0x00A00000; /* add to sub */
+        }
+      *opcode |= ((a >> 11) & 1) << 26 | ((a >> 8) & 7) << 12 | (a & 0xFF);
+      break;
+
+    case ARM_RELOC_ARM_B24:
+      if ((off & 3) || off < -33554432 || off > 33554428)
+        {
+          return -1;
+        }
+      *opcode |= (u >> 2) & 0xFFFFFF;
+      break;
+
+    case ARM_RELOC_ARM_ADR:
+      if (arm_a32_modimm(a, &a))
+        {
+          return -1;
+        }
+      if (s)
+        {
+          *opcode ^= 0x00C00000; /* add to sub */
         }
-      else if (*arg == '#') /*TODO unified syntax does not require litterals to start with a # */
+      *opcode |= a;
+      break;
+
+    default:
+      return -1;
+    }
+  return 0;
+}
+
+/*****************************************************************************/
+/* Value of pc seen by an instruction at addr, for a relocation kind. ARM
+ * reads 8 bytes ahead, Thumb 4, and loads use the word aligned value.
+ */
+
+static uint32_t arm_pc(uint32_t kind, uint32_t addr)
+{
+  if (kind >= ARM_RELOC_ARM_B24)
+    {
+      return addr + 8;
+    }
+  if (kind == ARM_RELOC_THM_PC8 || kind == ARM_RELOC_THM_PC12 || kind == ARM_RELOC_THM_ADR12)
+    {
+      return (addr + 4) & ~3u;
+    }
+  return addr + 4;
+}
+
+/*****************************************************************************/
+/* Insert the offset from an instruction at pc to value, where a symbol was
+ * defined in mode. bl to the other instruction set becomes blx, no other
+ * branch can switch. Returns the reason of a failure, or NULL.
+ */
+
+static const char *arm_resolve(const struct arm_state_s *arm, uint32_t kind, uint32_t *opcode,
+                               uint32_t value, uint32_t pc, int mode)
+{
+  int a32 = (kind >= ARM_RELOC_ARM_B24);
+  uint32_t off = value - arm_pc(kind, pc);
+
+  if ((kind <= ARM_RELOC_THM_CB || kind == ARM_RELOC_ARM_B24) &&
+      mode != (a32 ? ARM_MODE_ARM : ARM_MODE_THUMB))
+    {
+      if (kind == ARM_RELOC_THM_B24 && (*opcode & 0xD000) == 0xD000)
         {
-          uint32_t val;
-          char *rest;
-          /* litteral */
-          arg++;
-          val = strtol(arg, &rest, 0);
-          /*check that no strange characters appear after the litteral*/
-          if (*rest)
+          /* from the word aligned pc to a word */
+          *opcode &= ~0x1000u;
+          off = value - ((pc + 4) & ~3u);
+          if (off & 3)
             {
-              emit_message(state, ASM_ERROR, "Syntax error in litteral near '%s'",arg);
-              return NULL;
+              return "target not on a word for blx";
             }
-          printf("litteral %s->%u\n",arg,val);
-          op->value = val;
-          /* set types according to value range */
         }
-      else if (arg[2])
+      else if (kind == ARM_RELOC_ARM_B24 && (*opcode & 0xFF000000) == 0xEB000000)
         {
-          /*after Rn and litterals, only allowed values are pc,sp, or lr*/
-linvalidreg:
-          emit_message(state, ASM_ERROR, "Invalid register %s", arg);
-          return NULL;
+          /* the halfword of the offset is the H bit */
+          *opcode = 0xFA000000 | (off & 2) << 23;
+          off &= ~2u;
         }
-      else if (arg[0]=='s' && arg[1]=='p')
+      else
         {
-          val = 13; /* sp = r13 */
-          goto lvalidreg;
+          return "target in the other instruction set, only bl can switch";
         }
-      else if (arg[0]=='l' && arg[1]=='r')
+      if (arm && !(arm->isa & (a32 ? IA5T : IT5T)))
         {
-          val = 14; /* lr = r14 */
-          goto lvalidreg;
+          return "target in the other instruction set, without blx";
         }
-      else if (arg[0]=='p' && arg[1]=='c')
+    }
+  if (arm_target(opcode, kind, off))
+    {
+      return "target out of range";
+    }
+  return NULL;
+}
+
+/*****************************************************************************/
+/* pc relative references, once the addresses are known */
+
+int arm_relocate(const struct asm_backend_s *backend, struct asm_state_s *state, const struct asm_reloc_s *reloc,
+                 const struct asm_symbol_s *sym, uint32_t value, uint32_t pc, uint8_t *data)
+{
+  const char *why;
+  uint32_t opcode;
+  int narrow;
+  int arm;
+
+  if (reloc->type < ARM_RELOC_THM_B8 || reloc->type > ARM_RELOC_ARM_ADR)
+    {
+      return ASM_UNHANDLED;
+    }
+  narrow = (reloc->type == ARM_RELOC_THM_B8 || reloc->type == ARM_RELOC_THM_B11 ||
+            reloc->type == ARM_RELOC_THM_CB || reloc->type == ARM_RELOC_THM_PC8);
+  arm    = (reloc->type >= ARM_RELOC_ARM_B24);
+
+  opcode = data[0] | data[1] << 8;
+  if (arm)
+    {
+      opcode |= data[2] << 16 | (uint32_t)data[3] << 24;
+    }
+  else if (!narrow)
+    {
+      opcode = opcode << 16 | data[2] | data[3] << 8;
+    }
+  why = arm_resolve(state->backenddata, reloc->type, &opcode, value, pc, sym->mode);
+  if (why)
+    {
+      return emit_message(state, ASM_ERROR, "Reference to '%s' at 0x%08X: %s", reloc->symbolname, pc, why);
+    }
+  if (narrow)
+    {
+      data[0] = opcode;
+      data[1] = opcode >> 8;
+    }
+  else if (arm)
+    {
+      data[0] = opcode;
+      data[1] = opcode >> 8;
+      data[2] = opcode >> 16;
+      data[3] = opcode >> 24;
+    }
+  else
+    {
+      data[0] = opcode >> 16;
+      data[1] = opcode >> 24;
+      data[2] = opcode;
+      data[3] = opcode >> 8;
+    }
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* A narrow Thumb reference that may not reach its label: b, b<cond>, ldr
+ * and adr take their 32-bit form, two bytes longer, if it does not.
+ */
+
+int arm_relax(const struct asm_backend_s *backend, struct asm_state_s *state, struct asm_section_s *sec,
+              struct asm_reloc_s *reloc, const struct asm_symbol_s *sym, uint32_t value, uint32_t *grow)
+{
+  uint8_t  data[4];
+  uint32_t opcode;
+  uint32_t type;
+
+  *grow = 0;
+  if (section_bytes(sec, reloc->offset, data, 2, 0))
+    {
+      return emit_message(state, ASM_ERROR, "Relocation outside of section %s", sec->name);
+    }
+  opcode = data[0] | data[1] << 8;
+  if (sym && !arm_resolve(state->backenddata, reloc->type, &opcode, value, reloc->offset, sym->mode))
+    {
+      return ASM_OK;
+    }
+
+  opcode = data[0] | data[1] << 8;
+  switch (reloc->type)
+    {
+    case ARM_RELOC_THM_B8: /* b<cond>.w, the condition moves */
+      opcode = 0xF0008000 | (opcode & 0x0F00) << 14;
+      type   = ARM_RELOC_THM_B20;
+      break;
+
+    case ARM_RELOC_THM_B11: /* b.w */
+      opcode = 0xF0009000;
+      type   = ARM_RELOC_THM_B24;
+      break;
+
+    case ARM_RELOC_THM_PC8: /* ldr.w rt, [pc, #imm12] or adr.w rd */
+      if ((opcode & 0xF800) == 0x4800)
         {
-          val = 15; /* pc = r15 */
-          goto lvalidreg;
+          opcode = 0xF85F0000 | (opcode & 0x0700) << 4;
+          type   = ARM_RELOC_THM_PC12;
         }
       else
         {
-          /* catch-all for undefined cases */
-          emit_message(state, ASM_ERROR, "Syntax error for operand '%s'", arg);
-          return NULL;
+          opcode = 0xF20F0000 | (opcode & 0x0700);
+          type   = ARM_RELOC_THM_ADR12;
         }
+      break;
 
+    default:
+      return ASM_UNHANDLED;
     }
-  else if(*arg=='[' || *arg=='{')
+
+  if (section_resize(state, sec, reloc->offset + 2, 2) != ASM_OK)
     {
-      char sep = *arg;
-      struct arm_operand_s tmp;
-      int count;
-      /*compute closing char */
-      sep = (*arg=='[')?']':'}';
+      return ASM_ERROR;
+    }
+  data[0] = opcode >> 16;
+  data[1] = opcode >> 24;
+  data[2] = opcode;
+  data[3] = opcode >> 8;
+  section_bytes(sec, reloc->offset, data, 4, 1);
+  reloc->type = type;
+  *grow = 2;
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* Instructions of sec from offset moved by delta bytes. The records of a
+ * section are in offset order.
+ */
+
+void arm_move(const struct asm_backend_s *backend, struct asm_state_s *state, struct asm_section_s *sec,
+              uint32_t offset, int32_t delta)
+{
+  struct arm_state_s *arm = state->backenddata;
+  uint32_t i;
 
-      /*[ra,rb], [ra,#imm], {ra,...}*/
-      arg++; /* skip initial bracket */
-      while(*buf && !(*buf==sep)) buf++;
-      if(*buf)
+  for (i = arm ? arm->nrecs : 0; i > 0; i--)
+    {
+      if (arm->recs[i - 1].section != sec)
         {
-          *buf = 0;
-          buf++;
+          continue;
         }
-      printf("arg: %s\n",arg);
-
-      /* recursively parse the contents of the arg
-       * we count the args and only expect 2.
-       * Also the first one has to be a reg. */
-      count = 0;
-      while (*arg)
+      if (arm->recs[i - 1].offset < offset)
         {
-          arg = arm_parse_operand(state, arg, &tmp);
-          if(!arg) return arg;
-          count++;
+          break;
         }
-      printf("composite done\n");
+      arm->recs[i - 1].offset += delta;
     }
-  else
+}
+
+/*****************************************************************************/
+/* Pending literal of the current section with this value, or NULL */
+
+static struct arm_literal_s *arm_pool_find(struct asm_state_s *state, const struct arm_operand_s *op)
+{
+  struct arm_state_s *arm = state->backenddata;
+  struct arm_literal_s *lit;
+
+  for (lit = arm ? arm->pool : NULL; lit; lit = lit->next)
     {
-      emit_message(state, ASM_ERROR, "Syntax error near '%s'", arg);
-      return NULL;
+      if (lit->section != state->current_section)
+        {
+          continue;
+        }
+      if (op->name ? (lit->label && lit->addend == op->addend && !strncmp(lit->label, op->name, op->namelen) &&
+                      !lit->label[op->namelen])
+                   : (!lit->label && lit->value == op->value))
+        {
+          return lit;
+        }
     }
-  return buf;
+  return NULL;
 }
 
 /*****************************************************************************/
+/* Hash of mnemonics and register aliases */
 
-int arm_instruction(const struct asm_backend_s *backend, struct asm_state_s *state, char *buf)
+static uint32_t arm_hash(const char *name, int len)
 {
-  struct arm_operand_s operands[3];
-  int nops;
-  int i;
-  char *inst = buf;
+  uint32_t h = 5381;
 
-  printf("arm instruction: %s\n",buf);
+  while (len--)
+    {
+      h = h * 33 + (uint8_t)*name++;
+    }
+  return h;
+}
 
-  while(*buf && !(*buf==' ' || *buf=='\t')) buf++;
-  *buf = 0;
-  buf++;
+/*****************************************************************************/
+/* The backend state, created on first use. Returns NULL after an error. */
 
-  printf("opcode: %s\n",inst);
+static struct arm_state_s *arm_state(struct asm_state_s *state)
+{
+  struct arm_state_s *arm = state->backenddata;
 
-  /* parse operands */
-  nops = 0;
-  while (*buf)
+  if (!arm)
     {
-      buf = arm_parse_operand(state, buf, &operands[nops]);
-      if(!buf) return ASM_ERROR;
-      nops++;
+      arm = asm_malloc(state, MEM_BACKEND, sizeof(struct arm_state_s));
+      if (!arm)
+        {
+          emit_message(state, ASM_ERROR, "malloc() failed");
+          return NULL;
+        }
+      memset(arm, 0, sizeof(struct arm_state_s));
+      arm->last = &arm->pool;
+      arm->isa  = ISA_ARM | ISA_THUMB;
+      state->backenddata = arm;
     }
+  return arm;
+}
 
-  /* try to match something */
+/*****************************************************************************/
+/* Add a literal to the pool of the current section, unless it is already
+ * there. Its symbol name is copied to name.
+ */
+
+static int arm_pool_add(struct asm_state_s *state, const struct arm_operand_s *op, char *name)
+{
+  struct arm_state_s *arm = arm_state(state);
+  struct arm_literal_s *lit;
 
-  for (i=0; i<COUNT(arm_thumb_instructions); i++)
+  if (!arm)
     {
-      printf("-> %s\n",arm_thumb_instructions[i].name);
+      return ASM_ERROR;
     }
 
+  lit = arm_pool_find(state, op);
+  if (!lit)
+    {
+      lit = asm_malloc(state, MEM_SYMBOL, sizeof(struct arm_literal_s) + (op->name ? op->namelen + 1 : 0));
+      if (!lit)
+        {
+          return emit_message(state, ASM_ERROR, "malloc() failed");
+        }
+      lit->next    = NULL;
+      lit->section = state->current_section;
+      lit->value   = op->value;
+      lit->addend  = op->addend;
+      lit->label   = NULL;
+      if (op->name)
+        {
+          lit->label = (char*)&lit[1];
+          memcpy(lit->label, op->name, op->namelen);
+          lit->label[op->namelen] = 0;
+        }
+      sprintf(lit->name, ".Lpool%u", arm->nliterals++);
+      *arm->last = lit;
+      arm->last  = &lit->next;
+    }
+  strcpy(name, lit->name);
   return ASM_OK;
 }
 
+/*****************************************************************************/
+/* Append the pending literals of a section, or of all sections if sec is
+ * NULL, word aligned, each one after its label.
+ */
+
+static int arm_pool_dump(struct asm_state_s *state, struct asm_section_s *sec)
+{
+  struct arm_state_s *arm = state->backenddata;
+  struct asm_section_s *prev = state->current_section;
+  struct arm_literal_s **plit;
+  struct arm_literal_s *lit;
+  uint8_t buf[4] = { 0 };
+  int ret = ASM_OK;
+
+  if (!arm)
+    {
+      return ASM_OK;
+    }
+  plit = &arm->pool;
+  while ((lit = *plit) && ret == ASM_OK)
+    {
+      if (sec && lit->section != sec)
+        {
+          plit = &lit->next;
+          continue;
+        }
+      state->current_section = lit->section;
+      TRACE(state, DEBUG_ARM, 2, "literal %s in %s\n", lit->name, lit->section->name);
+
+      ret = section_pad(state, lit->section, 4, 0);
+      if (ret == ASM_OK)
+        {
+          ret = symbol_define(state, lit->name);
+        }
+      if (ret == ASM_OK && lit->label)
+        {
+          ret = symbol_reference(state, lit->label, lit->addend, ASM_RELOC_ABS32, section_size(lit->section), 0);
+          memset(buf, 0, sizeof(buf));
+        }
+      else
+        {
+          buf[0] = lit->value;
+          buf[1] = lit->value >> 8;
+          buf[2] = lit->value >> 16;
+          buf[3] = lit->value >> 24;
+        }
+      if (ret == ASM_OK)
+        {
+          ret = chunk_append(state, &lit->section->data, buf, 4);
+        }
+      memset(buf, 0, sizeof(buf));
+
+      *plit = lit->next;
+      asm_free(state, lit);
+    }
+
+  /* the list may have lost its tail */
+
+  for (arm->last = &arm->pool; *arm->last; arm->last = &(*arm->last)->next);
+  state->current_section = prev;
+  return ret;
+}
+
+/*****************************************************************************/
+/* end of an input: its literals must be dumped while its labels are seen */
+
+int arm_finish(const struct asm_backend_s *backend, struct asm_state_s *state)
+{
+  return arm_pool_dump(state, NULL);
+}
+
+/*****************************************************************************/
+/* NOP padding of code: the hint if the target has one, else a mov to itself.
+ * Bytes before the first instruction boundary are zeros. In Thumb state, a
+ * narrow NOP reaches a word boundary, then nop.w fills the words, and a
+ * narrow NOP the last halfword.
+ */
+
+static uint32_t arm_nop_fill(uint8_t *buf, const uint8_t *nop, uint32_t len, uint32_t size)
+{
+  uint32_t i;
+
+  for (i = 0; i < size; i += len)
+    {
+      memcpy(buf + i, nop, len);
+    }
+  return size;
+}
+
+int arm_nop(const struct asm_backend_s *backend, struct asm_state_s *state,
+            uint32_t offset, uint8_t *buf, uint32_t size)
+{
+  static const uint8_t nops[4][4] =
+  {
+    { 0x00, 0xBF },             /* nop */
+    { 0xC0, 0x46 },             /* mov r8, r8 */
+    { 0x00, 0xF0, 0x20, 0xE3 }, /* nop */
+    { 0x00, 0x00, 0xA0, 0xE1 }, /* mov r0, r0 */
+  };
+  static const uint8_t nopw[4] = { 0xAF, 0xF3, 0x00, 0x80 }; /* first halfword first */
+  struct arm_state_s *arm = state->backenddata;
+  uint16_t isa = arm ? arm->isa : (ISA_ARM | ISA_THUMB);
+  const uint8_t *nop;
+  uint32_t head;
+  uint32_t words;
+
+  if (state->mode != ARM_MODE_THUMB)
+    {
+      nop = nops[(isa & IA7) ? 2 : 3];
+      memset(buf, 0, size & 3);
+      arm_nop_fill(buf + (size & 3), nop, 4, size & ~3);
+      return ASM_OK;
+    }
+
+  nop  = nops[(isa & IT2) ? 0 : 1];
+  head = size & 1;
+  memset(buf, 0, head);
+  offset += head;
+  buf    += head;
+  size   -= head;
+  if (!(isa & IT7M))
+    {
+      arm_nop_fill(buf, nop, 2, size);
+      return ASM_OK;
+    }
+
+  head  = (offset & 2) ? 2 : 0;
+  head  = (head > size) ? size : head;
+  words = (size - head) & ~3;
+  buf  += arm_nop_fill(buf, nop, 2, head);
+  buf  += arm_nop_fill(buf, nopw, 4, words);
+  arm_nop_fill(buf, nop, 2, size - head - words);
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+
+void arm_release(const struct asm_backend_s *backend, struct asm_state_s *state)
+{
+  struct arm_state_s *arm = state->backenddata;
+  struct arm_literal_s *lit;
+  struct arm_alias_s *alias;
+  int i;
+
+  if (!arm)
+    {
+      return;
+    }
+  while (arm->pool)
+    {
+      lit = arm->pool;
+      arm->pool = lit->next;
+      asm_free(state, lit);
+    }
+  if (arm->chain)
+    {
+      asm_free(state, arm->chain);
+    }
+  for (i = 0; i < arm->nrecs; i++)
+    {
+      if (arm->recs[i].target)
+        {
+          asm_free(state, arm->recs[i].target);
+        }
+    }
+  if (arm->recs)
+    {
+      asm_free(state, arm->recs);
+    }
+  for (i = 0; i < ARM_ALIAS_HASH; i++)
+    {
+      while (arm->aliases[i])
+        {
+          alias = arm->aliases[i];
+          arm->aliases[i] = alias->next;
+          asm_free(state, alias);
+        }
+    }
+  asm_free(state, arm);
+  state->backenddata = NULL;
+}
+
+/*****************************************************************************/
+
+/* https://gcc.gnu.org/onlinedocs/gcc/ARM-Options.html */
+
+int arm_option(const struct asm_backend_s *backend, struct asm_state_s *state, char *buf)
+{
+  const struct arm_target_s *targets;
+  struct arm_state_s *arm;
+  const char *name;
+  int count;
+  int i;
+
+  TRACE(state, DEBUG_ARM, 1, "arm option: %s\n",buf);
+  if (!strcmp(buf, "thumb") || !strcmp(buf, "arm"))
+    {
+      state->mode = (buf[0] == 't') ? ARM_MODE_THUMB : ARM_MODE_ARM;
+      return ASM_OK;
+    }
+  if (!strncmp(buf, "cycles=", 7))
+    {
+      for (i = 0; i < ARM_CORES && strcmp(buf + 7, arm_cores[i]); i++);
+      if (i == ARM_CORES)
+        {
+          return emit_message(state, ASM_ERROR, "Unknown core '%s' for cycles", buf + 7);
+        }
+      arm = arm_state(state);
+      if (!arm)
+        {
+          return ASM_ERROR;
+        }
+      arm->cycles = i + 1;
+      return ASM_OK;
+    }
+  if (!strcmp(buf, "stack"))
+    {
+      arm = arm_state(state);
+      if (!arm)
+        {
+          return ASM_ERROR;
+        }
+      arm->stack = 1;
+      return ASM_OK;
+    }
+  if (!strncmp(buf, "cpu=", 4))
+    {
+      targets = arm_cpus;
+      count   = COUNT(arm_cpus);
+    }
+  else if (!strncmp(buf, "arch=", 5))
+    {
+      targets = arm_archs;
+      count   = COUNT(arm_archs);
+    }
+  else
+    {
+      return emit_message(state, ASM_ERROR, "Unknown arm option '%s'", buf);
+    }
+
+  name = strchr(buf, '=') + 1;
+  for (i = 0; i < count && strcmp(targets[i].name, name); i++);
+  if (i == count || strlen(name) >= sizeof(arm->target))
+    {
+      return emit_message(state, ASM_ERROR, "Unknown %s '%s'", (targets == arm_cpus) ? "cpu" : "architecture", name);
+    }
+  arm = arm_state(state);
+  if (!arm)
+    {
+      return ASM_ERROR;
+    }
+  arm->isa = targets[i].isa;
+  strcpy(arm->target, name);
+
+  /* the index is built again for this mask on next use */
+
+  if (arm->chain)
+    {
+      asm_free(state, arm->chain);
+      arm->chain = NULL;
+    }
+
+  /* profiles without ARM state start in Thumb state */
+
+  if (!(arm->isa & ISA_ARM))
+    {
+      state->mode = ARM_MODE_THUMB;
+    }
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* Return the link to the alias of that name, or to the NULL ending its bucket */
+
+static struct arm_alias_s **arm_alias_find(struct arm_state_s *arm, const char *name, int len)
+{
+  struct arm_alias_s **link = &arm->aliases[arm_hash(name, len) % ARM_ALIAS_HASH];
+
+  while (*link && (strncmp((*link)->name, name, len) || (*link)->name[len]))
+    {
+      link = &(*link)->next;
+    }
+  return link;
+}
+
+/*****************************************************************************/
+/* .unreq name: remove a register alias */
+
+static int arm_unreq(struct asm_state_s *state)
+{
+  struct asm_token_s *tok = &state->tokens[state->tokcur];
+  const char *arg = state->tokline + tok->pos;
+  struct arm_state_s *arm = state->backenddata;
+  struct arm_alias_s **link;
+  struct arm_alias_s *alias;
+
+  if (state->tokcur + 1 != state->ntokens || tok->type != TOK_WORD)
+    {
+      return emit_message(state, ASM_ERROR, ".unreq expects an alias name");
+    }
+  link = arm ? arm_alias_find(arm, arg, tok->len) : NULL;
+  if (!link || !*link)
+    {
+      return emit_message(state, ASM_ERROR, "Unknown register alias '%.*s'", tok->len, arg);
+    }
+  alias = *link;
+  *link = alias->next;
+  asm_free(state, alias);
+  arm->naliases--;
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* Report that the target has no ARM or Thumb state. Returns TRUE if so. */
+
+static int arm_nostate(struct asm_state_s *state, int mode)
+{
+  struct arm_state_s *arm = state->backenddata;
+
+  if (arm && !(arm->isa & ((mode == ARM_MODE_THUMB) ? ISA_THUMB : ISA_ARM)))
+    {
+      emit_message(state, ASM_ERROR, "%s has no %s state", arm->target, (mode == ARM_MODE_THUMB) ? "Thumb" : "ARM");
+      return 1;
+    }
+  return 0;
+}
+
+/* https://sourceware.org/binutils/docs/as/ARM-Directives.html */
+int arm_directive(const struct asm_backend_s *backend, struct asm_state_s *state, char *dir)
+{
+  int ret = ASM_UNHANDLED;
+  TRACE(state, DEBUG_ARM, 1, "arm directive: %s\n",dir);
+  if(!strcmp(dir, ".thumb"))
+    {
+      if (arm_nostate(state, ARM_MODE_THUMB))
+        {
+          return ASM_ERROR;
+        }
+      state->mode = ARM_MODE_THUMB;
+      ret = ASM_OK;
+    }
+  else if(!strcmp(dir, ".arm"))
+    {
+      if (arm_nostate(state, ARM_MODE_ARM))
+        {
+          return ASM_ERROR;
+        }
+      state->mode = ARM_MODE_ARM;
+      ret = ASM_OK;
+    }
+  else if(!strcmp(dir, ".code")) /*[16|32]*/
+    {
+      struct asm_token_s *tok = &state->tokens[state->tokcur];
+      const char *arg;
+      if (state->tokcur + 1 != state->ntokens || tok->len != 2)
+        {
+          return emit_message(state, ASM_ERROR, ".code expects 16 or 32");
+        }
+      arg = state->tokline + tok->pos;
+      if (!strncmp(arg, "16", 2) && !arm_nostate(state, ARM_MODE_THUMB))
+        {
+          state->mode = ARM_MODE_THUMB;
+        }
+      else if (!strncmp(arg, "32", 2) && !arm_nostate(state, ARM_MODE_ARM))
+        {
+          state->mode = ARM_MODE_ARM;
+        }
+      else if (!strncmp(arg, "16", 2) || !strncmp(arg, "32", 2))
+        {
+          return ASM_ERROR;
+        }
+      else
+        {
+          return emit_message(state, ASM_ERROR, ".code expects 16 or 32");
+        }
+      ret = ASM_OK;
+    }
+  else if(!strcmp(dir, ".syntax")) /* unified|divided */
+    {
+      struct asm_token_s *tok = &state->tokens[state->tokcur];
+      if (state->tokcur + 1 != state->ntokens || tok->len != 7 ||
+          strncmp(state->tokline + tok->pos, "unified", 7))
+        {
+          return emit_message(state, ASM_ERROR, "Only .syntax unified is supported");
+        }
+      ret = ASM_OK;
+    }
+  else if(!strcmp(dir, ".ltorg") || !strcmp(dir, ".pool"))
+    {
+      if (!state->current_section)
+        {
+          return emit_message(state, ASM_ERROR, "No current section");
+        }
+      ret = arm_pool_dump(state, state->current_section);
+    }
+  else if(!strcmp(dir, ".unreq"))
+    {
+      ret = arm_unreq(state);
+    }
+  /*
+   * .even -> .align 2
+   */
+
+  return ret;
+}
+
+
+/*****************************************************************************/
+
+/* Return the number of a register name: r0-r15, sp, lr, pc. Returns -1 if
+ * this is not a register name, -2 for rN with N too large.
+ */
+
+static int arm_register_name(const char *arg, int len)
+{
+  int val;
+  int i;
+
+  if (arg[0] == 'r' && len >= 2 && len <= 3)
+    {
+      val = 0;
+      for (i = 1; i < len; i++)
+        {
+          if (arg[i] < '0' || arg[i] > '9')
+            {
+              return -1;
+            }
+          val = val * 10 + arg[i] - '0';
+        }
+      return (val > 15) ? -2 : val;
+    }
+  else if (len == 2)
+    {
+      if (arg[0]=='s' && arg[1]=='p')
+        {
+          return 13; /* sp = r13 */
+        }
+      else if (arg[0]=='l' && arg[1]=='r')
+        {
+          return 14; /* lr = r14 */
+        }
+      else if (arg[0]=='p' && arg[1]=='c')
+        {
+          return 15; /* pc = r15 */
+        }
+    }
+  return -1;
+}
+
+/*****************************************************************************/
+/* Return the number of a register name or alias, as arm_register_name().
+ * Aliases are only searched if the name is not a built-in one and some are
+ * defined.
+ */
+
+static int arm_register(struct asm_state_s *state, const char *arg, int len)
+{
+  struct arm_state_s *arm = state->backenddata;
+  struct arm_alias_s *alias;
+  int val;
+
+  val = arm_register_name(arg, len);
+  if (val != -1 || !arm || !arm->naliases)
+    {
+      return val;
+    }
+  alias = *arm_alias_find(arm, arg, len);
+  if (!alias)
+    {
+      return -1;
+    }
+  state->linevolatile = 1; /* the alias may be defined again */
+  return alias->reg;
+}
+
+/*****************************************************************************/
+/* Add a register alias, unless it exists */
+
+static int arm_alias_add(struct asm_state_s *state, struct arm_state_s *arm, const char *name, int reg)
+{
+  struct arm_alias_s **link;
+  int len = strlen(name);
+
+  link = arm_alias_find(arm, name, len);
+  if (*link)
+    {
+      if ((*link)->reg != reg)
+        {
+          emit_message(state, ASM_WARN, "Ignoring redefinition of register alias '%s'", name);
+        }
+      return ASM_OK;
+    }
+  *link = asm_malloc(state, MEM_BACKEND, sizeof(struct arm_alias_s) + len);
+  if (!*link)
+    {
+      return emit_message(state, ASM_ERROR, "malloc() failed");
+    }
+  (*link)->next = NULL;
+  (*link)->reg  = reg;
+  strcpy((*link)->name, name);
+  arm->naliases++;
+  TRACE(state, DEBUG_ARM, 2, "alias %s = r%d\n", name, reg);
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* name .req reg: define a register alias. The name is the mnemonic, the
+ * current token is .req.
+ */
+
+static int arm_req(struct asm_state_s *state, const char *name)
+{
+  struct asm_token_s *tok = &state->tokens[state->tokcur + 1];
+  const char *arg = state->tokline + tok->pos;
+  struct arm_state_s *arm;
+  int len = strlen(name);
+  int reg;
+
+  state->linevolatile = 1;
+  if (state->tokcur + 2 != state->ntokens || tok->type != TOK_WORD)
+    {
+      return emit_message(state, ASM_ERROR, ".req expects a register");
+    }
+  if (arm_register_name(name, len) != -1)
+    {
+      return emit_message(state, ASM_ERROR, "'%s' is a register name", name);
+    }
+  reg = arm_register(state, arg, tok->len);
+  if (reg < 0)
+    {
+      return emit_message(state, ASM_ERROR, "Invalid register %.*s", tok->len, arg);
+    }
+  arm = arm_state(state);
+  if (!arm)
+    {
+      return ASM_ERROR;
+    }
+
+  return arm_alias_add(state, arm, name, reg);
+}
+
+/*****************************************************************************/
+/* State left by a precompiled prelude: the instruction sets and the name
+ * of the target, then each register alias as its register and its name.
+ */
+
+uint32_t arm_save(const struct asm_backend_s *backend, struct asm_state_s *state, uint8_t *buf)
+{
+  struct arm_state_s *arm = state->backenddata;
+  struct arm_alias_s *alias;
+  uint32_t len;
+  int i;
+
+  if (!arm)
+    {
+      return 0;
+    }
+  len = 2 + strlen(arm->target) + 1;
+  if (buf)
+    {
+      buf[0] = arm->isa;
+      buf[1] = arm->isa >> 8;
+      strcpy((char*)buf + 2, arm->target);
+    }
+  for (i = 0; i < ARM_ALIAS_HASH; i++)
+    {
+      for (alias = arm->aliases[i]; alias; alias = alias->next)
+        {
+          if (buf)
+            {
+              buf[len] = alias->reg;
+              strcpy((char*)buf + len + 1, alias->name);
+            }
+          len += 1 + strlen(alias->name) + 1;
+        }
+    }
+  return len;
+}
+
+/*****************************************************************************/
+/* Restore the state saved by arm_save(). The target of the prelude is used
+ * unless -mcpu or -march chose one, it must then be the same.
+ */
+
+int arm_restore(const struct asm_backend_s *backend, struct asm_state_s *state, const uint8_t *buf, uint32_t len)
+{
+  struct arm_state_s *arm;
+  const char *name;
+  uint32_t pos;
+
+  if (!len)
+    {
+      return ASM_OK;
+    }
+  if (len < 3 || buf[len - 1])
+    {
+      return emit_message(state, ASM_ERROR, "Invalid arm state in pch");
+    }
+  arm = arm_state(state);
+  if (!arm)
+    {
+      return ASM_ERROR;
+    }
+
+  name = (const char*)buf + 2;
+  if (*name && *arm->target && strcmp(name, arm->target))
+    {
+      return emit_message(state, ASM_ERROR, "The pch was made for %s, not %s", name, arm->target);
+    }
+  if (*name && !*arm->target)
+    {
+      if (strlen(name) >= sizeof(arm->target))
+        {
+          return emit_message(state, ASM_ERROR, "Invalid arm state in pch");
+        }
+      arm->isa = buf[0] | buf[1] << 8;
+      strcpy(arm->target, name);
+      if (arm->chain)
+        {
+          asm_free(state, arm->chain);
+          arm->chain = NULL;
+        }
+    }
+
+  for (pos = 2 + strlen(name) + 1; pos + 1 < len; pos += 1 + strlen(name) + 1)
+    {
+      name = (const char*)buf + pos + 1;
+      if (buf[pos] > 15 || !*name)
+        {
+          return emit_message(state, ASM_ERROR, "Invalid arm state in pch");
+        }
+      if (arm_alias_add(state, arm, name, buf[pos]) != ASM_OK)
+        {
+          return ASM_ERROR;
+        }
+    }
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+
+/* Parse a register name token, with an optional ! for writeback */
+
+static int arm_parse_register(struct asm_state_s *state, struct asm_token_s *tok, struct arm_operand_s *op)
+{
+  const char *arg = state->tokline + tok->pos;
+  int len = tok->len;
+  int val;
+
+  if (tok->type != TOK_WORD)
+    {
+      return ASM_UNHANDLED;
+    }
+  if (len > 1 && arg[len - 1] == '!')
+    {
+      len--;
+    }
+
+  val = arm_register(state, arg, len);
+  if (val == -2)
+    {
+      return emit_message(state, ASM_ERROR, "Invalid register %.*s", tok->len, arg);
+    }
+  if (val < 0)
+    {
+      return ASM_UNHANDLED;
+    }
+
+  op->type = ARM_REG;
+  op->reg = val;
+  if (len < tok->len)
+    {
+      op->type |= ARM_WBACK;
+    }
+  /* check special regs */
+  if(val<8)
+    {
+      op->type |= ARM_REG8;
+    }
+  else if(val==13)
+    {
+      op->type |= ARM_SP;
+    }
+  else if(val==15)
+    {
+      op->type |= ARM_PC;
+    }
+  TRACE(state, DEBUG_ARM, 2, "register %d, flags %04X\n", op->reg, op->type);
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* Parse a register list {r0, r2-r4, lr}. tok is the index of the brace.
+ * Returns the index of the next token, or -1 after an error.
+ */
+
+static int arm_parse_list(struct asm_state_s *state, int tok, struct arm_operand_s *op)
+{
+  struct asm_token_s *t;
+  const char *arg;
+  const char *dash;
+  int first;
+  int last;
+
+  op->type  = ARM_LIST;
+  op->value = 0;
+  for (tok++; tok < state->ntokens && state->tokens[tok].type != TOK_RBRACE; tok++)
+    {
+      t = &state->tokens[tok];
+      if (t->type == TOK_COMMA)
+        {
+          continue;
+        }
+      arg   = state->tokline + t->pos;
+      dash  = memchr(arg, '-', t->len);
+      first = (t->type != TOK_WORD) ? -1 : arm_register(state, arg, dash ? dash - arg : t->len);
+      last  = (first < 0 || !dash) ? first : arm_register(state, dash + 1, t->len - (dash + 1 - arg));
+      if (first < 0 || last < first)
+        {
+          emit_message(state, ASM_ERROR, "Invalid register list near '%.*s'", t->len, arg);
+          return -1;
+        }
+      op->value |= (2u << last) - (1u << first);
+    }
+  if (tok == state->ntokens)
+    {
+      emit_message(state, ASM_ERROR, "Missing '}' in register list");
+      return -1;
+    }
+
+  if (!(op->value & ~0x00FF))
+    {
+      op->type |= ARM_RLIST7;
+    }
+  if (!(op->value & ~0x40FF))
+    {
+      op->type |= ARM_RLIST7LR;
+    }
+  if (!(op->value & ~0x80FF))
+    {
+      op->type |= ARM_RLIST7PC;
+    }
+  TRACE(state, DEBUG_ARM, 2, "register list %04X\n", op->value);
+  return tok + 1;
+}
+
+/*****************************************************************************/
+/* Parse one operand from the current line tokens, starting at index tok.
+ * Returns the index of the next token, or -1 after an error.
+ */
+
+static int arm_parse_operand(struct asm_state_s *state, int tok, struct arm_operand_s *op)
+{
+  struct asm_token_s *t = &state->tokens[tok];
+  char *arg = state->tokline + t->pos;
+  const char *name;
+  int pool;
+  int ret;
+  int i;
+
+  /* eat separators */
+  if (t->type == TOK_COMMA)
+    {
+      tok++;
+      t++;
+      arg = state->tokline + t->pos;
+      if (tok == state->ntokens)
+        {
+          emit_message(state, ASM_ERROR, "Missing operand after ','");
+          return -1;
+        }
+    }
+
+  memset(op, 0, sizeof(*op));
+
+  if (t->type == TOK_HASH) /*TODO unified syntax does not require litterals to start with a # */
+    {
+      uint32_t val;
+      char *rest;
+      char lit[24];
+
+      /* litteral */
+      t++;
+      if (tok + 1 == state->ntokens || t->type != TOK_WORD || t->len >= sizeof(lit))
+        {
+          emit_message(state, ASM_ERROR, "Syntax error in litteral near '%s'", arg + 1);
+          return -1;
+        }
+      memcpy(lit, state->tokline + t->pos, t->len);
+      lit[t->len] = 0;
+      val = strtoul(lit, &rest, 0);
+      if (lit[0] == '-')
+        {
+          val = strtol(lit, &rest, 0);
+        }
+      /*check that no strange characters appear after the litteral*/
+      if (*rest)
+        {
+          emit_message(state, ASM_ERROR, "Syntax error in litteral near '%s'", lit);
+          return -1;
+        }
+      TRACE(state, DEBUG_ARM, 2, "litteral %s->%u\n",lit,val);
+      op->value = val;
+      /* set types according to value range */
+      op->type = ARM_IMM;
+      if (val < 256)
+        {
+          op->type |= ARM_LIT8;
+        }
+      if (val < 32)
+        {
+          op->type |= ARM_LIT5;
+        }
+      if (val < 8)
+        {
+          op->type |= ARM_LIT3;
+        }
+      return tok + 2;
+    }
+
+  if (t->type == TOK_LBRACE)
+    {
+      return arm_parse_list(state, tok, op);
+    }
+
+  if (t->type == TOK_LBRACK)
+    {
+      struct arm_operand_s tmp[3];
+      int count;
+
+      /*[rn], [rn, #imm], [rn, rm], [rn, rm, lsl #imm] */
+      TRACE(state, DEBUG_ARM, 2, "arg: %s\n",arg);
+
+      /* recursively parse the contents of the arg
+       * we count the args and only expect 3.
+       * Also the first one has to be a reg. */
+      count = 0;
+      tok++;
+      while (tok < state->ntokens && state->tokens[tok].type != TOK_RBRACK)
+        {
+          if (count == COUNT(tmp))
+            {
+              emit_message(state, ASM_ERROR, "Too many terms in '%s'", arg);
+              return -1;
+            }
+          tok = arm_parse_operand(state, tok, &tmp[count]);
+          if (tok < 0) return tok;
+          count++;
+        }
+      if (tok == state->ntokens)
+        {
+          emit_message(state, ASM_ERROR, "Missing ']' after '%s'", arg);
+          return -1;
+        }
+      if (count == 0 || !(tmp[0].type & ARM_REG) ||
+          (count >= 2 && !(tmp[1].type & (ARM_REG | ARM_IMM))) ||
+          (count == 3 && (!(tmp[1].type & ARM_REG) || !(tmp[2].type & ARM_SHIFT))))
+        {
+          emit_message(state, ASM_ERROR, "Invalid address '%s'", arg);
+          return -1;
+        }
+      op->type = ARM_MEM;
+      op->reg  = tmp[0].reg;
+      if (count >= 2 && (tmp[1].type & ARM_REG))
+        {
+          op->type  |= ARM_RRD;
+          op->regd   = tmp[1].reg;
+          op->shift  = (count == 3) ? tmp[2].shift : 0;
+          op->amount = (count == 3) ? tmp[2].amount : 0;
+        }
+      else
+        {
+          op->type  |= ARM_RDS5;
+          op->value  = (count == 2) ? tmp[1].value : 0;
+        }
+      if (tmp[0].reg == 15)
+        {
+          op->type |= ARM_PCR8;
+        }
+      else if (tmp[0].reg == 13)
+        {
+          op->type |= ARM_SPR8;
+        }
+
+      /* pre-indexed writeback */
+      tok++;
+      if (tok < state->ntokens && state->tokens[tok].len == 1 && state->tokline[state->tokens[tok].pos] == '!')
+        {
+          op->type |= ARM_WBACK;
+          tok++;
+        }
+      TRACE(state, DEBUG_ARM, 2, "composite done\n");
+      return tok;
+    }
+
+  /*reg,pc,sp,lr*/
+  ret = arm_parse_register(state, t, op);
+  if (ret == ASM_OK)
+    {
+      return tok + 1;
+    }
+  if (ret == ASM_ERROR)
+    {
+      return -1;
+    }
+
+  /* shift #amount or shift register */
+  for (i = 0; t->type == TOK_WORD && t->len == 3 && i < COUNT(arm_shifts); i++)
+    {
+      if (!strncmp(arg, arm_shifts[i], 3) && tok + 1 < state->ntokens && t[1].type == TOK_WORD)
+        {
+          tok = arm_parse_operand(state, tok + 1, op);
+          if (tok >= 0 && op->type != (ARM_REG | (op->type & (ARM_REG8 | ARM_SP | ARM_PC))))
+            {
+              emit_message(state, ASM_ERROR, "Invalid shift register near '%s'", arg);
+              return -1;
+            }
+          op->type  = ARM_RSHIFT;
+          op->shift = i;
+          return tok;
+        }
+      if (!strncmp(arg, arm_shifts[i], 3) && tok + 1 < state->ntokens && t[1].type == TOK_HASH)
+        {
+          tok = arm_parse_operand(state, tok + 1, op);
+          if (tok >= 0 && op->value > 32)
+            {
+              emit_message(state, ASM_ERROR, "Invalid shift amount %u", op->value);
+              return -1;
+            }
+          op->type   = ARM_SHIFT;
+          op->shift  = i;
+          op->amount = op->value;
+          return tok;
+        }
+    }
+
+  /* label{+-offset}, =value or =label{+-offset} for the literal pool */
+  pool = (t->type == TOK_WORD && *arg == '=' && t->len > 1);
+  name = arg + pool;
+  if (pool && ((*name >= '0' && *name <= '9') || *name == '-'))
+    {
+      char num[24];
+      char *rest;
+
+      if (t->len - 1 >= sizeof(num))
+        {
+          emit_message(state, ASM_ERROR, "Syntax error near '%.*s'", t->len, arg);
+          return -1;
+        }
+      memcpy(num, name, t->len - 1);
+      num[t->len - 1] = 0;
+      op->type  = ARM_POOL;
+      op->value = (*num == '-') ? strtol(num, &rest, 0) : strtoul(num, &rest, 0);
+      if (*rest)
+        {
+          emit_message(state, ASM_ERROR, "Syntax error in litteral near '%s'", num);
+          return -1;
+        }
+      return tok + 1;
+    }
+  if (t->type == TOK_WORD && ((*name >= 'a' && *name <= 'z') || (*name >= 'A' && *name <= 'Z') ||
+                              *name == '_' || *name == '.' || *name == '$'))
+    {
+      char num[24];
+      char *rest;
+      int len;
+      int end = t->len - pool;
+
+      for (len = 1; len < end && name[len] != '+' && name[len] != '-'; len++);
+      op->type    = pool ? ARM_POOL : ARM_LABEL;
+      op->name    = name;
+      op->namelen = len;
+      if (len < end)
+        {
+          if (end - len >= sizeof(num))
+            {
+              emit_message(state, ASM_ERROR, "Syntax error near '%.*s'", t->len, arg);
+              return -1;
+            }
+          memcpy(num, name + len, end - len);
+          num[end - len] = 0;
+          op->addend = strtol(num, &rest, 0);
+          if (*rest || rest == num + 1)
+            {
+              emit_message(state, ASM_ERROR, "Syntax error near '%.*s'", t->len, arg);
+              return -1;
+            }
+        }
+      return tok + 1;
+    }
+
+  emit_message(state, ASM_ERROR, "Syntax error near '%s'", arg);
+  return -1;
+}
+
+/*****************************************************************************/
+/* Thumb-2 modified immediate: 00XY, 0XY0XY, XY0XY00, XYXYXYXY or 1bcdefgh
+ * rotated. The rotation is found from the leading zeros, not by trying all
+ * of them. Returns -1 if the constant cannot be encoded.
+ */
+
+static int arm_thumb_modimm(uint32_t val, uint32_t *bits)
+{
+  uint32_t b = val & 0xFF;
+  uint32_t imm12;
+  uint32_t unrot;
+  int rot;
+
+  if (val <= 0xFF)
+    {
+      imm12 = val;
+    }
+  else if (val == (b | b << 16))
+    {
+      imm12 = 0x100 | b;
+    }
+  else if (val == ((val >> 8 & 0xFF) * 0x01000100))
+    {
+      imm12 = 0x200 | (val >> 8 & 0xFF);
+    }
+  else if (val == b * 0x01010101)
+    {
+      imm12 = 0x300 | b;
+    }
+  else
+    {
+      /* the leading one is bit 7 of the unrotated byte */
+      rot   = 8 + __builtin_clz(val);
+      unrot = val << rot | val >> (32 - rot);
+      if (unrot > 0xFF)
+        {
+          return -1;
+        }
+      imm12 = rot << 7 | (unrot & 0x7F);
+    }
+  *bits = ((imm12 >> 11) & 1) << 26 | ((imm12 >> 8) & 7) << 12 | (imm12 & 0xFF);
+  return 0;
+}
+
+/*****************************************************************************/
+/* Encode a label operand. A symbol already defined in the current section
+ * of this input is resolved now, anything else becomes a relocation. While
+ * a narrow reference of the section may still grow, labels before move too
+ * and are relocations as well. An unresolved narrow form is relaxed: it is
+ * kept if it reaches its label in the end, else it grows to the wide form.
+ */
+
+static int arm_label(struct asm_state_s *state, struct arm_enc_s *enc, const struct arm_operand_s *op,
+                     uint32_t kind, int narrow, uint32_t *opcode)
+{
+  struct asm_section_s *sec = state->current_section;
+  struct asm_symbol_s *sym;
+  uint32_t o = *opcode;
+
+  if (op->namelen >= sizeof(enc->label))
+    {
+      enc->why = "symbol name too long";
+      return ASM_UNHANDLED;
+    }
+  memcpy(enc->label, op->name, op->namelen);
+  enc->label[op->namelen] = 0;
+  state->linevolatile = 1;
+
+  sym = symbol_find(state, enc->label, state->unit, 0);
+  sym = (sym && sym->section == sec) ? sym : NULL;
+  if (sym && !sec->nrelax)
+    {
+      /* the condition is needed to tell bl from blx */
+      if (kind == ARM_RELOC_ARM_B24)
+        {
+          o |= (uint32_t)((enc->cond < 0) ? 14 : enc->cond) << 28;
+        }
+      enc->why = arm_resolve(state->backenddata, kind, &o, sym->value + op->addend, enc->addr, sym->mode);
+      if (enc->why)
+        {
+          return ASM_UNHANDLED;
+        }
+      *opcode = o;
+      return ASM_OK;
+    }
+
+  if (narrow && enc->haswide && enc->width != 2)
+    {
+      /* a label before only gets further */
+      if (sym)
+        {
+          enc->why = arm_resolve(state->backenddata, kind, &o, sym->value + op->addend, enc->addr, sym->mode);
+          if (enc->why)
+            {
+              return ASM_UNHANDLED;
+            }
+        }
+      enc->relax = 1;
+    }
+  enc->reloc  = kind;
+  enc->addend = op->addend;
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* Shift encoding of a register operand: imm3:imm2 and type. lsr and asr
+ * accept 32, encoded as 0. Returns -1 if the amount is invalid.
+ */
+
+static int arm_thumb_shift(int type, uint32_t amount, uint32_t *bits)
+{
+  if ((type == 0 && amount > 31) || (type != 0 && (amount < 1 || amount > 32)) ||
+      (type == 3 && amount == 32))
+    {
+      return -1;
+    }
+  amount &= 31;
+  *bits = (amount >> 2) << 12 | (amount & 3) << 6 | type << 4;
+  return 0;
+}
+
+/*****************************************************************************/
+
+#define OP_REG(i) (enc->nops > (i) && (ops[i].type & ARM_REG) && !(ops[i].type & ARM_WBACK))
+#define OP_LO(i)  (OP_REG(i) && (ops[i].type & ARM_REG8))
+#define OP_IMM(i) (enc->nops > (i) && (ops[i].type & ARM_IMM))
+
+/* Encode one candidate. Returns ASM_UNHANDLED if it does not fit the
+ * operands, then the next candidate is tried.
+ */
+
+static int arm_thumb_encode(struct asm_state_s *state, const struct arm_inst *inst, struct arm_enc_s *enc,
+                            uint32_t *opcode)
+{
+  struct arm_operand_s *ops = enc->ops;
+  uint32_t o = inst->opcode;
+  uint32_t val;
+  uint32_t bits;
+  int n = enc->nops;
+  int rd;
+  int rn;
+  int rm;
+  int i;
+
+  if (enc->cond >= 0 && inst->format != FMT_TC4I8 && inst->format != FMT_WBCC)
+    {
+      enc->why = "conditional execution needs an IT block";
+      return ASM_UNHANDLED;
+    }
+
+  switch (inst->format)
+    {
+    case FMT_TNONE:
+      if (n != 0)
+        {
+          return ASM_UNHANDLED;
+        }
+      break;
+
+    case FMT_TSHIFT:
+      if (!OP_LO(0) || !((n == 3 && OP_LO(1) && OP_IMM(2)) || (n == 2 && OP_IMM(1))))
+        {
+          return ASM_UNHANDLED;
+        }
+      rm  = ops[n - 2].reg;
+      val = ops[n - 1].value;
+      if ((o == 0x0000 && val > 31) || (o != 0x0000 && (val < 1 || val > 32)))
+        {
+          enc->why = "invalid shift amount";
+          return ASM_UNHANDLED;
+        }
+      o |= (val & 31) << 6 | rm << 3 | ops[0].reg;
+      break;
+
+    case FMT_TR3:
+      if (o < 0x5000 && n >= 2 && n <= 3 && OP_LO(0) && OP_LO(1) && (n == 2 || OP_LO(2)))
+        {
+          /* adds/subs Rd, Rn, Rm, or Rd, Rm for Rd, Rd, Rm */
+          o |= ops[n - 1].reg << 6 | ops[n - 2].reg << 3 | ops[0].reg;
+        }
+      else if (o >= 0x5000 && n == 2 && OP_LO(0) && (ops[1].type & ARM_RRD) &&
+               !(ops[1].type & ARM_WBACK) && ops[1].reg < 8 && ops[1].regd < 8 && !ops[1].amount)
+        {
+          o |= ops[1].regd << 6 | ops[1].reg << 3 | ops[0].reg;
+        }
+      else
+        {
+          return ASM_UNHANDLED;
+        }
+      break;
+
+    case FMT_TI3R2:
+      if (n != 3 || !OP_LO(0) || !OP_LO(1) || !OP_IMM(2))
+        {
+          return ASM_UNHANDLED;
+        }
+      if (!(ops[2].type & ARM_LIT3))
+        {
+          enc->why = "immediate out of range";
+          return ASM_UNHANDLED;
+        }
+      o |= ops[2].value << 6 | ops[1].reg << 3 | ops[0].reg;
+      break;
+
+    case FMT_TR1I8:
+      if (!OP_LO(0) || !((n == 2 && OP_IMM(1)) ||
+                         (n == 3 && o >= 0x3000 && OP_REG(1) && ops[1].reg == ops[0].reg && OP_IMM(2))))
+        {
+          return ASM_UNHANDLED;
+        }
+      if (!(ops[n - 1].type & ARM_LIT8))
+        {
+          enc->why = "immediate out of range";
+          return ASM_UNHANDLED;
+        }
+      o |= ops[0].reg << 8 | ops[n - 1].value;
+      break;
+
+    case FMT_TR2:
+      if (!OP_LO(0) || !OP_LO(1))
+        {
+          return ASM_UNHANDLED;
+        }
+      rd = ops[0].reg;
+      rm = ops[1].reg;
+      if (o == 0x4240 && n == 3)
+        {
+          /* rsbs Rd, Rm, #0 */
+          if (!OP_IMM(2) || ops[2].value != 0)
+            {
+              return ASM_UNHANDLED;
+            }
+        }
+      else if (o == 0x4340 && n == 3)
+        {
+          /* muls Rd, Rn, Rd */
+          if (!OP_LO(2) || (ops[2].reg != rd && rm != rd))
+            {
+              return ASM_UNHANDLED;
+            }
+          rm = (rm == rd) ? ops[2].reg : rm;
+        }
+      else if (n == 3)
+        {
+          /* Rd, Rd, Rm for the operations with a destination */
+          if (o == 0x0000 || o == 0x4200 || o == 0x4280 || o == 0x42C0 || o >= 0xB000 ||
+              !OP_LO(2) || rm != rd)
+            {
+              return ASM_UNHANDLED;
+            }
+          rm = ops[2].reg;
+        }
+      else if (n != 2)
+        {
+          return ASM_UNHANDLED;
+        }
+      o |= rm << 3 | rd;
+      break;
+
+    case FMT_TRH2:
+      if (!OP_REG(0) || !OP_REG(1) || n > 3 || (n == 3 && (o != 0x4400 || !OP_REG(2) || ops[1].reg != ops[0].reg)))
+        {
+          return ASM_UNHANDLED;
+        }
+      rd = ops[0].reg;
+      rm = ops[n - 1].reg;
+      if (o == 0x4500 && rd < 8 && rm < 8)
+        {
+          return ASM_UNHANDLED;
+        }
+      o |= (rd & 8) << 4 | rm << 3 | (rd & 7);
+      break;
+
+    case FMT_TRB:
+      if (n != 1 || !OP_REG(0))
+        {
+          return ASM_UNHANDLED;
+        }
+      o |= ops[0].reg << 3;
+      break;
+
+    case FMT_TR1PCI8:
+      if (!OP_LO(0))
+        {
+          return ASM_UNHANDLED;
+        }
+      if (n == 2 && (ops[1].type & ARM_LABEL))
+        {
+          o |= ops[0].reg << 8;
+          if (arm_label(state, enc, &ops[1], ARM_RELOC_THM_PC8, 1, &o) != ASM_OK)
+            {
+              return ASM_UNHANDLED;
+            }
+          *opcode = o;
+          return ASM_OK;
+        }
+      if (o == 0x4800 && n == 2 && (ops[1].type & ARM_PCR8) && !(ops[1].type & (ARM_RRD | ARM_WBACK)))
+        {
+          val = ops[1].value;
+        }
+      else if (o == 0xA000 && n == 3 && OP_REG(1) && ops[1].reg == 15 && OP_IMM(2))
+        {
+          val = ops[2].value;
+        }
+      else
+        {
+          return ASM_UNHANDLED;
+        }
+      if ((val & 3) || val > 1020)
+        {
+          enc->why = "offset out of range";
+          return ASM_UNHANDLED;
+        }
+      o |= ops[0].reg << 8 | val >> 2;
+      break;
+
+    case FMT_TR1SPI8:
+      if (!OP_LO(0))
+        {
+          return ASM_UNHANDLED;
+        }
+      if (o != 0xA800 && n == 2 && (ops[1].type & ARM_SPR8) && !(ops[1].type & (ARM_RRD | ARM_WBACK)))
+        {
+          val = ops[1].value;
+        }
+      else if (o == 0xA800 && n == 3 && OP_REG(1) && ops[1].reg == 13 && OP_IMM(2))
+        {
+          val = ops[2].value;
+        }
+      else
+        {
+          return ASM_UNHANDLED;
+        }
+      if ((val & 3) || val > 1020)
+        {
+          enc->why = "offset out of range";
+          return ASM_UNHANDLED;
+        }
+      o |= ops[0].reg << 8 | val >> 2;
+      break;
+
+    case FMT_TI5R2:
+      if (n != 2 || !OP_LO(0) || !(ops[1].type & ARM_RDS5) || (ops[1].type & ARM_WBACK) || ops[1].reg > 7)
+        {
+          return ASM_UNHANDLED;
+        }
+      /* the offset is scaled by the access size */
+      i   = ((o & 0xF000) == 0x6000) ? 2 : ((o & 0xF000) == 0x8000) ? 1 : 0;
+      val = ops[1].value;
+      if ((val & ((1 << i) - 1)) || (val >> i) > 31)
+        {
+          enc->why = "offset out of range";
+          return ASM_UNHANDLED;
+        }
+      o |= (val >> i) << 6 | ops[1].reg << 3 | ops[0].reg;
+      break;
+
+    case FMT_TSPI7:
+      if (!OP_REG(0) || ops[0].reg != 13 || !((n == 2 && OP_IMM(1)) ||
+                                             (n == 3 && OP_REG(1) && ops[1].reg == 13 && OP_IMM(2))))
+        {
+          return ASM_UNHANDLED;
+        }
+      val = ops[n - 1].value;
+      if ((val & 3) || val > 508)
+        {
+          enc->why = "immediate out of range";
+          return ASM_UNHANDLED;
+        }
+      o |= val >> 2;
+      break;
+
+    case FMT_TCB:
+      if (n != 2 || !OP_LO(0) || !(ops[1].type & ARM_LABEL))
+        {
+          return ASM_UNHANDLED;
+        }
+      o |= ops[0].reg;
+      if (arm_label(state, enc, &ops[1], ARM_RELOC_THM_CB, 1, &o) != ASM_OK)
+        {
+          return ASM_UNHANDLED;
+        }
+      break;
+
+    case FMT_TI8:
+      if (n > 1 || (n == 1 && !OP_IMM(0)))
+        {
+          return ASM_UNHANDLED;
+        }
+      if (n == 1 && !(ops[0].type & ARM_LIT8))
+        {
+          enc->why = "immediate out of range";
+          return ASM_UNHANDLED;
+        }
+      o |= (n == 1) ? ops[0].value : 0;
+      break;
+
+    case FMT_CPS:
+      if (n != 1 || !(ops[0].type & ARM_LABEL) || ops[0].addend || ops[0].namelen > 3)
+        {
+          return ASM_UNHANDLED;
+        }
+      for (i = 0; i < ops[0].namelen; i++)
+        {
+          bits = (ops[0].name[i] == 'a') ? 4 : (ops[0].name[i] == 'i') ? 2 : (ops[0].name[i] == 'f') ? 1 : 0;
+          if (!bits || (o & bits))
+            {
+              return ASM_UNHANDLED;
+            }
+          o |= bits;
+        }
+      break;
+
+    case FMT_TSETE:
+      if (n != 1 || !(ops[0].type & ARM_LABEL) || ops[0].namelen != 2)
+        {
+          return ASM_UNHANDLED;
+        }
+      if (!strncmp(ops[0].name, "be", 2))
+        {
+          o |= 0x0008;
+        }
+      else if (strncmp(ops[0].name, "le", 2))
+        {
+          return ASM_UNHANDLED;
+        }
+      break;
+
+    case FMT_TR1RL8:
+      if (n != 2 || !(ops[0].type & ARM_REG8) || !(ops[1].type & ARM_RLIST7) || !ops[1].value)
+        {
+          return ASM_UNHANDLED;
+        }
+      /* ldm writes back unless the base is loaded, stm always does */
+      rn = ops[0].reg;
+      if (!(ops[0].type & ARM_WBACK) != ((o == 0xC800) && (ops[1].value & (1 << rn))))
+        {
+          enc->why = "invalid writeback";
+          return ASM_UNHANDLED;
+        }
+      o |= rn << 8 | ops[1].value;
+      break;
+
+    case FMT_TPCRL8:
+    case FMT_TLRRL8:
+      if (n != 1 || !ops[0].value ||
+          !(ops[0].type & ((inst->format == FMT_TPCRL8) ? ARM_RLIST7PC : ARM_RLIST7LR)))
+        {
+          return ASM_UNHANDLED;
+        }
+      o |= (ops[0].value & 0xC000 ? 0x100 : 0) | (ops[0].value & 0xFF);
+      break;
+
+    case FMT_TC4I8:
+      if (enc->cond < 0 || n != 1 || !(ops[0].type & ARM_LABEL))
+        {
+          return ASM_UNHANDLED;
+        }
+      o |= enc->cond << 8;
+      if (arm_label(state, enc, &ops[0], ARM_RELOC_THM_B8, 1, &o) != ASM_OK)
+        {
+          return ASM_UNHANDLED;
+        }
+      break;
+
+    case FMT_TI11:
+    case FMT_TLI22:
+    case FMT_WB:
+      if (enc->cond >= 0 || n != 1 || !(ops[0].type & ARM_LABEL))
+        {
+          return ASM_UNHANDLED;
+        }
+      if (arm_label(state, enc, &ops[0], (inst->format == FMT_TI11) ? ARM_RELOC_THM_B11 : ARM_RELOC_THM_B24,
+                          inst->format == FMT_TI11, &o) != ASM_OK)
+        {
+          return ASM_UNHANDLED;
+        }
+      break;
+
+    case FMT_WBCC:
+      if (enc->cond < 0 || n != 1 || !(ops[0].type & ARM_LABEL))
+        {
+          return ASM_UNHANDLED;
+        }
+      o |= enc->cond << 22;
+      if (arm_label(state, enc, &ops[0], ARM_RELOC_THM_B20, 0, &o) != ASM_OK)
+        {
+          return ASM_UNHANDLED;
+        }
+      break;
+
+    case FMT_WDPI:
+    case FMT_WDPR:
+      {
+        int hasrd = (o & 0x0F00) != 0x0F00;
+        int hasrn = (o & 0x000F0000) != 0x000F0000;
+        int last  = (inst->format == FMT_WDPI) ? ARM_IMM : ARM_REG;
+        int nregs = hasrd + hasrn;
+        int shift = (inst->format == FMT_WDPR && n > 0 && (ops[n - 1].type & ARM_SHIFT));
+
+        /* Rd, Rn, op2 or Rd, op2 for Rd, Rd, op2 */
+        if (n - shift == nregs + 1)
+          {
+            i = 0;
+          }
+        else if (hasrd && hasrn && n - shift == 2)
+          {
+            i = 1;
+          }
+        else
+          {
+            return ASM_UNHANDLED;
+          }
+        n -= shift;
+        for (rd = 0; rd < n - 1; rd++)
+          {
+            if (!OP_REG(rd) || ops[rd].reg == 15)
+              {
+                return ASM_UNHANDLED;
+              }
+          }
+        if (!(ops[n - 1].type & last) || (ops[n - 1].type & ARM_WBACK))
+          {
+            return ASM_UNHANDLED;
+          }
+        rd = hasrd ? ops[0].reg : 0;
+        rn = !hasrn ? 0 : (i || !hasrd) ? ops[0].reg : ops[1].reg;
+
+        if (inst->format == FMT_WDPR)
+          {
+            bits = 0;
+            if (shift && arm_thumb_shift(ops[n].shift, ops[n].amount, &bits))
+              {
+                enc->why = "invalid shift amount";
+                return ASM_UNHANDLED;
+              }
+            o |= bits | ops[n - 1].reg;
+          }
+        else if (arm_thumb_modimm(ops[n - 1].value, &bits))
+          {
+            /* the same operation on the complemented or negated constant */
+            static const int8_t alt[16] = { 1, 0, 3, 2, -1, -1, -1, -1, 13, -1, 11, 10, -1, 8, -1, -1 };
+            int op = (o >> 21) & 15;
+
+            val = ops[n - 1].value;
+            val = (op == 8 || op == 13) ? -val : ~val;
+            if (alt[op] < 0 || arm_thumb_modimm(val, &bits))
+              {
+                enc->why = "constant cannot be encoded";
+                return ASM_UNHANDLED;
+              }
+            o = (o & ~(15u << 21)) | alt[op] << 21;
+            o |= bits;
+          }
+        else
+          {
+            o |= bits;
+          }
+        o |= rn << 16 | rd << 8;
+      }
+      break;
+
+    case FMT_WDPI12:
+      if (!OP_REG(0) || !((n == 3 && OP_REG(1) && OP_IMM(2)) || (n == 2 && OP_IMM(1))) ||
+          ops[0].reg == 15 || ops[n - 2].reg == 15)
+        {
+          return ASM_UNHANDLED;
+        }
+      val = ops[n - 1].value;
+      if (val > 4095)
+        {
+          enc->why = "immediate out of range";
+          return ASM_UNHANDLED;
+        }
+      o |= ops[n - 2].reg << 16 | ops[0].reg << 8 | ((val >> 11) & 1) << 26 | ((val >> 8) & 7) << 12 | (val & 0xFF);
+      break;
+
+    case FMT_WMOV16:
+      if (n != 2 || !OP_REG(0) || !OP_IMM(1) || ops[0].reg == 15)
+        {
+          return ASM_UNHANDLED;
+        }
+      val = ops[1].value;
+      if (val > 0xFFFF)
+        {
+          enc->why = "immediate out of range";
+          return ASM_UNHANDLED;
+        }
+      o |= (val >> 12) << 16 | ((val >> 11) & 1) << 26 | ((val >> 8) & 7) << 12 | (val & 0xFF) | ops[0].reg << 8;
+      break;
+
+    case FMT_WADR:
+      if (n != 2 || !OP_REG(0) || !(ops[1].type & ARM_LABEL))
+        {
+          return ASM_UNHANDLED;
+        }
+      o |= ops[0].reg << 8;
+      if (arm_label(state, enc, &ops[1], ARM_RELOC_THM_ADR12, 0, &o) != ASM_OK)
+        {
+          return ASM_UNHANDLED;
+        }
+      break;
+
+    case FMT_WSHI:
+      if (!OP_REG(0) || !((n == 3 && OP_REG(1) && OP_IMM(2)) || (n == 2 && OP_IMM(1))))
+        {
+          return ASM_UNHANDLED;
+        }
+      if (arm_thumb_shift((o >> 4) & 3, ops[n - 1].value, &bits) || ops[n - 1].value == 0)
+        {
+          enc->why = "invalid shift amount";
+          return ASM_UNHANDLED;
+        }
+      o = (o & ~0x30u) | bits | ops[0].reg << 8 | ops[n - 2].reg;
+      break;
+
+    case FMT_WSHR:
+    case FMT_WMUL:
+      if (!OP_REG(0) || !OP_REG(1) || n < 2 || n > 3 || (n == 3 && !OP_REG(2)))
+        {
+          return ASM_UNHANDLED;
+        }
+      o |= ops[n - 2].reg << 16 | ops[0].reg << 8 | ops[n - 1].reg;
+      break;
+
+    case FMT_WMLA:
+    case FMT_WMULL:
+      if (n != 4 || !OP_REG(0) || !OP_REG(1) || !OP_REG(2) || !OP_REG(3))
+        {
+          return ASM_UNHANDLED;
+        }
+      if (inst->format == FMT_WMLA)
+        {
+          o |= ops[1].reg << 16 | ops[3].reg << 12 | ops[0].reg << 8 | ops[2].reg;
+        }
+      else
+        {
+          o |= ops[2].reg << 16 | ops[0].reg << 12 | ops[1].reg << 8 | ops[3].reg;
+        }
+      break;
+
+    case FMT_WLSI:
+      if (n != 2 || !OP_REG(0) || !(ops[1].type & ARM_RDS5) || (ops[1].type & (ARM_WBACK | ARM_PCR8)))
+        {
+          return ASM_UNHANDLED;
+        }
+      if (ops[1].value > 4095)
+        {
+          enc->why = "offset out of range";
+          return ASM_UNHANDLED;
+        }
+      o |= ops[1].reg << 16 | ops[0].reg << 12 | ops[1].value;
+      break;
+
+    case FMT_WLSI8:
+      if (!OP_REG(0) || !(ops[1].type & ARM_RDS5) || (ops[1].type & ARM_PCR8))
+        {
+          return ASM_UNHANDLED;
+        }
+      if (n == 3 && OP_IMM(2) && ops[1].value == 0 && !(ops[1].type & ARM_WBACK))
+        {
+          val  = ops[2].value;
+          bits = 0x100;          /* post-indexed: P=0 W=1 */
+        }
+      else if (n == 2)
+        {
+          val  = ops[1].value;
+          bits = (ops[1].type & ARM_WBACK) ? 0x500 : 0x400; /* P=1, W */
+        }
+      else
+        {
+          return ASM_UNHANDLED;
+        }
+      if ((int32_t)val >= 0)
+        {
+          bits |= 0x200;         /* U */
+        }
+      else
+        {
+          val = -val;
+        }
+      if (val > 255)
+        {
+          enc->why = "offset out of range";
+          return ASM_UNHANDLED;
+        }
+      o |= ops[1].reg << 16 | ops[0].reg << 12 | bits | val;
+      break;
+
+    case FMT_WLSR:
+      if (n != 2 || !OP_REG(0) || !(ops[1].type & ARM_RRD) || (ops[1].type & ARM_WBACK))
+        {
+          return ASM_UNHANDLED;
+        }
+      if (ops[1].shift != 0 || ops[1].amount > 3)
+        {
+          enc->why = "only lsl #0-3 is allowed";
+          return ASM_UNHANDLED;
+        }
+      o |= ops[1].reg << 16 | ops[0].reg << 12 | ops[1].amount << 4 | ops[1].regd;
+      break;
+
+    case FMT_WLSL:
+      if (n != 2 || !OP_REG(0))
+        {
+          return ASM_UNHANDLED;
+        }
+      o |= ops[0].reg << 12;
+      if (ops[1].type & ARM_LABEL)
+        {
+          if (arm_label(state, enc, &ops[1], ARM_RELOC_THM_PC12, 0, &o) != ASM_OK)
+            {
+              return ASM_UNHANDLED;
+            }
+          break;
+        }
+      if (!(ops[1].type & ARM_PCR8) || (ops[1].type & (ARM_RRD | ARM_WBACK)) ||
+          arm_target(&o, ARM_RELOC_THM_PC12, ops[1].value))
+        {
+          return ASM_UNHANDLED;
+        }
+      break;
+
+    case FMT_WLDM:
+      if (o & 0x000F0000)
+        {
+          /* push and pop, a single register is a str or ldr */
+          if (n != 1 || !(ops[0].type & ARM_LIST) || !ops[0].value)
+            {
+              return ASM_UNHANDLED;
+            }
+          val = ops[0].value;
+          if (!(val & (val - 1)))
+            {
+              o = ((o & 0x00100000) ? 0xF85D0B04 : 0xF84D0D04) | __builtin_ctz(val) << 12;
+              break;
+            }
+        }
+      else
+        {
+          if (n != 2 || !(ops[0].type & ARM_REG) || !(ops[1].type & ARM_LIST) || !ops[1].value)
+            {
+              return ASM_UNHANDLED;
+            }
+          val = ops[1].value;
+          o |= ops[0].reg << 16 | ((ops[0].type & ARM_WBACK) ? 0x00200000 : 0);
+        }
+      if ((val & 0x2000) || (!(o & 0x00100000) && (val & 0x8000)))
+        {
+          enc->why = "invalid register in list";
+          return ASM_UNHANDLED;
+        }
+      o |= val;
+      break;
+
+    default:
+      return ASM_UNHANDLED;
+    }
+
+  *opcode = o;
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* ARM shifted register: imm5 and type. lsr and asr accept 32, encoded as 0.
+ * Returns -1 if the amount is invalid.
+ */
+
+static int arm_a32_shift(int type, uint32_t amount, uint32_t *bits)
+{
+  if ((type == 0 && amount > 31) || (type != 0 && (amount < 1 || amount > 32)) ||
+      (type == 3 && amount == 32))
+    {
+      return -1;
+    }
+  *bits = (amount & 31) << 7 | type << 5;
+  return 0;
+}
+
+/*****************************************************************************/
+/* Second operand of data processing: #const, Rm, Rm, shift #n or Rm, shift
+ * Rs, starting at ops[i]. Returns -1 if they do not form one.
+ */
+
+static int arm_a32_operand2(struct arm_enc_s *enc, int i, uint32_t *bits)
+{
+  struct arm_operand_s *ops = enc->ops;
+  uint32_t sh;
+
+  if (OP_IMM(i) && enc->nops == i + 1)
+    {
+      if (arm_a32_modimm(ops[i].value, bits))
+        {
+          enc->why = "constant cannot be encoded";
+          return -1;
+        }
+      *bits |= 0x02000000; /* I */
+      return 0;
+    }
+  if (!OP_REG(i))
+    {
+      return -1;
+    }
+  if (enc->nops == i + 1)
+    {
+      *bits = ops[i].reg;
+      return 0;
+    }
+  if (enc->nops != i + 2)
+    {
+      return -1;
+    }
+  if (ops[i + 1].type & ARM_RSHIFT)
+    {
+      *bits = ops[i + 1].reg << 8 | ops[i + 1].shift << 5 | 0x10 | ops[i].reg;
+      return 0;
+    }
+  if (!(ops[i + 1].type & ARM_SHIFT) || arm_a32_shift(ops[i + 1].shift, ops[i + 1].amount, &sh))
+    {
+      enc->why = "invalid shift";
+      return -1;
+    }
+  *bits = sh | ops[i].reg;
+  return 0;
+}
+
+/*****************************************************************************/
+/* ldr Rd, =value: the cheapest sequence that loads the constant. One mov,
+ * mvn or movw, then a literal already in the pool (a 4-byte ldr), then
+ * movw and movt (8 bytes, no load), then a new literal (8 bytes and a
+ * load). Addresses always use the pool.
+ */
+
+static int arm_a32_literal(struct asm_state_s *state, struct arm_enc_s *enc, const struct arm_operand_s *op,
+                           int rd, uint32_t *opcode)
+{
+  uint32_t val = op->value;
+  uint32_t bits;
+
+  if (!op->name)
+    {
+      if (!arm_a32_modimm(val, &bits))
+        {
+          *opcode = 0x03A00000 | rd << 12 | bits; /* mov */
+          return ASM_OK;
+        }
+      if (!arm_a32_modimm(~val, &bits))
+        {
+          *opcode = 0x03E00000 | rd << 12 | bits; /* mvn */
+          return ASM_OK;
+        }
+      if ((enc->isa & IA7) && val <= 0xFFFF)
+        {
+          *opcode = 0x03000000 | (val >> 12) << 16 | rd << 12 | (val & 0xFFF); /* movw */
+          return ASM_OK;
+        }
+
+      state->linevolatile = 1; /* depends on the pool contents */
+      if ((enc->isa & IA7) && !arm_pool_find(state, op))
+        {
+          *opcode   = 0x03000000 | ((val >> 12) & 15) << 16 | rd << 12 | (val & 0xFFF);
+          enc->next = 0x03400000 | (val >> 28) << 16 | rd << 12 | ((val >> 16) & 0xFFF);
+          return ASM_OK;
+        }
+    }
+
+  /* ldr Rd, [pc, #offset] */
+  *opcode     = 0x05100000 | 15 << 16 | rd << 12;
+  enc->pool   = 1;
+  enc->reloc  = ARM_RELOC_ARM_PC12;
+  enc->addend = 0;
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* Load and store addressing: [Rn, #+-imm]{!}, [Rn], #+-imm, [Rn, Rm{, shift
+ * #n}]{!} and [Rn], Rm. half is TRUE for the halfword and signed forms,
+ * that have an 8-bit offset and no shift. Returns -1 for other operands.
+ */
+
+static int arm_a32_address(struct arm_enc_s *enc, int half, uint32_t *bits)
+{
+  struct arm_operand_s *ops = enc->ops;
+  struct arm_operand_s *mem = &ops[1];
+  uint32_t val;
+  uint32_t sh;
+
+  if (enc->nops < 2 || !(mem->type & ARM_MEM))
+    {
+      return -1;
+    }
+  if (enc->nops == 2 && (mem->type & ARM_RRD))
+    {
+      if (half && mem->amount)
+        {
+          enc->why = "no shift is allowed";
+          return -1;
+        }
+      if (!half && arm_a32_shift(mem->shift, mem->amount, &sh))
+        {
+          enc->why = "invalid shift";
+          return -1;
+        }
+      *bits = 0x01800000 | (half ? 0 : 0x02000000 | sh) | mem->regd; /* P U, register */
+    }
+  else if (enc->nops == 3 && !(mem->type & (ARM_RRD | ARM_WBACK)) && !mem->value && OP_REG(2))
+    {
+      *bits = 0x00800000 | (half ? 0 : 0x02000000) | ops[2].reg; /* U, post-indexed register */
+      return 0;
+    }
+  else
+    {
+      if (enc->nops == 2)
+        {
+          val   = mem->value;
+          *bits = 0x01000000; /* P */
+        }
+      else if (enc->nops == 3 && !(mem->type & (ARM_RRD | ARM_WBACK)) && !mem->value && OP_IMM(2))
+        {
+          val   = ops[2].value;
+          *bits = 0; /* post-indexed */
+        }
+      else
+        {
+          return -1;
+        }
+      if ((int32_t)val >= 0)
+        {
+          *bits |= 0x00800000; /* U */
+        }
+      else
+        {
+          val = -val;
+        }
+      if (val > (half ? 255 : 4095))
+        {
+          enc->why = "offset out of range";
+          return -1;
+        }
+      *bits |= half ? (0x00400000 | (val >> 4) << 8 | (val & 15)) : val;
+    }
+  if (mem->type & ARM_WBACK)
+    {
+      *bits |= 0x00200000; /* W */
+    }
+  return 0;
+}
+
+/*****************************************************************************/
+/* Encode one ARM candidate. Returns ASM_UNHANDLED if it does not fit the
+ * operands, then the next candidate is tried.
+ */
+
+static int arm_a32_encode(struct asm_state_s *state, const struct arm_inst *inst, struct arm_enc_s *enc,
+                          uint32_t *opcode)
+{
+  struct arm_operand_s *ops = enc->ops;
+  uint32_t o = inst->opcode;
+  uint32_t bits;
+  uint32_t val;
+  int n = enc->nops;
+  int op;
+  int i;
+
+  switch (inst->format)
+    {
+    case FMT_ADP:
+      {
+        /* the same operation on the complemented or negated constant */
+        static const int8_t alt[16] = { 14, -1, 4, -1, 2, 6, 5, -1, -1, -1, 11, 10, -1, 15, 0, 13 };
+        int test = ((o >> 21) & 15) >= 8 && ((o >> 21) & 15) <= 11;
+        int move = ((o >> 21) & 15) == 13 || ((o >> 21) & 15) == 15;
+
+        /* Rd, Rn, op2, or Rd, op2 for Rd, Rd, op2 */
+        i = (test || move) ? 1 : (n >= 3 && OP_REG(1) && !(ops[2].type & (ARM_SHIFT | ARM_RSHIFT))) ? 2 : 1;
+        if (!OP_REG(0))
+          {
+            return ASM_UNHANDLED;
+          }
+        if (arm_a32_operand2(enc, i, &bits))
+          {
+            op  = (o >> 21) & 15;
+            val = ops[i].value;
+            val = (op == 2 || op == 4 || op == 10 || op == 11) ? -val : ~val;
+            if (!OP_IMM(i) || n != i + 1 || alt[op] < 0 || arm_a32_modimm(val, &bits))
+              {
+                return ASM_UNHANDLED;
+              }
+            o = (o & ~(15u << 21)) | alt[op] << 21 | 0x02000000 | bits;
+          }
+        else
+          {
+            o |= bits;
+          }
+        if (test)
+          {
+            o |= ops[0].reg << 16;
+          }
+        else
+          {
+            o |= ops[0].reg << 12 | (move ? 0 : ops[i - 1].reg << 16);
+          }
+      }
+      break;
+
+    case FMT_ASH:
+      if (!OP_REG(0) || n < 2 || n > 3 || (n == 3 && !OP_REG(1)))
+        {
+          return ASM_UNHANDLED;
+        }
+      if (OP_REG(n - 1))
+        {
+          o |= ops[n - 1].reg << 8 | 0x10;
+        }
+      else if (!OP_IMM(n - 1) || arm_a32_shift((o >> 5) & 3, ops[n - 1].value, &bits))
+        {
+          enc->why = "invalid shift amount";
+          return ASM_UNHANDLED;
+        }
+      else
+        {
+          o = (o & ~0x60u) | bits;
+        }
+      o |= ops[0].reg << 12 | ops[n - 2].reg;
+      break;
+
+    case FMT_AMOV16:
+      if (n != 2 || !OP_REG(0) || !OP_IMM(1) || ops[0].reg == 15)
+        {
+          return ASM_UNHANDLED;
+        }
+      val = ops[1].value;
+      if (val > 0xFFFF)
+        {
+          return ASM_UNHANDLED;
+        }
+      o |= (val >> 12) << 16 | ops[0].reg << 12 | (val & 0xFFF);
+      break;
+
+    case FMT_AADR:
+      if (n != 2 || !OP_REG(0) || !(ops[1].type & ARM_LABEL))
+        {
+          return ASM_UNHANDLED;
+        }
+      o |= ops[0].reg << 12;
+      if (arm_label(state, enc, &ops[1], ARM_RELOC_ARM_ADR, 0, &o) != ASM_OK)
+        {
+          return ASM_UNHANDLED;
+        }
+      break;
+
+    case FMT_AMUL:
+      i = (o & 0x00200000) ? 4 : 3; /* mla has an accumulator */
+      if (n != i || !OP_REG(0) || !OP_REG(1) || !OP_REG(2) || (i == 4 && !OP_REG(3)))
+        {
+          return ASM_UNHANDLED;
+        }
+      o |= ops[0].reg << 16 | ops[2].reg << 8 | ops[1].reg | ((i == 4) ? ops[3].reg << 12 : 0);
+      break;
+
+    case FMT_AMULL:
+      if (n != 4 || !OP_REG(0) || !OP_REG(1) || !OP_REG(2) || !OP_REG(3))
+        {
+          return ASM_UNHANDLED;
+        }
+      o |= ops[1].reg << 16 | ops[0].reg << 12 | ops[3].reg << 8 | ops[2].reg;
+      break;
+
+    case FMT_AR2:
+      if (n != 2 || !OP_REG(0) || !OP_REG(1))
+        {
+          return ASM_UNHANDLED;
+        }
+      o |= ops[0].reg << 12 | ops[1].reg;
+      break;
+
+    case FMT_ALS:
+      if (!OP_REG(0))
+        {
+          return ASM_UNHANDLED;
+        }
+      if (n == 2 && (ops[1].type & ARM_POOL))
+        {
+          if (o != 0x04100000)
+            {
+              enc->why = "only ldr loads literals";
+              return ASM_UNHANDLED;
+            }
+          if (arm_a32_literal(state, enc, &ops[1], ops[0].reg, &o) != ASM_OK)
+            {
+              return ASM_UNHANDLED;
+            }
+          break;
+        }
+      o |= ops[0].reg << 12;
+      if (n == 2 && (ops[1].type & ARM_LABEL))
+        {
+          o |= 0x01000000 | 15 << 16;
+          if (arm_label(state, enc, &ops[1], ARM_RELOC_ARM_PC12, 0, &o) != ASM_OK)
+            {
+              return ASM_UNHANDLED;
+            }
+          break;
+        }
+      if (arm_a32_address(enc, 0, &bits))
+        {
+          return ASM_UNHANDLED;
+        }
+      o |= ops[1].reg << 16 | bits;
+      break;
+
+    case FMT_ALSH:
+      if (!OP_REG(0) || arm_a32_address(enc, 1, &bits))
+        {
+          return ASM_UNHANDLED;
+        }
+      o |= ops[1].reg << 16 | ops[0].reg << 12 | bits;
+      break;
+
+    case FMT_ALDM:
+      if ((o & 0x000F0000) == 0x000D0000 && (o & 0x00200000))
+        {
+          /* push and pop, a single register is a str or ldr */
+          if (n != 1 || !(ops[0].type & ARM_LIST) || !ops[0].value)
+            {
+              return ASM_UNHANDLED;
+            }
+          val = ops[0].value;
+          if (!(val & (val - 1)))
+            {
+              o = ((o & 0x00100000) ? 0x049D0004 : 0x052D0004) | __builtin_ctz(val) << 12;
+              break;
+            }
+        }
+      else
+        {
+          if (n != 2 || !(ops[0].type & ARM_REG) || !(ops[1].type & ARM_LIST) || !ops[1].value)
+            {
+              return ASM_UNHANDLED;
+            }
+          val = ops[1].value;
+          o |= ops[0].reg << 16 | ((ops[0].type & ARM_WBACK) ? 0x00200000 : 0);
+        }
+      o |= val;
+      break;
+
+    case FMT_AB:
+      if (n != 1 || !(ops[0].type & ARM_LABEL))
+        {
+          return ASM_UNHANDLED;
+        }
+      if (arm_label(state, enc, &ops[0], ARM_RELOC_ARM_B24, 0, &o) != ASM_OK)
+        {
+          return ASM_UNHANDLED;
+        }
+      break;
+
+    case FMT_ABX:
+      if (n != 1 || !OP_REG(0))
+        {
+          return ASM_UNHANDLED;
+        }
+      o |= ops[0].reg;
+      break;
+
+    case FMT_ASVC:
+      if (n != 1 || !OP_IMM(0) || ops[0].value > 0xFFFFFF)
+        {
+          return ASM_UNHANDLED;
+        }
+      o |= ops[0].value;
+      break;
+
+    case FMT_ABKPT:
+      if (n != 1 || !OP_IMM(0) || ops[0].value > 0xFFFF)
+        {
+          return ASM_UNHANDLED;
+        }
+      if (enc->cond >= 0)
+        {
+          enc->why = "bkpt cannot be conditional";
+          return ASM_UNHANDLED;
+        }
+      *opcode = o | (ops[0].value >> 4) << 8 | (ops[0].value & 15);
+      return ASM_OK;
+
+    case FMT_ANONE:
+      if (n != 0)
+        {
+          return ASM_UNHANDLED;
+        }
+      break;
+
+    default:
+      return ASM_UNHANDLED;
+    }
+
+  /* condition, always if there is none */
+
+  i = (enc->cond < 0) ? 14 : enc->cond;
+  *opcode = o | (uint32_t)i << 28;
+  if (enc->next)
+    {
+      enc->next |= (uint32_t)i << 28;
+    }
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* Append an instruction. 32-bit Thumb instructions are two halfwords, the
+ * first one holds the high bits. ARM instructions are little endian words.
+ */
+
+static int arm_emit(struct asm_state_s *state, uint32_t opcode, int ilen)
+{
+  uint8_t buf[4];
+
+  if (state->mode == ARM_MODE_ARM)
+    {
+      buf[0] = opcode;
+      buf[1] = opcode >> 8;
+      buf[2] = opcode >> 16;
+      buf[3] = opcode >> 24;
+    }
+  else if (ilen == 2)
+    {
+      buf[0] = opcode;
+      buf[1] = opcode >> 8;
+    }
+  else
+    {
+      buf[0] = opcode >> 16;
+      buf[1] = opcode >> 24;
+      buf[2] = opcode;
+      buf[3] = opcode >> 8;
+    }
+  return chunk_append(state, &state->current_section->data, buf, ilen);
+}
+
+/*****************************************************************************/
+/* Build the mnemonic index of the selected target, once. Each bucket chains
+ * the entries of one mode in table order, entries of other instruction sets
+ * are left out.
+ */
+
+static int arm_index(struct asm_state_s *state, struct arm_state_s *arm)
+{
+  const struct arm_inst *inst;
+  int16_t *head;
+  int i;
+
+  arm->chain = asm_malloc(state, MEM_BACKEND, COUNT(arm_thumb_instructions) * sizeof(int16_t));
+  if (!arm->chain)
+    {
+      return emit_message(state, ASM_ERROR, "malloc() failed");
+    }
+  memset(arm->head, 0xFF, sizeof(arm->head));
+
+  for (i = COUNT(arm_thumb_instructions) - 1; i >= 0; i--)
+    {
+      inst = &arm_thumb_instructions[i];
+      if (!(inst->isa & arm->isa))
+        {
+          continue;
+        }
+      head = &arm->head[(inst->isa & ISA_THUMB) ? ARM_MODE_THUMB : ARM_MODE_ARM][arm_hash(inst->name, strlen(inst->name)) % ARM_INDEX_HASH];
+      arm->chain[i] = *head;
+      *head = i;
+    }
+  TRACE(state, DEBUG_ARM, 1, "index built for isa %04X\n", arm->isa);
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* Return the first entry of a mnemonic in the current mode, or -1 */
+
+static int arm_find(struct arm_state_s *arm, int mode, const char *name)
+{
+  int i;
+
+  for (i = arm->head[mode][arm_hash(name, strlen(name)) % ARM_INDEX_HASH]; i >= 0; i = arm->chain[i])
+    {
+      if (!strcmp(arm_thumb_instructions[i].name, name))
+        {
+          return i;
+        }
+    }
+  return -1;
+}
+
+/*****************************************************************************/
+/* A mnemonic that is not in the index: tell why. Only on errors, so the
+ * whole table is searched.
+ */
+
+static int arm_unknown(struct asm_state_s *state, struct arm_state_s *arm, const char *name, const char *mnemo)
+{
+  const char *iname;
+  uint16_t modes = (state->mode == ARM_MODE_THUMB) ? ISA_THUMB : ISA_ARM;
+  uint16_t found = 0;
+  int len = strlen(name);
+  int i;
+
+  for (i = 0; i < COUNT(arm_thumb_instructions); i++)
+    {
+      iname = arm_thumb_instructions[i].name;
+      if (!strcmp(iname, name) || (len > 2 && !strncmp(iname, name, len - 2) && !iname[len - 2]))
+        {
+          found |= arm_thumb_instructions[i].isa;
+        }
+    }
+  if (found & arm->isa & ~modes)
+    {
+      return emit_message(state, ASM_ERROR, "'%s' is not available in %s state", mnemo,
+                          (state->mode == ARM_MODE_THUMB) ? "Thumb" : "ARM");
+    }
+  if (found & modes)
+    {
+      return emit_message(state, ASM_ERROR, "'%s' is not supported by %s", mnemo, arm->target);
+    }
+  return emit_message(state, ASM_ERROR, "Unknown instruction '%s'", mnemo);
+}
+
+/*****************************************************************************/
+/* Cost kind of an instruction: its format, or COST_LDST for ldr and str */
+
+static int arm_cost_kind(const struct arm_inst *inst)
+{
+  int kind = arm_costs[inst->format].kind;
+
+  if (kind == COST_ALU && (!strncmp(inst->name, "ldr", 3) || !strncmp(inst->name, "str", 3)))
+    {
+      kind = COST_LDST;
+    }
+  return kind;
+}
+
+/*****************************************************************************/
+/* Registers of an operand, as a mask */
+
+static uint16_t arm_op_regs(const struct arm_operand_s *op)
+{
+  if (op->type & ARM_LIST)
+    {
+      return op->value;
+    }
+  if (op->type & ARM_MEM)
+    {
+      return (1 << op->reg) | ((op->type & ARM_RRD) ? 1 << op->regd : 0);
+    }
+  if (op->type & (ARM_REG | ARM_RSHIFT))
+    {
+      return 1 << op->reg;
+    }
+  return 0;
+}
+
+/*****************************************************************************/
+/* Record an encoded instruction for the report. Its line is not replayed
+ * from the lines cache, or it would be missing.
+ */
+
+static int arm_record(struct asm_state_s *state, struct arm_state_s *arm, const struct arm_inst *inst,
+                      const struct arm_enc_s *enc)
+{
+  const char *name = inst->name;
+  const struct arm_operand_s *mem;
+  struct arm_rec_s *rec;
+  uint16_t first;
+  uint16_t rest = 0;
+  int kind = arm_cost_kind(inst);
+  int sp;
+  int i;
+
+  state->linevolatile = 1;
+  if (arm->nrecs == arm->maxrecs)
+    {
+      rec = asm_malloc(state, MEM_BACKEND, (arm->maxrecs * 2 + 64) * sizeof(struct arm_rec_s));
+      if (!rec)
+        {
+          return emit_message(state, ASM_ERROR, "malloc() failed");
+        }
+      if (arm->recs)
+        {
+          memcpy(rec, arm->recs, arm->nrecs * sizeof(struct arm_rec_s));
+          asm_free(state, arm->recs);
+        }
+      arm->recs    = rec;
+      arm->maxrecs = arm->maxrecs * 2 + 64;
+    }
+
+  rec = &arm->recs[arm->nrecs++];
+  rec->section = state->current_section;
+  rec->offset  = enc->addr;
+  rec->inst    = inst - arm_thumb_instructions;
+  rec->cond    = (enc->cond >= 0);
+  rec->nregs   = 0;
+  rec->target  = NULL;
+  rec->unit    = state->unit;
+
+  first = enc->nops ? arm_op_regs(&enc->ops[0]) : 0;
+  for (i = 0; i < enc->nops; i++)
+    {
+      rest |= i ? arm_op_regs(&enc->ops[i]) : 0;
+      if (enc->ops[i].type & ARM_LIST)
+        {
+          rec->nregs = __builtin_popcount(enc->ops[i].value);
+        }
+      if ((enc->ops[i].type & ARM_LABEL) && (kind == COST_BRANCH || kind == COST_CALL ||
+                                             !strcmp(name, "b") || !strcmp(name, "bl")))
+        {
+          rec->target = asm_malloc(state, MEM_BACKEND, strlen(enc->label) + 1);
+          if (!rec->target)
+            {
+              return emit_message(state, ASM_ERROR, "malloc() failed");
+            }
+          strcpy(rec->target, enc->label);
+        }
+    }
+
+  /* the first operand is written, unless it is stored, compared or a base */
+
+  if (!strncmp(name, "str", 3) || !strncmp(name, "stm", 3) || !strcmp(name, "push") ||
+      !strcmp(name, "cmp") || !strcmp(name, "cmn") || !strcmp(name, "tst") || !strcmp(name, "teq") ||
+      kind == COST_BRANCH || kind == COST_BX || kind == COST_CALL)
+    {
+      rec->uses = first | rest;
+      rec->defs = 0;
+    }
+  else if (!strncmp(name, "ldm", 3))
+    {
+      rec->uses = first;
+      rec->defs = rest;
+    }
+  else
+    {
+      for (i = 0; i < COUNT(arm_moves) && strcmp(name, arm_moves[i]); i++);
+      rec->uses = (enc->nops == 2 && kind != COST_LDST && i == COUNT(arm_moves)) ? first | rest : rest;
+      rec->defs = first;
+    }
+
+  /* stack use: push and pop, stm and ldm on sp!, add and sub of a constant
+   * to sp, loads and stores that write sp back. Other writes of sp are
+   * dynamic.
+   */
+
+  rec->sp    = 0;
+  rec->spdyn = 0;
+  sp = enc->nops && (enc->ops[0].type & ARM_WBACK) && enc->ops[0].reg == 13;
+  mem = (enc->nops >= 2 && (enc->ops[1].type & ARM_MEM) && enc->ops[1].reg == 13) ? &enc->ops[1] : NULL;
+  if (!strcmp(name, "push") || (sp && (!strcmp(name, "stmdb") || !strcmp(name, "stmfd"))))
+    {
+      rec->sp = 4 * rec->nregs;
+    }
+  else if (!strcmp(name, "pop") || (sp && (!strcmp(name, "ldm") || !strcmp(name, "ldmia") || !strcmp(name, "ldmfd"))))
+    {
+      rec->sp = -4 * rec->nregs;
+    }
+  else if (mem && (mem->type & ARM_WBACK))
+    {
+      rec->sp = -(int32_t)mem->value;     /* [sp, #-n]! */
+    }
+  else if (mem && enc->nops == 3 && (enc->ops[2].type & ARM_IMM))
+    {
+      rec->sp = -(int32_t)enc->ops[2].value; /* [sp], #n */
+    }
+  else if ((rec->defs & (1 << 13)) && (!strcmp(name, "sub") || !strcmp(name, "add")) &&
+           (enc->ops[enc->nops - 1].type & ARM_IMM) &&
+           (enc->nops == 2 || ((enc->ops[1].type & ARM_REG) && enc->ops[1].reg == 13)))
+    {
+      rec->sp = (int32_t)enc->ops[enc->nops - 1].value;
+      rec->sp = (name[0] == 's') ? rec->sp : -rec->sp;
+    }
+  else if ((rec->defs & (1 << 13)) || sp)
+    {
+      rec->spdyn = 1;
+    }
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* Encode an instruction of the current state. In Thumb state, this is the
+ * narrowest form that fits, unless .n or .w asks for one.
+ */
+
+static int arm_assemble(struct asm_state_s *state, char *name, struct arm_operand_s *ops, int nops)
+{
+  int (*encode)(struct asm_state_s *state, const struct arm_inst *inst, struct arm_enc_s *enc, uint32_t *opcode);
+  struct arm_state_s *arm = arm_state(state);
+  const struct arm_inst *inst;
+  struct arm_enc_s enc;
+  char mnemo[CONFIG_ASM_MNEMO_SIZE];
+  const char *why = NULL;
+  uint32_t opcode = 0;
+  int len = strlen(name);
+  int first;
+  int count;
+  int ret = ASM_UNHANDLED;
+  int i;
+
+  enc.ops     = ops;
+  enc.nops    = nops;
+  enc.cond    = -1;
+  enc.width   = 0;
+  enc.haswide = 0;
+  enc.reloc   = 0;
+  enc.relax   = 0;
+  enc.next    = 0;
+  enc.pool    = 0;
+  enc.why     = NULL;
+
+  if (!arm || (!arm->chain && arm_index(state, arm) != ASM_OK))
+    {
+      return ASM_ERROR;
+    }
+  if (state->mode == ARM_MODE_THUMB)
+    {
+      enc.isa = arm->isa & ISA_THUMB;
+      encode  = arm_thumb_encode;
+    }
+  else
+    {
+      enc.isa = arm->isa & ISA_ARM;
+      encode  = arm_a32_encode;
+    }
+
+  if (!state->current_section)
+    {
+      return emit_message(state, ASM_ERROR, "No current section");
+    }
+  enc.addr = section_size(state->current_section);
+  strcpy(mnemo, name);
+
+  /* width qualifier */
+
+  if (len > 2 && name[len - 2] == '.' && (name[len - 1] == 'n' || name[len - 1] == 'w'))
+    {
+      enc.width = (name[len - 1] == 'n') ? 2 : 4;
+      len -= 2;
+      name[len] = 0;
+    }
+
+  /* condition suffix, all ARM instructions and Thumb branches */
+
+  first = arm_find(arm, state->mode, name);
+  if (first < 0 && len > 2)
+    {
+      for (i = 0; i < COUNT(arm_conds); i++)
+        {
+          if (!strcmp(name + len - 2, arm_conds[i]))
+            {
+              name[len - 2] = 0;
+              first = arm_find(arm, state->mode, name);
+              enc.cond = (i < 15) ? i : i - 13; /* hs and lo are cs and cc */
+              if (enc.cond == 14)
+                {
+                  enc.cond = -1; /* always */
+                }
+              break;
+            }
+        }
+    }
+  if (first < 0)
+    {
+      if (len > 2)
+        {
+          name[len - 2] = mnemo[len - 2]; /* put back a condition suffix */
+        }
+      return arm_unknown(state, arm, name, mnemo);
+    }
+
+  /* forms of the requested width, the chain holds only those of the target */
+
+  count = 0;
+  for (i = first; i >= 0; i = arm->chain[i])
+    {
+      inst = &arm_thumb_instructions[i];
+      if (!strcmp(inst->name, name))
+        {
+          enc.haswide |= (inst->ilen == 4 && enc.width != 2);
+          count += (!enc.width || inst->ilen == enc.width);
+        }
+    }
+  if (!count)
+    {
+      return emit_message(state, ASM_ERROR, "No %d-bit encoding for '%s'", enc.width * 8, mnemo);
+    }
+
+  for (i = first; i >= 0 && ret == ASM_UNHANDLED; i = arm->chain[i])
+    {
+      inst = &arm_thumb_instructions[i];
+      if (strcmp(inst->name, name) || (enc.width && inst->ilen != enc.width))
+        {
+          continue;
+        }
+      enc.reloc = 0;
+      enc.relax = 0;
+      enc.next  = 0;
+      ret = encode(state, inst, &enc, &opcode);
+      why = why ? why : enc.why; /* the first reason is the most precise */
+    }
+
+  if (ret == ASM_UNHANDLED)
+    {
+      if (why)
+        {
+          return emit_message(state, ASM_ERROR, "Invalid operands for '%s': %s", mnemo, why);
+        }
+      return emit_message(state, ASM_ERROR, "Invalid operands for '%s'", mnemo);
+    }
+  if (ret != ASM_OK)
+    {
+      return ret;
+    }
+
+  TRACE(state, DEBUG_ARM, 2, "%s: format %d, %d bytes, %08X\n", inst->name, inst->format, inst->ilen, opcode);
+  if ((arm->cycles || arm->stack) && arm_record(state, arm, inst, &enc) != ASM_OK)
+    {
+      return ASM_ERROR;
+    }
+  if (enc.pool && arm_pool_add(state, &ops[1], enc.label) != ASM_OK)
+    {
+      return ASM_ERROR;
+    }
+  if (enc.reloc && symbol_reference(state, enc.label, enc.addend, enc.reloc, enc.addr, enc.relax) != ASM_OK)
+    {
+      return ASM_ERROR;
+    }
+  ret = arm_emit(state, opcode, inst->ilen);
+  if (ret == ASM_OK && enc.next)
+    {
+      TRACE(state, DEBUG_ARM, 2, "then %08X\n", enc.next);
+      ret = arm_emit(state, enc.next, inst->ilen);
+    }
+  return ret;
+}
+
+/*****************************************************************************/
+/* The mnemonic is in buf, the operands are the remaining tokens of the line */
+
+int arm_instruction(const struct asm_backend_s *backend, struct asm_state_s *state, char *buf)
+{
+  struct arm_operand_s operands[ARM_MAXOPS];
+  char name[CONFIG_ASM_MNEMO_SIZE];
+  int nops;
+  int tok;
+  int i;
+
+  TRACE(state, DEBUG_ARM, 1, "arm instruction: %s\n",buf);
+
+  /* name .req reg */
+
+  tok = state->tokcur;
+  if (tok < state->ntokens && state->tokens[tok].len == 4 &&
+      !strncmp(state->tokline + state->tokens[tok].pos, ".req", 4))
+    {
+      return arm_req(state, buf);
+    }
+
+  for (i = 0; buf[i] && i < sizeof(name) - 1; i++)
+    {
+      name[i] = (buf[i] >= 'A' && buf[i] <= 'Z') ? buf[i] - 'A' + 'a' : buf[i];
+    }
+  name[i] = 0;
+
+  /* parse operands */
+  nops = 0;
+  tok = state->tokcur;
+  while (tok < state->ntokens)
+    {
+      if (nops == COUNT(operands))
+        {
+          return emit_message(state, ASM_ERROR, "Too many operands");
+        }
+      tok = arm_parse_operand(state, tok, &operands[nops]);
+      if(tok < 0) return ASM_ERROR;
+      nops++;
+    }
+  state->tokcur = tok;
+
+  return arm_assemble(state, name, operands, nops);
+}
+
+/*****************************************************************************/
+/* Return the labels of a section sorted by offset, or NULL if there is none
+ * or after an error. The caller frees the array.
+ */
+
+static int arm_label_cmp(const void *a, const void *b)
+{
+  const struct asm_symbol_s *sa = *(const struct asm_symbol_s **)a;
+  const struct asm_symbol_s *sb = *(const struct asm_symbol_s **)b;
+
+  if (sa->value != sb->value)
+    {
+      return (sa->value < sb->value) ? -1 : 1;
+    }
+  return strcmp(sa->name, sb->name);
+}
+
+static struct asm_symbol_s **arm_labels(struct asm_state_s *state, const struct asm_section_s *sec, int *count)
+{
+  struct asm_symbol_s **labels;
+  struct asm_symbol_s *sym;
+  int i;
+
+  *count = 0;
+  for (i = 0; i < CONFIG_ASM_SYM_HASH; i++)
+    {
+      for (sym = state->symbols[i]; sym; sym = sym->next)
+        {
+          *count += (sym->section == sec && strncmp(sym->name, ".Lpool", 6));
+        }
+    }
+  if (!*count)
+    {
+      return NULL;
+    }
+  labels = asm_malloc(state, MEM_BACKEND, *count * sizeof(struct asm_symbol_s *));
+  if (!labels)
+    {
+      emit_message(state, ASM_ERROR, "malloc() failed");
+      return NULL;
+    }
+  *count = 0;
+  for (i = 0; i < CONFIG_ASM_SYM_HASH; i++)
+    {
+      for (sym = state->symbols[i]; sym; sym = sym->next)
+        {
+          if (sym->section == sec && strncmp(sym->name, ".Lpool", 6))
+            {
+              labels[(*count)++] = sym;
+            }
+        }
+    }
+  qsort(labels, *count, sizeof(struct asm_symbol_s *), arm_label_cmp);
+  return labels;
+}
+
+/*****************************************************************************/
+/* Cycles of a recorded instruction on a core, after prev, the instruction
+ * executed before it or NULL. *taken is the penalty of a conditional branch
+ * when it is taken, the straight line cost is returned.
+ */
+
+static int arm_rec_cycles(const struct arm_rec_s *rec, const struct arm_rec_s *prev, int core, int *taken)
+{
+  const struct arm_inst *inst = &arm_thumb_instructions[rec->inst];
+  int kind = arm_cost_kind(inst);
+  int cycles = arm_costs[inst->format].cycles[core];
+  int load = prev && arm_cost_kind(&arm_thumb_instructions[prev->inst]) == COST_LDST;
+
+  *taken = 0;
+  if (kind == COST_LDST && core > 0 && load && !(prev->defs & rec->uses))
+    {
+      cycles = 1; /* neighbouring loads and stores pipeline */
+    }
+  else if (kind == COST_LIST)
+    {
+      cycles += rec->nregs;
+    }
+  else if (kind == COST_BRANCH && (rec->cond || inst->format == FMT_TCB))
+    {
+      *taken = ARM_REFILL;
+    }
+  else if (kind == COST_BRANCH)
+    {
+      cycles += ARM_REFILL;
+    }
+  else if (kind == COST_MUL && strstr(inst->name, "div"))
+    {
+      cycles = 12;
+    }
+
+  if ((kind == COST_ALU || kind == COST_LDST || kind == COST_LIST) && (rec->defs & 0x8000))
+    {
+      cycles += ARM_REFILL; /* writes pc */
+    }
+
+  /* load-use: a loaded register is a cycle late for the next instruction */
+
+  load = load && !strncmp(arm_thumb_instructions[prev->inst].name, "ldr", 3);
+  if (core > 0 && load && (prev->defs & rec->uses))
+    {
+      cycles++;
+    }
+  return cycles;
+}
+
+/*****************************************************************************/
+/* TRUE if execution does not go on after the instruction */
+
+static int arm_rec_ends_block(const struct arm_rec_s *rec)
+{
+  int kind = arm_cost_kind(&arm_thumb_instructions[rec->inst]);
+
+  return kind == COST_BRANCH || kind == COST_BX || (kind != COST_CALL && (rec->defs & 0x8000));
+}
+
+/*****************************************************************************/
+/* Print a row of the blocks table */
+
+static void arm_report_block(FILE *out, const char *label, uint32_t base, uint32_t offset,
+                             uint32_t ninsts, uint32_t cycles, int taken)
+{
+  char name[48];
+
+  if (offset == base)
+    {
+      snprintf(name, sizeof(name), "%s", label);
+    }
+  else
+    {
+      snprintf(name, sizeof(name), "%s+0x%X", label, offset - base);
+    }
+  fprintf(out, "  %08X  %-24s %6u %7u", offset, name, ninsts, cycles);
+  if (taken)
+    {
+      fprintf(out, " %7u\n", cycles + taken);
+    }
+  else
+    {
+      fprintf(out, "       -\n");
+    }
+}
+
+/*****************************************************************************/
+/* Cycle report of one section: a row per basic block, then per label the
+ * straight line cost up to the next label. Blocks start at labels and after
+ * branches. A single pass over the instructions, in the order they were
+ * encoded.
+ */
+
+static int arm_report_cycles(struct asm_state_s *state, struct arm_state_s *arm, struct asm_section_s *sec, FILE *out)
+{
+  const struct arm_rec_s *rec;
+  const struct arm_rec_s *prev = NULL;
+  struct asm_symbol_s **labels;
+  uint32_t *totals;
+  const char *label = sec->name;
+  uint32_t base = 0;
+  uint32_t start = 0;    /* of the current block */
+  uint32_t ninsts = 0;   /* of the current block, 0 if there is none */
+  uint32_t cycles = 0;
+  uint32_t count = 0;
+  uint32_t sum = 0;
+  uint32_t untimed = 0;
+  int core = arm->cycles - 1;
+  int nlabels;
+  int taken = 0;
+  int cur = -1;          /* label of the current block */
+  int li = 0;
+  int c;
+  uint32_t i;
+
+  for (i = 0; i < arm->nrecs && arm->recs[i].section != sec; i++);
+  if (i == arm->nrecs)
+    {
+      return ASM_OK;
+    }
+  labels = arm_labels(state, sec, &nlabels);
+  totals = asm_malloc(state, MEM_BACKEND, (nlabels + 1) * 2 * sizeof(uint32_t));
+  if (!totals)
+    {
+      asm_free(state, labels);
+      return emit_message(state, ASM_ERROR, "malloc() failed");
+    }
+  memset(totals, 0, (nlabels + 1) * 2 * sizeof(uint32_t));
+
+  fprintf(out, "Cycles of section %s on %s: %u bytes\n", sec->name, arm_cores[core], section_size(sec));
+  fprintf(out, "  offset    block                     insns  cycles   taken\n");
+
+  for (; i < arm->nrecs; i++)
+    {
+      rec = &arm->recs[i];
+      if (rec->section != sec)
+        {
+          continue;
+        }
+      if (arm_costs[arm_thumb_instructions[rec->inst].format].kind == COST_NONE)
+        {
+          untimed++;
+          prev = NULL;
+          continue;
+        }
+
+      /* labels up to this instruction start a block */
+
+      if (li < nlabels && labels[li]->value <= rec->offset)
+        {
+          if (ninsts)
+            {
+              arm_report_block(out, label, base, start, ninsts, cycles, taken);
+              ninsts = 0;
+            }
+          while (li < nlabels && labels[li]->value <= rec->offset)
+            {
+              label = labels[li]->name;
+              base  = labels[li]->value;
+              cur   = li++;
+            }
+        }
+      if (!ninsts)
+        {
+          start  = rec->offset;
+          cycles = 0;
+          taken  = 0;
+        }
+
+      c = arm_rec_cycles(rec, prev, core, &taken);
+      ninsts++;
+      cycles += c;
+      count++;
+      sum += c;
+      totals[(cur + 1) * 2]++;
+      totals[(cur + 1) * 2 + 1] += c;
+      prev = rec;
+
+      if (arm_rec_ends_block(rec))
+        {
+          arm_report_block(out, label, base, start, ninsts, cycles, taken);
+          ninsts = 0;
+          prev   = NULL;
+        }
+    }
+  if (ninsts)
+    {
+      arm_report_block(out, label, base, start, ninsts, cycles, taken);
+    }
+
+  fprintf(out, "  total %u instructions, %u cycles straight line", count, sum);
+  if (untimed)
+    {
+      fprintf(out, ", %u ARM instructions not timed", untimed);
+    }
+  fprintf(out, "\n");
+
+  if (nlabels)
+    {
+      fprintf(out, "  label                               insns  cycles\n");
+      for (c = 0; c < nlabels; c++)
+        {
+          if (totals[(c + 1) * 2])
+            {
+              fprintf(out, "  %-34s %6u %7u\n", labels[c]->name, totals[(c + 1) * 2], totals[(c + 1) * 2 + 1]);
+            }
+        }
+      asm_free(state, labels);
+    }
+  asm_free(state, totals);
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* Stack usage of a function of the --stack-usage report */
+
+#define ARM_SU_DYNAMIC   0x01 /* sp changes by an unknown amount */
+#define ARM_SU_INDIRECT  0x02 /* calls through a register */
+#define ARM_SU_EXTERNAL  0x04 /* calls symbols of other sections or inputs */
+#define ARM_SU_RECURSIVE 0x08 /* part of a cycle of calls */
+
+struct arm_func_s
+{
+  const char *name;
+  uint32_t frame;   /* deepest stack use of its own code */
+  uint32_t worst;   /* with its calls */
+  uint32_t first;   /* first call edge */
+  uint32_t nedges;
+  uint32_t ninsts;
+  int      next;    /* callee of the worst path, -1 if none */
+  uint8_t  dynamic; /* TRUE if its own code changes sp by an unknown amount */
+  uint8_t  flags;   /* ARM_SU_*, with those of its callees once visited */
+  uint8_t  visit;   /* 0 not visited, 1 in progress, 2 done */
+};
+
+struct arm_edge_s
+{
+  uint32_t depth;   /* stack used at the call */
+  int      callee;
+};
+
+/*****************************************************************************/
+/* Index of a label in the sorted array of arm_labels, from a hash table of
+ * mask + 1 entries keyed by the symbol address. Insert it if add is set.
+ * Returns -1 if the symbol is not a label of the section.
+ */
+
+static int arm_label_index(int *table, uint32_t mask, struct asm_symbol_s **labels,
+                           const struct asm_symbol_s *sym, int add)
+{
+  uint32_t h = (uint32_t)(((uintptr_t)sym >> 3) * 2654435761u) & mask;
+
+  while (table[h] >= 0 && labels[table[h]] != sym)
+    {
+      h = (h + 1) & mask;
+    }
+  if (add)
+    {
+      table[h] = add - 1;
+    }
+  return table[h];
+}
+
+/*****************************************************************************/
+/* Worst stack use of a function with its calls, a depth first walk of the
+ * call graph where each function is visited once. A call back to a
+ * function in progress makes it recursive, its depth is unbounded.
+ */
+
+static void arm_stack_walk(struct arm_func_s *funcs, const struct arm_edge_s *edges, int f)
+{
+  struct arm_func_s *func = &funcs[f];
+  const struct arm_edge_s *edge;
+  struct arm_func_s *callee;
+  uint32_t i;
+
+  func->visit = 1;
+  func->worst = func->frame;
+  for (i = 0; i < func->nedges; i++)
+    {
+      edge   = &edges[func->first + i];
+      callee = &funcs[edge->callee];
+      if (callee->visit == 1)
+        {
+          func->flags   |= ARM_SU_RECURSIVE;
+          callee->flags |= ARM_SU_RECURSIVE;
+          continue;
+        }
+      if (!callee->visit)
+        {
+          arm_stack_walk(funcs, edges, edge->callee);
+        }
+      func->flags |= callee->flags;
+      if (edge->depth + callee->worst > func->worst)
+        {
+          func->worst = edge->depth + callee->worst;
+          func->next  = edge->callee;
+        }
+    }
+  func->visit = 2;
+}
+
+/*****************************************************************************/
+/* Stack report of one section. Functions start at .global labels and at
+ * targets of bl, other labels are part of the function before them. The
+ * code before the first function is named after the section. A first pass
+ * finds the functions, a second one follows the depth of the stack in each
+ * and records the calls and tail calls (b to a function), then the call
+ * graph is walked once: linear in the instructions and calls.
+ *
+ * Branches are not followed, the depth of an instruction is the sum of the
+ * instructions before it in the function. After a return (bx, a write of
+ * pc, b to a function), the depth is restored to where the epilogue
+ * started, for the code reached by a branch from the body.
+ */
+
+static int arm_report_stack(struct asm_state_s *state, struct arm_state_s *arm, struct asm_section_s *sec, FILE *out)
+{
+  const struct arm_rec_s *rec;
+  const struct arm_inst *inst;
+  struct asm_symbol_s **labels;
+  struct asm_symbol_s *sym;
+  struct arm_func_s *funcs = NULL;
+  struct arm_func_s *func;
+  struct arm_edge_s *edges = NULL;
+  int *table = NULL;
+  int *fnum  = NULL;     /* function of each label, -1 if not one */
+  uint32_t mask = 15;
+  uint32_t nedges = 0;
+  uint32_t nrecs = 0;
+  int32_t depth = 0;
+  int32_t epilogue = -1; /* depth before the stack started to be freed */
+  int nlabels;
+  int nfuncs = 1;
+  int cur = 0;
+  int li = 0;
+  int ret = ASM_ERROR;
+  int ends;
+  int l;
+  int f;
+  uint32_t i;
+
+  for (i = 0; i < arm->nrecs; i++)
+    {
+      nrecs += (arm->recs[i].section == sec);
+    }
+  if (!nrecs)
+    {
+      return ASM_OK;
+    }
+  labels = arm_labels(state, sec, &nlabels);
+  if (nlabels && !labels)
+    {
+      return ASM_ERROR;
+    }
+  while (mask + 1 < 2 * (uint32_t)nlabels)
+    {
+      mask = mask * 2 + 1;
+    }
+  table = asm_malloc(state, MEM_BACKEND, (mask + 1) * sizeof(int));
+  fnum  = asm_malloc(state, MEM_BACKEND, (nlabels + 1) * sizeof(int));
+  edges = asm_malloc(state, MEM_BACKEND, nrecs * sizeof(struct arm_edge_s));
+  if (!table || !fnum || !edges)
+    {
+      emit_message(state, ASM_ERROR, "malloc() failed");
+      goto done;
+    }
+  memset(table, 0xFF, (mask + 1) * sizeof(int));
+  for (l = 0; l < nlabels; l++)
+    {
+      arm_label_index(table, mask, labels, labels[l], l + 1);
+      fnum[l] = labels[l]->global ? 0 : -1;
+    }
+
+  /* first pass: the targets of bl are functions */
+
+  for (i = 0; i < arm->nrecs; i++)
+    {
+      rec = &arm->recs[i];
+      if (rec->section == sec && rec->target && !strcmp(arm_thumb_instructions[rec->inst].name, "bl"))
+        {
+          sym = symbol_resolve(state, rec->target, rec->unit);
+          l = sym ? arm_label_index(table, mask, labels, sym, 0) : -1;
+          if (l >= 0)
+            {
+              fnum[l] = 0;
+            }
+        }
+    }
+  for (l = 0; l < nlabels; l++)
+    {
+      fnum[l] = (fnum[l] < 0) ? -1 : nfuncs++;
+    }
+  funcs = asm_malloc(state, MEM_BACKEND, nfuncs * sizeof(struct arm_func_s));
+  if (!funcs)
+    {
+      emit_message(state, ASM_ERROR, "malloc() failed");
+      goto done;
+    }
+  memset(funcs, 0, nfuncs * sizeof(struct arm_func_s));
+  funcs[0].name = sec->name;
+  funcs[0].next = -1;
+  for (l = 0; l < nlabels; l++)
+    {
+      if (fnum[l] >= 0)
+        {
+          funcs[fnum[l]].name = labels[l]->name;
+          funcs[fnum[l]].next = -1;
+        }
+    }
+
+  /* second pass: depths and calls */
+
+  for (i = 0; i < arm->nrecs; i++)
+    {
+      rec = &arm->recs[i];
+      if (rec->section != sec)
+        {
+          continue;
+        }
+      inst = &arm_thumb_instructions[rec->inst];
+      for (; li < nlabels && labels[li]->value <= rec->offset; li++)
+        {
+          if (fnum[li] >= 0 && fnum[li] != cur)
+            {
+              cur      = fnum[li];
+              depth    = 0;
+              epilogue = -1;
+              funcs[cur].first = nedges;
+            }
+        }
+      func = &funcs[cur];
+      func->ninsts++;
+      func->dynamic |= rec->spdyn;
+      func->flags   |= rec->spdyn ? ARM_SU_DYNAMIC : 0;
+
+      /* calls, at the depth before them */
+
+      l = -1;
+      if (rec->target)
+        {
+          sym = symbol_resolve(state, rec->target, rec->unit);
+          l = (sym && sym->section == sec) ? arm_label_index(table, mask, labels, sym, 0) : -1;
+          l = (l >= 0) ? fnum[l] : -1;
+          if (l < 0 && !strcmp(inst->name, "bl"))
+            {
+              func->flags |= ARM_SU_EXTERNAL;
+            }
+        }
+      else if (!strcmp(inst->name, "blx"))
+        {
+          func->flags |= ARM_SU_INDIRECT;
+        }
+      if (l >= 0)
+        {
+          edges[nedges].depth  = (depth > 0) ? depth : 0;
+          edges[nedges].callee = l;
+          nedges++;
+          func->nedges++;
+        }
+
+      if (rec->sp < 0 && epilogue < 0)
+        {
+          epilogue = depth;
+        }
+      else if (rec->sp > 0)
+        {
+          epilogue = -1;
+        }
+      depth += rec->sp;
+      if (depth > 0 && (uint32_t)depth > func->frame)
+        {
+          func->frame = depth;
+        }
+
+      ends = !strcmp(inst->name, "bx") || (rec->defs & 0x8000) || (l >= 0 && !strcmp(inst->name, "b") && !rec->cond);
+      if (ends && epilogue >= 0)
+        {
+          depth    = epilogue;
+          epilogue = -1;
+        }
+    }
+
+  for (f = 0; f < nfuncs; f++)
+    {
+      if (!funcs[f].visit)
+        {
+          arm_stack_walk(funcs, edges, f);
+        }
+    }
+
+  /* the .su lines of gcc: function, bytes, static or dynamic, then the
+   * worst depth with the calls. Labels without code are left out.
+   */
+
+  fprintf(out, "Stack usage of section %s\n", sec->name);
+  for (f = 0; f < nfuncs; f++)
+    {
+      if (funcs[f].ninsts)
+        {
+          fprintf(out, "%s:%s\t%u\t%s\n", sec->name, funcs[f].name, funcs[f].frame,
+                  funcs[f].dynamic ? "dynamic" : "static");
+        }
+    }
+
+  fprintf(out, "  function                           frame   worst  path\n");
+  for (f = 0; f < nfuncs; f++)
+    {
+      func = &funcs[f];
+      if (!func->ninsts)
+        {
+          continue;
+        }
+      fprintf(out, "  %-32s %6u %7u%s %s", func->name, func->frame, func->worst,
+              (func->flags & (ARM_SU_DYNAMIC | ARM_SU_INDIRECT | ARM_SU_RECURSIVE)) ? "+" : " ",
+              func->name);
+      for (l = func->next; l >= 0; l = funcs[l].next)
+        {
+          fprintf(out, " > %s", funcs[l].name);
+        }
+      if (func->flags & ARM_SU_RECURSIVE)
+        {
+          fprintf(out, ", recursive");
+        }
+      if (func->flags & ARM_SU_INDIRECT)
+        {
+          fprintf(out, ", indirect calls");
+        }
+      if (func->flags & ARM_SU_DYNAMIC)
+        {
+          fprintf(out, ", dynamic sp");
+        }
+      if (func->flags & ARM_SU_EXTERNAL)
+        {
+          fprintf(out, ", external calls not counted");
+        }
+      fprintf(out, "\n");
+    }
+  ret = ASM_OK;
+
+done:
+  asm_free(state, labels);
+  asm_free(state, table);
+  asm_free(state, fnum);
+  asm_free(state, edges);
+  asm_free(state, funcs);
+  return ret;
+}
+
+/*****************************************************************************/
+/* The analyses asked by options, after the output */
+
+int arm_report(const struct asm_backend_s *backend, struct asm_state_s *state, FILE *out)
+{
+  struct arm_state_s *arm = state->backenddata;
+  int i;
+
+  if (!arm)
+    {
+      return ASM_OK;
+    }
+  for (i = 0; i < CONFIG_ASM_SEC_MAX; i++)
+    {
+      if (arm->cycles && arm_report_cycles(state, arm, &state->sections[i], out) != ASM_OK)
+        {
+          return ASM_ERROR;
+        }
+      if (arm->stack && arm_report_stack(state, arm, &state->sections[i], out) != ASM_OK)
+        {
+          return ASM_ERROR;
+        }
+    }
+  return ferror(out) ? ASM_ERROR : ASM_OK;
+}
@@ -0,0 +1,129 @@
+/* ARM (A32) instructions, unified syntax. Included in the instruction table
+ * of arm.c after the Thumb ones. The condition field is left at zero, it
+ * is set from the mnemonic suffix, AL if there is none. Entries with the
+ * same name are tried in order.
+ */
+
+/* data processing, DDI 0100i A3.4 */
+
+  { "and",    IA4,  FMT_ADP,     4, 0x00000000 },
+  { "ands",   IA4,  FMT_ADP,     4, 0x00100000 },
+  { "eor",    IA4,  FMT_ADP,     4, 0x00200000 },
+  { "eors",   IA4,  FMT_ADP,     4, 0x00300000 },
+  { "sub",    IA4,  FMT_ADP,     4, 0x00400000 },
+  { "subs",   IA4,  FMT_ADP,     4, 0x00500000 },
+  { "rsb",    IA4,  FMT_ADP,     4, 0x00600000 },
+  { "rsbs",   IA4,  FMT_ADP,     4, 0x00700000 },
+  { "add",    IA4,  FMT_ADP,     4, 0x00800000 },
+  { "adds",   IA4,  FMT_ADP,     4, 0x00900000 },
+  { "adc",    IA4,  FMT_ADP,     4, 0x00A00000 },
+  { "adcs",   IA4,  FMT_ADP,     4, 0x00B00000 },
+  { "sbc",    IA4,  FMT_ADP,     4, 0x00C00000 },
+  { "sbcs",   IA4,  FMT_ADP,     4, 0x00D00000 },
+  { "rsc",    IA4,  FMT_ADP,     4, 0x00E00000 },
+  { "rscs",   IA4,  FMT_ADP,     4, 0x00F00000 },
+  { "tst",    IA4,  FMT_ADP,     4, 0x01100000 },
+  { "teq",    IA4,  FMT_ADP,     4, 0x01300000 },
+  { "cmp",    IA4,  FMT_ADP,     4, 0x01500000 },
+  { "cmn",    IA4,  FMT_ADP,     4, 0x01700000 },
+  { "orr",    IA4,  FMT_ADP,     4, 0x01800000 },
+  { "orrs",   IA4,  FMT_ADP,     4, 0x01900000 },
+  { "mov",    IA4,  FMT_ADP,     4, 0x01A00000 },
+  { "movs",   IA4,  FMT_ADP,     4, 0x01B00000 },
+  { "bic",    IA4,  FMT_ADP,     4, 0x01C00000 },
+  { "bics",   IA4,  FMT_ADP,     4, 0x01D00000 },
+  { "mvn",    IA4,  FMT_ADP,     4, 0x01E00000 },
+  { "mvns",   IA4,  FMT_ADP,     4, 0x01F00000 },
+  { "mov",    IA7,  FMT_AMOV16,  4, 0x03000000 },
+  { "movw",   IA7,  FMT_AMOV16,  4, 0x03000000 },
+  { "movt",   IA7,  FMT_AMOV16,  4, 0x03400000 },
+  { "adr",    IA4,  FMT_AADR,    4, 0x028F0000 },
+
+/* shifts are mov with a shifted register */
+
+  { "lsl",    IA4,  FMT_ASH,     4, 0x01A00000 },
+  { "lsls",   IA4,  FMT_ASH,     4, 0x01B00000 },
+  { "lsr",    IA4,  FMT_ASH,     4, 0x01A00020 },
+  { "lsrs",   IA4,  FMT_ASH,     4, 0x01B00020 },
+  { "asr",    IA4,  FMT_ASH,     4, 0x01A00040 },
+  { "asrs",   IA4,  FMT_ASH,     4, 0x01B00040 },
+  { "ror",    IA4,  FMT_ASH,     4, 0x01A00060 },
+  { "rors",   IA4,  FMT_ASH,     4, 0x01B00060 },
+
+/* multiply, A3.5 */
+
+  { "mul",    IA4,  FMT_AMUL,    4, 0x00000090 },
+  { "muls",   IA4,  FMT_AMUL,    4, 0x00100090 },
+  { "mla",    IA4,  FMT_AMUL,    4, 0x00200090 },
+  { "mlas",   IA4,  FMT_AMUL,    4, 0x00300090 },
+  { "umull",  IA4,  FMT_AMULL,   4, 0x00800090 },
+  { "umulls", IA4,  FMT_AMULL,   4, 0x00900090 },
+  { "umlal",  IA4,  FMT_AMULL,   4, 0x00A00090 },
+  { "umlals", IA4,  FMT_AMULL,   4, 0x00B00090 },
+  { "smull",  IA4,  FMT_AMULL,   4, 0x00C00090 },
+  { "smulls", IA4,  FMT_AMULL,   4, 0x00D00090 },
+  { "smlal",  IA4,  FMT_AMULL,   4, 0x00E00090 },
+  { "smlals", IA4,  FMT_AMULL,   4, 0x00F00090 },
+
+/* misc arithmetic */
+
+  { "clz",    IA5T, FMT_AR2,     4, 0x016F0F10 },
+  { "rev",    IA6,  FMT_AR2,     4, 0x06BF0F30 },
+  { "rev16",  IA6,  FMT_AR2,     4, 0x06BF0FB0 },
+  { "sxtb",   IA6,  FMT_AR2,     4, 0x06AF0070 },
+  { "sxth",   IA6,  FMT_AR2,     4, 0x06BF0070 },
+  { "uxtb",   IA6,  FMT_AR2,     4, 0x06EF0070 },
+  { "uxth",   IA6,  FMT_AR2,     4, 0x06FF0070 },
+
+/* load and store, A3.11 */
+
+  { "ldr",    IA4,  FMT_ALS,     4, 0x04100000 },
+  { "str",    IA4,  FMT_ALS,     4, 0x04000000 },
+  { "ldrb",   IA4,  FMT_ALS,     4, 0x04500000 },
+  { "strb",   IA4,  FMT_ALS,     4, 0x04400000 },
+  { "ldrh",   IA4,  FMT_ALSH,    4, 0x001000B0 },
+  { "strh",   IA4,  FMT_ALSH,    4, 0x000000B0 },
+  { "ldrsb",  IA4,  FMT_ALSH,    4, 0x001000D0 },
+  { "ldrsh",  IA4,  FMT_ALSH,    4, 0x001000F0 },
+
+/* load and store multiple, A3.12 */
+
+  { "ldm",    IA4,  FMT_ALDM,    4, 0x08900000 },
+  { "ldmia",  IA4,  FMT_ALDM,    4, 0x08900000 },
+  { "ldmfd",  IA4,  FMT_ALDM,    4, 0x08900000 },
+  { "ldmib",  IA4,  FMT_ALDM,    4, 0x09900000 },
+  { "ldmed",  IA4,  FMT_ALDM,    4, 0x09900000 },
+  { "ldmda",  IA4,  FMT_ALDM,    4, 0x08100000 },
+  { "ldmfa",  IA4,  FMT_ALDM,    4, 0x08100000 },
+  { "ldmdb",  IA4,  FMT_ALDM,    4, 0x09100000 },
+  { "ldmea",  IA4,  FMT_ALDM,    4, 0x09100000 },
+  { "stm",    IA4,  FMT_ALDM,    4, 0x08800000 },
+  { "stmia",  IA4,  FMT_ALDM,    4, 0x08800000 },
+  { "stmea",  IA4,  FMT_ALDM,    4, 0x08800000 },
+  { "stmib",  IA4,  FMT_ALDM,    4, 0x09800000 },
+  { "stmfa",  IA4,  FMT_ALDM,    4, 0x09800000 },
+  { "stmda",  IA4,  FMT_ALDM,    4, 0x08000000 },
+  { "stmed",  IA4,  FMT_ALDM,    4, 0x08000000 },
+  { "stmdb",  IA4,  FMT_ALDM,    4, 0x09000000 },
+  { "stmfd",  IA4,  FMT_ALDM,    4, 0x09000000 },
+  { "push",   IA4,  FMT_ALDM,    4, 0x092D0000 },
+  { "pop",    IA4,  FMT_ALDM,    4, 0x08BD0000 },
+
+/* branches, A3.3 */
+
+  { "b",      IA4,  FMT_AB,      4, 0x0A000000 },
+  { "bl",     IA4,  FMT_AB,      4, 0x0B000000 },
+  { "bx",     IA4T, FMT_ABX,     4, 0x012FFF10 },
+  { "blx",    IA5T, FMT_ABX,     4, 0x012FFF30 },
+
+/* exceptions and hints */
+
+  { "svc",    IA4,  FMT_ASVC,    4, 0x0F000000 },
+  { "swi",    IA4,  FMT_ASVC,    4, 0x0F000000 },
+  { "bkpt",   IA5T, FMT_ABKPT,   4, 0xE1200070 },
+  { "nop",    IA7,  FMT_ANONE,   4, 0x0320F000 },
+  { "nop",    IA4,  FMT_ANONE,   4, 0x01A00000 },
+  { "wfi",    IA7,  FMT_ANONE,   4, 0x0320F003 },
+  { "wfe",    IA7,  FMT_ANONE,   4, 0x0320F002 },
+  { "sev",    IA7,  FMT_ANONE,   4, 0x0320F004 },
+  { "yield",  IA7,  FMT_ANONE,   4, 0x0320F001 },
@@ -0,0 +1,257 @@
+/* Thumb instructions, unified syntax. Included in the instruction table of
+ * arm.c. Entries with the same name are tried in order, so the 16-bit forms
+ * come first and the 32-bit Thumb-2 forms are used only when no narrow form
+ * can encode the operands. 32-bit opcodes are first halfword << 16 | second.
+ */
+
+/* 16-bit forms, DDI 0100i and DDI 0403E */
+
+  { "lsls",   IT4T, FMT_TSHIFT,  2, 0x0000 },
+  { "lsrs",   IT4T, FMT_TSHIFT,  2, 0x0800 },
+  { "asrs",   IT4T, FMT_TSHIFT,  2, 0x1000 },
+  { "adds",   IT4T, FMT_TR3,     2, 0x1800 },
+  { "subs",   IT4T, FMT_TR3,     2, 0x1A00 },
+  { "adds",   IT4T, FMT_TI3R2,   2, 0x1C00 },
+  { "subs",   IT4T, FMT_TI3R2,   2, 0x1E00 },
+  { "movs",   IT4T, FMT_TR1I8,   2, 0x2000 },
+  { "cmp",    IT4T, FMT_TR1I8,   2, 0x2800 },
+  { "adds",   IT4T, FMT_TR1I8,   2, 0x3000 },
+  { "subs",   IT4T, FMT_TR1I8,   2, 0x3800 },
+  { "movs",   IT4T, FMT_TR2,     2, 0x0000 },
+  { "ands",   IT4T, FMT_TR2,     2, 0x4000 },
+  { "eors",   IT4T, FMT_TR2,     2, 0x4040 },
+  { "lsls",   IT4T, FMT_TR2,     2, 0x4080 },
+  { "lsrs",   IT4T, FMT_TR2,     2, 0x40C0 },
+  { "asrs",   IT4T, FMT_TR2,     2, 0x4100 },
+  { "adcs",   IT4T, FMT_TR2,     2, 0x4140 },
+  { "sbcs",   IT4T, FMT_TR2,     2, 0x4180 },
+  { "rors",   IT4T, FMT_TR2,     2, 0x41C0 },
+  { "tst",    IT4T, FMT_TR2,     2, 0x4200 },
+  { "rsbs",   IT4T, FMT_TR2,     2, 0x4240 },
+  { "negs",   IT4T, FMT_TR2,     2, 0x4240 },
+  { "cmp",    IT4T, FMT_TR2,     2, 0x4280 },
+  { "cmn",    IT4T, FMT_TR2,     2, 0x42C0 },
+  { "orrs",   IT4T, FMT_TR2,     2, 0x4300 },
+  { "muls",   IT4T, FMT_TR2,     2, 0x4340 },
+  { "bics",   IT4T, FMT_TR2,     2, 0x4380 },
+  { "mvns",   IT4T, FMT_TR2,     2, 0x43C0 },
+  { "add",    IT4T, FMT_TRH2,    2, 0x4400 },
+  { "cmp",    IT4T, FMT_TRH2,    2, 0x4500 },
+  { "mov",    IT4T, FMT_TRH2,    2, 0x4600 },
+  { "bx",     IT4T, FMT_TRB,     2, 0x4700 },
+  { "blx",    IT5T, FMT_TRB,     2, 0x4780 },
+  { "ldr",    IT4T, FMT_TR1PCI8, 2, 0x4800 },
+  { "str",    IT4T, FMT_TR3,     2, 0x5000 },
+  { "strh",   IT4T, FMT_TR3,     2, 0x5200 },
+  { "strb",   IT4T, FMT_TR3,     2, 0x5400 },
+  { "ldrsb",  IT4T, FMT_TR3,     2, 0x5600 },
+  { "ldr",    IT4T, FMT_TR3,     2, 0x5800 },
+  { "ldrh",   IT4T, FMT_TR3,     2, 0x5A00 },
+  { "ldrb",   IT4T, FMT_TR3,     2, 0x5C00 },
+  { "ldrsh",  IT4T, FMT_TR3,     2, 0x5E00 },
+  { "str",    IT4T, FMT_TI5R2,   2, 0x6000 },
+  { "ldr",    IT4T, FMT_TI5R2,   2, 0x6800 },
+  { "strb",   IT4T, FMT_TI5R2,   2, 0x7000 },
+  { "ldrb",   IT4T, FMT_TI5R2,   2, 0x7800 },
+  { "strh",   IT4T, FMT_TI5R2,   2, 0x8000 },
+  { "ldrh",   IT4T, FMT_TI5R2,   2, 0x8800 },
+  { "str",    IT4T, FMT_TR1SPI8, 2, 0x9000 },
+  { "ldr",    IT4T, FMT_TR1SPI8, 2, 0x9800 },
+  { "adr",    IT4T, FMT_TR1PCI8, 2, 0xA000 },
+  { "add",    IT4T, FMT_TR1PCI8, 2, 0xA000 },
+  { "add",    IT4T, FMT_TR1SPI8, 2, 0xA800 },
+  { "add",    IT4T, FMT_TSPI7,   2, 0xB000 },
+  { "sub",    IT4T, FMT_TSPI7,   2, 0xB080 },
+  { "cbz",    IT7M, FMT_TCB,     2, 0xB100 },
+  { "sxth",   IT6,  FMT_TR2,     2, 0xB200 },
+  { "sxtb",   IT6,  FMT_TR2,     2, 0xB240 },
+  { "uxth",   IT6,  FMT_TR2,     2, 0xB280 },
+  { "uxtb",   IT6,  FMT_TR2,     2, 0xB2C0 },
+  { "push",   IT4T, FMT_TLRRL8,  2, 0xB400 },
+  { "setend", IT6A, FMT_TSETE,   2, 0xB650 },
+  { "cpsie",  IT6,  FMT_CPS,     2, 0xB660 },
+  { "cpsid",  IT6,  FMT_CPS,     2, 0xB670 },
+  { "cbnz",   IT7M, FMT_TCB,     2, 0xB900 },
+  { "rev",    IT6,  FMT_TR2,     2, 0xBA00 },
+  { "rev16",  IT6,  FMT_TR2,     2, 0xBA40 },
+  { "revsh",  IT6,  FMT_TR2,     2, 0xBAC0 },
+  { "pop",    IT4T, FMT_TPCRL8,  2, 0xBC00 },
+  { "bkpt",   IT5T, FMT_TI8,     2, 0xBE00 },
+  { "nop",    IT2,  FMT_TNONE,   2, 0xBF00 },
+  { "nop",    IT4T, FMT_TNONE,   2, 0x46C0 }, /* mov r8, r8 before the hints */
+  { "yield",  IT2,  FMT_TNONE,   2, 0xBF10 },
+  { "wfe",    IT2,  FMT_TNONE,   2, 0xBF20 },
+  { "wfi",    IT2,  FMT_TNONE,   2, 0xBF30 },
+  { "sev",    IT2,  FMT_TNONE,   2, 0xBF40 },
+  { "stm",    IT4T, FMT_TR1RL8,  2, 0xC000 },
+  { "stmia",  IT4T, FMT_TR1RL8,  2, 0xC000 },
+  { "stmea",  IT4T, FMT_TR1RL8,  2, 0xC000 },
+  { "ldm",    IT4T, FMT_TR1RL8,  2, 0xC800 },
+  { "ldmia",  IT4T, FMT_TR1RL8,  2, 0xC800 },
+  { "ldmfd",  IT4T, FMT_TR1RL8,  2, 0xC800 },
+  { "b",      IT4T, FMT_TC4I8,   2, 0xD000 },
+  { "svc",    IT4T, FMT_TI8,     2, 0xDF00 },
+  { "swi",    IT4T, FMT_TI8,     2, 0xDF00 },
+  { "b",      IT4T, FMT_TI11,    2, 0xE000 },
+  { "bl",     IT4T, FMT_TLI22,   4, 0xF000D000 },
+
+/* 32-bit Thumb-2 forms, DDI 0403E A5.3 */
+
+  /* data processing, modified immediate */
+
+  { "and",    IT7M, FMT_WDPI,    4, 0xF0000000 },
+  { "ands",   IT7M, FMT_WDPI,    4, 0xF0100000 },
+  { "tst",    IT7M, FMT_WDPI,    4, 0xF0100F00 },
+  { "bic",    IT7M, FMT_WDPI,    4, 0xF0200000 },
+  { "bics",   IT7M, FMT_WDPI,    4, 0xF0300000 },
+  { "orr",    IT7M, FMT_WDPI,    4, 0xF0400000 },
+  { "orrs",   IT7M, FMT_WDPI,    4, 0xF0500000 },
+  { "mov",    IT7M, FMT_WDPI,    4, 0xF04F0000 },
+  { "movs",   IT7M, FMT_WDPI,    4, 0xF05F0000 },
+  { "orn",    IT7M, FMT_WDPI,    4, 0xF0600000 },
+  { "orns",   IT7M, FMT_WDPI,    4, 0xF0700000 },
+  { "mvn",    IT7M, FMT_WDPI,    4, 0xF06F0000 },
+  { "mvns",   IT7M, FMT_WDPI,    4, 0xF07F0000 },
+  { "eor",    IT7M, FMT_WDPI,    4, 0xF0800000 },
+  { "eors",   IT7M, FMT_WDPI,    4, 0xF0900000 },
+  { "teq",    IT7M, FMT_WDPI,    4, 0xF0900F00 },
+  { "add",    IT7M, FMT_WDPI,    4, 0xF1000000 },
+  { "adds",   IT7M, FMT_WDPI,    4, 0xF1100000 },
+  { "cmn",    IT7M, FMT_WDPI,    4, 0xF1100F00 },
+  { "adc",    IT7M, FMT_WDPI,    4, 0xF1400000 },
+  { "adcs",   IT7M, FMT_WDPI,    4, 0xF1500000 },
+  { "sbc",    IT7M, FMT_WDPI,    4, 0xF1600000 },
+  { "sbcs",   IT7M, FMT_WDPI,    4, 0xF1700000 },
+  { "sub",    IT7M, FMT_WDPI,    4, 0xF1A00000 },
+  { "subs",   IT7M, FMT_WDPI,    4, 0xF1B00000 },
+  { "cmp",    IT7M, FMT_WDPI,    4, 0xF1B00F00 },
+  { "rsb",    IT7M, FMT_WDPI,    4, 0xF1C00000 },
+  { "rsbs",   IT7M, FMT_WDPI,    4, 0xF1D00000 },
+
+  /* data processing, plain binary immediate */
+
+  { "add",    IT7M, FMT_WDPI12,  4, 0xF2000000 },
+  { "addw",   IT7M, FMT_WDPI12,  4, 0xF2000000 },
+  { "sub",    IT7M, FMT_WDPI12,  4, 0xF2A00000 },
+  { "subw",   IT7M, FMT_WDPI12,  4, 0xF2A00000 },
+  { "mov",    IT7M, FMT_WMOV16,  4, 0xF2400000 },
+  { "movw",   IT7M, FMT_WMOV16,  4, 0xF2400000 },
+  { "movt",   IT7M, FMT_WMOV16,  4, 0xF2C00000 },
+  { "adr",    IT7M, FMT_WADR,    4, 0xF20F0000 },
+
+  /* data processing, shifted register */
+
+  { "and",    IT7M, FMT_WDPR,    4, 0xEA000000 },
+  { "ands",   IT7M, FMT_WDPR,    4, 0xEA100000 },
+  { "tst",    IT7M, FMT_WDPR,    4, 0xEA100F00 },
+  { "bic",    IT7M, FMT_WDPR,    4, 0xEA200000 },
+  { "bics",   IT7M, FMT_WDPR,    4, 0xEA300000 },
+  { "orr",    IT7M, FMT_WDPR,    4, 0xEA400000 },
+  { "orrs",   IT7M, FMT_WDPR,    4, 0xEA500000 },
+  { "mov",    IT7M, FMT_WDPR,    4, 0xEA4F0000 },
+  { "movs",   IT7M, FMT_WDPR,    4, 0xEA5F0000 },
+  { "orn",    IT7M, FMT_WDPR,    4, 0xEA600000 },
+  { "orns",   IT7M, FMT_WDPR,    4, 0xEA700000 },
+  { "mvn",    IT7M, FMT_WDPR,    4, 0xEA6F0000 },
+  { "mvns",   IT7M, FMT_WDPR,    4, 0xEA7F0000 },
+  { "eor",    IT7M, FMT_WDPR,    4, 0xEA800000 },
+  { "eors",   IT7M, FMT_WDPR,    4, 0xEA900000 },
+  { "teq",    IT7M, FMT_WDPR,    4, 0xEA900F00 },
+  { "add",    IT7M, FMT_WDPR,    4, 0xEB000000 },
+  { "adds",   IT7M, FMT_WDPR,    4, 0xEB100000 },
+  { "cmn",    IT7M, FMT_WDPR,    4, 0xEB100F00 },
+  { "adc",    IT7M, FMT_WDPR,    4, 0xEB400000 },
+  { "adcs",   IT7M, FMT_WDPR,    4, 0xEB500000 },
+  { "sbc",    IT7M, FMT_WDPR,    4, 0xEB600000 },
+  { "sbcs",   IT7M, FMT_WDPR,    4, 0xEB700000 },
+  { "sub",    IT7M, FMT_WDPR,    4, 0xEBA00000 },
+  { "subs",   IT7M, FMT_WDPR,    4, 0xEBB00000 },
+  { "cmp",    IT7M, FMT_WDPR,    4, 0xEBB00F00 },
+  { "rsb",    IT7M, FMT_WDPR,    4, 0xEBC00000 },
+  { "rsbs",   IT7M, FMT_WDPR,    4, 0xEBD00000 },
+
+  /* shifts */
+
+  { "lsl",    IT7M, FMT_WSHI,    4, 0xEA4F0000 },
+  { "lsls",   IT7M, FMT_WSHI,    4, 0xEA5F0000 },
+  { "lsr",    IT7M, FMT_WSHI,    4, 0xEA4F0010 },
+  { "lsrs",   IT7M, FMT_WSHI,    4, 0xEA5F0010 },
+  { "asr",    IT7M, FMT_WSHI,    4, 0xEA4F0020 },
+  { "asrs",   IT7M, FMT_WSHI,    4, 0xEA5F0020 },
+  { "ror",    IT7M, FMT_WSHI,    4, 0xEA4F0030 },
+  { "rors",   IT7M, FMT_WSHI,    4, 0xEA5F0030 },
+  { "lsl",    IT7M, FMT_WSHR,    4, 0xFA00F000 },
+  { "lsls",   IT7M, FMT_WSHR,    4, 0xFA10F000 },
+  { "lsr",    IT7M, FMT_WSHR,    4, 0xFA20F000 },
+  { "lsrs",   IT7M, FMT_WSHR,    4, 0xFA30F000 },
+  { "asr",    IT7M, FMT_WSHR,    4, 0xFA40F000 },
+  { "asrs",   IT7M, FMT_WSHR,    4, 0xFA50F000 },
+  { "ror",    IT7M, FMT_WSHR,    4, 0xFA60F000 },
+  { "rors",   IT7M, FMT_WSHR,    4, 0xFA70F000 },
+
+  /* multiply and divide */
+
+  { "mul",    IT7M, FMT_WMUL,    4, 0xFB00F000 },
+  { "sdiv",   IT7D, FMT_WMUL,    4, 0xFB90F0F0 },
+  { "udiv",   IT7D, FMT_WMUL,    4, 0xFBB0F0F0 },
+  { "mla",    IT7M, FMT_WMLA,    4, 0xFB000000 },
+  { "mls",    IT7M, FMT_WMLA,    4, 0xFB000010 },
+  { "smull",  IT7M, FMT_WMULL,   4, 0xFB800000 },
+  { "umull",  IT7M, FMT_WMULL,   4, 0xFBA00000 },
+  { "smlal",  IT7M, FMT_WMULL,   4, 0xFBC00000 },
+  { "umlal",  IT7M, FMT_WMULL,   4, 0xFBE00000 },
+
+  /* load and store, positive 12-bit offset, 8-bit offset with index and
+   * writeback, register offset, then pc relative
+   */
+
+  { "str",    IT7M, FMT_WLSI,    4, 0xF8C00000 },
+  { "strb",   IT7M, FMT_WLSI,    4, 0xF8800000 },
+  { "strh",   IT7M, FMT_WLSI,    4, 0xF8A00000 },
+  { "ldr",    IT7M, FMT_WLSI,    4, 0xF8D00000 },
+  { "ldrb",   IT7M, FMT_WLSI,    4, 0xF8900000 },
+  { "ldrh",   IT7M, FMT_WLSI,    4, 0xF8B00000 },
+  { "ldrsb",  IT7M, FMT_WLSI,    4, 0xF9900000 },
+  { "ldrsh",  IT7M, FMT_WLSI,    4, 0xF9B00000 },
+  { "str",    IT7M, FMT_WLSI8,   4, 0xF8400800 },
+  { "strb",   IT7M, FMT_WLSI8,   4, 0xF8000800 },
+  { "strh",   IT7M, FMT_WLSI8,   4, 0xF8200800 },
+  { "ldr",    IT7M, FMT_WLSI8,   4, 0xF8500800 },
+  { "ldrb",   IT7M, FMT_WLSI8,   4, 0xF8100800 },
+  { "ldrh",   IT7M, FMT_WLSI8,   4, 0xF8300800 },
+  { "ldrsb",  IT7M, FMT_WLSI8,   4, 0xF9100800 },
+  { "ldrsh",  IT7M, FMT_WLSI8,   4, 0xF9300800 },
+  { "str",    IT7M, FMT_WLSR,    4, 0xF8400000 },
+  { "strb",   IT7M, FMT_WLSR,    4, 0xF8000000 },
+  { "strh",   IT7M, FMT_WLSR,    4, 0xF8200000 },
+  { "ldr",    IT7M, FMT_WLSR,    4, 0xF8500000 },
+  { "ldrb",   IT7M, FMT_WLSR,    4, 0xF8100000 },
+  { "ldrh",   IT7M, FMT_WLSR,    4, 0xF8300000 },
+  { "ldrsb",  IT7M, FMT_WLSR,    4, 0xF9100000 },
+  { "ldrsh",  IT7M, FMT_WLSR,    4, 0xF9300000 },
+  { "ldr",    IT7M, FMT_WLSL,    4, 0xF85F0000 },
+  { "ldrb",   IT7M, FMT_WLSL,    4, 0xF81F0000 },
+  { "ldrh",   IT7M, FMT_WLSL,    4, 0xF83F0000 },
+  { "ldrsb",  IT7M, FMT_WLSL,    4, 0xF91F0000 },
+  { "ldrsh",  IT7M, FMT_WLSL,    4, 0xF93F0000 },
+
+  /* load and store multiple */
+
+  { "stm",    IT7M, FMT_WLDM,    4, 0xE8800000 },
+  { "stmia",  IT7M, FMT_WLDM,    4, 0xE8800000 },
+  { "stmea",  IT7M, FMT_WLDM,    4, 0xE8800000 },
+  { "ldm",    IT7M, FMT_WLDM,    4, 0xE8900000 },
+  { "ldmia",  IT7M, FMT_WLDM,    4, 0xE8900000 },
+  { "ldmfd",  IT7M, FMT_WLDM,    4, 0xE8900000 },
+  { "stmdb",  IT7M, FMT_WLDM,    4, 0xE9000000 },
+  { "stmfd",  IT7M, FMT_WLDM,    4, 0xE9000000 },
+  { "ldmdb",  IT7M, FMT_WLDM,    4, 0xE9100000 },
+  { "ldmea",  IT7M, FMT_WLDM,    4, 0xE9100000 },
+  { "push",   IT7M, FMT_WLDM,    4, 0xE92D0000 },
+  { "pop",    IT7M, FMT_WLDM,    4, 0xE8BD0000 },
+
+  /* branches and hints */
+
+  { "b",      IT7M, FMT_WBCC,    4, 0xF0008000 },
+  { "b",      IT7M, FMT_WB,      4, 0xF0009000 },
+  { "nop",    IT7M, FMT_TNONE,   4, 0xF3AF8000 },
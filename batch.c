@@ -0,0 +1,196 @@
+/* work-stealing thread pool for tcasm --batch
+ *
+ * Each worker owns a contiguous range of jobs. It takes jobs from the front
+ * of its own range, and when it is empty, steals from the back of the range
+ * of another worker. Jobs are independent: each one assembles one input file
+ * with its own state, so the only shared data are the ranges.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "tcasm.h"
+
+/*****************************************************************************
+ * Types
+ *****************************************************************************/
+
+/* jobs of one worker, [head, tail[ */
+
+struct batch_queue_s
+{
+  pthread_mutex_t lock;
+  int             head;
+  int             tail;
+};
+
+struct batch_pool_s;
+
+struct batch_worker_s
+{
+  struct batch_pool_s  *pool;
+  struct batch_queue_s queue;
+  int                  index;
+  pthread_t            thread;
+};
+
+struct batch_pool_s
+{
+  int  (*job)(void *arg, int index);
+  void *arg;
+  int  nworkers;
+  int  failed; /* number of jobs that did not return ASM_OK */
+  pthread_mutex_t lock;
+  struct batch_worker_s *workers;
+};
+
+/*****************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/* take the next job of our own queue */
+
+static int batch_pop(struct batch_queue_s *queue)
+{
+  int job = -1;
+
+  pthread_mutex_lock(&queue->lock);
+  if (queue->head < queue->tail)
+    {
+      job = queue->head++;
+    }
+  pthread_mutex_unlock(&queue->lock);
+  return job;
+}
+
+/*****************************************************************************/
+/* take the last job of another queue */
+
+static int batch_steal(struct batch_queue_s *queue)
+{
+  int job = -1;
+
+  pthread_mutex_lock(&queue->lock);
+  if (queue->head < queue->tail)
+    {
+      job = --queue->tail;
+    }
+  pthread_mutex_unlock(&queue->lock);
+  return job;
+}
+
+/*****************************************************************************/
+
+static void *batch_worker(void *arg)
+{
+  struct batch_worker_s *self = arg;
+  struct batch_pool_s   *pool = self->pool;
+  int failed = 0;
+  int job;
+  int i;
+
+  while (1)
+    {
+      job = batch_pop(&self->queue);
+
+      /* own queue is empty, visit the others once, starting at our right */
+
+      for (i = 1; job < 0 && i < pool->nworkers; i++)
+        {
+          job = batch_steal(&pool->workers[(self->index + i) % pool->nworkers].queue);
+        }
+      if (job < 0)
+        {
+          break; /* no job left anywhere: jobs do not create jobs */
+        }
+      if (pool->job(pool->arg, job) != ASM_OK)
+        {
+          failed++;
+        }
+    }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->failed += failed;
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+/*****************************************************************************/
+/* Run count jobs on a pool sized to the number of cores. Jobs are called as
+ * job(arg, index) and must be independent. Returns the number of jobs that
+ * failed, or -1 if the pool could not be started.
+ */
+
+int batch_run(int count, int (*job)(void *arg, int index), void *arg)
+{
+  struct batch_pool_s pool;
+  long ncpu;
+  int  started;
+  int  i;
+
+  ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  if (ncpu < 1)
+    {
+      ncpu = 1;
+    }
+  if (ncpu > CONFIG_ASM_BATCH_THREADS)
+    {
+      ncpu = CONFIG_ASM_BATCH_THREADS;
+    }
+
+  pool.job      = job;
+  pool.arg      = arg;
+  pool.nworkers = (count < ncpu) ? count : ncpu;
+  pool.failed   = 0;
+  if (pool.nworkers < 1)
+    {
+      return 0;
+    }
+
+  pool.workers = calloc(pool.nworkers, sizeof(struct batch_worker_s));
+  if (!pool.workers)
+    {
+      return -1;
+    }
+  pthread_mutex_init(&pool.lock, NULL);
+
+  /* split the jobs in contiguous ranges */
+
+  for (i = 0; i < pool.nworkers; i++)
+    {
+      struct batch_worker_s *w = &pool.workers[i];
+      w->pool  = &pool;
+      w->index = i;
+      w->queue.head = (int)((int64_t)count * i / pool.nworkers);
+      w->queue.tail = (int)((int64_t)count * (i + 1) / pool.nworkers);
+      pthread_mutex_init(&w->queue.lock, NULL);
+    }
+
+  /* the calling thread is worker 0 */
+
+  for (started = 1; started < pool.nworkers; started++)
+    {
+      if (pthread_create(&pool.workers[started].thread, NULL, batch_worker, &pool.workers[started]))
+        {
+          break; /* its jobs will be stolen */
+        }
+    }
+  batch_worker(&pool.workers[0]);
+
+  for (i = 1; i < started; i++)
+    {
+      pthread_join(pool.workers[i].thread, NULL);
+    }
+
+  for (i = 0; i < pool.nworkers; i++)
+    {
+      pthread_mutex_destroy(&pool.workers[i].queue.lock);
+    }
+  pthread_mutex_destroy(&pool.lock);
+  free(pool.workers);
+  return pool.failed;
+}
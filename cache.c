@@ -0,0 +1,501 @@
+/* content-addressed assembly cache for tcasm
+ *
+ * The key of an assembly is a SHA-256 of everything that can change its
+ * output: tcasm version, backend, options and the contents of the input
+ * files, computed by the caller with the cache_hash functions. Each key is
+ * an entry file in the cache directory:
+ *
+ *   tcasm-cache 1
+ *   dep <sha256> <path>     one line per included file
+ *   obj
+ *   <output bytes until the end of the file>
+ *
+ * An entry is a hit only if all its dependencies still have the same
+ * contents, they are then known to the include cache like after parsing.
+ * Entries are written to a temporary file then renamed, so that
+ * readers never see partial entries. Hits update the entry time, and the
+ * oldest entries are removed when the directory grows above its size.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "tcasm.h"
+
+#if CONFIG_ASM_CACHE
+
+/*****************************************************************************
+ * Definitions
+ *****************************************************************************/
+
+#define CACHE_MAGIC "tcasm-cache 1\n"
+#define CACHE_PATH  (CONFIG_ASM_INC_MAXLEN + 2 * CACHE_HASH_SIZE + 16)
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/*****************************************************************************
+ * Types
+ *****************************************************************************/
+
+/* an entry of the cache directory, for eviction */
+
+struct cache_entry_s
+{
+  char     *name;
+  time_t   mtime;
+  uint64_t size;
+};
+
+/*****************************************************************************
+ * Variables
+ *****************************************************************************/
+
+static const uint32_t sha256_k[64] =
+{
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/*****************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/* SHA-256 of one 64-byte block */
+
+static void cache_hash_block(struct cache_hash_s *ctx, const uint8_t *p)
+{
+  uint32_t w[64];
+  uint32_t a, b, c, d, e, f, g, h, t1, t2;
+  int i;
+
+  for (i = 0; i < 16; i++)
+    {
+      w[i] = (uint32_t)p[4*i] << 24 | (uint32_t)p[4*i+1] << 16 | (uint32_t)p[4*i+2] << 8 | p[4*i+3];
+    }
+  for (i = 16; i < 64; i++)
+    {
+      w[i] = w[i-16] + (ROR(w[i-15], 7) ^ ROR(w[i-15], 18) ^ (w[i-15] >> 3))
+           + w[i-7] + (ROR(w[i-2], 17) ^ ROR(w[i-2], 19) ^ (w[i-2] >> 10));
+    }
+
+  a = ctx->h[0]; b = ctx->h[1]; c = ctx->h[2]; d = ctx->h[3];
+  e = ctx->h[4]; f = ctx->h[5]; g = ctx->h[6]; h = ctx->h[7];
+  for (i = 0; i < 64; i++)
+    {
+      t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+      t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+      h = g; g = f; f = e; e = d + t1;
+      d = c; c = b; b = a; a = t1 + t2;
+    }
+  ctx->h[0] += a; ctx->h[1] += b; ctx->h[2] += c; ctx->h[3] += d;
+  ctx->h[4] += e; ctx->h[5] += f; ctx->h[6] += g; ctx->h[7] += h;
+}
+
+/*****************************************************************************/
+
+void cache_hash_init(struct cache_hash_s *ctx)
+{
+  static const uint32_t init[8] =
+  {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+  memcpy(ctx->h, init, sizeof(init));
+  ctx->len = 0;
+}
+
+/*****************************************************************************/
+
+void cache_hash_update(struct cache_hash_s *ctx, const void *data, size_t len)
+{
+  const uint8_t *p = data;
+  size_t used = ctx->len & 63;
+  size_t copy;
+
+  ctx->len += len;
+  if (used)
+    {
+      copy = (len < 64 - used) ? len : 64 - used;
+      memcpy(ctx->buf + used, p, copy);
+      p   += copy;
+      len -= copy;
+      if (used + copy < 64)
+        {
+          return;
+        }
+      cache_hash_block(ctx, ctx->buf);
+    }
+  for (; len >= 64; p += 64, len -= 64)
+    {
+      cache_hash_block(ctx, p);
+    }
+  memcpy(ctx->buf, p, len);
+}
+
+/*****************************************************************************/
+/* Hash a string with its terminator, so that "ab","c" differs from "a","bc" */
+
+void cache_hash_string(struct cache_hash_s *ctx, const char *str)
+{
+  cache_hash_update(ctx, str ? str : "", str ? strlen(str) + 1 : 1);
+}
+
+/*****************************************************************************/
+
+void cache_hash_final(struct cache_hash_s *ctx, uint8_t digest[CACHE_HASH_SIZE])
+{
+  uint64_t bits = ctx->len * 8;
+  uint8_t  pad[72];
+  size_t   padlen = 64 - ((ctx->len + 8) & 63);
+  int i;
+
+  memset(pad, 0, sizeof(pad));
+  pad[0] = 0x80;
+  for (i = 0; i < 8; i++)
+    {
+      pad[padlen + i] = bits >> (56 - 8 * i);
+    }
+  cache_hash_update(ctx, pad, padlen + 8);
+  for (i = 0; i < 8; i++)
+    {
+      digest[4*i]   = ctx->h[i] >> 24;
+      digest[4*i+1] = ctx->h[i] >> 16;
+      digest[4*i+2] = ctx->h[i] >> 8;
+      digest[4*i+3] = ctx->h[i];
+    }
+}
+
+/*****************************************************************************/
+/* Hash the contents of a file. Returns ASM_ERROR if it cannot be read */
+
+int cache_hash_file(struct cache_hash_s *ctx, const char *path)
+{
+  uint8_t buf[4096];
+  size_t  len;
+  FILE    *f;
+  int     ret;
+
+  f = fopen(path, "rb");
+  if (!f)
+    {
+      return ASM_ERROR;
+    }
+  while ((len = fread(buf, 1, sizeof(buf), f)) > 0)
+    {
+      cache_hash_update(ctx, buf, len);
+    }
+  ret = ferror(f) ? ASM_ERROR : ASM_OK;
+  fclose(f);
+  return ret;
+}
+
+/*****************************************************************************/
+
+static void cache_hex(char *out, const uint8_t *digest)
+{
+  int i;
+
+  for (i = 0; i < CACHE_HASH_SIZE; i++)
+    {
+      sprintf(out + 2 * i, "%02x", digest[i]);
+    }
+}
+
+/*****************************************************************************/
+
+static int cache_path(char *path, const char *dir, const uint8_t *key)
+{
+  char hex[2 * CACHE_HASH_SIZE + 1];
+
+  if (strlen(dir) > CONFIG_ASM_INC_MAXLEN)
+    {
+      return ASM_ERROR;
+    }
+  cache_hex(hex, key);
+  sprintf(path, "%s/%s", dir, hex);
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* Look for the key in the cache directory. On a hit, returns the entry
+ * positioned at the cached output, to give to cache_fetch(). Returns NULL
+ * on a miss.
+ */
+
+FILE *cache_lookup(struct asm_state_s *state, const char *dir, const uint8_t *key)
+{
+  char    path[CACHE_PATH];
+  char    line[CONFIG_ASM_INC_MAXLEN * 2 + 2 * CACHE_HASH_SIZE + 8];
+  char    hex[2 * CACHE_HASH_SIZE + 1];
+  uint8_t digest[CACHE_HASH_SIZE];
+  struct cache_hash_s ctx;
+  size_t  len;
+  long    obj;
+  FILE    *f;
+
+  if (cache_path(path, dir, key) != ASM_OK)
+    {
+      return NULL;
+    }
+  f = fopen(path, "rb");
+  if (!f)
+    {
+      TRACE(state, DEBUG_CACHE, 1, "cache miss %s\n", path);
+      return NULL;
+    }
+
+  if (!fgets(line, sizeof(line), f) || strcmp(line, CACHE_MAGIC))
+    {
+      goto done;
+    }
+
+  /* all dependencies must be unchanged */
+
+  while (fgets(line, sizeof(line), f))
+    {
+      len = strlen(line);
+      if (!len || line[len - 1] != '\n')
+        {
+          goto done;
+        }
+      line[len - 1] = 0;
+      if (!strcmp(line, "obj"))
+        {
+          break;
+        }
+      if (strncmp(line, "dep ", 4) || len < 4 + 2 * CACHE_HASH_SIZE + 2)
+        {
+          goto done;
+        }
+      cache_hash_init(&ctx);
+      if (cache_hash_file(&ctx, line + 5 + 2 * CACHE_HASH_SIZE) != ASM_OK)
+        {
+          TRACE(state, DEBUG_CACHE, 1, "cache dep %s is gone\n", line + 5 + 2 * CACHE_HASH_SIZE);
+          goto done;
+        }
+      cache_hash_final(&ctx, digest);
+      cache_hex(hex, digest);
+      if (memcmp(hex, line + 4, 2 * CACHE_HASH_SIZE))
+        {
+          TRACE(state, DEBUG_CACHE, 1, "cache dep %s changed\n", line + 5 + 2 * CACHE_HASH_SIZE);
+          goto done;
+        }
+    }
+  if (feof(f))
+    {
+      goto done; /* truncated */
+    }
+
+  /* the dependencies become known files, as if the input was parsed */
+
+  obj = ftell(f);
+  rewind(f);
+  fgets(line, sizeof(line), f);
+  while (fgets(line, sizeof(line), f) && strcmp(line, "obj\n"))
+    {
+      line[strlen(line) - 1] = 0;
+      include_find(state, line + 5 + 2 * CACHE_HASH_SIZE, 0);
+    }
+  fseek(f, obj, SEEK_SET);
+
+  utimes(path, NULL); /* recently used */
+  TRACE(state, DEBUG_CACHE, 1, "cache hit %s\n", path);
+  return f;
+
+done:
+  fclose(f);
+  return NULL;
+}
+
+/*****************************************************************************/
+/* Copy the output of an entry found by cache_lookup(), and close it */
+
+int cache_fetch(struct asm_state_s *state, FILE *entry, FILE *out)
+{
+  char   buf[4096];
+  size_t len;
+  int    ret = ASM_OK;
+
+  while ((len = fread(buf, 1, sizeof(buf), entry)) > 0)
+    {
+      fwrite(buf, 1, len, out);
+    }
+  if (ferror(entry) || ferror(out))
+    {
+      ret = emit_message(state, ASM_ERROR, "Cannot copy cached output");
+    }
+  fclose(entry);
+  return ret;
+}
+
+/*****************************************************************************/
+
+static int cache_entry_cmp(const void *a, const void *b)
+{
+  const struct cache_entry_s *ea = a;
+  const struct cache_entry_s *eb = b;
+  return (ea->mtime > eb->mtime) - (ea->mtime < eb->mtime);
+}
+
+/*****************************************************************************/
+/* Remove the least recently used entries until the directory holds less
+ * than 90% of maxsize, so that this does not happen on each store.
+ */
+
+static void cache_evict(struct asm_state_s *state, const char *dir, uint64_t maxsize)
+{
+  struct cache_entry_s *entries = NULL;
+  struct dirent *de;
+  struct stat   st;
+  char     path[CACHE_PATH];
+  uint64_t total = 0;
+  int      count = 0;
+  int      alloc = 0;
+  int      i;
+  DIR      *d;
+
+  d = opendir(dir);
+  if (!d)
+    {
+      return;
+    }
+  while ((de = readdir(d)))
+    {
+      if (de->d_name[0] == '.' || strlen(de->d_name) != 2 * CACHE_HASH_SIZE)
+        {
+          continue; /* not an entry, or a temporary file */
+        }
+      sprintf(path, "%s/%.*s", dir, 2 * CACHE_HASH_SIZE, de->d_name);
+      if (stat(path, &st) || !S_ISREG(st.st_mode))
+        {
+          continue;
+        }
+      if (count == alloc)
+        {
+          struct cache_entry_s *grown;
+          alloc = alloc ? 2 * alloc : 64;
+          grown = realloc(entries, alloc * sizeof(struct cache_entry_s));
+          if (!grown)
+            {
+              break;
+            }
+          entries = grown;
+        }
+      entries[count].name  = strdup(de->d_name);
+      entries[count].mtime = st.st_mtime;
+      entries[count].size  = st.st_size;
+      if (entries[count].name)
+        {
+          total += st.st_size;
+          count++;
+        }
+    }
+  closedir(d);
+
+  if (total > maxsize)
+    {
+      qsort(entries, count, sizeof(struct cache_entry_s), cache_entry_cmp);
+      for (i = 0; i < count && total > maxsize / 10 * 9; i++)
+        {
+          sprintf(path, "%s/%s", dir, entries[i].name);
+          if (!unlink(path))
+            {
+              TRACE(state, DEBUG_CACHE, 2, "cache evicted %s\n", path);
+              total -= entries[i].size;
+            }
+        }
+    }
+
+  for (i = 0; i < count; i++)
+    {
+      free(entries[i].name);
+    }
+  free(entries);
+}
+
+/*****************************************************************************/
+/* Store the output of an assembly under key. The dependencies are the files
+ * loaded in the include cache. Failures are silent: the cache is optional.
+ */
+
+int cache_store(struct asm_state_s *state, const char *dir, uint64_t maxsize, const uint8_t *key)
+{
+  struct asm_file_s *file;
+  struct cache_hash_s ctx;
+  uint8_t digest[CACHE_HASH_SIZE];
+  char    hex[2 * CACHE_HASH_SIZE + 1];
+  char    path[CACHE_PATH];
+  char    tmp[CACHE_PATH];
+  FILE    *f;
+  int     fd;
+  int     ret;
+
+  if (cache_path(path, dir, key) != ASM_OK)
+    {
+      return ASM_ERROR;
+    }
+  mkdir(dir, 0777);
+  sprintf(tmp, "%s/.tmpXXXXXX", dir);
+  fd = mkstemp(tmp);
+  if (fd < 0)
+    {
+      TRACE(state, DEBUG_CACHE, 1, "cache cannot create %s\n", tmp);
+      return ASM_ERROR;
+    }
+  fchmod(fd, 0644); /* mkstemp() makes it private */
+  f = fdopen(fd, "wb");
+  if (!f)
+    {
+      close(fd);
+      unlink(tmp);
+      return ASM_ERROR;
+    }
+
+  fputs(CACHE_MAGIC, f);
+  for (file = state->incorder; file; file = file->order)
+    {
+      if (!file->path)
+        {
+          continue;
+        }
+      cache_hash_init(&ctx);
+      if (file->data)
+        {
+          cache_hash_update(&ctx, file->data, file->len);
+        }
+      else if (cache_hash_file(&ctx, file->path) != ASM_OK)
+        {
+          continue; /* not loaded, like pipelined inputs, and now gone */
+        }
+      cache_hash_final(&ctx, digest);
+      cache_hex(hex, digest);
+      fprintf(f, "dep %s %s\n", hex, file->path);
+    }
+  fputs("obj\n", f);
+  ret = output_dump(state, f);
+
+  if (fclose(f) || ret != ASM_OK || rename(tmp, path))
+    {
+      unlink(tmp);
+      return ASM_ERROR;
+    }
+  TRACE(state, DEBUG_CACHE, 1, "cache stored %s\n", path);
+
+  cache_evict(state, dir, maxsize);
+  return ASM_OK;
+}
+
+#endif /* CONFIG_ASM_CACHE */
@@ -4,38 +4,25 @@
 
 #include "tcasm.h"
 
-#define DEBUG 0
-#define DEBUG_CHUNK 1
-
 /* Append data to chunk, possibly splitting data in multiple blocks.
  * The chunk list may be modified. Always succeed if there is enough memory.
  * This routine fills chunks to their maximum possible size.
  */
 
-int chunk_append(struct asm_state_s *state, struct asm_chunk_s **chlist, void *base, int len)
+int chunk_append(struct asm_state_s *state, struct asm_chunks_s *chlist, void *base, int len)
 {
-  struct asm_chunk_s *ch = *chlist;
-  struct asm_chunk_s *prev = NULL;
+  struct asm_chunk_s *ch = chlist->last;
+  struct asm_chunk_s *prev;
   int copy;
 
-#if DEBUG & DEBUG_CHUNK
-  printf("TODO: %d bytes\n",len);
-#endif
-  /* seek to end of chain */
-
-  while (ch) 
-    {
-      prev = ch;
-      ch = ch->next;
-    }
-  ch = prev;
+  TRACE(state, DEBUG_CHUNK, 1, "append %d bytes\n",len);
 
-  /* now ch is null and prev is the last chunk, or null if the chain is empty */
+  /* the list keeps its last chunk, there is no chain to walk */
 
   if (!ch)
     {
       /* the chain is empty, create the first chunk */
-      ch = malloc(CONFIG_ASM_CHUNK+sizeof(struct asm_chunk_s));
+      ch = asm_malloc(state, MEM_CHUNK, CONFIG_ASM_CHUNK+sizeof(struct asm_chunk_s));
       if (!ch)
         {
           return emit_message(state, ASM_ERROR, "malloc() failed");
@@ -43,18 +30,15 @@ int chunk_append(struct asm_state_s *state, struct asm_chunk_s **chlist, void *b
       ch->data = (unsigned char*)(&ch[1]);
       ch->len  = 0;
       ch->next = NULL;
-      *chlist = ch; /* we have allocated the first block of the chain */
-#if DEBUG & DEBUG_CHUNK
-      printf("made initial chunk\n");
-#endif
+      chlist->first = ch; /* we have allocated the first block of the chain */
+      chlist->last  = ch;
+      TRACE(state, DEBUG_CHUNK, 2, "made initial chunk\n");
     }
-#if DEBUG & DEBUG_CHUNK
   else
     {
       /* the chain has a chunk */
-      printf("we have a chunk with %d bytes free\n", CONFIG_ASM_CHUNK - prev->len);
+      TRACE(state, DEBUG_CHUNK, 2, "we have a chunk with %d bytes free\n", CONFIG_ASM_CHUNK - ch->len);
     }
-#endif
 
   /* copy as many data as possible */
 
@@ -65,17 +49,13 @@ int chunk_append(struct asm_state_s *state, struct asm_chunk_s **chlist, void *b
         {
           copy = CONFIG_ASM_CHUNK - ch->len;
         }
-#if DEBUG & DEBUG_CHUNK
-      printf("cur chunk can contain: %d\n", CONFIG_ASM_CHUNK - ch->len);
-#endif
+      TRACE(state, DEBUG_CHUNK, 2, "cur chunk can contain: %d\n", CONFIG_ASM_CHUNK - ch->len);
       if (copy==0)
         {
           /* no room in current chunk */
-#if DEBUG & DEBUG_CHUNK
-          printf("new chunk required\n");
-#endif
+          TRACE(state, DEBUG_CHUNK, 2, "new chunk required\n");
           prev = ch;
-          ch = malloc(CONFIG_ASM_CHUNK+sizeof(struct asm_chunk_s));
+          ch = asm_malloc(state, MEM_CHUNK, CONFIG_ASM_CHUNK+sizeof(struct asm_chunk_s));
           if (!ch)
             {
               return emit_message(state, ASM_ERROR, "malloc() failed");
@@ -84,29 +64,63 @@ int chunk_append(struct asm_state_s *state, struct asm_chunk_s **chlist, void *b
           ch->len  = 0;
           ch->next = NULL;
           prev->next = ch;
+          chlist->last = ch;
           continue;
         }
-#if DEBUG & DEBUG_CHUNK
-      printf("total remaining %d, will store %d\n",len,copy);
-#endif
+      TRACE(state, DEBUG_CHUNK, 2, "total remaining %d, will store %d\n",len,copy);
       memcpy(ch->data + ch->len, base, copy);
       ch->len += copy;
-#if DEBUG & DEBUG_CHUNK
-      printf("copied %d bytes, remaining in chunk:%d\n", copy, (CONFIG_ASM_CHUNK - ch->len));
-#endif
+      chlist->size += copy;
+      TRACE(state, DEBUG_CHUNK, 2, "copied %d bytes, remaining in chunk:%d\n", copy, (CONFIG_ASM_CHUNK - ch->len));
       base += copy;
       len -= copy;
     }
 
-#if DEBUG & DEBUG_CHUNK
-  printf("summary\n");
-  ch = *chlist;
-  while (ch)
+  if (TRACE_ON(state, DEBUG_CHUNK, 3))
+    {
+      TRACE(state, DEBUG_CHUNK, 3, "summary\n");
+      for (ch = chlist->first; ch; ch = ch->next)
+        {
+          TRACE(state, DEBUG_CHUNK, 3, "chunk @ %p len=%d\n",ch, ch->len);
+        }
+    }
+  return ASM_OK;
+}
+
+/* Append size bytes repeating a pattern of len bytes. The pattern is copied
+ * to a run of whole patterns, appended as few times as possible. The
+ * pattern must fit the run.
+ */
+
+int chunk_fill(struct asm_state_s *state, struct asm_chunks_s *chlist, const void *pattern, int len, uint32_t size)
+{
+  uint8_t run[256];
+  uint32_t step;
+  int runlen;
+
+  if (len <= 0 || len > sizeof(run))
+    {
+      return emit_message(state, ASM_ERROR, "Cannot fill with a pattern of %d bytes", len);
+    }
+  for (runlen = 0; runlen + len <= sizeof(run); runlen += len)
+    {
+      memcpy(run + runlen, pattern, len);
+    }
+
+  while (size > 0)
     {
-      printf("chunk @ %p len=%d\n",ch, ch->len);
-      ch = ch->next;
+      step = size;
+      if (step > runlen)
+        {
+          step = runlen;
+        }
+      if (chunk_append(state, chlist, run, step) != ASM_OK)
+        {
+          return ASM_ERROR;
+        }
+      size -= step;
     }
-#endif
+  return ASM_OK;
 }
 
 /* Append data to chunk NOT splitting it. Used for symbol strings.
@@ -115,20 +129,28 @@ int chunk_append(struct asm_state_s *state, struct asm_chunk_s **chlist, void *b
  * This routine may not fill chunks to their maximum possible size (if a block doesnt fit).
  */
 
-int chunk_append_block(struct asm_state_s *state, struct asm_chunk_s **chlist, void *base, int len)
+int chunk_append_block(struct asm_state_s *state, struct asm_chunks_s *chlist, void *base, int len)
 {
 }
 
 /* return the total size of a chunk list */
 
-uint32_t chunk_totalsize(struct asm_chunk_s *chlist)
+uint32_t chunk_totalsize(const struct asm_chunks_s *chlist)
 {
-  uint32_t total = 0;
-  while (chlist)
+  return chlist->size;
+}
+
+/* free a chunk list */
+
+void chunk_release(struct asm_state_s *state, struct asm_chunks_s *chlist)
+{
+  struct asm_chunk_s *ch;
+  while (chlist->first)
     {
-      total += chlist->len;
-      chlist = chlist->next;
+      ch = chlist->first;
+      chlist->first = ch->next;
+      asm_free(state, ch);
     }
-  return total;
+  chlist->last = NULL;
+  chlist->size = 0;
 }
-
@@ -8,6 +8,11 @@
 /* Program version */
 #define CONFIG_ASM_VERSION "0.01"
 
+/* Trace categories compiled in (DEBUG_xxx in tcasm.h), 0 removes all traces */
+#ifndef CONFIG_ASM_DEBUG
+#define CONFIG_ASM_DEBUG 0xFF
+#endif
+
 /* Configured targets */
 #define CONFIG_ASM_TARGET_ARM 1
 
@@ -27,6 +32,13 @@
 #define CONFIG_ASM_INBUF_SIZE 80
 #endif
 
+/* Read buffer of the inputs parsed with a memory budget, longer lines are
+ * truncated like by the line buffers
+ */
+#ifndef CONFIG_ASM_STREAM_BUF
+#define CONFIG_ASM_STREAM_BUF 1024
+#endif
+
 /* Line Comment char */
 #ifndef CONFIG_ASM_COMMENT_LINE
 #define CONFIG_ASM_COMMENT_LINE '#'
@@ -37,11 +49,26 @@
 #define CONFIG_ASM_COMMENT_CONT '@'
 #endif
 
+/* Maximum number of tokens in a source line */
+#ifndef CONFIG_ASM_TOKENS
+#define CONFIG_ASM_TOKENS 64
+#endif
+
+/* Maximum length of a mnemonic or directive name, including the final zero */
+#ifndef CONFIG_ASM_MNEMO_SIZE
+#define CONFIG_ASM_MNEMO_SIZE 32
+#endif
+
 /* Allocation chunk size */
 #ifndef CONFIG_ASM_CHUNK
 #define CONFIG_ASM_CHUNK 256
 #endif
 
+/* Number of values encoded at once by data directives */
+#ifndef CONFIG_ASM_DATA_BATCH
+#define CONFIG_ASM_DATA_BATCH 64
+#endif
+
 /* Maximum number of include path entries */
 #ifndef CONFIG_ASM_INC_COUNT
 #define CONFIG_ASM_INC_COUNT 4
@@ -52,5 +79,144 @@
 #define CONFIG_ASM_INC_MAXLEN 80
 #endif
 
+/* Number of hash buckets in the include file cache */
+#ifndef CONFIG_ASM_INC_HASH
+#define CONFIG_ASM_INC_HASH 16
+#endif
+
+/* Maximum .include nesting level */
+#ifndef CONFIG_ASM_INC_DEPTH
+#define CONFIG_ASM_INC_DEPTH 8
+#endif
+
+/* Pipelined input (-p): reader and tokenizer threads */
+#ifndef CONFIG_ASM_PIPELINE
+#define CONFIG_ASM_PIPELINE 1
+#endif
+
+/* Size of the pipelined input blocks */
+#ifndef CONFIG_ASM_PIPE_BLOCK
+#define CONFIG_ASM_PIPE_BLOCK 65536
+#endif
+
+/* Number of input blocks between reader and tokenizer, power of two */
+#ifndef CONFIG_ASM_PIPE_BLOCKS
+#define CONFIG_ASM_PIPE_BLOCKS 4
+#endif
+
+/* Number of tokenized lines between tokenizer and parser, power of two */
+#ifndef CONFIG_ASM_PIPE_LINES
+#define CONFIG_ASM_PIPE_LINES 256
+#endif
+
+/* Maximum number of threads for --batch, the default is one per core */
+#ifndef CONFIG_ASM_BATCH_THREADS
+#define CONFIG_ASM_BATCH_THREADS 64
+#endif
+
+/* Map included files in memory instead of reading them */
+#ifndef CONFIG_ASM_MMAP
+#define CONFIG_ASM_MMAP 1
+#endif
+
+/* Built-in C preprocessor, used for .S files or with -P */
+#ifndef CONFIG_ASM_PREPROC
+#define CONFIG_ASM_PREPROC 1
+#endif
+
+/* Preprocessor line buffer size, after joining continued lines */
+#ifndef CONFIG_ASM_PPBUF_SIZE
+#define CONFIG_ASM_PPBUF_SIZE 256
+#endif
+
+/* Maximum nesting of preprocessor conditionals */
+#ifndef CONFIG_ASM_PP_DEPTH
+#define CONFIG_ASM_PP_DEPTH 16
+#endif
+
+/* Maximum number of parameters of a function-like macro */
+#ifndef CONFIG_ASM_PP_PARAMS
+#define CONFIG_ASM_PP_PARAMS 8
+#endif
+
+/* Number of hash buckets for preprocessor macros */
+#ifndef CONFIG_ASM_PP_HASH
+#define CONFIG_ASM_PP_HASH 32
+#endif
+
+/* Content-addressed cache of assembly outputs (--cache-dir) */
+#ifndef CONFIG_ASM_CACHE
+#define CONFIG_ASM_CACHE 1
+#endif
+
+/* Default cache directory size, oldest entries are removed above it */
+#ifndef CONFIG_ASM_CACHE_SIZE
+#define CONFIG_ASM_CACHE_SIZE (64 * 1024 * 1024)
+#endif
+
+/* Number of hash buckets of the symbol table */
+#ifndef CONFIG_ASM_SYM_HASH
+#define CONFIG_ASM_SYM_HASH 256
+#endif
+
+/* Bytes of a section after a short reference that may still get longer,
+ * beyond which the references to labels still to come take their long form
+ */
+#ifndef CONFIG_ASM_RELAX_WINDOW
+#define CONFIG_ASM_RELAX_WINDOW 4096
+#endif
+
+/* Link stage: flat binaries and ELF executables (--link) */
+#ifndef CONFIG_ASM_LINK
+#define CONFIG_ASM_LINK 1
+#endif
+
+/* Maximum number of memory regions in a link script */
+#ifndef CONFIG_ASM_LINK_REGIONS
+#define CONFIG_ASM_LINK_REGIONS 8
+#endif
+
+/* Incremental reassembly with a line cache (--incremental) */
+#ifndef CONFIG_ASM_LINES
+#define CONFIG_ASM_LINES 1
+#endif
+
+/* Number of hash buckets of the line cache */
+#ifndef CONFIG_ASM_LINES_HASH
+#define CONFIG_ASM_LINES_HASH 4096
+#endif
+
+/* Precompiled preludes (--emit-pch, --use-pch) */
+#ifndef CONFIG_ASM_PCH
+#define CONFIG_ASM_PCH 1
+#endif
+
+/* Server and client modes (--server, --client) */
+#ifndef CONFIG_ASM_SERVER
+#define CONFIG_ASM_SERVER 1
+#endif
+
+/* Number of hash buckets of the file contents shared by server requests */
+#ifndef CONFIG_ASM_SERVER_HASH
+#define CONFIG_ASM_SERVER_HASH 256
+#endif
+
+/* Memory accounting, and budget mode (--mem-budget) where all allocations
+ * are made from a single region
+ */
+#ifndef CONFIG_ASM_MEMBUDGET
+#define CONFIG_ASM_MEMBUDGET 1
+#endif
+
+/* Maximum number of memory high-water marks */
+#ifndef CONFIG_ASM_MEM_MARKS
+#define CONFIG_ASM_MEM_MARKS 4
+#endif
+
+/* Default high-water mark, in percent of the budget */
+#ifndef CONFIG_ASM_MEM_WARN
+#define CONFIG_ASM_MEM_WARN 75
+#endif
+
 #endif /* __CONFIG__H__ */
 
@@ -4,12 +4,13 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <ctype.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "tcasm.h"
 
-#define DEBUG 0
-#define DEBUG_DIR 2
-
 /* Execution modes for the fill/align command */
 
 enum
@@ -19,17 +20,43 @@ enum
   MODE_P2ALIGN
 };
 
+/*****************************************************************************/
+/* TRUE for sections of code: .text and .text.<name> */
+
+static int section_is_code(const struct asm_section_s *sec)
+{
+  return sec->id == SECTION_TEXT || !strncmp(sec->name, ".text.", 6);
+}
+
 /*****************************************************************************/
 /*.section sec .text .data .bss .rodata */
 
 static int parse_section(struct asm_state_s *state, const char *secname)
 {
-#if DEBUG & DEBUG_DIR
-  printf("section [%s]\n", secname);
-#endif
-  state->current_section = section_find_create(state, secname);
+  struct asm_section_s *sec;
+  uint32_t align;
+  uint32_t pad;
+  uint8_t zero = 0;
 
-  return ASM_OK;
+  TRACE(state, DEBUG_DIR, 1, "section [%s]\n", secname);
+  sec = section_find_create(state, secname);
+  state->current_section = sec;
+  if (!sec || sec->unit == state->unit)
+    {
+      return ASM_OK;
+    }
+
+  /* the part of each input starts aligned, code at least on a word */
+
+  sec->unit = state->unit;
+  align = sec->align;
+  if (section_is_code(sec) && align < state->infos.wordsize)
+    {
+      align = state->infos.wordsize;
+    }
+  pad = -section_size(sec) & (align - 1);
+  TRACE(state, DEBUG_DIR, 2, "%u bytes before the part of input %d\n", pad, state->unit);
+  return pad ? chunk_fill(state, &sec->data, &zero, 1, pad) : ASM_OK;
 }
 
 /*****************************************************************************/
@@ -38,14 +65,12 @@ static int parse_section(struct asm_state_s *state, const char *secname)
 
 static int parse_space_align(struct asm_state_s *state, const char *params, int mode)
 {
-  uint8_t buf[8];
-  uint32_t size,step,cur;
+  uint32_t size;
   char *rest;
   uint8_t fill = 0;
+  int hasfill = 0;
 
-#if DEBUG & DEBUG_DIR
-  printf("space ->%s\n", params);
-#endif
+  TRACE(state, DEBUG_DIR, 2, "space ->%s\n", params);
 
   /* check we have a section */
 
@@ -56,9 +81,7 @@ static int parse_space_align(struct asm_state_s *state, const char *params, int
 
   /* eat spaces */
   while (*params && (*params==' ' || *params=='\t')) params++;
-#if DEBUG & DEBUG_DIR
-  printf("after ->'%s'\n", params);
-#endif
+  TRACE(state, DEBUG_DIR, 2, "after ->'%s'\n", params);
   if (!params)
     {
     return emit_message(state, ASM_ERROR, "bad space directive");
@@ -78,87 +101,67 @@ static int parse_space_align(struct asm_state_s *state, const char *params, int
       size = 1 << size;
     }
 
-#if DEBUG & DEBUG_DIR
-  printf("size: %d\n",size);
-#endif
+  TRACE(state, DEBUG_DIR, 2, "size: %d\n",size);
 
   /* eat spaces */
 
   while (*params && (*params==' ' || *params=='\t' || *params==',')) params++;
 
-#if DEBUG & DEBUG_DIR
-  printf("after ->'%s'\n", params);
-#endif
+  TRACE(state, DEBUG_DIR, 2, "after ->'%s'\n", params);
   if(*params)
     {
     fill = strtol(params, &rest, 0);
+    hasfill = 1;
       /* if what follows is not a sep, then we have garbage */
       if ( *rest && !(*rest==' ' || *rest=='\t' || *rest==',') )
         {
           return emit_message(state, ASM_ERROR, "Invalid number: near %s", params);
         }
     }
-#if DEBUG & DEBUG_DIR
-  printf("fill: %u\n",fill);
-#endif
+  TRACE(state, DEBUG_DIR, 2, "fill: %u\n",fill);
 
   if (mode != MODE_FILL)
     {
-      /* compute the size to align */
-      cur = chunk_totalsize(state->current_section->data);
-      printf("current offset: %u\n",cur);
+      TRACE(state, DEBUG_DIR, 2, "current offset: %u\n", section_size(state->current_section));
 
-      step = ((cur + size - 1) / size) * size;
-      printf("aligned offset: %u\n",step);
+      /* the link stage places the section on the largest power of two */
 
-      size = step - cur;
+      if (!(size & (size - 1)) && size > state->current_section->align)
+        {
+          state->current_section->align = size;
+        }
+
+      /* code that may run through the padding of .align gets NOPs */
+
+      return section_pad(state, state->current_section, size,
+                         (!hasfill && section_is_code(state->current_section)) ? -1 : fill);
     }
 
   /* do the fill */
 
-  memset(buf, fill, 8);
-  while (size>0)
-    {
-      step = size;
-      if (step>8) step = 8;
-      chunk_append(state, &state->current_section->data, buf, step);
-      size -= step;
-    }
- 
-  return ASM_OK;
+  return chunk_fill(state, &state->current_section->data, &fill, 1, size);
 }
 
 /*****************************************************************************/
-/* search a file name in all path entries */
+/* extract the quoted file name of .incbin/.include */
 
-static FILE* fopen_incpath(struct asm_state_s *state, char *filename)
+static char *parse_filename(struct asm_state_s *state, char *params)
 {
-  char *dest;
-  int i;
-  int fnlen = strlen(filename);
-  int inclen;
-  FILE *f;
-  for (i = 0; i < CONFIG_ASM_INC_COUNT; i++)
-    {
-      if (!state->includes[i]) break;
-      inclen = strlen(state->includes[i]);
-      dest   = malloc(inclen + 1 + fnlen + 1);
-      if (!dest)
-        {
-          emit_message(state, ASM_ERROR, "Cannot evaluate include path, malloc() failed");
-          return NULL;
-        }
-      strcpy(dest, state->includes[i]);
-      strcat(dest, "/");
-      strcat(dest, filename);
-      f = fopen(dest, "rb");
-      free(dest);
-      if (f)
-        {
-        return f;
-        }
+  char *base = params;
+
+  /* skip to end of string */
+
+  if (*base!='\"')
+    {
+      emit_message(state, ASM_ERROR, "Invalid string litteral, expected \"");
+      return NULL;
     }
-  return NULL;
+  base++;
+  params++;
+  while (*params && *params!='"') params++;
+  *params=0;
+
+  return base;
 }
 
 /*****************************************************************************/
@@ -166,9 +169,8 @@ static FILE* fopen_incpath(struct asm_state_s *state, char *filename)
 
 static int parse_incbin(struct asm_state_s *state, char *params)
 {
-  char *base = params;
-  FILE *f;
-  uint8_t buf[8];
+  struct asm_file_s *file;
+  char *name;
 
   /* check we have a section */
 
@@ -177,53 +179,168 @@ static int parse_incbin(struct asm_state_s *state, char *params)
     return emit_message(state, ASM_ERROR, "No current section");
     }
 
-  /* skip to end of string */
+  name = parse_filename(state, params);
+  if (!name)
+    {
+      return ASM_ERROR;
+    }
 
-  if (*base!='\"')
+  /* resolve includes, once per name */
+
+  file = include_find(state, name, 1);
+  if (!file || include_load(state, file) != ASM_OK)
     {
-      return emit_message(state, ASM_ERROR, "Invalid string litteral, expected \"");
+      return ASM_ERROR;
     }
-  base++;
-  params++;
-  while (*params && *params!='"') params++;
-  *params=0;
 
-#if DEBUG & DEBUG_DIR
-  printf("in section [%s] incbin file '%s'\n",state->current_section->name, base);
-#endif
+  TRACE(state, DEBUG_DIR, 1, "in section [%s] incbin file '%s', %u bytes\n",state->current_section->name, file->path, file->len);
 
-  /* resolve includes */
+  chunk_append(state, &state->current_section->data, file->data, file->len);
+
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* .include "file" */
 
-  f = fopen_incpath(state, base);
-  if(!f)
+static int parse_include(struct asm_state_s *state, char *params)
+{
+  char *name = parse_filename(state, params);
+  if (!name)
     {
-      return emit_message(state, ASM_ERROR, "File '%s' not found in include path", base);
+      return ASM_ERROR;
+    }
+  return include_source(state, name);
+}
+
+/*****************************************************************************/
+/* Find the first quote, backslash or end of string. Loads are aligned, so
+ * they never cross a page boundary past the terminating zero.
+ */
+
+static char *string_scan(char *str)
+{
+#ifdef __SSE2__
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i bslash = _mm_set1_epi8('\\');
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i *ptr = (const __m128i *)((uintptr_t)str & ~15);
+  __m128i v;
+  uint32_t mask;
+
+  v = _mm_load_si128(ptr);
+  mask = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                                                     _mm_cmpeq_epi8(v, bslash)),
+                                        _mm_cmpeq_epi8(v, zero)));
+  mask &= ~0U << ((uintptr_t)str & 15); /* ignore bytes before str */
+  while (!mask)
+    {
+      v = _mm_load_si128(++ptr);
+      mask = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                                                         _mm_cmpeq_epi8(v, bslash)),
+                                            _mm_cmpeq_epi8(v, zero)));
+    }
+  return (char *)ptr + __builtin_ctz(mask);
+#else
+  typedef uintptr_t __attribute__((may_alias)) word_t;
+  const word_t ones  = (word_t)-1 / 255;
+  const word_t highs = ones << 7;
+  const word_t *ptr;
+  word_t v, q, b;
+
+  /* bytes until aligned */
+
+  while ((uintptr_t)str & (sizeof(word_t) - 1))
+    {
+      if (!*str || *str == '"' || *str == '\\')
+        {
+          return str;
+        }
+      str++;
     }
 
-  while (!feof(f))
+  /* whole words, with the classic has-zero-byte test */
+
+  for (ptr = (const word_t *)str; ; ptr++)
     {
-      int ret = fread(buf,1,8,f);
-      if (ret<=0)
+      v = *ptr;
+      q = v ^ (ones * '"');
+      b = v ^ (ones * '\\');
+      if (((v - ones) & ~v & highs) | ((q - ones) & ~q & highs) | ((b - ones) & ~b & highs))
         {
           break;
         }
-#if DEBUG & DEBUG_DIR
-      else printf("got %d bytes\n",ret);
-#endif
-      chunk_append(state, &state->current_section->data, buf, ret);
     }
 
-  fclose(f);
+  for (str = (char *)ptr; *str && *str != '"' && *str != '\\'; str++);
+  return str;
+#endif
+}
 
-  return ASM_OK;
+/*****************************************************************************/
+/* Decode one escape sequence, in points after the backslash.
+ * Returns the position after the sequence, or NULL if there is none.
+ */
+
+static char *string_escape(char *in, char *out)
+{
+  int val;
+  int i;
+
+  switch (*in)
+    {
+      case 'n': *out = '\n'; return in + 1;
+      case 't': *out = '\t'; return in + 1;
+      case 'r': *out = '\r'; return in + 1;
+      case 'b': *out = '\b'; return in + 1;
+      case 'f': *out = '\f'; return in + 1;
+      case 'v': *out = '\v'; return in + 1;
+      case 'a': *out = '\a'; return in + 1;
+      case 0:   return NULL;
+      case 'x':
+      case 'X':
+        /* like gas, all hex digits are taken, the low byte is kept */
+        val = 0;
+        for (i = 1; isxdigit((uint8_t)in[i]); i++)
+          {
+            val = (val << 4) | (isdigit((uint8_t)in[i]) ? in[i] - '0' : (in[i] | 0x20) - 'a' + 10);
+          }
+        if (i == 1)
+          {
+            return NULL;
+          }
+        *out = val;
+        return in + i;
+    }
+
+  if (*in >= '0' && *in <= '7')
+    {
+      /* up to 3 octal digits */
+      val = 0;
+      for (i = 0; i < 3 && in[i] >= '0' && in[i] <= '7'; i++)
+        {
+          val = (val << 3) | (in[i] - '0');
+        }
+      *out = val;
+      return in + i;
+    }
+
+  *out = *in; /* \\ \" \' and unknown escapes */
+  return in + 1;
 }
 
 /*****************************************************************************/
-/* Append a string to the current section, possibly adding a final zero. */
+/* Append a string to the current section, possibly adding a final zero.
+ * Clean runs are moved in bulk, escapes are decoded in place, and the
+ * decoded string is appended with a single write.
+ */
 
 static int directive_cb_append_string(struct asm_state_s *state, char **str, int arg)
 {
   char *base = *str;
+  char *in;
+  char *out;
+  char *run;
 
   /* check we have a section */
 
@@ -232,86 +349,272 @@ static int directive_cb_append_string(struct asm_state_s *state, char **str, int
     return emit_message(state, ASM_ERROR, "No current section");
     }
 
-  /* skip to end of string */
-
   if (*base!='\"')
     {
       return emit_message(state, ASM_ERROR, "Invalid string litteral, expected \"", *base);
     }
   base++;
-  (*str)++;
-  while (**str && **str!='"') (*str)++;
-  **str=0;
-  (*str)++; /* ready for next param */
 
-#if DEBUG & DEBUG_DIR
-  printf("in section [%s] append string %s'%s'\n",state->current_section->name, arg?"with zeros ":"", base);
-#endif
-  chunk_append(state, &state->current_section->data, base, strlen(base));
+  in  = base;
+  out = base;
+  while (1)
+    {
+      run = string_scan(in);
+      if (out != in)
+        {
+          memmove(out, in, run - in);
+        }
+      out += run - in;
+      in   = run;
+
+      if (*in == '"')
+        {
+          break;
+        }
+      if (!*in)
+        {
+          return emit_message(state, ASM_ERROR, "Unterminated string litteral");
+        }
+
+      in = string_escape(in + 1, out++);
+      if (!in)
+        {
+          return emit_message(state, ASM_ERROR, "Invalid escape sequence");
+        }
+    }
+
+  *str = in + 1; /* ready for next param */
+
+  /* the closing quote is after the decoded data, there is room for a zero */
+
   if (arg)
     {
-      chunk_append(state, &state->current_section->data, "", 1);
+      *out++ = 0;
     }
+
+  TRACE(state, DEBUG_DIR, 2, "in section [%s] append string %s%d bytes\n",state->current_section->name, arg?"with zeros ":"", (int)(out - base));
+  chunk_append(state, &state->current_section->data, base, out - base);
   return ASM_OK;
 }
 
 /*****************************************************************************/
+/* Encode a block of numbers. Values are stored in host order, then swapped
+ * in a separate simple loop that the compiler can vectorize. Returns -1 if
+ * the size or the endianess cannot be encoded.
+ */
 
-static void number_encode(uint8_t *dest, int val, int size, int endianess)
+static int number_encode(uint8_t *dest, const uint64_t *vals, int count, int size, int endianess)
 {
-  if (size<1 || size>4)
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  int swap = (endianess == ASM_ENDIAN_LITTLE);
+#else
+  int swap = (endianess == ASM_ENDIAN_BIG);
+#endif
+  uint16_t h;
+  uint32_t w;
+  uint64_t d;
+  int i;
+
+  if (endianess == ASM_ENDIAN_UNDEF)
     {
-      return;
+      return -1;
     }
-  if (endianess == ASM_ENDIAN_LITTLE)
+
+  if (size == 1)
     {
-      dest[0]     = (val      ) & 0xFF;
-      if (size>1)
-        {
-          dest[1] = (val >>  8) & 0xFF;
-        }
-      if (size>2)
+      for (i = 0; i < count; i++)
         {
-          dest[2] = (val >> 16) & 0xFF;
+          dest[i] = vals[i];
         }
-      if (size>3)
+    }
+  else if (size == 2)
+    {
+      for (i = 0; i < count; i++)
         {
-          dest[3] = (val >> 24) & 0xFF;
+          h = vals[i];
+          if (swap)
+            {
+              h = __builtin_bswap16(h);
+            }
+          memcpy(dest + 2 * i, &h, 2);
         }
     }
-  else if (endianess == ASM_ENDIAN_BIG)
+  else if (size == 4)
     {
-      int off = 0;
-      if (size>3)
+      for (i = 0; i < count; i++)
         {
-          dest[off++] = (val >> 24) & 0xFF;
+          w = vals[i];
+          if (swap)
+            {
+              w = __builtin_bswap32(w);
+            }
+          memcpy(dest + 4 * i, &w, 4);
         }
-      if (size>2)
+    }
+  else if (size == 8)
+    {
+      for (i = 0; i < count; i++)
         {
-          dest[off++] = (val >> 16) & 0xFF;
+          d = vals[i];
+          if (swap)
+            {
+              d = __builtin_bswap64(d);
+            }
+          memcpy(dest + 8 * i, &d, 8);
         }
-      if (size>1)
+    }
+  else
+    {
+      return -1;
+    }
+  return 0;
+}
+
+/*****************************************************************************/
+/* Return the end of the symbol name at str, or str if there is none */
+
+static char *symbol_scan(char *str)
+{
+  char *end = str;
+
+  if ((*end >= '0' && *end <= '9') || !*end)
+    {
+      return str;
+    }
+  while ((*end >= 'a' && *end <= 'z') || (*end >= 'A' && *end <= 'Z') ||
+         (*end >= '0' && *end <= '9') || *end == '_' || *end == '.' || *end == '$')
+    {
+      end++;
+    }
+  return end;
+}
+
+/*****************************************************************************/
+/* Parse a symbol reference, name[+-offset], and record it as a relocation
+ * at offset. Returns what follows, or NULL if there is no symbol.
+ */
+
+static char *symbol_parse(struct asm_state_s *state, char *str, int size, uint32_t offset)
+{
+  static const uint32_t types[] = { 0, ASM_RELOC_ABS8, ASM_RELOC_ABS16, 0, ASM_RELOC_ABS32 }; /* by size */
+  char     *end = symbol_scan(str);
+  char     *rest = end;
+  char     *digits;
+  char     save;
+  int32_t  addend = 0;
+  uint32_t val;
+  int      neg;
+  int      ret;
+
+  if (end == str || size == 3 || size > 4)
+    {
+      return NULL;
+    }
+
+  while (*rest == ' ' || *rest == '\t') rest++;
+  if (*rest == '+' || *rest == '-')
+    {
+      neg = (*rest == '-');
+      rest++;
+      while (*rest == ' ' || *rest == '\t') rest++;
+      digits = rest;
+      val = strtoul(digits, &rest, 0);
+      if (rest == digits)
         {
-          dest[off++] = (val >>  8) & 0xFF;
+          return NULL;
         }
-      dest[off++]     = (val      ) & 0xFF;
+      addend = neg ? -(int32_t)val : (int32_t)val;
     }
   else
     {
-      /* undefined endianess */
+      rest = end;
     }
+
+  save = *end;
+  *end = 0;
+  ret = symbol_reference(state, str, addend, types[size], offset, 0);
+  *end = save;
+  return (ret == ASM_OK) ? rest : NULL;
 }
 
 /*****************************************************************************/
+/* Parse an integer like strtol(base 0), also accepting 0b binary. Values
+ * wrap modulo 2^32. Returns NULL if there is no number.
+ */
+
+static char *number_parse(char *str, uint64_t *val)
+{
+  uint32_t v = 0;
+  uint32_t d;
+  int neg = 0;
+  int base = 10;
+  char *start;
+
+  if (*str == '-' || *str == '+')
+    {
+      neg = (*str == '-');
+      str++;
+    }
+
+  if (str[0] == '0' && (str[1] == 'x' || str[1] == 'X'))
+    {
+      base = 16;
+      str += 2;
+    }
+  else if (str[0] == '0' && (str[1] == 'b' || str[1] == 'B'))
+    {
+      base = 2;
+      str += 2;
+    }
+  else if (str[0] == '0')
+    {
+      base = 8;
+    }
 
-/* Append a number to the current section. arg is number of bytes */
+  start = str;
+  while (1)
+    {
+      d = (uint8_t)*str;
+      if (d - '0' < 10)
+        {
+          d -= '0';
+        }
+      else if ((d | 0x20) - 'a' < 6)
+        {
+          d = (d | 0x20) - 'a' + 10;
+        }
+      else
+        {
+          break;
+        }
+      if (d >= base)
+        {
+          break;
+        }
+      v = v * base + d;
+      str++;
+    }
 
-static int directive_cb_append_number(struct asm_state_s *state, char **str, int arg)
+  if (str == start)
+    {
+      return NULL;
+    }
+  *val = neg ? (uint32_t)-v : v;
+  return str;
+}
+
+/*****************************************************************************/
+/* Append a list of numbers of the given size to the current section.
+ * Values are parsed in a local batch and appended with a single write.
+ * If fp is set, the values are floating point literals.
+ */
+
+static int directive_append_numbers(struct asm_state_s *state, char *params, int size, int endianess, int fp)
 {
-  long val;
-  char *rest;
-  uint8_t encoded[4];
-  int end;
+  uint64_t vals[CONFIG_ASM_DATA_BATCH];
+  uint8_t  encoded[CONFIG_ASM_DATA_BATCH * 8];
+  int      count = 0;
+  char     *rest;
 
   /* check we have a section */
 
@@ -320,33 +623,54 @@ static int directive_cb_append_number(struct asm_state_s *state, char **str, int
     return emit_message(state, ASM_ERROR, "No current section");
     }
 
-  val = strtol(*str, &rest, 0);
+  while (1)
+    {
+      while(*params==' ' || *params=='\t' || *params==',') params++;
 
-  /*printf("parsed val=%ld, after number : %s\n",val, rest);*/
+      /* flush the batch at the end of the list or when it is full */
 
-  /* if what follows is not a sep, then we have garbage */
-  if ( *rest && !(*rest==' ' || *rest=='\t' || *rest==',') )
-    {
-      return emit_message(state, ASM_ERROR, "Invalid number: near %s", *str);
-    }
+      if (!*params || count == CONFIG_ASM_DATA_BATCH)
+        {
+          if (count && number_encode(encoded, vals, count, size, endianess))
+            {
+              return emit_message(state, ASM_ERROR, "Cannot encode %d-byte numbers for this target", size);
+            }
+          if (count && chunk_append(state, &state->current_section->data, encoded, count * size) != ASM_OK)
+            {
+              return ASM_ERROR;
+            }
+          count = 0;
+          if (!*params)
+            {
+              break;
+            }
+        }
 
-  /* eat all non-seps */
-  while(*rest && !(*rest==' ' || *rest=='\t' || *rest==',')) rest++;
+      if (fp)
+        {
+          rest = float_parse(params, size, &vals[count]);
+        }
+      else
+        {
+          rest = number_parse(params, &vals[count]);
+          if (!rest && symbol_scan(params) != params)
+            {
+              /* a symbol, patched by the link stage */
+              vals[count] = 0;
+              rest = symbol_parse(state, params, size, section_size(state->current_section) + count * size);
+            }
+        }
 
-  *str = rest;
+      /* if what follows is not a sep, then we have garbage */
+      if ( !rest || (*rest && !(*rest==' ' || *rest=='\t' || *rest==',')) )
+        {
+          return emit_message(state, ASM_ERROR, "Invalid number: near %s", params);
+        }
 
-  /* retrieve endianess */
-  end = ASM_ENDIAN_BIG;
-  if (arg<0)
-    {
-      arg = -arg;
-      end = ASM_ENDIAN_LITTLE;
+      count++;
+      params = rest;
     }
 
-  /* add to current section */
-  number_encode(encoded, val, arg, end);
-  chunk_append(state, &state->current_section->data, encoded, arg);
-
   return ASM_OK;
 }
 
@@ -369,6 +693,38 @@ int directive_for_each_param(struct asm_state_s *state, char *params, int (*call
     return ASM_OK;
 }
 
+/*****************************************************************************/
+/* .global and .extern, one symbol name per parameter */
+
+static int directive_cb_symbol(struct asm_state_s *state, char **str, int global)
+{
+  char *name = *str;
+  char *end = symbol_scan(name);
+  char save;
+  int  ret = ASM_OK;
+
+  if (!*name)
+    {
+      return ASM_OK;
+    }
+  if (end == name)
+    {
+      return emit_message(state, ASM_ERROR, "Symbol name expected near '%s'", name);
+    }
+
+  /* undefined symbols are external anyway, .extern only checks the name */
+
+  if (global)
+    {
+      save = *end;
+      *end = 0;
+      ret = symbol_global(state, name);
+      *end = save;
+    }
+  *str = end;
+  return ret;
+}
+
 /*****************************************************************************/
 
 /* manage directives */
@@ -376,13 +732,12 @@ int directive_for_each_param(struct asm_state_s *state, char *params, int (*call
 int directive(struct asm_state_s *state, char *dir, char *params)
 {
   int ret;
-  struct asm_backend_infos_s infos;
-
-  state->current_backend->getinfos(&infos);
+  const struct asm_backend_infos_s *infos = &state->infos;
 
   if (!strcmp(dir, ".section"))
     {
       char *ptr = params;
+      state->linevolatile = 1;
       /* find end of section name */
       while (*ptr && !(*ptr == ' ' || *ptr=='\t')) ptr++;
       *ptr=0;
@@ -390,24 +745,28 @@ int directive(struct asm_state_s *state, char *dir, char *params)
     }
   else if (!strcmp(dir, ".text") || !strcmp(dir, ".data") || !strcmp(dir, ".bss") || !strcmp(dir, ".rodata") )
     {
+      state->linevolatile = 1;
       ret = parse_section(state, dir);
     }
   else if (!strcmp(dir, ".db") || !strcmp(dir, ".byte") )
     {
-      ret = directive_for_each_param(state, params, directive_cb_append_number, (infos.endianess == ASM_ENDIAN_BIG)?1:-1);
+      ret = directive_append_numbers(state, params, 1, infos->endianess, 0);
     }
   else if (!strcmp(dir, ".dh") || !strcmp(dir, ".hword") || !strcmp(dir, ".short")  )
     {
-      ret = directive_for_each_param(state, params, directive_cb_append_number, (infos.endianess == ASM_ENDIAN_BIG)?2:-2);
+      ret = directive_append_numbers(state, params, 2, infos->endianess, 0);
     }
   else if (!strcmp(dir, ".dw") || !strcmp(dir, ".word") || !strcmp(dir, ".int") || !strcmp(dir, ".long")  )
     {
-      int ws = infos.wordsize;
-      if (infos.endianess == ASM_ENDIAN_LITTLE)
-        {
-          ws=-ws;
-        }
-      ret = directive_for_each_param(state, params, directive_cb_append_number, ws);
+      ret = directive_append_numbers(state, params, infos->wordsize, infos->endianess, 0);
+    }
+  else if (!strcmp(dir, ".float") || !strcmp(dir, ".single") )
+    {
+      ret = directive_append_numbers(state, params, 4, infos->endianess, 1);
+    }
+  else if (!strcmp(dir, ".double") )
+    {
+      ret = directive_append_numbers(state, params, 8, infos->endianess, 1);
     }
   else if (!strcmp(dir, ".ds") || !strcmp(dir, ".space") )
     {
@@ -419,25 +778,43 @@ int directive(struct asm_state_s *state, char *dir, char *params)
     }
   else if (!strcmp(dir, ".incbin") )
     {
+      state->linevolatile = 1; /* the file may change */
       ret = parse_incbin(state, params);
     }
+  else if (!strcmp(dir, ".include") )
+    {
+      state->linevolatile = 1;
+      ret = parse_include(state, params);
+    }
   else if (!strcmp(dir, ".balign") )
     {
+      state->linevolatile = 1; /* depends on the position */
       ret = parse_space_align(state, params, MODE_BALIGN);
     }
   else if (!strcmp(dir, ".p2align") )
     {
+      state->linevolatile = 1;
       ret = parse_space_align(state, params, MODE_P2ALIGN);
     }
   else if (!strcmp(dir, ".align") )
     {
-      ret = parse_space_align(state, params, infos.align_p2?MODE_P2ALIGN:MODE_BALIGN);
+      state->linevolatile = 1;
+      ret = parse_space_align(state, params, infos->align_p2?MODE_P2ALIGN:MODE_BALIGN);
+    }
+  else if (!strcmp(dir, ".global") || !strcmp(dir, ".globl") )
+    {
+      state->linevolatile = 1;
+      ret = directive_for_each_param(state, params, directive_cb_symbol, 1);
+    }
+  else if (!strcmp(dir, ".extern") )
+    {
+      ret = directive_for_each_param(state, params, directive_cb_symbol, 0);
     }
   else if (!strcmp(dir, ".end") )
     {
+      state->linevolatile = 1;
       /* Discard anything after this line. */
-      fseek(state->input, 0, SEEK_END); /* next read will EOF */
-      /* Do you have a simpler way to do that?? :D */
+      state->inpos = state->input->len; /* next read will EOF */
       ret = ASM_OK;
     }
   else
@@ -0,0 +1,487 @@
+/* decimal to binary floating point conversion for tcasm
+ *
+ * strtod is locale dependent and not always correctly rounded on small libcs,
+ * so floating point literals are converted here. Short literals use exact
+ * native arithmetic (Clinger's fast path). Others are approximated, then
+ * corrected one ulp at a time by comparing the exact decimal value with the
+ * halfway points, using big integers. The result is always correctly rounded
+ * (to nearest, ties to even), for single and double precision.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <float.h>
+
+#include "tcasm.h"
+
+/*****************************************************************************
+ * Definitions
+ *****************************************************************************/
+
+#define FLOAT_MAXDIGITS 800 /* significant digits kept, more are sticky. The
+                             * halfway points of doubles have up to 767 */
+#define BIG_WORDS       128 /* enough for 10^1125 shifted by 2^1077 */
+
+/*****************************************************************************
+ * Types
+ *****************************************************************************/
+
+/* binary format description */
+
+struct float_format_s
+{
+  int mbits;  /* explicit mantissa bits */
+  int ebits;  /* exponent bits */
+  int maxe10; /* values >= 10^maxe10 are infinite */
+  int mine10; /* values < 10^mine10 are zero */
+};
+
+/* fixed size big integer, little endian words */
+
+struct big_s
+{
+  int      n;
+  uint32_t w[BIG_WORDS];
+};
+
+/*****************************************************************************
+ * Variables
+ *****************************************************************************/
+
+static const struct float_format_s float_single = { 23,  8,  39,  -46 };
+static const struct float_format_s float_double = { 52, 11, 309, -325 };
+
+static const double float_pow10[] =
+{
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/*****************************************************************************
+ * Functions
+ *****************************************************************************/
+
+static void big_set(struct big_s *b, uint64_t v)
+{
+  b->w[0] = (uint32_t)v;
+  b->w[1] = (uint32_t)(v >> 32);
+  b->n = b->w[1] ? 2 : b->w[0] ? 1 : 0;
+}
+
+static void big_mul_add(struct big_s *b, uint32_t mul, uint32_t add)
+{
+  uint64_t carry = add;
+  int i;
+
+  for (i = 0; i < b->n; i++)
+    {
+      carry += (uint64_t)b->w[i] * mul;
+      b->w[i] = (uint32_t)carry;
+      carry >>= 32;
+    }
+  if (carry && b->n < BIG_WORDS)
+    {
+      b->w[b->n++] = (uint32_t)carry;
+    }
+}
+
+static void big_mul_pow10(struct big_s *b, int p)
+{
+  while (p >= 9)
+    {
+      big_mul_add(b, 1000000000U, 0);
+      p -= 9;
+    }
+  if (p > 0)
+    {
+      big_mul_add(b, (uint32_t)float_pow10[p], 0);
+    }
+}
+
+static void big_shl(struct big_s *b, int bits)
+{
+  int words = bits / 32;
+  int i;
+
+  bits %= 32;
+  if (!b->n)
+    {
+      return;
+    }
+  if (bits)
+    {
+      uint32_t carry = 0;
+      for (i = 0; i < b->n; i++)
+        {
+          uint32_t w = b->w[i];
+          b->w[i] = (w << bits) | carry;
+          carry = w >> (32 - bits);
+        }
+      if (carry && b->n < BIG_WORDS)
+        {
+          b->w[b->n++] = carry;
+        }
+    }
+  if (words)
+    {
+      if (b->n + words > BIG_WORDS)
+        {
+          words = BIG_WORDS - b->n;
+        }
+      memmove(b->w + words, b->w, b->n * sizeof(uint32_t));
+      memset(b->w, 0, words * sizeof(uint32_t));
+      b->n += words;
+    }
+}
+
+static int big_cmp(const struct big_s *a, const struct big_s *b)
+{
+  int i;
+
+  if (a->n != b->n)
+    {
+      return a->n < b->n ? -1 : 1;
+    }
+  for (i = a->n - 1; i >= 0; i--)
+    {
+      if (a->w[i] != b->w[i])
+        {
+          return a->w[i] < b->w[i] ? -1 : 1;
+        }
+    }
+  return 0;
+}
+
+/*****************************************************************************/
+/* compare digits * 10^e10 with m * 2^e2. If sticky is set, nonzero digits
+ * were dropped after the kept ones, the value is above an equal m * 2^e2.
+ */
+
+static int float_compare(const char *digits, int ndigits, int sticky, int e10, uint64_t m, int e2)
+{
+  struct big_s x;
+  struct big_s y;
+  int cmp;
+  int i;
+
+  x.n = 0;
+  for (i = 0; i < ndigits; i++)
+    {
+      if (!x.n)
+        {
+          big_set(&x, digits[i]);
+        }
+      else
+        {
+          big_mul_add(&x, 10, digits[i]);
+        }
+    }
+  big_set(&y, m);
+
+  if (e10 >= 0)
+    {
+      big_mul_pow10(&x, e10);
+    }
+  else
+    {
+      big_mul_pow10(&y, -e10);
+    }
+
+  if (e2 >= 0)
+    {
+      big_shl(&y, e2);
+    }
+  else
+    {
+      big_shl(&x, -e2);
+    }
+
+  cmp = big_cmp(&x, &y);
+  return (cmp == 0 && sticky) ? 1 : cmp;
+}
+
+/*****************************************************************************/
+/* split raw bits (without sign) in mantissa and exponent: value = m * 2^e */
+
+static void float_split(const struct float_format_s *fmt, uint64_t bits, uint64_t *m, int *e, int *normal)
+{
+  int bias = (1 << (fmt->ebits - 1)) - 1;
+  int exp  = bits >> fmt->mbits;
+
+  *m = bits & ((1ULL << fmt->mbits) - 1);
+  *normal = (exp != 0);
+  if (exp)
+    {
+      *m |= 1ULL << fmt->mbits;
+      *e = exp - bias - fmt->mbits;
+    }
+  else
+    {
+      *e = 1 - bias - fmt->mbits;
+    }
+}
+
+/*****************************************************************************/
+/* move a candidate one ulp at a time until it is the correctly rounded value */
+
+static uint64_t float_correct(const struct float_format_s *fmt, const char *digits, int ndigits, int sticky,
+                              int e10, uint64_t bits)
+{
+  uint64_t inf = ((1ULL << fmt->ebits) - 1) << fmt->mbits;
+  uint64_t m;
+  int e, normal, cmp;
+
+  if (bits >= inf)
+    {
+      bits = inf - 1;
+    }
+
+  while (1)
+    {
+      /* above the upper halfway point, or on it and odd: go up */
+
+      float_split(fmt, bits, &m, &e, &normal);
+      cmp = float_compare(digits, ndigits, sticky, e10, 2 * m + 1, e - 1);
+      if (cmp > 0 || (cmp == 0 && (m & 1)))
+        {
+          bits++;
+          if (bits == inf)
+            {
+              break;
+            }
+          continue;
+        }
+
+      if (!bits)
+        {
+          break;
+        }
+
+      /* below the lower halfway point, or on it and odd: go down.
+       * Below a power of two, the ulp is halved.
+       */
+
+      if (normal && m == (1ULL << fmt->mbits) && (bits >> fmt->mbits) > 1)
+        {
+          cmp = float_compare(digits, ndigits, sticky, e10, 4 * m - 1, e - 2);
+        }
+      else
+        {
+          cmp = float_compare(digits, ndigits, sticky, e10, 2 * m - 1, e - 1);
+        }
+      if (cmp < 0 || (cmp == 0 && (m & 1)))
+        {
+          bits--;
+          continue;
+        }
+      break;
+    }
+  return bits;
+}
+
+/*****************************************************************************/
+
+static int float_nocase(const char *str, const char *word)
+{
+  while (*word)
+    {
+      if ((*str++ | 0x20) != *word++)
+        {
+          return 0;
+        }
+    }
+  return 1;
+}
+
+/*****************************************************************************/
+/* Parse a decimal floating point literal into the raw bits of a single
+ * (size 4) or double (size 8) precision value. Returns the end of the
+ * literal, or NULL if there is none.
+ */
+
+char *float_parse(char *str, int size, uint64_t *result)
+{
+  const struct float_format_s *fmt = (size == 4) ? &float_single : &float_double;
+  char     digits[FLOAT_MAXDIGITS + 1];
+  int      ndigits = 0;
+  int      sticky = 0;
+  int      e10 = 0;
+  int      exp = 0;
+  int      expneg = 0;
+  int      neg = 0;
+  int      seen = 0;
+  int      dot = 0;
+  uint64_t sign;
+  uint64_t bits;
+  uint64_t m = 0;
+  double   x;
+  int      i, p;
+
+  if (*str == '-' || *str == '+')
+    {
+      neg = (*str == '-');
+      str++;
+    }
+  sign = (uint64_t)neg << (fmt->mbits + fmt->ebits);
+
+  /* gas style 0f/0d prefixes */
+
+  if (str[0] == '0' && (str[1] == 'f' || str[1] == 'F' || str[1] == 'd' || str[1] == 'D'))
+    {
+      str += 2;
+    }
+
+  if (float_nocase(str, "inf") || float_nocase(str, "nan"))
+    {
+      bits = ((1ULL << fmt->ebits) - 1) << fmt->mbits;
+      if ((*str | 0x20) == 'n')
+        {
+          bits |= 1ULL << (fmt->mbits - 1); /* quiet nan */
+        }
+      str += float_nocase(str, "infinity") ? 8 : 3;
+      *result = sign | bits;
+      return str;
+    }
+
+  /* collect significant digits, the decimal exponent is adjusted so that
+   * value = digits * 10^e10
+   */
+
+  for (;; str++)
+    {
+      if (*str == '.' && !dot)
+        {
+          dot = 1;
+          continue;
+        }
+      if (*str < '0' || *str > '9')
+        {
+          break;
+        }
+      seen = 1;
+      if (*str == '0' && !ndigits)
+        {
+          e10 -= dot; /* leading zero */
+          continue;
+        }
+      if (ndigits < FLOAT_MAXDIGITS)
+        {
+          digits[ndigits++] = *str - '0';
+          e10 -= dot;
+        }
+      else
+        {
+          e10 += !dot;
+          sticky |= (*str != '0'); /* breaks ties */
+        }
+    }
+
+  if (!seen)
+    {
+      return NULL;
+    }
+
+  if (*str == 'e' || *str == 'E')
+    {
+      char *save = str++;
+      if (*str == '-' || *str == '+')
+        {
+          expneg = (*str == '-');
+          str++;
+        }
+      if (*str < '0' || *str > '9')
+        {
+          str = save; /* not an exponent */
+        }
+      while (*str >= '0' && *str <= '9')
+        {
+          if (exp < 100000)
+            {
+              exp = exp * 10 + *str - '0';
+            }
+          str++;
+        }
+      e10 += expneg ? -exp : exp;
+    }
+
+  /* drop trailing zeros */
+
+  while (ndigits && !digits[ndigits - 1])
+    {
+      ndigits--;
+      e10++;
+    }
+
+  if (!ndigits || ndigits + e10 <= fmt->mine10)
+    {
+      *result = sign; /* zero */
+      return str;
+    }
+  if (ndigits + e10 > fmt->maxe10)
+    {
+      *result = sign | (((1ULL << fmt->ebits) - 1) << fmt->mbits); /* inf */
+      return str;
+    }
+
+  for (i = 0; i < ndigits && i < 19; i++)
+    {
+      m = m * 10 + digits[i];
+    }
+
+  /* exact fast path: both operands and the operation are exact */
+
+#if FLT_EVAL_METHOD == 0
+  if (ndigits <= 19)
+    {
+      if (size == 8 && m < (1ULL << 53) && e10 >= -22 && e10 <= 22)
+        {
+          x = (e10 >= 0) ? (double)m * float_pow10[e10] : (double)m / float_pow10[-e10];
+          memcpy(&bits, &x, 8);
+          *result = sign | bits;
+          return str;
+        }
+      if (size == 4 && m < (1ULL << 24) && e10 >= -10 && e10 <= 10)
+        {
+          float f = (e10 >= 0) ? (float)m * (float)float_pow10[e10] : (float)m / (float)float_pow10[-e10];
+          uint32_t fb;
+          memcpy(&fb, &f, 4);
+          *result = sign | fb;
+          return str;
+        }
+    }
+#endif
+
+  /* approximate with native arithmetic, then correct */
+
+  x = (double)m;
+  p = e10 + ndigits - i; /* digits after the 19th are ignored */
+  while (p > 22)
+    {
+      x *= 1e22;
+      p -= 22;
+    }
+  while (p < -22)
+    {
+      x /= 1e22;
+      p += 22;
+    }
+  x = (p >= 0) ? x * float_pow10[p] : x / float_pow10[-p];
+
+  if (size == 4)
+    {
+      float f = (x > FLT_MAX) ? FLT_MAX : (float)x;
+      uint32_t fb;
+      memcpy(&fb, &f, 4);
+      bits = fb;
+    }
+  else
+    {
+      memcpy(&bits, &x, 8);
+    }
+
+  bits = float_correct(fmt, digits, ndigits, sticky, e10, bits);
+  *result = sign | bits;
+  return str;
+}
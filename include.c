@@ -0,0 +1,479 @@
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#if CONFIG_ASM_MMAP
+#include <sys/mman.h>
+#endif
+#if CONFIG_ASM_SERVER
+#include <pthread.h>
+#endif
+
+#include "tcasm.h"
+
+#if CONFIG_ASM_SERVER
+/*****************************************************************************
+ * Types
+ *****************************************************************************/
+
+/* File contents shared by all the states of a server, found by file
+ * identity. An entry is used only if the file did not change since it was
+ * loaded. Replaced entries live until their last user releases them.
+ */
+
+struct include_shared_s
+{
+  struct include_shared_s *next;
+  dev_t    dev;
+  ino_t    ino;
+  off_t    size;
+  struct timespec mtime;
+  int      refs;   /* users, plus one while in the table */
+  uint8_t  *data;
+  uint32_t len;
+  uint8_t  mapped; /* TRUE if data was obtained with mmap() */
+};
+
+/*****************************************************************************
+ * Variables
+ *****************************************************************************/
+
+static pthread_mutex_t include_shared_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct include_shared_s *include_shared[CONFIG_ASM_SERVER_HASH];
+static int include_sharing; /* TRUE if contents are shared */
+#endif
+
+/*****************************************************************************/
+/* hash a file name for the include cache */
+
+static uint32_t include_hash(const char *name)
+{
+  uint32_t h = 2166136261U; /* FNV-1a */
+  while (*name)
+    {
+      h ^= (uint8_t)*name++;
+      h *= 16777619U;
+    }
+  return h;
+}
+
+/*****************************************************************************/
+/* Resolve a file name, memoising the result (including failures).
+ * If search is set, the include path entries are tried first, then the name
+ * itself. Otherwise the name is used as-is (main input files).
+ * Returns NULL only if memory is exhausted. A name that cannot be resolved
+ * gives an entry with a NULL path.
+ */
+
+struct asm_file_s *include_find(struct asm_state_s *state, const char *name, int search)
+{
+  char path[CONFIG_ASM_INC_MAXLEN + 1 + CONFIG_ASM_INBUF_SIZE];
+  struct asm_file_s *file;
+  struct asm_file_s **tail;
+  uint32_t bucket;
+  int fnlen = strlen(name);
+  int inclen;
+  int i;
+
+  bucket = include_hash(name) % CONFIG_ASM_INC_HASH;
+  for (file = state->incfiles[bucket]; file; file = file->next)
+    {
+      if (file->search == search && !strcmp(file->name, name))
+        {
+          TRACE(state, DEBUG_INC, 2, "include '%s' cached -> %s\n", name, file->path ? file->path : "(not found)");
+          return file;
+        }
+    }
+
+  /* not seen yet, create the cache entry. The name is stored after it */
+
+  file = asm_malloc(state, MEM_INCLUDE, sizeof(struct asm_file_s) + fnlen + 1);
+  if (!file)
+    {
+      emit_message(state, ASM_ERROR, "Cannot evaluate include path, malloc() failed");
+      return NULL;
+    }
+  file->name   = (char*)&file[1];
+  strcpy(file->name, name);
+  file->search = search;
+  file->path   = NULL;
+  file->data   = NULL;
+  file->len    = 0;
+  file->mapped = 0;
+  file->shared = NULL;
+  file->order  = NULL;
+
+  for (i = 0; search && i < CONFIG_ASM_INC_COUNT; i++)
+    {
+      if (!state->includes[i])
+        {
+          break;
+        }
+      inclen = strlen(state->includes[i]);
+      if (inclen + 1 + fnlen + 1 > sizeof(path))
+        {
+          continue;
+        }
+      memcpy(path, state->includes[i], inclen);
+      path[inclen] = '/';
+      memcpy(path + inclen + 1, name, fnlen + 1);
+      if (!access(path, R_OK))
+        {
+          file->path = asm_malloc(state, MEM_INCLUDE, strlen(path) + 1);
+          if (file->path)
+            {
+              strcpy(file->path, path);
+            }
+          break;
+        }
+    }
+
+  if (!file->path && !access(name, R_OK))
+    {
+      file->path = file->name;
+    }
+
+  TRACE(state, DEBUG_INC, 1, "include '%s' resolved -> %s\n", name, file->path ? file->path : "(not found)");
+
+  /* insert in hash table and remember resolution order */
+
+  file->next = state->incfiles[bucket];
+  state->incfiles[bucket] = file;
+
+  tail = &state->incorder;
+  while (*tail)
+    {
+      tail = &(*tail)->order;
+    }
+  *tail = file;
+
+  return file;
+}
+
+#if CONFIG_ASM_SERVER
+/*****************************************************************************/
+/* Share the contents of loaded files between all states, for servers */
+
+void include_share(int enable)
+{
+  include_sharing = enable;
+}
+
+/*****************************************************************************/
+
+static void include_unref(struct include_shared_s *sh)
+{
+  pthread_mutex_lock(&include_shared_lock);
+  if (--sh->refs > 0)
+    {
+      sh = NULL;
+    }
+  pthread_mutex_unlock(&include_shared_lock);
+  if (!sh)
+    {
+      return;
+    }
+#if CONFIG_ASM_MMAP
+  if (sh->mapped)
+    {
+      munmap(sh->data, sh->len);
+    }
+  else
+#endif
+    {
+      free(sh->data);
+    }
+  free(sh);
+}
+
+/*****************************************************************************/
+/* Load a file through the shared contents. fd is closed */
+
+static int include_load_shared(struct asm_state_s *state, struct asm_file_s *file, int fd, struct stat *st)
+{
+  struct include_shared_s **psh;
+  struct include_shared_s *sh;
+  struct include_shared_s *old = NULL;
+  uint32_t bucket = (uint32_t)(st->st_ino ^ st->st_dev) % CONFIG_ASM_SERVER_HASH;
+  uint32_t done;
+  int ret;
+
+  pthread_mutex_lock(&include_shared_lock);
+  for (sh = include_shared[bucket]; sh; sh = sh->next)
+    {
+      if (sh->dev == st->st_dev && sh->ino == st->st_ino &&
+          sh->size == st->st_size && sh->mtime.tv_sec == st->st_mtim.tv_sec &&
+          sh->mtime.tv_nsec == st->st_mtim.tv_nsec)
+        {
+          sh->refs++;
+          break;
+        }
+    }
+  pthread_mutex_unlock(&include_shared_lock);
+
+  if (sh)
+    {
+      TRACE(state, DEBUG_INC, 1, "include shared %s\n", file->path);
+      close(fd);
+      file->data   = sh->data;
+      file->len    = sh->len;
+      file->shared = sh;
+      return ASM_OK;
+    }
+
+  /* not loaded yet, or changed */
+
+  sh = calloc(1, sizeof(struct include_shared_s));
+  if (!sh)
+    {
+      close(fd);
+      return emit_message(state, ASM_ERROR, "malloc() failed");
+    }
+  sh->dev   = st->st_dev;
+  sh->ino   = st->st_ino;
+  sh->size  = st->st_size;
+  sh->mtime = st->st_mtim;
+  sh->len   = st->st_size;
+  sh->refs  = 2;
+
+#if CONFIG_ASM_MMAP
+  if (sh->len > 0)
+    {
+      void *map = mmap(NULL, sh->len, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map != MAP_FAILED)
+        {
+          sh->data   = map;
+          sh->mapped = 1;
+        }
+    }
+#endif
+  if (!sh->data)
+    {
+      sh->data = malloc(sh->len + 1);
+      for (done = 0; sh->data && done < sh->len; done += ret)
+        {
+          ret = read(fd, sh->data + done, sh->len - done);
+          if (ret <= 0)
+            {
+              break;
+            }
+        }
+      sh->len = done;
+    }
+  close(fd);
+  if (!sh->data)
+    {
+      free(sh);
+      return emit_message(state, ASM_ERROR, "malloc() failed");
+    }
+
+  /* publish, replacing the entry of an older version */
+
+  pthread_mutex_lock(&include_shared_lock);
+  for (psh = &include_shared[bucket]; *psh; psh = &(*psh)->next)
+    {
+      if ((*psh)->dev == sh->dev && (*psh)->ino == sh->ino)
+        {
+          old  = *psh;
+          *psh = old->next;
+          break;
+        }
+    }
+  sh->next = include_shared[bucket];
+  include_shared[bucket] = sh;
+  pthread_mutex_unlock(&include_shared_lock);
+  if (old)
+    {
+      include_unref(old);
+    }
+
+  file->data   = sh->data;
+  file->len    = sh->len;
+  file->shared = sh;
+  return ASM_OK;
+}
+#endif
+
+/*****************************************************************************/
+/* Open a resolved file and get its size in file->len. Returns the file
+ * descriptor, or -1 after an error.
+ */
+
+int include_open(struct asm_state_s *state, struct asm_file_s *file)
+{
+  struct stat st;
+  int fd;
+
+  if (!file->path)
+    {
+      emit_message(state, ASM_ERROR, "File '%s' not found in include path", file->name);
+      return -1;
+    }
+
+  fd = open(file->path, O_RDONLY);
+  if (fd < 0)
+    {
+      emit_message(state, ASM_ERROR, "Cannot open '%s'", file->path);
+      return -1;
+    }
+
+  if (fstat(fd, &st))
+    {
+      close(fd);
+      emit_message(state, ASM_ERROR, "Cannot stat '%s'", file->path);
+      return -1;
+    }
+
+  file->len = st.st_size;
+  return fd;
+}
+
+/*****************************************************************************/
+/* Load the contents of a resolved file, once. Files are mapped when possible
+ * and stay available until include_release().
+ */
+
+int include_load(struct asm_state_s *state, struct asm_file_s *file)
+{
+#if CONFIG_ASM_SERVER
+  struct stat st;
+#endif
+  uint32_t done;
+  int ret;
+  int fd;
+
+  if (file->data)
+    {
+      return ASM_OK; /* already loaded */
+    }
+
+  fd = include_open(state, file);
+  if (fd < 0)
+    {
+      return ASM_ERROR;
+    }
+
+  TRACE(state, DEBUG_INC, 1, "include loading %s: %u bytes\n", file->path, file->len);
+
+#if CONFIG_ASM_SERVER
+  if (include_sharing && !MEM_BUDGETED(state) && !fstat(fd, &st))
+    {
+      return include_load_shared(state, file, fd, &st);
+    }
+#endif
+
+#if CONFIG_ASM_MMAP
+  /* with a memory budget, contents must be read in the budget to count */
+
+  if (file->len > 0 && !MEM_BUDGETED(state))
+    {
+      void *map = mmap(NULL, file->len, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map != MAP_FAILED)
+        {
+          close(fd);
+          file->data   = map;
+          file->mapped = 1;
+          return ASM_OK;
+        }
+    }
+#endif
+
+  /* no mmap, read the file in memory. Keep room for an empty file */
+
+  file->data = asm_malloc(state, MEM_INCLUDE, file->len + 1);
+  if (!file->data)
+    {
+      close(fd);
+      return emit_message(state, ASM_ERROR, "malloc() failed");
+    }
+
+  for (done = 0; done < file->len; done += ret)
+    {
+      ret = read(fd, file->data + done, file->len - done);
+      if (ret <= 0)
+        {
+          break;
+        }
+    }
+  file->len = done;
+  close(fd);
+
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* Release all cached files */
+
+void include_release(struct asm_state_s *state)
+{
+  struct asm_file_s *file;
+
+  while (state->incorder)
+    {
+      file = state->incorder;
+      state->incorder = file->order;
+#if CONFIG_ASM_SERVER
+      if (file->shared)
+        {
+          include_unref(file->shared);
+        }
+      else
+#endif
+#if CONFIG_ASM_MMAP
+      if (file->mapped)
+        {
+          munmap(file->data, file->len);
+        }
+      else
+#endif
+        {
+          asm_free(state, file->data);
+        }
+      if (file->path != file->name)
+        {
+          asm_free(state, file->path);
+        }
+      asm_free(state, file);
+    }
+  memset(state->incfiles, 0, sizeof(state->incfiles));
+}
+
+/*****************************************************************************/
+/* Resolve, load and assemble a source file, for .include and #include */
+
+int include_source(struct asm_state_s *state, const char *name)
+{
+  struct asm_file_s *file;
+  int ret;
+
+  if (state->incdepth >= CONFIG_ASM_INC_DEPTH)
+    {
+      return emit_message(state, ASM_ERROR, "Too many nested includes");
+    }
+
+  file = include_find(state, name, 1);
+  if (!file)
+    {
+      return ASM_ERROR;
+    }
+
+  /* with a memory budget, parse_file() reads the lines one by one */
+
+  ret = MEM_BUDGETED(state) ? ASM_OK : include_load(state, file);
+  if (ret != ASM_OK)
+    {
+      return ret;
+    }
+
+  TRACE(state, DEBUG_INC, 1, "include file '%s'\n", file->path);
+
+  state->incdepth++;
+  ret = parse_file(state, file);
+  state->incdepth--;
+  return ret;
+}
@@ -0,0 +1,488 @@
+/*
+ * assembler state management and library interface
+ *
+ * Everything an assembly needs is in struct asm_state_s, this file creates
+ * and releases states, emits their messages, and exposes them as contexts
+ * through the libtcasm.h API.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "tcasm.h"
+#include "libtcasm.h"
+
+/*****************************************************************************
+ * Definitions
+ *****************************************************************************/
+
+#define MESSAGE_SIZE 256 /* formatted message length for the diag callback */
+
+/*****************************************************************************
+ * Types
+ *****************************************************************************/
+
+/* a library context: a state, and what it owns on behalf of the caller */
+
+struct tcasm_s
+{
+  struct asm_state_s state;
+  char         *includes[CONFIG_ASM_INC_COUNT]; /* copies of include paths */
+  struct iovec *iov; /* last section returned by tcasm_get_section() */
+  int          iovsize;
+  int          inregion; /* TRUE if the context is in the caller's memory */
+};
+
+/*****************************************************************************
+ * Variables
+ *****************************************************************************/
+
+/* these definitions depend on the presence of backends */
+
+#ifdef CONFIG_ASM_TARGET_ARM
+extern struct asm_backend_s arm_backend;
+#endif
+
+static struct asm_backend_s * const backends[] =
+{
+#ifdef CONFIG_ASM_TARGET_ARM
+  &arm_backend,
+#endif
+  NULL
+};
+
+static const char * const msgtypes[] =
+{
+  "message",
+  "warning",
+  "error",
+};
+
+/*****************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/* Get a configured backend by index, NULL after the last one */
+
+struct asm_backend_s *backend_get(int index)
+{
+  if (index < 0 || index >= sizeof(backends) / sizeof(backends[0]))
+    {
+      return NULL;
+    }
+  return backends[index];
+}
+
+/*****************************************************************************/
+/* Get a configured backend by name */
+
+struct asm_backend_s *backend_find(const char *name)
+{
+  struct asm_backend_infos_s infos;
+  int i;
+
+  for (i = 0; backends[i]; i++)
+    {
+      backends[i]->getinfos(&infos);
+      if (!strcmp(infos.name, name))
+        {
+          return backends[i];
+        }
+    }
+  return NULL;
+}
+
+/*****************************************************************************/
+
+int emit_message(struct asm_state_s *asmstate, int type, const char *msg, ...)
+{
+  va_list ap;
+  if (type > ASM_ERROR)
+    {
+    type = 0;
+    }
+  if (type == ASM_WARN)
+    {
+      asmstate->nwarnings++;
+    }
+  va_start(ap, msg);
+  if (asmstate->diag)
+    {
+      char buf[MESSAGE_SIZE];
+      vsnprintf(buf, sizeof(buf), msg, ap);
+      asmstate->diag(asmstate->diagarg, asmstate->inputname, asmstate->curline, type, buf);
+    }
+  else
+    {
+      flockfile(stderr); /* keep messages whole in batch mode */
+      if (asmstate->inputname)
+        {
+          fprintf(stderr, "%s:%d: ", asmstate->inputname, asmstate->curline);
+        }
+      else
+        {
+          fprintf(stderr, "tcasm: "); /* options, before any input */
+        }
+      fprintf(stderr, "%s: ", msgtypes[type]);
+      vfprintf(stderr, msg, ap);
+      fprintf(stderr, "\n");
+      funlockfile(stderr);
+    }
+  va_end(ap);
+  return type;
+}
+
+/*****************************************************************************/
+
+void asm_trace(struct asm_state_s *asmstate, const char *msg, ...)
+{
+  va_list ap;
+  va_start(ap, msg);
+  flockfile(stderr);
+  if (asmstate->inputname)
+    {
+      fprintf(stderr, "%s:%d: ", asmstate->inputname, asmstate->curline);
+    }
+  vfprintf(stderr, msg, ap);
+  funlockfile(stderr);
+  va_end(ap);
+}
+
+/*****************************************************************************/
+/* Select the backend of a state, and keep its infos */
+
+void asm_set_backend(struct asm_state_s *asmstate, struct asm_backend_s *backend)
+{
+  asmstate->current_backend = backend;
+  if (backend)
+    {
+      backend->getinfos(&asmstate->infos);
+    }
+}
+
+/*****************************************************************************/
+
+void asm_init(struct asm_state_s *asmstate)
+{
+  int i;
+  memset(asmstate, 0, sizeof(struct asm_state_s));
+  asmstate->outputname = NULL;
+  asmstate->debug = 0;
+  asmstate->debuglevel = 0;
+  asmstate->pipeline = 0;
+  asmstate->spill = 0;
+  asmstate->nwarnings = 0;
+  asmstate->diag = NULL;
+  asmstate->diagarg = NULL;
+  asmstate->tokens = asmstate->tokbuf;
+  asmstate->current_section = NULL;
+  asmstate->current_backend = NULL;
+  for (i = 0; i<CONFIG_ASM_SEC_MAX; i++)
+    {
+      asmstate->sections[i].id = SECTION_NONE;
+    }
+  for (i = 0; i < CONFIG_ASM_INC_COUNT; i++)
+    {
+      asmstate->includes[i]=NULL;
+    }
+  for (i = 0; i < CONFIG_ASM_INC_HASH; i++)
+    {
+      asmstate->incfiles[i]=NULL;
+    }
+  asmstate->incorder = NULL;
+  asmstate->incdepth = 0;
+  asmstate->input = NULL;
+  asmstate->ppenable = 0;
+  asmstate->ppactive = 0;
+  asmstate->pplevel = 0;
+  asmstate->ppcomment = 0;
+  asmstate->pplen = 0;
+  for (i = 0; i < CONFIG_ASM_PP_HASH; i++)
+    {
+      asmstate->macros[i]=NULL;
+    }
+#if CONFIG_ASM_MEMBUDGET
+  asmstate->mem.marks[0] = CONFIG_ASM_MEM_WARN;
+  mem_account(asmstate, MEM_STATE, sizeof(struct asm_state_s));
+#endif
+#if CONFIG_ASM_PREPROC
+  pp_define(asmstate, "__ASSEMBLER__"); /* like cc does for .S files */
+#endif
+}
+
+/*****************************************************************************/
+/* free everything owned by a state */
+
+void asm_release(struct asm_state_s *asmstate)
+{
+  const struct asm_backend_s *backend = asmstate->current_backend;
+
+  if (backend && backend->release)
+    {
+      backend->release(backend, asmstate);
+    }
+  include_release(asmstate);
+  symbol_release(asmstate);
+#if CONFIG_ASM_PREPROC
+  pp_release(asmstate);
+#endif
+#if CONFIG_ASM_PCH
+  pch_release(asmstate); /* after the macros that point into it */
+#endif
+#if CONFIG_ASM_LINES
+  lines_release(asmstate);
+#endif
+  section_release(asmstate);
+  free(asmstate->outputname);
+  asmstate->outputname = NULL;
+}
+
+/*****************************************************************************
+ * Library interface
+ *****************************************************************************/
+
+/* copy a string, in the budget if there is one */
+
+static char *tcasm_strdup(struct tcasm_s *ctx, const char *str)
+{
+  char *copy = asm_malloc(&ctx->state, MEM_STATE, strlen(str) + 1);
+  if (copy)
+    {
+      strcpy(copy, str);
+    }
+  return copy;
+}
+
+/*****************************************************************************/
+
+struct tcasm_s *tcasm_create(const struct tcasm_opts_s *opts)
+{
+  struct tcasm_s *ctx;
+  int ret = ASM_OK;
+  int i;
+
+#if CONFIG_ASM_MEMBUDGET
+  if (opts && opts->membase)
+    {
+      /* the context is at the start of the region, the rest is the budget */
+
+      uintptr_t base = ((uintptr_t)opts->membase + sizeof(void*) - 1) & ~(uintptr_t)(sizeof(void*) - 1);
+      size_t    skip = base - (uintptr_t)opts->membase + sizeof(struct tcasm_s);
+
+      if (opts->memsize <= skip || opts->memsize - skip > UINT32_MAX)
+        {
+          return NULL;
+        }
+      ctx = (struct tcasm_s*)base;
+      memset(ctx, 0, sizeof(struct tcasm_s));
+      asm_init(&ctx->state);
+      ctx->inregion = 1;
+      mem_account(&ctx->state, MEM_STATE, skip - sizeof(struct asm_state_s));
+      if (mem_budget(&ctx->state, (uint8_t*)ctx + sizeof(struct tcasm_s), opts->memsize - skip) != ASM_OK)
+        {
+          return NULL;
+        }
+    }
+  else
+#else
+  if (opts && opts->membase)
+    {
+      return NULL; /* no budget support */
+    }
+  else
+#endif
+    {
+      ctx = calloc(1, sizeof(struct tcasm_s));
+      if (!ctx)
+        {
+          return NULL;
+        }
+      asm_init(&ctx->state);
+    }
+
+  /* backend, by name or the only one */
+
+  if (opts && opts->backend)
+    {
+      asm_set_backend(&ctx->state, backend_find(opts->backend));
+    }
+  else if (!backend_get(1))
+    {
+      asm_set_backend(&ctx->state, backend_get(0));
+    }
+  if (!ctx->state.current_backend)
+    {
+      goto errout;
+    }
+
+  if (!opts)
+    {
+      return ctx;
+    }
+
+#if CONFIG_ASM_MEMBUDGET
+  for (i = 0; opts->memwarn && opts->memwarn[i] && i < CONFIG_ASM_MEM_MARKS; i++)
+    {
+      ctx->state.mem.marks[i] = opts->memwarn[i];
+    }
+#endif
+  ctx->state.diag     = opts->diag;
+  ctx->state.diagarg  = opts->diagarg;
+  ctx->state.ppenable = opts->preprocess;
+
+  for (i = 0; opts->includes && opts->includes[i]; i++)
+    {
+      if (i == CONFIG_ASM_INC_COUNT || strlen(opts->includes[i]) > CONFIG_ASM_INC_MAXLEN)
+        {
+          goto errout;
+        }
+      ctx->includes[i] = tcasm_strdup(ctx, opts->includes[i]);
+      if (!ctx->includes[i])
+        {
+          goto errout;
+        }
+      ctx->state.includes[i] = ctx->includes[i];
+    }
+
+#if CONFIG_ASM_PREPROC
+  for (i = 0; ret == ASM_OK && opts->defines && opts->defines[i]; i++)
+    {
+      ret = pp_define(&ctx->state, opts->defines[i]);
+    }
+#endif
+
+  /* backend options may be modified by the backend, use copies */
+
+  for (i = 0; ret == ASM_OK && opts->options && opts->options[i]; i++)
+    {
+      char *option = tcasm_strdup(ctx, opts->options[i]);
+      if (!option)
+        {
+          goto errout;
+        }
+      ret = ctx->state.current_backend->option(ctx->state.current_backend, &ctx->state, option);
+      asm_free(&ctx->state, option);
+    }
+  if (ret != ASM_OK)
+    {
+      goto errout;
+    }
+
+  return ctx;
+
+errout:
+  tcasm_destroy(ctx);
+  return NULL;
+}
+
+/*****************************************************************************/
+
+int tcasm_assemble_named_buffer(struct tcasm_s *ctx, const char *name, const char *src, size_t len)
+{
+  if (len > UINT32_MAX)
+    {
+      return emit_message(&ctx->state, ASM_ERROR, "Source too large");
+    }
+  return parse_buffer(&ctx->state, name ? name : "<buffer>", (const uint8_t*)src, len);
+}
+
+/*****************************************************************************/
+
+int tcasm_assemble_buffer(struct tcasm_s *ctx, const char *src, size_t len)
+{
+  return tcasm_assemble_named_buffer(ctx, NULL, src, len);
+}
+
+/*****************************************************************************/
+
+int tcasm_assemble_file(struct tcasm_s *ctx, const char *path)
+{
+  ctx->state.inputname = (char*)path;
+  return parse(&ctx->state);
+}
+
+/*****************************************************************************/
+
+int tcasm_get_section(struct tcasm_s *ctx, const char *name, const struct iovec **iov)
+{
+  struct asm_section_s *sec = NULL;
+  struct asm_chunk_s *chunk;
+  int count;
+  int i;
+
+  for (i = 0; i < CONFIG_ASM_SEC_MAX; i++)
+    {
+      if (ctx->state.sections[i].name[0] && !strcmp(ctx->state.sections[i].name, name))
+        {
+          sec = &ctx->state.sections[i];
+          break;
+        }
+    }
+  if (!sec || sec->spill)
+    {
+      return -1; /* spilled contents are not in memory */
+    }
+
+  count = 0;
+  for (chunk = sec->data.first; chunk; chunk = chunk->next)
+    {
+      count++;
+    }
+
+  if (count > ctx->iovsize)
+    {
+      struct iovec *grown = asm_malloc(&ctx->state, MEM_STATE, count * sizeof(struct iovec));
+      if (!grown)
+        {
+          return -1;
+        }
+      asm_free(&ctx->state, ctx->iov);
+      ctx->iov     = grown;
+      ctx->iovsize = count;
+    }
+
+  for (i = 0, chunk = sec->data.first; chunk; chunk = chunk->next, i++)
+    {
+      ctx->iov[i].iov_base = chunk->data;
+      ctx->iov[i].iov_len  = chunk->len;
+    }
+
+  *iov = ctx->iov;
+  return count;
+}
+
+/*****************************************************************************/
+
+void tcasm_destroy(struct tcasm_s *ctx)
+{
+  int i;
+
+  if (!ctx)
+    {
+      return;
+    }
+  asm_release(&ctx->state);
+  for (i = 0; i < CONFIG_ASM_INC_COUNT; i++)
+    {
+      asm_free(&ctx->state, ctx->includes[i]);
+    }
+  asm_free(&ctx->state, ctx->iov);
+  if (!ctx->inregion)
+    {
+      free(ctx);
+    }
+}
+
+/*****************************************************************************/
+
+void tcasm_mem_report(struct tcasm_s *ctx, FILE *out)
+{
+#if CONFIG_ASM_MEMBUDGET
+  mem_report(&ctx->state, out);
+#endif
+}
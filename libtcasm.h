@@ -0,0 +1,89 @@
+/*
+ * libtcasm: tcasm as a library
+ *
+ * Each context is a complete assembler state. There is no global state, so
+ * contexts can be used concurrently from different threads, one thread per
+ * context at a time.
+ */
+
+#ifndef __LIBTCASM__H__
+#define __LIBTCASM__H__
+
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/uio.h>
+
+/* message types given to the diagnostic callback, and results */
+
+#define TCASM_OK    0
+#define TCASM_WARN  1
+#define TCASM_ERROR 2
+
+struct tcasm_s;
+
+/* context options. Arrays are NULL terminated and may be NULL. Strings are
+ * copied, they do not have to live longer than tcasm_create().
+ */
+
+struct tcasm_opts_s
+{
+  const char *backend;      /* backend name, NULL for the only one */
+  const char **includes;    /* include path */
+  const char **defines;     /* preprocessor definitions, name[=value] */
+  const char **options;     /* backend options, like -m */
+  int        preprocess;    /* TRUE to preprocess all sources */
+
+  /* diagnostic callback, NULL to print on stderr. file and line give the
+   * source position, type is TCASM_WARN or TCASM_ERROR.
+   */
+  void (*diag)(void *arg, const char *file, int line, int type, const char *msg);
+  void *diagarg;
+
+  /* memory budget. If membase is not NULL, the context and everything it
+   * allocates are placed in these memsize bytes, which must stay valid until
+   * tcasm_destroy(). memwarn are high-water marks in percent, 0 terminated,
+   * NULL for the default.
+   */
+  void         *membase;
+  size_t       memsize;
+  const int    *memwarn;
+};
+
+/* Create a context. opts may be NULL for the defaults. Returns NULL if
+ * memory is exhausted, an option is invalid, or a budget is requested from a
+ * library built without CONFIG_ASM_MEMBUDGET.
+ */
+
+struct tcasm_s *tcasm_create(const struct tcasm_opts_s *opts);
+
+/* Assemble source text from memory. name is used in messages and may be
+ * NULL. Several buffers and files can be assembled in the same context,
+ * their contents are appended to the same sections.
+ * Returns TCASM_OK or TCASM_ERROR.
+ */
+
+int tcasm_assemble_buffer(struct tcasm_s *ctx, const char *src, size_t len);
+int tcasm_assemble_named_buffer(struct tcasm_s *ctx, const char *name, const char *src, size_t len);
+
+/* Assemble a source file */
+
+int tcasm_assemble_file(struct tcasm_s *ctx, const char *path);
+
+/* Get the contents of a section, as an array of memory blocks owned by the
+ * context, valid until the next call or tcasm_destroy().
+ * Returns the number of blocks, or -1 if the section does not exist.
+ */
+
+int tcasm_get_section(struct tcasm_s *ctx, const char *name, const struct iovec **iov);
+
+/* Print the peak memory use of a context, per subsystem. Prints nothing
+ * without CONFIG_ASM_MEMBUDGET.
+ */
+
+void tcasm_mem_report(struct tcasm_s *ctx, FILE *out);
+
+/* Release a context and everything it owns */
+
+void tcasm_destroy(struct tcasm_s *ctx);
+
+#endif /* __LIBTCASM__H__ */
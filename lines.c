@@ -0,0 +1,451 @@
+/* incremental line cache for tcasm
+ *
+ * With --incremental=<file>, the bytes produced by each line are kept in a
+ * sidecar file, keyed by the text of the line after preprocessing and the
+ * backend mode. On the next run, lines found there append their bytes to
+ * the current section without being parsed or encoded, so only the lines
+ * that changed are assembled again. Section contents are rebuilt in line
+ * order from cached and new pieces.
+ *
+ * Only lines whose whole effect is to append bytes to the current section
+ * are cached. Handlers of lines that depend on anything else (position,
+ * other files, labels, mode changes) set state->linevolatile. Lines that
+ * emit messages are not cached either, the messages would be lost.
+ *
+ * The sidecar is written by the same build that reads it:
+ *
+ *   "tcasmlin", version, context length, context, entry count
+ *   per entry: mode, text length, data length, text, data
+ *
+ * The context describes the options that change encodings, the sidecar is
+ * ignored if it differs. Only the entries used by the last run are kept.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "tcasm.h"
+
+#if CONFIG_ASM_LINES
+
+/*****************************************************************************
+ * Definitions
+ *****************************************************************************/
+
+#define LINES_MAGIC   "tcasmlin"
+#define LINES_VERSION 1
+
+/*****************************************************************************
+ * Types
+ *****************************************************************************/
+
+struct lines_entry_s
+{
+  struct lines_entry_s *next; /* hash chain */
+  uint32_t hash;
+  uint32_t mode;
+  uint32_t textlen;
+  uint32_t len;               /* bytes produced by the line */
+  const char    *text;
+  const uint8_t *data;
+  int      used;              /* TRUE if seen in this run, kept on save */
+  int      alloc;             /* TRUE if allocated alone, not in the image */
+};
+
+struct asm_lines_s
+{
+  char     *path;             /* sidecar file */
+  char     *ctx;              /* options that change encodings */
+  uint8_t  *image;            /* loaded sidecar, NULL if none */
+  struct lines_entry_s *loaded; /* entries of the image */
+  struct lines_entry_s *hash[CONFIG_ASM_LINES_HASH];
+  uint32_t hits;
+  uint32_t misses;
+
+  /* line being parsed after a miss */
+  char     *text;
+  uint32_t textlen;
+  uint32_t textsize;
+  uint32_t texthash;
+  struct asm_section_s *sec;  /* current section before the line */
+  uint32_t start;             /* its size before the line */
+  uint32_t fixup;
+  uint32_t mode;
+  int      nwarnings;
+};
+
+/*****************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/* FNV-1a */
+
+static uint32_t lines_hash(const char *text, uint32_t len, uint32_t mode)
+{
+  uint32_t h = 2166136261u ^ mode;
+  uint32_t i;
+
+  for (i = 0; i < len; i++)
+    {
+      h = (h ^ (uint8_t)text[i]) * 16777619u;
+    }
+  return h;
+}
+
+/*****************************************************************************/
+
+static void lines_insert(struct asm_lines_s *lines, struct lines_entry_s *e)
+{
+  uint32_t bucket = e->hash % CONFIG_ASM_LINES_HASH;
+
+  e->next = lines->hash[bucket];
+  lines->hash[bucket] = e;
+}
+
+/*****************************************************************************/
+/* Read a field of the image, returns FALSE at the end */
+
+static int lines_get(const uint8_t **ptr, const uint8_t *end, void *val, uint32_t len)
+{
+  if ((uint32_t)(end - *ptr) < len)
+    {
+      return 0;
+    }
+  memcpy(val, *ptr, len);
+  *ptr += len;
+  return 1;
+}
+
+/*****************************************************************************/
+/* Load the sidecar. A missing or stale one just gives an empty cache */
+
+static void lines_load(struct asm_state_s *state, struct asm_lines_s *lines)
+{
+  const uint8_t *ptr;
+  const uint8_t *end;
+  struct stat st;
+  char     magic[8];
+  uint32_t version;
+  uint32_t ctxlen;
+  uint32_t count;
+  uint32_t i;
+  FILE *f;
+
+  f = fopen(lines->path, "rb");
+  if (!f)
+    {
+      return;
+    }
+  if (fstat(fileno(f), &st) < 0 || st.st_size > UINT32_MAX ||
+      !(lines->image = asm_malloc(state, MEM_LINES, st.st_size + 1)) ||
+      fread(lines->image, 1, st.st_size, f) != st.st_size)
+    {
+      fclose(f);
+      goto stale;
+    }
+  fclose(f);
+
+  ptr = lines->image;
+  end = ptr + st.st_size;
+  if (!lines_get(&ptr, end, magic, sizeof(magic)) || memcmp(magic, LINES_MAGIC, sizeof(magic)) ||
+      !lines_get(&ptr, end, &version, sizeof(version)) || version != LINES_VERSION ||
+      !lines_get(&ptr, end, &ctxlen, sizeof(ctxlen)) || ctxlen != strlen(lines->ctx) ||
+      (uint32_t)(end - ptr) < ctxlen || memcmp(ptr, lines->ctx, ctxlen))
+    {
+      goto stale;
+    }
+  ptr += ctxlen;
+  if (!lines_get(&ptr, end, &count, sizeof(count)) || count > st.st_size / 12)
+    {
+      goto stale;
+    }
+
+  lines->loaded = asm_malloc(state, MEM_LINES, count * sizeof(struct lines_entry_s) + 1);
+  if (!lines->loaded)
+    {
+      goto stale;
+    }
+  for (i = 0; i < count; i++)
+    {
+      struct lines_entry_s *e = &lines->loaded[i];
+      if (!lines_get(&ptr, end, &e->mode, sizeof(e->mode)) ||
+          !lines_get(&ptr, end, &e->textlen, sizeof(e->textlen)) ||
+          !lines_get(&ptr, end, &e->len, sizeof(e->len)) ||
+          (uint32_t)(end - ptr) < (uint64_t)e->textlen + e->len)
+        {
+          goto stale;
+        }
+      e->text  = (const char*)ptr;
+      e->data  = ptr + e->textlen;
+      e->hash  = lines_hash(e->text, e->textlen, e->mode);
+      e->used  = 0;
+      e->alloc = 0;
+      ptr += e->textlen + e->len;
+      lines_insert(lines, e);
+    }
+  TRACE(state, DEBUG_PARSE, 1, "lines: %u entries loaded from %s\n", count, lines->path);
+  return;
+
+stale:
+  TRACE(state, DEBUG_PARSE, 1, "lines: %s is not usable, starting empty\n", lines->path);
+  memset(lines->hash, 0, sizeof(lines->hash));
+  asm_free(state, lines->loaded);
+  asm_free(state, lines->image);
+  lines->loaded = NULL;
+  lines->image  = NULL;
+}
+
+/*****************************************************************************/
+/* Start using a line cache, ctx describes the options */
+
+int lines_open(struct asm_state_s *state, const char *path, const char *ctx)
+{
+  struct asm_lines_s *lines;
+
+  lines = asm_malloc(state, MEM_LINES, sizeof(struct asm_lines_s) + strlen(path) + strlen(ctx) + 2);
+  if (!lines)
+    {
+      return emit_message(state, ASM_ERROR, "malloc() failed");
+    }
+  memset(lines, 0, sizeof(struct asm_lines_s));
+  lines->path = (char*)&lines[1];
+  strcpy(lines->path, path);
+  lines->ctx = lines->path + strlen(path) + 1;
+  strcpy(lines->ctx, ctx);
+
+  state->lines = lines;
+  lines_load(state, lines);
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* Look for a line before parsing it. On a hit, its bytes are appended and
+ * ASM_OK is returned. Otherwise returns ASM_UNHANDLED, after remembering
+ * the line and the state for lines_record().
+ */
+
+int lines_lookup(struct asm_state_s *state, const char *text, int len)
+{
+  struct asm_lines_s   *lines = state->lines;
+  struct asm_section_s *sec = state->current_section;
+  struct lines_entry_s *e;
+  uint32_t hash = lines_hash(text, len, state->mode);
+  char *buf;
+
+  for (e = lines->hash[hash % CONFIG_ASM_LINES_HASH]; sec && e; e = e->next)
+    {
+      if (e->hash == hash && e->mode == state->mode && e->textlen == len && !memcmp(e->text, text, len))
+        {
+          e->used = 1;
+          lines->hits++;
+          if (e->len && chunk_append(state, &sec->data, (void*)e->data, e->len) != ASM_OK)
+            {
+              return ASM_ERROR;
+            }
+          return ASM_OK;
+        }
+    }
+  lines->misses++;
+
+  /* handlers may modify the line, keep it as it was */
+
+  if (len + 1 > lines->textsize)
+    {
+      buf = asm_malloc(state, MEM_LINES, len + 1);
+      if (!buf)
+        {
+          return emit_message(state, ASM_ERROR, "malloc() failed");
+        }
+      asm_free(state, lines->text);
+      lines->text     = buf;
+      lines->textsize = len + 1;
+    }
+  memcpy(lines->text, text, len);
+  lines->textlen   = len;
+  lines->texthash  = hash;
+  lines->sec       = sec;
+  lines->start     = sec ? section_size(sec) : 0;
+  lines->fixup     = sec ? sec->fixup : 0;
+  lines->mode      = state->mode;
+  lines->nwarnings = state->nwarnings;
+  state->linevolatile = 0;
+  return ASM_UNHANDLED;
+}
+
+/*****************************************************************************/
+/* Keep the bytes of a line parsed after a miss, if it can be replayed */
+
+void lines_record(struct asm_state_s *state)
+{
+  struct asm_lines_s   *lines = state->lines;
+  struct asm_section_s *sec = lines->sec;
+  struct lines_entry_s *e;
+  struct asm_chunk_s   *ch;
+  uint32_t skip;
+  uint32_t len;
+  uint32_t done;
+  uint32_t n;
+  uint8_t  *data;
+
+  if (state->linevolatile || !sec || state->current_section != sec || state->mode != lines->mode ||
+      state->nwarnings != lines->nwarnings || sec->fixup != lines->fixup)
+    {
+      return;
+    }
+  len = section_size(sec) - lines->start;
+
+  e = asm_malloc(state, MEM_LINES, sizeof(struct lines_entry_s) + lines->textlen + len);
+  if (!e)
+    {
+      return; /* only a cache */
+    }
+  data = (uint8_t*)&e[1] + lines->textlen;
+  memcpy(&e[1], lines->text, lines->textlen);
+
+  /* the new bytes are at the end of the chunks, spills happen after */
+
+  skip = lines->start - sec->spilled;
+  for (ch = sec->data.first, done = 0; ch && done < len; ch = ch->next)
+    {
+      if (skip >= ch->len)
+        {
+          skip -= ch->len;
+          continue;
+        }
+      n = ch->len - skip;
+      memcpy(data + done, ch->data + skip, n);
+      done += n;
+      skip  = 0;
+    }
+
+  e->hash    = lines->texthash;
+  e->mode    = lines->mode;
+  e->textlen = lines->textlen;
+  e->len     = len;
+  e->text    = (const char*)&e[1];
+  e->data    = data;
+  e->used    = 1;
+  e->alloc   = 1;
+  lines_insert(lines, e);
+}
+
+/*****************************************************************************/
+/* Write the entries used by this run to the sidecar, atomically */
+
+int lines_save(struct asm_state_s *state)
+{
+  struct asm_lines_s   *lines = state->lines;
+  struct lines_entry_s *e;
+  uint32_t version = LINES_VERSION;
+  uint32_t ctxlen = strlen(lines->ctx);
+  uint32_t count = 0;
+  char *tmp;
+  FILE *f;
+  int  i;
+  int  fd;
+  int  ret = ASM_ERROR;
+
+  TRACE(state, DEBUG_PARSE, 1, "lines: %u hits, %u misses\n", lines->hits, lines->misses);
+
+  for (i = 0; i < CONFIG_ASM_LINES_HASH; i++)
+    {
+      for (e = lines->hash[i]; e; e = e->next)
+        {
+          count += e->used;
+        }
+    }
+
+  tmp = malloc(strlen(lines->path) + 8);
+  if (!tmp)
+    {
+      return emit_message(state, ASM_ERROR, "malloc() failed");
+    }
+  sprintf(tmp, "%s.XXXXXX", lines->path);
+  fd = mkstemp(tmp);
+  if (fd >= 0)
+    {
+      fchmod(fd, 0644); /* mkstemp() makes it private */
+    }
+  f  = (fd < 0) ? NULL : fdopen(fd, "wb");
+  if (!f)
+    {
+      if (fd >= 0)
+        {
+          close(fd);
+          unlink(tmp);
+        }
+      emit_message(state, ASM_ERROR, "Cannot create '%s'", lines->path);
+      goto done;
+    }
+
+  fwrite(LINES_MAGIC, 1, 8, f);
+  fwrite(&version, sizeof(version), 1, f);
+  fwrite(&ctxlen, sizeof(ctxlen), 1, f);
+  fwrite(lines->ctx, 1, ctxlen, f);
+  fwrite(&count, sizeof(count), 1, f);
+  for (i = 0; i < CONFIG_ASM_LINES_HASH; i++)
+    {
+      for (e = lines->hash[i]; e; e = e->next)
+        {
+          if (e->used)
+            {
+              fwrite(&e->mode, sizeof(e->mode), 1, f);
+              fwrite(&e->textlen, sizeof(e->textlen), 1, f);
+              fwrite(&e->len, sizeof(e->len), 1, f);
+              fwrite(e->text, 1, e->textlen, f);
+              fwrite(e->data, 1, e->len, f);
+            }
+        }
+    }
+
+  if (ferror(f) | fclose(f) || rename(tmp, lines->path))
+    {
+      unlink(tmp);
+      emit_message(state, ASM_ERROR, "Cannot write '%s'", lines->path);
+      goto done;
+    }
+  ret = ASM_OK;
+
+done:
+  free(tmp);
+  return ret;
+}
+
+/*****************************************************************************/
+
+void lines_release(struct asm_state_s *state)
+{
+  struct asm_lines_s   *lines = state->lines;
+  struct lines_entry_s *e;
+  int i;
+
+  if (!lines)
+    {
+      return;
+    }
+  for (i = 0; i < CONFIG_ASM_LINES_HASH; i++)
+    {
+      while (lines->hash[i])
+        {
+          e = lines->hash[i];
+          lines->hash[i] = e->next;
+          if (e->alloc)
+            {
+              asm_free(state, e);
+            }
+        }
+    }
+  asm_free(state, lines->text);
+  asm_free(state, lines->loaded);
+  asm_free(state, lines->image);
+  asm_free(state, lines);
+  state->lines = NULL;
+}
+
+#endif /* CONFIG_ASM_LINES */
@@ -0,0 +1,848 @@
+/* link stage for tcasm
+ *
+ * Once all inputs are parsed, sections are given addresses, symbol
+ * references are patched and the result is written as a flat binary or as
+ * an ELF executable. Inputs already append to shared sections, so there is
+ * nothing to merge: the link stage only has to place and patch.
+ *
+ * Without a script, sections are placed one after the other from a base
+ * address: code, constants, data, custom sections, then bss. A script gives
+ * memory regions and which sections go where:
+ *
+ *   # comment
+ *   MEMORY  flash 0x08000000 0x20000
+ *   MEMORY  ram   0x20000000 0x5000
+ *   SECTION .data ram
+ *   SECTION .bss  ram
+ *   ENTRY   reset
+ *
+ * Sections that are not listed go to the first region, in the default order.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "tcasm.h"
+
+#if CONFIG_ASM_LINK
+
+/*****************************************************************************
+ * Definitions
+ *****************************************************************************/
+
+
+/* ELF32 constants */
+
+#define ELF_EHSIZE     52
+#define ELF_PHENTSIZE  32
+#define ELF_SHENTSIZE  40
+#define ELF_SYMENTSIZE 16
+
+#define PT_LOAD        1
+#define PF_X           1
+#define PF_W           2
+#define PF_R           4
+
+#define SHT_PROGBITS   1
+#define SHT_SYMTAB     2
+#define SHT_STRTAB     3
+#define SHT_NOBITS     8
+#define SHF_WRITE      1
+#define SHF_ALLOC      2
+#define SHF_EXECINSTR  4
+
+#define STB_LOCAL      0
+#define STB_GLOBAL     1
+
+/*****************************************************************************
+ * Types
+ *****************************************************************************/
+
+struct link_region_s
+{
+  char     name[CONFIG_ASM_SEC_NAME];
+  uint32_t origin;
+  uint32_t length;
+  uint32_t used;
+};
+
+struct link_layout_s
+{
+  struct link_region_s regions[CONFIG_ASM_LINK_REGIONS];
+  int      nregions;
+  int      region[CONFIG_ASM_SEC_MAX]; /* of each section, -1 if not listed */
+  struct asm_section_s *order[CONFIG_ASM_SEC_MAX]; /* sections by address */
+  int      nsections;
+  char     entry[CONFIG_ASM_INBUF_SIZE]; /* entry symbol, empty if none */
+};
+
+/* growable byte buffer, for the ELF string tables */
+
+struct link_buf_s
+{
+  uint8_t  *data;
+  uint32_t len;
+  uint32_t size;
+  int      failed;
+};
+
+/*****************************************************************************
+ * Functions
+ *****************************************************************************/
+
+static void link_put16(uint8_t *p, uint32_t v, int big)
+{
+  p[big ? 1 : 0] = v;
+  p[big ? 0 : 1] = v >> 8;
+}
+
+static void link_put32(uint8_t *p, uint32_t v, int big)
+{
+  int i;
+
+  for (i = 0; i < 4; i++)
+    {
+      p[big ? 3 - i : i] = v >> (8 * i);
+    }
+}
+
+static uint32_t link_align(uint32_t value, uint32_t align)
+{
+  return (value + align - 1) & ~(align - 1);
+}
+
+/*****************************************************************************/
+/* Alignment of a section: its largest .align, at least a word */
+
+static uint32_t link_secalign(const struct asm_state_s *state, const struct asm_section_s *sec)
+{
+  return (sec->align > state->infos.wordsize) ? sec->align : state->infos.wordsize;
+}
+
+/*****************************************************************************/
+/* Read the link script into the layout. The script is resolved like a main
+ * input, so that it is a dependency of the output.
+ */
+
+static int link_script(struct asm_state_s *state, char *name, struct link_layout_s *layout)
+{
+  struct asm_file_s *file;
+  struct link_region_s *reg;
+  char line[CONFIG_ASM_INBUF_SIZE];
+  char word[3][CONFIG_ASM_INBUF_SIZE];
+  char     *inputname = state->inputname;
+  long     origin;
+  long     length;
+  uint32_t pos = 0;
+  uint32_t len;
+  int nwords;
+  int ret = ASM_OK;
+  int i;
+  int j;
+
+  file = include_find(state, name, 0);
+  if (!file)
+    {
+      return ASM_ERROR;
+    }
+  if (!file->path || include_load(state, file) != ASM_OK)
+    {
+      return emit_message(state, ASM_ERROR, "Cannot read link script '%s'", name);
+    }
+
+  state->inputname = name;
+  state->curline   = 0;
+  while (ret == ASM_OK && pos < file->len)
+    {
+      for (len = 0; pos + len < file->len && file->data[pos + len] != '\n'; len++);
+      state->curline++;
+      if (len >= sizeof(line))
+        {
+          ret = emit_message(state, ASM_ERROR, "Line too long");
+          break;
+        }
+      memcpy(line, file->data + pos, len);
+      line[len] = 0;
+      pos += len + 1;
+
+      if (strchr(line, '#'))
+        {
+          *strchr(line, '#') = 0;
+        }
+      nwords = sscanf(line, "%s %s %s", word[0], word[1], word[2]);
+      if (nwords <= 0)
+        {
+          continue;
+        }
+
+      if (!strcmp(word[0], "MEMORY") && nwords == 3)
+        {
+          if (layout->nregions == CONFIG_ASM_LINK_REGIONS)
+            {
+              ret = emit_message(state, ASM_ERROR, "Too many memory regions");
+              break;
+            }
+          reg = &layout->regions[layout->nregions];
+          if (strlen(word[1]) >= CONFIG_ASM_SEC_NAME)
+            {
+              ret = emit_message(state, ASM_ERROR, "Invalid region name '%s'", word[1]);
+              break;
+            }
+          if (sscanf(line, "%*s %*s %li %li", &origin, &length) != 2)
+            {
+              ret = emit_message(state, ASM_ERROR, "MEMORY expects a name, an origin and a length");
+              break;
+            }
+          strcpy(reg->name, word[1]);
+          reg->origin = origin;
+          reg->length = length;
+          reg->used   = 0;
+          layout->nregions++;
+        }
+      else if (!strcmp(word[0], "SECTION") && nwords == 3)
+        {
+          for (j = 0; j < CONFIG_ASM_SEC_MAX && strcmp(state->sections[j].name, word[1]); j++);
+          for (i = 0; i < layout->nregions && strcmp(layout->regions[i].name, word[2]); i++);
+          if (i == layout->nregions)
+            {
+              ret = emit_message(state, ASM_ERROR, "Unknown memory region '%s'", word[2]);
+              break;
+            }
+          if (j < CONFIG_ASM_SEC_MAX)
+            {
+              layout->region[j] = i; /* sections the inputs do not use are ignored */
+            }
+        }
+      else if (!strcmp(word[0], "ENTRY") && nwords == 2)
+        {
+          strcpy(layout->entry, word[1]);
+        }
+      else
+        {
+          ret = emit_message(state, ASM_ERROR, "Invalid link script command '%s'", word[0]);
+        }
+    }
+
+  if (ret == ASM_OK && !layout->nregions)
+    {
+      ret = emit_message(state, ASM_ERROR, "Link script defines no memory region");
+    }
+  state->inputname = inputname;
+  state->curline   = 0;
+  return ret;
+}
+
+/*****************************************************************************/
+/* Give an address to each section */
+
+static int link_place(struct asm_state_s *state, const struct asm_link_s *link, struct link_layout_s *layout)
+{
+  static const int ids[] = { SECTION_TEXT, SECTION_RODATA, SECTION_DATA, SECTION_CUSTOM, SECTION_BSS };
+  uint32_t align;
+  uint32_t cursor = link->base;
+  struct link_region_s *reg;
+  struct asm_section_s *sec;
+  uint32_t size;
+  unsigned int i;
+  int j;
+  int k;
+
+  for (i = 0; i < sizeof(ids) / sizeof(ids[0]); i++)
+    {
+      for (j = 0; j < CONFIG_ASM_SEC_MAX; j++)
+        {
+          sec = &state->sections[j];
+          if (!sec->name[0] || sec->id != ids[i])
+            {
+              continue;
+            }
+          size  = section_size(sec);
+          align = link_secalign(state, sec);
+          if (!layout->nregions)
+            {
+              sec->address = link_align(cursor, align);
+              cursor = sec->address + size;
+            }
+          else
+            {
+              reg = &layout->regions[layout->region[j] < 0 ? 0 : layout->region[j]];
+              sec->address = link_align(reg->origin + reg->used, align);
+              reg->used    = sec->address - reg->origin + size;
+              if (reg->used > reg->length)
+                {
+                  return emit_message(state, ASM_ERROR, "Section %s overflows region %s by %u bytes",
+                                      sec->name, reg->name, reg->used - reg->length);
+                }
+            }
+          TRACE(state, DEBUG_SECTION, 1, "section '%s' at 0x%08X, %u bytes\n", sec->name, sec->address, size);
+
+          /* insertion by address, the default order breaks ties */
+
+          for (k = layout->nsections; k > 0 && layout->order[k - 1]->address > sec->address; k--)
+            {
+              layout->order[k] = layout->order[k - 1];
+            }
+          layout->order[k] = sec;
+          layout->nsections++;
+        }
+    }
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* Patch every symbol reference */
+
+static int link_relocate(struct asm_state_s *state)
+{
+  const struct asm_backend_s *backend = state->current_backend;
+  int big = (state->infos.endianess == ASM_ENDIAN_BIG);
+  struct asm_symbol_s *sym;
+  struct asm_symbol_s *other;
+  struct asm_section_s *sec;
+  struct asm_reloc_s *reloc;
+  uint8_t  buf[ASM_RELOC_MAX];
+  uint32_t value;
+  uint32_t pc;
+  int      size;
+  int      ret = ASM_OK;
+  int      i;
+
+  /* a global symbol must have a single definition */
+
+  for (i = 0; i < CONFIG_ASM_SYM_HASH; i++)
+    {
+      for (sym = state->symbols[i]; sym; sym = sym->next)
+        {
+          if (!sym->global || !sym->section)
+            {
+              continue;
+            }
+          for (other = sym->next; other; other = other->next)
+            {
+              if (other->global && other->section && !strcmp(other->name, sym->name))
+                {
+                  ret = emit_message(state, ASM_ERROR, "Symbol '%s' is defined in several inputs", sym->name);
+                }
+            }
+        }
+    }
+
+  for (i = 0; i < CONFIG_ASM_SEC_MAX; i++)
+    {
+      sec = &state->sections[i];
+      for (reloc = sec->relocs; reloc; reloc = reloc->next)
+        {
+          sym = symbol_resolve(state, reloc->symbolname, reloc->unit);
+          if (!sym)
+            {
+              ret = emit_message(state, ASM_ERROR, "Undefined symbol '%s' referenced at %s+0x%X",
+                                 reloc->symbolname, sec->name, reloc->offset);
+              continue;
+            }
+          value = sym->section->address + sym->value + reloc->addend;
+          pc    = sec->address + reloc->offset;
+
+          if (reloc->type >= ASM_RELOC_BACKEND)
+            {
+              /* a short instruction may end the section */
+              size = section_size(sec) - reloc->offset;
+              size = (size > ASM_RELOC_MAX) ? ASM_RELOC_MAX : size;
+              if (reloc->offset >= section_size(sec) || section_bytes(sec, reloc->offset, buf, size, 0))
+                {
+                  return emit_message(state, ASM_ERROR, "Relocation outside of section %s", sec->name);
+                }
+              switch (backend->relocate(backend, state, reloc, sym, value, pc, buf))
+                {
+                case ASM_OK:
+                  section_bytes(sec, reloc->offset, buf, size, 1);
+                  break;
+                case ASM_UNHANDLED:
+                  ret = emit_message(state, ASM_ERROR, "Unknown relocation type 0x%X", reloc->type);
+                  break;
+                default:
+                  ret = ASM_ERROR;
+                  break;
+                }
+              continue;
+            }
+
+          /* absolute values, the value must fit signed or unsigned */
+
+          size = (reloc->type == ASM_RELOC_ABS8) ? 1 : (reloc->type == ASM_RELOC_ABS16) ? 2 : 4;
+          if (size < 4 && value >= (1u << (size * 8)) && value < (uint32_t)-(1 << (size * 8 - 1)))
+            {
+              ret = emit_message(state, ASM_ERROR, "Value of '%s' (0x%X) does not fit in %d bytes",
+                                 reloc->symbolname, value, size);
+              continue;
+            }
+          if (size == 1)
+            {
+              buf[0] = value;
+            }
+          else if (size == 2)
+            {
+              link_put16(buf, value, big);
+            }
+          else
+            {
+              link_put32(buf, value, big);
+            }
+          if (section_bytes(sec, reloc->offset, buf, size, 1))
+            {
+              return emit_message(state, ASM_ERROR, "Relocation outside of section %s", sec->name);
+            }
+        }
+    }
+  return ret;
+}
+
+/*****************************************************************************/
+/* Write the contents of a section, spilled part first */
+
+static int link_write_section(struct asm_state_s *state, struct asm_section_s *sec, FILE *out)
+{
+  struct asm_chunk_s *chunk;
+  uint8_t buf[CONFIG_ASM_CHUNK];
+  size_t  len;
+  uint32_t done = 0;
+
+  if (sec->spill)
+    {
+      rewind(sec->spill);
+      while ((len = fread(buf, 1, sizeof(buf), sec->spill)) > 0)
+        {
+          fwrite(buf, 1, len, out);
+          done += len;
+        }
+      if (ferror(sec->spill) || done != sec->spilled)
+        {
+          return emit_message(state, ASM_ERROR, "Cannot read spill file of section %s", sec->name);
+        }
+      fseek(sec->spill, 0, SEEK_END);
+    }
+  for (chunk = sec->data.first; chunk; chunk = chunk->next)
+    {
+      fwrite(chunk->data, 1, chunk->len, out);
+    }
+  return ASM_OK;
+}
+
+static void link_zeros(FILE *out, uint32_t len)
+{
+  while (len--)
+    {
+      fputc(0, out);
+    }
+}
+
+/*****************************************************************************/
+/* Flat binary: memory image from the lowest to the highest loaded address */
+
+static int link_binary(struct asm_state_s *state, struct link_layout_s *layout, FILE *out)
+{
+  struct asm_section_s *sec;
+  struct asm_section_s *prev = NULL;
+  uint32_t pos = 0;
+  int i;
+
+  for (i = 0; i < layout->nsections; i++)
+    {
+      sec = layout->order[i];
+      if (sec->id == SECTION_BSS || !section_size(sec))
+        {
+          continue;
+        }
+      if (prev && sec->address < pos)
+        {
+          return emit_message(state, ASM_ERROR, "Sections %s and %s overlap", prev->name, sec->name);
+        }
+      if (prev)
+        {
+          link_zeros(out, sec->address - pos);
+        }
+      if (link_write_section(state, sec, out) != ASM_OK)
+        {
+          return ASM_ERROR;
+        }
+      pos  = sec->address + section_size(sec);
+      prev = sec;
+    }
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* Append to a growable buffer, returns the offset of the data */
+
+static uint32_t link_append(struct asm_state_s *state, struct link_buf_s *buf, const void *data, uint32_t len)
+{
+  uint32_t pos = buf->len;
+  uint8_t *grown;
+
+  if (buf->len + len > buf->size)
+    {
+      buf->size = 2 * (buf->len + len);
+      grown = asm_malloc(state, MEM_SYMBOL, buf->size);
+      if (!grown)
+        {
+          buf->failed = 1;
+          return 0;
+        }
+      if (buf->data)
+        {
+          memcpy(grown, buf->data, buf->len);
+          asm_free(state, buf->data);
+        }
+      buf->data = grown;
+    }
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+  return pos;
+}
+
+static uint32_t link_string(struct asm_state_s *state, struct link_buf_s *buf, const char *str)
+{
+  return link_append(state, buf, str, strlen(str) + 1);
+}
+
+/*****************************************************************************/
+/* Symbol table, locals first as ELF requires. Returns the index of the first
+ * global symbol.
+ */
+
+static uint32_t link_symbols(struct asm_state_s *state, struct link_buf_s *symtab, struct link_buf_s *strtab,
+                             const uint16_t *shndx)
+{
+  int big = (state->infos.endianess == ASM_ENDIAN_BIG);
+  struct asm_symbol_s *sym;
+  uint8_t  ent[ELF_SYMENTSIZE];
+  uint32_t firstglobal = 1;
+  int      bind;
+  int      i;
+
+  memset(ent, 0, sizeof(ent));
+  link_append(state, symtab, ent, sizeof(ent)); /* null symbol */
+  link_string(state, strtab, "");
+
+  for (bind = STB_LOCAL; bind <= STB_GLOBAL; bind++)
+    {
+      if (bind == STB_GLOBAL)
+        {
+          firstglobal = symtab->len / ELF_SYMENTSIZE;
+        }
+      for (i = 0; i < CONFIG_ASM_SYM_HASH; i++)
+        {
+          for (sym = state->symbols[i]; sym; sym = sym->next)
+            {
+              if (!sym->section || sym->global != bind)
+                {
+                  continue;
+                }
+              link_put32(ent + 0, link_string(state, strtab, sym->name), big);
+              link_put32(ent + 4, sym->section->address + sym->value, big);
+              link_put32(ent + 8, 0, big);
+              ent[12] = bind << 4; /* STT_NOTYPE */
+              ent[13] = 0;
+              link_put16(ent + 14, shndx[sym->section - state->sections], big);
+              link_append(state, symtab, ent, sizeof(ent));
+            }
+        }
+    }
+  return firstglobal;
+}
+
+/*****************************************************************************/
+
+static void link_shdr(uint8_t *p, int big, uint32_t name, uint32_t type, uint32_t flags, uint32_t addr,
+                      uint32_t offset, uint32_t size, uint32_t link, uint32_t info, uint32_t align, uint32_t entsize)
+{
+  link_put32(p +  0, name, big);
+  link_put32(p +  4, type, big);
+  link_put32(p +  8, flags, big);
+  link_put32(p + 12, addr, big);
+  link_put32(p + 16, offset, big);
+  link_put32(p + 20, size, big);
+  link_put32(p + 24, link, big);
+  link_put32(p + 28, info, big);
+  link_put32(p + 32, align, big);
+  link_put32(p + 36, entsize, big);
+}
+
+/*****************************************************************************/
+/* ELF32 executable: one loadable segment per section, with section headers
+ * and a symbol table for debuggers and objdump.
+ */
+
+static int link_elf(struct asm_state_s *state, struct link_layout_s *layout, FILE *out)
+{
+  int big = (state->infos.endianess == ASM_ENDIAN_BIG);
+  struct link_buf_s symtab = { NULL, 0, 0, 0 };
+  struct link_buf_s strtab = { NULL, 0, 0, 0 };
+  struct link_buf_s shstrtab = { NULL, 0, 0, 0 };
+  uint16_t shndx[CONFIG_ASM_SEC_MAX];
+  uint32_t names[CONFIG_ASM_SEC_MAX];
+  uint32_t tabnames[3];
+  uint32_t offsets[CONFIG_ASM_SEC_MAX];
+  uint8_t  hdr[ELF_EHSIZE];
+  uint8_t  ent[ELF_SHENTSIZE];
+  struct asm_symbol_s *sym;
+  struct asm_section_s *sec;
+  uint32_t firstglobal;
+  uint32_t symoff;
+  uint32_t stroff;
+  uint32_t shstroff;
+  uint32_t shoff;
+  uint32_t pos;
+  uint32_t entry;
+  uint32_t flags;
+  uint32_t size;
+  uint32_t shnum = layout->nsections + 4; /* null, sections, symtab, strtab, shstrtab */
+  uint32_t nsym;
+  int ret = ASM_OK;
+  int i;
+
+  if (state->infos.wordsize != 4)
+    {
+      return emit_message(state, ASM_ERROR, "ELF output needs a 32-bit backend");
+    }
+
+  /* section headers are in address order, after the null one */
+
+  link_string(state, &shstrtab, "");
+  for (i = 0; i < layout->nsections; i++)
+    {
+      sec = layout->order[i];
+      shndx[sec - state->sections] = i + 1;
+      names[i] = link_string(state, &shstrtab, sec->name);
+    }
+  firstglobal = link_symbols(state, &symtab, &strtab, shndx);
+  nsym = symtab.len / ELF_SYMENTSIZE;
+  tabnames[0] = link_string(state, &shstrtab, ".symtab");
+  tabnames[1] = link_string(state, &shstrtab, ".strtab");
+  tabnames[2] = link_string(state, &shstrtab, ".shstrtab");
+  if (symtab.failed || strtab.failed || shstrtab.failed)
+    {
+      ret = emit_message(state, ASM_ERROR, "malloc() failed");
+      goto done;
+    }
+
+  /* file layout: headers, contents, tables, section headers */
+
+  pos = ELF_EHSIZE + layout->nsections * ELF_PHENTSIZE;
+  for (i = 0; i < layout->nsections; i++)
+    {
+      sec = layout->order[i];
+      pos = link_align(pos, link_secalign(state, sec));
+      offsets[i] = pos;
+      if (sec->id != SECTION_BSS)
+        {
+          pos += section_size(sec);
+        }
+    }
+  symoff   = link_align(pos, 4);
+  stroff   = symoff + symtab.len;
+  shstroff = stroff + strtab.len;
+  shoff    = link_align(shstroff + shstrtab.len, 4);
+
+  /* entry point: ENTRY of the script, _start, or the start of .text */
+
+  sym = symbol_resolve(state, layout->entry[0] ? layout->entry : "_start", -1);
+  if (sym)
+    {
+      entry = sym->section->address + sym->value;
+    }
+  else if (layout->entry[0])
+    {
+      ret = emit_message(state, ASM_ERROR, "Entry symbol '%s' is not a global symbol", layout->entry);
+      goto done;
+    }
+  else
+    {
+      entry = layout->nsections ? layout->order[0]->address : 0;
+      for (i = 0; i < layout->nsections; i++)
+        {
+          if (layout->order[i]->id == SECTION_TEXT)
+            {
+              entry = layout->order[i]->address;
+            }
+        }
+    }
+
+  memset(hdr, 0, sizeof(hdr));
+  memcpy(hdr, "\177ELF", 4);
+  hdr[4] = 1;                      /* ELFCLASS32 */
+  hdr[5] = big ? 2 : 1;            /* ELFDATA2MSB or ELFDATA2LSB */
+  hdr[6] = 1;                      /* EV_CURRENT */
+  link_put16(hdr + 16, 2, big);    /* ET_EXEC */
+  link_put16(hdr + 18, state->infos.elf_machine, big);
+  link_put32(hdr + 20, 1, big);
+  link_put32(hdr + 24, entry, big);
+  link_put32(hdr + 28, layout->nsections ? ELF_EHSIZE : 0, big);
+  link_put32(hdr + 32, shoff, big);
+  link_put32(hdr + 36, state->infos.elf_flags, big);
+  link_put16(hdr + 40, ELF_EHSIZE, big);
+  link_put16(hdr + 42, ELF_PHENTSIZE, big);
+  link_put16(hdr + 44, layout->nsections, big);
+  link_put16(hdr + 46, ELF_SHENTSIZE, big);
+  link_put16(hdr + 48, shnum, big);
+  link_put16(hdr + 50, shnum - 1, big);
+  fwrite(hdr, 1, ELF_EHSIZE, out);
+
+  /* program headers */
+
+  for (i = 0; i < layout->nsections; i++)
+    {
+      sec   = layout->order[i];
+      size  = section_size(sec);
+      flags = (sec->id == SECTION_TEXT) ? PF_R | PF_X :
+              (sec->id == SECTION_RODATA) ? PF_R :
+              (sec->id == SECTION_CUSTOM) ? PF_R | PF_W | PF_X : PF_R | PF_W;
+      link_put32(ent +  0, PT_LOAD, big);
+      link_put32(ent +  4, offsets[i], big);
+      link_put32(ent +  8, sec->address, big);
+      link_put32(ent + 12, sec->address, big);
+      link_put32(ent + 16, (sec->id == SECTION_BSS) ? 0 : size, big);
+      link_put32(ent + 20, size, big);
+      link_put32(ent + 24, flags, big);
+      link_put32(ent + 28, link_secalign(state, sec), big);
+      fwrite(ent, 1, ELF_PHENTSIZE, out);
+    }
+
+  /* contents */
+
+  pos = ELF_EHSIZE + layout->nsections * ELF_PHENTSIZE;
+  for (i = 0; i < layout->nsections; i++)
+    {
+      sec = layout->order[i];
+      if (sec->id == SECTION_BSS)
+        {
+          continue;
+        }
+      link_zeros(out, offsets[i] - pos);
+      if (link_write_section(state, sec, out) != ASM_OK)
+        {
+          ret = ASM_ERROR;
+          goto done;
+        }
+      pos = offsets[i] + section_size(sec);
+    }
+  link_zeros(out, symoff - pos);
+  fwrite(symtab.data, 1, symtab.len, out);
+  fwrite(strtab.data, 1, strtab.len, out);
+  fwrite(shstrtab.data, 1, shstrtab.len, out);
+  link_zeros(out, shoff - shstroff - shstrtab.len);
+
+  /* section headers */
+
+  memset(ent, 0, sizeof(ent));
+  fwrite(ent, 1, ELF_SHENTSIZE, out);
+  for (i = 0; i < layout->nsections; i++)
+    {
+      sec   = layout->order[i];
+      flags = (sec->id == SECTION_TEXT) ? SHF_ALLOC | SHF_EXECINSTR :
+              (sec->id == SECTION_RODATA) ? SHF_ALLOC :
+              (sec->id == SECTION_CUSTOM) ? SHF_ALLOC | SHF_WRITE | SHF_EXECINSTR : SHF_ALLOC | SHF_WRITE;
+      link_shdr(ent, big, names[i], (sec->id == SECTION_BSS) ? SHT_NOBITS : SHT_PROGBITS, flags,
+                sec->address, offsets[i], section_size(sec), 0, 0, link_secalign(state, sec), 0);
+      fwrite(ent, 1, ELF_SHENTSIZE, out);
+    }
+  link_shdr(ent, big, tabnames[0], SHT_SYMTAB, 0, 0, symoff, symtab.len, shnum - 2, firstglobal, 4, ELF_SYMENTSIZE);
+  fwrite(ent, 1, ELF_SHENTSIZE, out);
+  link_shdr(ent, big, tabnames[1], SHT_STRTAB, 0, 0, stroff, strtab.len, 0, 0, 1, 0);
+  fwrite(ent, 1, ELF_SHENTSIZE, out);
+  link_shdr(ent, big, tabnames[2], SHT_STRTAB, 0, 0, shstroff, shstrtab.len, 0, 0, 1, 0);
+  fwrite(ent, 1, ELF_SHENTSIZE, out);
+  TRACE(state, DEBUG_SECTION, 1, "elf: %d sections, %u symbols, entry 0x%08X\n", layout->nsections, nsym, entry);
+
+done:
+  asm_free(state, symtab.data);
+  asm_free(state, strtab.data);
+  asm_free(state, shstrtab.data);
+  return ret;
+}
+
+/*****************************************************************************/
+/* Link everything that was parsed into state->outputname */
+
+int link_output(struct asm_state_s *state, const struct asm_link_s *link)
+{
+  struct link_layout_s *layout;
+  FILE *out = NULL;
+  int  fd;
+  int  ret;
+  int  i;
+
+  layout = asm_malloc(state, MEM_SYMBOL, sizeof(struct link_layout_s));
+  if (!layout)
+    {
+      return emit_message(state, ASM_ERROR, "malloc() failed");
+    }
+  memset(layout, 0, sizeof(struct link_layout_s));
+  for (i = 0; i < CONFIG_ASM_SEC_MAX; i++)
+    {
+      layout->region[i] = -1;
+    }
+
+  /* messages are not about the last input anymore */
+
+  state->inputname = NULL;
+  ret = ASM_OK;
+  if (link->script)
+    {
+      ret = link_script(state, link->script, layout);
+    }
+  if (ret == ASM_OK)
+    {
+      ret = link_place(state, link, layout);
+    }
+  if (ret == ASM_OK)
+    {
+      ret = link_relocate(state);
+    }
+  if (ret != ASM_OK)
+    {
+      goto done;
+    }
+
+  /* executables get the execute permission, within the umask */
+
+  fd = open(state->outputname, O_WRONLY | O_CREAT | O_TRUNC, (link->format == LINK_ELF) ? 0777 : 0666);
+  out = (fd < 0) ? NULL : fdopen(fd, "wb");
+  if (!out)
+    {
+      if (fd >= 0)
+        {
+          close(fd);
+        }
+      ret = emit_message(state, ASM_ERROR, "Cannot create '%s'", state->outputname);
+      goto done;
+    }
+  if (link->format == LINK_ELF)
+    {
+      ret = link_elf(state, layout, out);
+    }
+  else
+    {
+      ret = link_binary(state, layout, out);
+    }
+  fd = ferror(out);
+  if ((fclose(out) || fd) && ret == ASM_OK)
+    {
+      ret = emit_message(state, ASM_ERROR, "Cannot write '%s'", state->outputname);
+    }
+  if (ret != ASM_OK)
+    {
+      unlink(state->outputname);
+    }
+
+done:
+  asm_free(state, layout);
+  return ret;
+}
+
+#endif /* CONFIG_ASM_LINK */
@@ -10,9 +10,10 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <stdarg.h>
 #include <string.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
 
 #include "tcasm.h"
 
@@ -24,168 +25,824 @@
  * Types
  *****************************************************************************/
 
+/* command line options that are applied to each state in batch mode */
+
+struct batch_s
+{
+  struct asm_state_s *opts;  /* state with the command line options */
+  char **files;              /* input files */
+  int  nfiles;
+  char **defines;            /* -D arguments */
+  int  ndefines;
+  char **moptions;           /* -m arguments */
+  int  nmoptions;
+  uint32_t membudget;        /* --mem-budget, 0 if none */
+  int  memreport;            /* TRUE for --mem-report */
+  char *cachedir;            /* --cache-dir, NULL if none */
+  uint64_t cachesize;        /* --cache-size */
+  FILE *out;                 /* where the output and help go */
+  FILE *err;                 /* where command line errors go */
+  int  depend;               /* TRUE for -MD */
+  int  depphony;             /* TRUE for -MP */
+  char *depfile;             /* -MF, NULL for the output name with .d */
+  char *deptarget;           /* -MT, NULL for the output name */
+  char *emitpch;             /* --emit-pch, NULL if none */
+  char *usepch;              /* --use-pch, NULL if none */
+  char *lines;               /* --incremental, NULL if none */
+  struct asm_link_s link;    /* --link, --base, -T */
+  char cycles[32];           /* --cycles, as the backend option cycles=<core> */
+  int  report;               /* TRUE if the backend writes a report */
+};
+
 /*****************************************************************************
  * Variables
  *****************************************************************************/
 
-/* these definitions depend on the presence of backends */
+/* long options, values above the single letter options */
 
+enum
+{
+  OPT_BATCH = 0x100,
+  OPT_SPILL,
+  OPT_CACHE_DIR,
+  OPT_CACHE_SIZE,
+  OPT_MEM_BUDGET,
+  OPT_MEM_WARN,
+  OPT_MEM_REPORT,
+  OPT_EMIT_PCH,
+  OPT_USE_PCH,
+  OPT_INCREMENTAL,
+  OPT_LINK,
+  OPT_BASE,
+  OPT_CYCLES,
+  OPT_STACK_USAGE
+};
 
-#ifdef CONFIG_ASM_TARGET_ARM
-extern struct asm_backend_s arm_backend;
-#endif
+/* backend option of --stack-usage, kept in batch->moptions */
 
-/* preprocessor cannot use sizeof. so use an enum instead */
-enum asm_backend_counter_e
+static char stack_option[] = "stack";
+
+static const struct option long_options[] =
 {
-#ifdef CONFIG_ASM_TARGET_ARM
-  arm_backend_index,
+  { "batch",      no_argument,       NULL, OPT_BATCH      },
+  { "spill",      no_argument,       NULL, OPT_SPILL      },
+#if CONFIG_ASM_CACHE
+  { "cache-dir",  required_argument, NULL, OPT_CACHE_DIR  },
+  { "cache-size", required_argument, NULL, OPT_CACHE_SIZE },
+#endif
+#if CONFIG_ASM_MEMBUDGET
+  { "mem-budget", required_argument, NULL, OPT_MEM_BUDGET },
+  { "mem-warn",   required_argument, NULL, OPT_MEM_WARN   },
+  { "mem-report", no_argument,       NULL, OPT_MEM_REPORT },
+#endif
+#if CONFIG_ASM_PCH
+  { "emit-pch",   required_argument, NULL, OPT_EMIT_PCH   },
+  { "use-pch",    required_argument, NULL, OPT_USE_PCH    },
+#endif
+#if CONFIG_ASM_LINES
+  { "incremental", required_argument, NULL, OPT_INCREMENTAL },
 #endif
-  ASM_BACKEND_COUNT
+#if CONFIG_ASM_LINK
+  { "link",       required_argument, NULL, OPT_LINK       },
+  { "base",       required_argument, NULL, OPT_BASE       },
+#endif
+  { "cycles",     required_argument, NULL, OPT_CYCLES     },
+  { "stack-usage", no_argument,      NULL, OPT_STACK_USAGE },
+  { NULL,         0,                 NULL, 0              }
 };
 
-static struct asm_backend_s * backends[] = 
+/* trace categories for -d */
+
+static const struct
 {
-#ifdef CONFIG_ASM_TARGET_ARM
-  &arm_backend,
-#endif
+  const char *name;
+  uint32_t   mask;
+} debugcats[] =
+{
+  { "chunk",   DEBUG_CHUNK   },
+  { "dir",     DEBUG_DIR     },
+  { "inc",     DEBUG_INC     },
+  { "pp",      DEBUG_PP      },
+  { "parse",   DEBUG_PARSE   },
+  { "section", DEBUG_SECTION },
+  { "arm",     DEBUG_ARM     },
+  { "cache",   DEBUG_CACHE   },
+  { "all",     DEBUG_ALL     },
 };
 
-static struct asm_state_s state;
-
 /*****************************************************************************
  * Functions
  *****************************************************************************/
 
-void usage(void)
+void usage(FILE *out)
 {
-  printf("Tiny Compact Assembler\n"
+  fprintf(out, "Tiny Compact Assembler\n"
          "tcasm [options] infile [infile...]\n"
          "  -I <path> Add dir to include path\n"
+         "  -P preprocess all input files (default: only .S files)\n"
+#if CONFIG_ASM_PIPELINE
+         "  -p read and tokenize input files in separate threads\n"
+#endif
+         "  -D <name>[=<value>] define a preprocessor macro\n"
          "  -o <outfile> (default: <infile>.s, or a.out if multiple infiles)\n"
-         "  -v version info\n");
-  if(ASM_BACKEND_COUNT > 1)
-    printf(
+         "  -MD write a make dependency file of the included files\n"
+         "  -MF <file> dependency file name (default: <outfile>.d)\n"
+         "  -MT <target> target of the dependency rule (default: <outfile>)\n"
+         "  -MP add an empty rule for each included file\n"
+         "  -d <cat>[,<cat>...][:<level>] enable traces, cat is one of\n"
+         "     chunk dir inc pp parse section arm cache all\n"
+         "  -v version info\n"
+         "  --batch assemble each infile separately, infile.s -> infile.o,\n"
+         "     in parallel\n"
+         "  --spill keep finished section contents in temporary files\n"
+         "     instead of memory\n"
+         "  --cycles=<core> estimate the cycles of each block and label,\n"
+         "     core is cortex-m0, cortex-m3 or cortex-m4\n"
+         "  --stack-usage report the stack used by each function and its calls\n");
+#if CONFIG_ASM_PCH
+  fprintf(out, "  --emit-pch=<file> save the macros and sections defined by the infiles\n"
+         "     to file instead of assembling\n"
+         "  --use-pch=<file> start from the state saved in file\n");
+#endif
+#if CONFIG_ASM_LINES
+  fprintf(out, "  --incremental=<file> keep the bytes of each line in file, and only\n"
+         "     assemble the lines that are not there\n");
+#endif
+#if CONFIG_ASM_LINK
+  fprintf(out, "  --link=bin|elf resolve symbols and write a flat binary or an ELF\n"
+         "     executable (default: section dump)\n"
+         "  --base=<addr> address of the first section (default: 0)\n"
+         "  -T <script> place sections in the memory regions of script\n");
+#endif
+#if CONFIG_ASM_CACHE
+  fprintf(out, "  --cache-dir=<dir> reuse outputs of identical assemblies stored in dir\n"
+         "     (default: $TCASM_CACHE_DIR, no cache if unset)\n"
+         "  --cache-size=<bytes> cache size limit (default: %u)\n",
+         (unsigned)CONFIG_ASM_CACHE_SIZE);
+#endif
+#if CONFIG_ASM_MEMBUDGET
+  fprintf(out, "  --mem-budget=<bytes> make all allocations in a region of this size\n"
+         "  --mem-warn=<pct>[,<pct>...] warn when memory use reaches these\n"
+         "     percentages of the budget (default: %d)\n"
+         "  --mem-report show peak memory use per subsystem at the end\n",
+         CONFIG_ASM_MEM_WARN);
+#endif
+  if(backend_get(1))
+    fprintf(out,
          "  -b <target> select backend\n"
          "  -m backend options (must appear after -b)\n");
   else
-    printf(
+    fprintf(out,
          "  -m backend options\n");
+#if CONFIG_ASM_SERVER
+  fprintf(out, "tcasm --server <socket>\n"
+         "  serve command lines from clients on a local socket\n"
+         "tcasm --client <socket> [options] infile [infile...]\n"
+         "  run a command line in a server\n");
+#endif
 }
 
 /*****************************************************************************/
 
-void version(void)
+void version(FILE *out)
 {
   int i;
   struct asm_backend_infos_s infos;
-  printf("tcasm version " CONFIG_ASM_VERSION "\n" );
-  printf("Configured backends:");
-  for (i=0; i<ASM_BACKEND_COUNT; i++)
+  fprintf(out, "tcasm version " CONFIG_ASM_VERSION "\n" );
+  fprintf(out, "Configured backends:");
+  for (i=0; backend_get(i); i++)
     {
-      backends[i]->getinfos(&infos);
-      printf(" %s", infos.name);
+      backend_get(i)->getinfos(&infos);
+      fprintf(out, " %s", infos.name);
     }
-  printf("\n");
+  fprintf(out, "\n");
 }
 
 /*****************************************************************************/
+/* Print messages to a FILE given as arg, like emit_message() on stderr */
 
-static const char * msgtypes[] = 
+static void diag_print(void *arg, const char *file, int line, int type, const char *msg)
 {
-  "message",
-  "warning",
-  "error",
-};
+  static const char * const msgtypes[] = { "message", "warning", "error" };
+  FILE *err = arg;
+
+  flockfile(err);
+  if (file)
+    {
+      fprintf(err, "%s:%d: ", file, line);
+    }
+  else
+    {
+      fprintf(err, "tcasm: ");
+    }
+  fprintf(err, "%s: %s\n", msgtypes[type], msg);
+  funlockfile(err);
+}
 
-int emit_message(struct asm_state_s *asmstate, int type, const char *msg, ...)
+/*****************************************************************************/
+
+/* parse a -d option: cat[,cat...][:level] */
+
+static int debug_option(struct asm_state_s *asmstate, char *arg, FILE *err)
 {
-  va_list ap;
-  if (type > ASM_ERROR)
+  char *level = strchr(arg, ':');
+  char *save;
+  char *cat;
+  int  i;
+
+  if (level)
     {
-    type = 0;
+      *level++ = 0;
+      asmstate->debuglevel = atoi(level);
+    }
+  else if (!asmstate->debuglevel)
+    {
+      asmstate->debuglevel = 1;
+    }
+
+  for (cat = strtok_r(arg, ",", &save); cat; cat = strtok_r(NULL, ",", &save))
+    {
+      for (i = 0; i < sizeof(debugcats) / sizeof(debugcats[0]); i++)
+        {
+          if (!strcmp(cat, debugcats[i].name))
+            {
+              break;
+            }
+        }
+      if (i == sizeof(debugcats) / sizeof(debugcats[0]))
+        {
+          fprintf(err, "Unknown trace category %s\n", cat);
+          return 1;
+        }
+      if ((debugcats[i].mask & CONFIG_ASM_DEBUG) != debugcats[i].mask)
+        {
+          fprintf(err, "Warning: traces for %s are not compiled in\n", cat);
+        }
+      asmstate->debug |= debugcats[i].mask;
     }
-  va_start(ap, msg);
-  fprintf(stderr, "%s:%d: %s: ",asmstate->inputname, asmstate->curline, msgtypes[type]);
-  vfprintf(stderr, msg, ap);
-  fprintf(stderr, "\n");
-  va_end(ap);
-  return type;
+  return 0;
 }
 
 /*****************************************************************************/
 
-void init(struct asm_state_s *asmstate)
+#if CONFIG_ASM_MEMBUDGET
+/* parse a --mem-warn option: pct[,pct...] */
+
+static int memwarn_option(struct asm_state_s *asmstate, char *arg, FILE *err)
 {
-  int i;
-  asmstate->outputname = NULL;
-  asmstate->current_section = NULL;
-  asmstate->current_backend = NULL;
-  for (i = 0; i<CONFIG_ASM_SEC_MAX; i++)
+  char *save;
+  char *pct;
+  int  i = 0;
+
+  memset(asmstate->mem.marks, 0, sizeof(asmstate->mem.marks));
+  for (pct = strtok_r(arg, ",", &save); pct; pct = strtok_r(NULL, ",", &save))
     {
-      asmstate->sections[i].id = SECTION_NONE;
+      if (i == CONFIG_ASM_MEM_MARKS || atoi(pct) < 1 || atoi(pct) > 100)
+        {
+          fprintf(err, "Invalid memory mark %s\n", pct);
+          return 1;
+        }
+      asmstate->mem.marks[i++] = atoi(pct);
     }
-  for (i = 0; i < CONFIG_ASM_INC_COUNT; i++)
+  return 0;
+}
+
+/*****************************************************************************/
+/* Give a state a region of budget bytes, the state included. Returns the
+ * region to free, or NULL on error.
+ */
+
+static void *membudget_setup(struct asm_state_s *asmstate, uint32_t budget, FILE *err)
+{
+  void *region;
+
+  if (budget <= sizeof(struct asm_state_s))
+    {
+      fprintf(err, "Memory budget too small, the state needs %u bytes\n",
+              (unsigned)sizeof(struct asm_state_s));
+      return NULL;
+    }
+  budget -= sizeof(struct asm_state_s);
+  region  = malloc(budget);
+  if (region && mem_budget(asmstate, region, budget) != ASM_OK)
     {
-      asmstate->includes[i]=NULL;
+      fprintf(err, "Memory budget too small\n");
+      free(region);
+      region = NULL;
     }
+  return region;
 }
+#endif
 
 /*****************************************************************************/
 
-int main(int argc, char **argv)
+/* Derive an output file name from an input file name: foo.s -> foo.o */
+
+static char *output_name(const char *inputname)
 {
-  int option;
-  int index;
-  char *asm_options;
-  int ret = 0;
+  const char *dot = strrchr(inputname, '.');
+  int len = strlen(inputname);
+  char *name;
+
+  if (dot && !strchr(dot, '/'))
+    {
+      len = dot - inputname;
+    }
+  name = malloc(len + 3);
+  if (name)
+    {
+      memcpy(name, inputname, len);
+      strcpy(name + len, ".o");
+    }
+  return name;
+}
+
+/*****************************************************************************/
+
+/* Give an option to the backend, and keep it for the states of batch mode.
+ * arg must live as long as batch. Returns nonzero on error.
+ */
+
+static int backend_option(struct asm_state_s *state, struct batch_s *batch, char *arg)
+{
+  if (!state->current_backend)
+    {
+      fprintf(batch->err, "No backend selected\n");
+      return 1;
+    }
+  if (state->current_backend->option(state->current_backend, state, arg) != 0)
+    {
+      return 1;
+    }
+  batch->moptions[batch->nmoptions++] = arg;
+  return 0;
+}
+
+/*****************************************************************************/
+/* parse a -M option: D, P, F <file>, T <target>. The argument of F and T
+ * may also be attached: -MFfile.
+ */
+
+static int depend_option(struct batch_s *batch, char *arg, int argc, char **argv)
+{
+  char **value = NULL;
+
+  if (!strcmp(arg, "D"))
+    {
+      batch->depend = 1;
+      return 0;
+    }
+  if (!strcmp(arg, "P"))
+    {
+      batch->depphony = 1;
+      return 0;
+    }
+  if (arg[0] == 'F')
+    {
+      value = &batch->depfile;
+    }
+  else if (arg[0] == 'T')
+    {
+      value = &batch->deptarget;
+    }
+  if (!value)
+    {
+      fprintf(batch->err, "Unknown option -M%s\n", arg);
+      return 1;
+    }
+  if (arg[1])
+    {
+      *value = arg + 1;
+    }
+  else if (optind < argc)
+    {
+      *value = argv[optind++];
+    }
+  else
+    {
+      fprintf(batch->err, "-M%s needs an argument\n", arg);
+      return 1;
+    }
+  return 0;
+}
+
+/*****************************************************************************/
+/* Write the dependency file of an assembly, if requested */
+
+static int depend_write(struct asm_state_s *asmstate, struct batch_s *batch)
+{
+  const char *target = batch->deptarget ? batch->deptarget : asmstate->outputname;
+  char *name;
+  int  ret;
+
+  if (!batch->depend)
+    {
+      return ASM_OK;
+    }
+  if (batch->depfile)
+    {
+      return output_depend(asmstate, batch->depfile, target, batch->depphony);
+    }
 
+  /* like cc, foo.o -> foo.d */
+
+  name = output_name(asmstate->outputname);
+  if (!name)
+    {
+      return ASM_ERROR;
+    }
+  name[strlen(name) - 1] = 'd';
+  ret = output_depend(asmstate, name, target, batch->depphony);
+  free(name);
+  return ret;
+}
+
+/*****************************************************************************/
+
+#if CONFIG_ASM_CACHE
+/* Compute the cache key of an assembly from everything that can change its
+ * output. Included files are not known yet, they are checked by the cache.
+ */
+
+static int cache_key(struct asm_state_s *asmstate, struct batch_s *batch, char **files, int nfiles, uint8_t *key)
+{
+  static const uint32_t config[] =
+  {
+    CONFIG_ASM_CHUNK, CONFIG_ASM_INBUF_SIZE, CONFIG_ASM_PPBUF_SIZE, CONFIG_ASM_TOKENS
+  };
   struct asm_backend_infos_s infos;
+  struct cache_hash_s ctx;
+  struct cache_hash_s file;
+  uint8_t digest[CACHE_HASH_SIZE];
+  int i;
 
-  /* Initialize the assembler state */
+  cache_hash_init(&ctx);
+  cache_hash_string(&ctx, "tcasm " CONFIG_ASM_VERSION);
+  cache_hash_update(&ctx, config, sizeof(config));
+  asmstate->current_backend->getinfos(&infos);
+  cache_hash_string(&ctx, infos.name);
+  cache_hash_update(&ctx, &asmstate->ppenable, sizeof(asmstate->ppenable));
 
-  init(&state);
+  /* each option is tagged, so that lists cannot be confused */
 
-  /* Determine the correct backend */
+  for (i = 0; i < CONFIG_ASM_INC_COUNT && asmstate->includes[i]; i++)
+    {
+      cache_hash_string(&ctx, "-I");
+      cache_hash_string(&ctx, asmstate->includes[i]);
+    }
+  for (i = 0; i < batch->ndefines; i++)
+    {
+      cache_hash_string(&ctx, "-D");
+      cache_hash_string(&ctx, batch->defines[i]);
+    }
+  for (i = 0; i < batch->nmoptions; i++)
+    {
+      cache_hash_string(&ctx, "-m");
+      cache_hash_string(&ctx, batch->moptions[i]);
+    }
+  if (batch->usepch)
+    {
+      cache_hash_string(&ctx, "--use-pch"); /* its contents are a dependency */
+      cache_hash_string(&ctx, batch->usepch);
+    }
+
+  /* inputs: names, they select the preprocessor, and contents */
 
-  if (ASM_BACKEND_COUNT == 1)
+  for (i = 0; i < nfiles; i++)
     {
-      state.current_backend = backends[0];
+      cache_hash_init(&file);
+      if (cache_hash_file(&file, files[i]) != ASM_OK)
+        {
+          return ASM_ERROR; /* parse() will report it */
+        }
+      cache_hash_final(&file, digest);
+      cache_hash_string(&ctx, files[i]);
+      cache_hash_update(&ctx, digest, sizeof(digest));
     }
 
-  if (ASM_BACKEND_COUNT > 1)
+  cache_hash_final(&ctx, key);
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* Write a cached output to state->outputname */
+
+static int cache_output_file(struct asm_state_s *asmstate, FILE *entry)
+{
+  FILE *out;
+  int ret;
+
+  out = fopen(asmstate->outputname, "w");
+  if (!out)
     {
-      asm_options = "bm:hI:o:v";
+      fclose(entry);
+      return emit_message(asmstate, ASM_ERROR, "Cannot create '%s'", asmstate->outputname);
+    }
+  ret = cache_fetch(asmstate, entry, out);
+  if (fclose(out) || ret != ASM_OK)
+    {
+      return emit_message(asmstate, ASM_ERROR, "Cannot write '%s'", asmstate->outputname);
+    }
+  return ASM_OK;
+}
+#endif
+
+#if CONFIG_ASM_LINES
+/*****************************************************************************/
+/* Open the line cache, its context is what changes encodings besides the
+ * text of the lines.
+ */
+
+static int lines_setup(struct asm_state_s *asmstate, struct batch_s *batch)
+{
+  char *ctx;
+  int  len;
+  int  i;
+  int  ret;
+
+  len = strlen("tcasm " CONFIG_ASM_VERSION) + strlen(asmstate->infos.name) + 2;
+  for (i = 0; i < batch->nmoptions; i++)
+    {
+      len += strlen(batch->moptions[i]) + 4;
+    }
+  ctx = malloc(len);
+  if (!ctx)
+    {
+      return emit_message(asmstate, ASM_ERROR, "malloc() failed");
+    }
+  sprintf(ctx, "tcasm " CONFIG_ASM_VERSION " %s", asmstate->infos.name);
+  for (i = 0; i < batch->nmoptions; i++)
+    {
+      strcat(ctx, " -m");
+      strcat(ctx, batch->moptions[i]);
+    }
+  ret = lines_open(asmstate, batch->lines, ctx);
+  free(ctx);
+  return ret;
+}
+#endif
+
+/*****************************************************************************/
+/* Assemble one input of a --batch run, with its own state and output */
+
+static int batch_job(void *arg, int index)
+{
+  struct batch_s *batch = arg;
+  struct asm_state_s *asmstate;
+  void *region = NULL;
+  int ret;
+  int i;
+#if CONFIG_ASM_CACHE
+  uint8_t key[CACHE_HASH_SIZE];
+  FILE *entry;
+  int cached = 0;
+#endif
+
+  asmstate = malloc(sizeof(struct asm_state_s));
+  if (!asmstate)
+    {
+      fprintf(batch->err, "%s: malloc() failed\n", batch->files[index]);
+      return ASM_ERROR;
+    }
+
+  /* same options as the command line */
+
+  asm_init(asmstate);
+  memcpy(asmstate->includes, batch->opts->includes, sizeof(asmstate->includes));
+  asmstate->debug           = batch->opts->debug;
+  asmstate->debuglevel      = batch->opts->debuglevel;
+  asmstate->diag            = batch->opts->diag;
+  asmstate->diagarg         = batch->opts->diagarg;
+  asmstate->ppenable        = batch->opts->ppenable;
+  asmstate->pipeline        = batch->opts->pipeline;
+  asmstate->spill           = batch->opts->spill;
+  asm_set_backend(asmstate, batch->opts->current_backend);
+  asmstate->inputname       = batch->files[index];
+
+  ret = ASM_OK;
+#if CONFIG_ASM_MEMBUDGET
+  memcpy(asmstate->mem.marks, batch->opts->mem.marks, sizeof(asmstate->mem.marks));
+  if (batch->membudget)
+    {
+      region = membudget_setup(asmstate, batch->membudget, batch->err);
+      ret = region ? ASM_OK : ASM_ERROR;
+    }
+#endif
+  for (i = 0; ret == ASM_OK && i < batch->nmoptions; i++)
+    {
+      ret = asmstate->current_backend->option(asmstate->current_backend, asmstate, batch->moptions[i]);
+    }
+#if CONFIG_ASM_PCH
+  /* after -m like a single assembly, the backend checks the target */
+
+  if (ret == ASM_OK && batch->usepch)
+    {
+      ret = pch_load(asmstate, batch->usepch);
+    }
+#endif
+#if CONFIG_ASM_PREPROC
+  for (i = 0; ret == ASM_OK && i < batch->ndefines; i++)
+    {
+      ret = pp_define(asmstate, batch->defines[i]);
+    }
+#endif
+
+  if (ret == ASM_OK)
+    {
+      asmstate->outputname = output_name(asmstate->inputname);
+      ret = asmstate->outputname ? ASM_OK : ASM_ERROR;
+    }
+
+#if CONFIG_ASM_CACHE
+  if (ret == ASM_OK && batch->cachedir && !batch->report)
+    {
+      cached = cache_key(asmstate, batch, &batch->files[index], 1, key) == ASM_OK;
+      entry  = cached ? cache_lookup(asmstate, batch->cachedir, key) : NULL;
+      if (entry)
+        {
+          ret = cache_output_file(asmstate, entry);
+          goto done;
+        }
+    }
+#endif
+
+  if (ret == ASM_OK)
+    {
+      ret = parse(asmstate);
+    }
+  if (ret == ASM_OK)
+    {
+      ret = output_file(asmstate);
+    }
+  if (ret == ASM_OK && batch->report && asmstate->current_backend->report)
+    {
+      flockfile(batch->out); /* keep reports whole */
+      fprintf(batch->out, "Report of %s\n", asmstate->inputname);
+      ret = asmstate->current_backend->report(asmstate->current_backend, asmstate, batch->out);
+      funlockfile(batch->out);
+    }
+
+#if CONFIG_ASM_CACHE
+  /* outputs with warnings are not cached, the warnings would be lost */
+
+  if (ret == ASM_OK && cached && !asmstate->nwarnings)
+    {
+      cache_store(asmstate, batch->cachedir, batch->cachesize, key);
+    }
+
+done:
+#endif
+
+  if (ret == ASM_OK)
+    {
+      ret = depend_write(asmstate, batch);
+    }
+
+  asm_release(asmstate);
+#if CONFIG_ASM_MEMBUDGET
+  if (batch->memreport)
+    {
+      flockfile(batch->err);
+      mem_report(asmstate, batch->err);
+      funlockfile(batch->err);
+    }
+#endif
+  free(region);
+  free(asmstate);
+  return ret;
+}
+
+/*****************************************************************************/
+
+/* Parse the command line into the state and the batch options. getopt() is
+ * not reentrant, concurrent server requests parse their options one at a
+ * time. Returns -1 to go on, or the exit code.
+ */
+
+static int parse_options(int argc, char **argv, struct asm_state_s *state, struct batch_s *batch, int *batchmode)
+{
+  static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+  char *asm_options;
+  int option;
+  int index;
+  int ret = -1;
+
+  if (backend_get(1))
+    {
+      asm_options = "b:m:hI:o:vPpD:d:M:T:";
     }
   else
     {
-      asm_options = "m:hI:o:v";
+      asm_options = "m:hI:o:vPpD:d:M:T:";
     }
 
-  /* parse options */
+  pthread_mutex_lock(&lock);
+#ifdef __GLIBC__
+  optind = 0; /* also resets the internal state of GNU getopt */
+#else
+  optind = 1;
+#endif
+  opterr = (batch->err == stderr);
 
-  while ((option = getopt(argc, argv, asm_options)) != -1)
+  while (ret < 0 && (option = getopt_long(argc, argv, asm_options, long_options, NULL)) != -1)
     {
       if (option == 'o')
         {
-          state.outputname = strdup(optarg);
+          state->outputname = strdup(optarg);
+        }
+      else if (option == OPT_BATCH)
+        {
+          *batchmode = 1;
+        }
+      else if (option == OPT_SPILL)
+        {
+          state->spill = 1;
+        }
+#if CONFIG_ASM_CACHE
+      else if (option == OPT_CACHE_DIR)
+        {
+          batch->cachedir = optarg;
+        }
+      else if (option == OPT_CACHE_SIZE)
+        {
+          batch->cachesize = strtoull(optarg, NULL, 0);
+        }
+#endif
+#if CONFIG_ASM_MEMBUDGET
+      else if (option == OPT_MEM_BUDGET)
+        {
+          batch->membudget = strtoul(optarg, NULL, 0);
+        }
+      else if (option == OPT_MEM_WARN)
+        {
+          if (memwarn_option(state, optarg, batch->err))
+            {
+              ret = 1;
+            }
+        }
+      else if (option == OPT_MEM_REPORT)
+        {
+          batch->memreport = 1;
+        }
+#endif
+#if CONFIG_ASM_PCH
+      else if (option == OPT_EMIT_PCH)
+        {
+          batch->emitpch = optarg;
+        }
+      else if (option == OPT_USE_PCH)
+        {
+          batch->usepch = optarg;
+        }
+#endif
+#if CONFIG_ASM_LINES
+      else if (option == OPT_INCREMENTAL)
+        {
+          batch->lines = optarg;
+        }
+#endif
+#if CONFIG_ASM_LINK
+      else if (option == OPT_LINK)
+        {
+          if (!strcmp(optarg, "bin"))
+            {
+              batch->link.format = LINK_BIN;
+            }
+          else if (!strcmp(optarg, "elf"))
+            {
+              batch->link.format = LINK_ELF;
+            }
+          else
+            {
+              fprintf(batch->err, "Unknown link format %s\n", optarg);
+              ret = 1;
+            }
         }
+      else if (option == OPT_BASE)
+        {
+          batch->link.base = strtoul(optarg, NULL, 0);
+        }
+      else if (option == 'T')
+        {
+          batch->link.script = optarg;
+        }
+#endif
       else if (option == 'I')
         {
           /* first, check that option length is reasonable */
           if (strlen(optarg) > CONFIG_ASM_INC_MAXLEN)
             {
-              fprintf(stderr, "Include path too long\n");
+              fprintf(batch->err, "Include path too long\n");
               continue;
             }
           for (index = 0; index < CONFIG_ASM_INC_COUNT; index++)
             {
-              if (state.includes[index]==NULL)
+              if (state->includes[index]==NULL)
                 {
-                  state.includes[index] = optarg;
+                  state->includes[index] = optarg;
                   break;
                 }
-              else if(!strcmp(state.includes[index], optarg))
+              else if(!strcmp(state->includes[index], optarg))
                 {
                   break;
                 }
@@ -193,97 +850,244 @@ int main(int argc, char **argv)
             }
           if (index == CONFIG_ASM_INC_COUNT)
             {
-              fprintf(stderr,"Error: too many includes, discarded '%s'\n",optarg);
+              fprintf(batch->err,"Error: too many includes, discarded '%s'\n",optarg);
+            }
+        }
+#if CONFIG_ASM_PREPROC
+      else if (option == 'P')
+        {
+          state->ppenable = 1;
+        }
+      else if (option == 'D')
+        {
+          batch->defines[batch->ndefines++] = optarg; /* defined after options */
+        }
+#endif
+#if CONFIG_ASM_PIPELINE
+      else if (option == 'p')
+        {
+          state->pipeline = 1;
+        }
+#endif
+      else if (option == 'd')
+        {
+          if (debug_option(state, optarg, batch->err))
+            {
+              ret = 1;
             }
         }
       else if (option == 'h')
         {
-          usage();
-          return 0;
+          usage(batch->out);
+          ret = 0;
         }
       else if (option == 'v')
         {
-          version();
-          return 0;
+          version(batch->out);
+          ret = 0;
         }
-      else if (option == 'b')
+      else if (option == 'M')
         {
-          int found = 0;
-          /* list all backends, then select */
-          for (index = 0; index < ASM_BACKEND_COUNT; index++)
+          if (depend_option(batch, optarg, argc, argv))
             {
-              backends[index]->getinfos(&infos);
-              if (!strcmp(infos.name, optarg))
-                {
-                  state.current_backend = backends[index];
-                  found = 1;
-                  break;
-                }
+              ret = 1;
             }
-          if (!found)
+        }
+      else if (option == 'b')
+        {
+          asm_set_backend(state, backend_find(optarg));
+          if (!state->current_backend)
             {
-              fprintf(stderr, "Unknown backend %s\n", optarg);
-              return 1;
+              fprintf(batch->err, "Unknown backend %s\n", optarg);
+              ret = 1;
             }
         }
       else if (option == 'm')
         {
-          if (!state.current_backend)
+          if (backend_option(state, batch, optarg))
             {
-              fprintf(stderr, "No backend selected\n");
-              return 1;
+              ret = 1;
             }
-          ret = state.current_backend->option(state.current_backend, &state, optarg);
-          if (ret != 0)
+        }
+      else if (option == OPT_STACK_USAGE)
+        {
+          batch->report = 1;
+          if (backend_option(state, batch, stack_option))
             {
-              return ret;
+              ret = 1;
+            }
+        }
+      else if (option == OPT_CYCLES)
+        {
+          snprintf(batch->cycles, sizeof(batch->cycles), "cycles=%s", optarg);
+          batch->report = 1;
+          if (backend_option(state, batch, batch->cycles))
+            {
+              ret = 1;
             }
         }
       else
         {
-          usage();
-          return 1;
+          usage(batch->out);
+          ret = 1;
         }
     }
 
+  batch->files  = argv + optind;
+  batch->nfiles = argc - optind;
+  pthread_mutex_unlock(&lock);
+  return ret;
+}
+
+/*****************************************************************************/
+/* Run a command line, with outputs to out and messages to err. This is
+ * main() for the command line, and for each request of a server.
+ */
+
+int tcasm_run(int argc, char **argv, FILE *out, FILE *err)
+{
+  struct asm_state_s state;
+  struct batch_s batch;
+  void *region = NULL;
+#if CONFIG_ASM_CACHE
+  uint8_t key[CACHE_HASH_SIZE];
+  int cached = 0;
+#endif
+  int index;
+  int batchmode = 0;
+  int ret = 0;
+
+  /* Initialize the assembler state */
+
+  asm_init(&state);
+  if (err != stderr)
+    {
+      state.diag    = diag_print;
+      state.diagarg = err;
+    }
+
+  /* options replayed for each input in batch mode */
+
+  batch.opts      = &state;
+  batch.ndefines  = 0;
+  batch.nmoptions = 0;
+  batch.membudget = 0;
+  batch.memreport = 0;
+  batch.cachedir  = getenv("TCASM_CACHE_DIR");
+  batch.cachesize = CONFIG_ASM_CACHE_SIZE;
+  batch.out       = out;
+  batch.err       = err;
+  batch.depend    = 0;
+  batch.depphony  = 0;
+  batch.depfile   = NULL;
+  batch.deptarget = NULL;
+  batch.emitpch   = NULL;
+  batch.usepch    = NULL;
+  batch.lines     = NULL;
+  batch.link.format = LINK_NONE;
+  batch.link.base   = 0;
+  batch.link.script = NULL;
+  batch.report    = 0;
+  batch.defines   = malloc(argc * sizeof(char*));
+  batch.moptions  = malloc(argc * sizeof(char*));
+  if (!batch.defines || !batch.moptions)
+    {
+      fprintf(err, "malloc() failed\n");
+      ret = 1;
+      goto donefree;
+    }
+
+  /* Determine the correct backend */
+
+  if (!backend_get(1))
+    {
+      asm_set_backend(&state, backend_get(0));
+    }
+
+  /* parse options */
+
+  ret = parse_options(argc, argv, &state, &batch, &batchmode);
+  if (ret >= 0)
+    {
+      goto donefree;
+    }
+  ret = 0;
+
   /* stop if there is no input file */
 
-  if (optind == argc)
+  if (!batch.nfiles)
     {
-      printf("tcasm: no input files\n");
+      fprintf(out, "tcasm: no input files\n");
       goto donefree;
     }
 
   /* stop if multiple backends are available and non was chosen */
   if (!state.current_backend)
     {
-      printf("More than one backend available, choose with -b\n");
-      return 1;
+      fprintf(out, "More than one backend available, choose with -b\n");
+      ret = 1;
+      goto donefree;
     }
 
 
-  /* Parse each input file */
+  /* In batch mode, each input is assembled separately to its own output */
 
-  for(index=optind;index<argc;index++)
+  if (batchmode)
     {
-      state.inputname = argv[index];
-      ret = parse(&state);
-      if (ret != 0)
+      if (state.outputname || batch.depfile || batch.deptarget || batch.emitpch || batch.lines || batch.link.format)
+        {
+          fprintf(err, "-o, -MF, -MT, --emit-pch, --incremental and --link cannot be used with --batch\n");
+          ret = 1;
+          goto donefree;
+        }
+      ret = batch_run(batch.nfiles, batch_job, &batch) ? 1 : 0;
+      goto donefree;
+    }
+
+#if CONFIG_ASM_MEMBUDGET
+  if (batch.membudget)
+    {
+      region = membudget_setup(&state, batch.membudget, err);
+      if (!region)
         {
+          ret = 1;
           goto donefree;
         }
     }
+#endif
 
-  /* linking stage : resolve symbols after all files have been parsed */
+#if CONFIG_ASM_PCH
+  /* the prelude comes first, the command line may override its macros */
+
+  if (batch.usepch && pch_load(&state, batch.usepch) != ASM_OK)
+    {
+      ret = 1;
+      goto donefree;
+    }
+#endif
+
+#if CONFIG_ASM_PREPROC
+  for (index = 0; index < batch.ndefines; index++)
+    {
+      if (pp_define(&state, batch.defines[index]) != ASM_OK)
+        {
+          ret = 1;
+          goto donefree;
+        }
+    }
+#endif
 
   /* Define output file name if none was given */
 
   if (!state.outputname)
     {
-      if (optind == argc-1)
+      if (batch.emitpch)
+        {
+          state.outputname = strdup(batch.emitpch); /* target of -MD */
+        }
+      else if (batch.nfiles == 1 && !batch.link.format)
         {
-          state.outputname = strdup(argv[optind]);
-          state.outputname[strlen(state.outputname)-1] = 'o';
+          state.outputname = output_name(batch.files[0]);
         }
       else
         {
@@ -291,46 +1095,133 @@ int main(int argc, char **argv)
         }
     }
 
-  printf("Output file name: %s\n",state.outputname);
+#if CONFIG_ASM_CACHE
+  /* An identical assembly may already be in the cache */
 
-  /* Write output file */
-  /* For now we just dump the sections */
-  for (index = 0; index < CONFIG_ASM_SEC_MAX; index++)
+  if (batch.cachedir && !batch.emitpch && !batch.link.format && !batch.report && cache_key(&state, &batch, batch.files, batch.nfiles, key) == ASM_OK)
     {
-      uint32_t i;
-      uint32_t offset = 0;
-      struct asm_chunk_s *chunk = state.sections[index].data;
-      if(!chunk)
-        {
-          continue;
-        }
-      printf("Contents of section %s: %u bytes\n", state.sections[index].name, chunk_totalsize(state.sections[index].data) );
-      while (chunk)
+      FILE *entry = cache_lookup(&state, batch.cachedir, key);
+      cached = 1;
+      if (entry)
         {
-          printf("chunk @ %p len %u\n", chunk, chunk->len);
-          for (i = 0; i < chunk->len; i++, offset++)
+          fprintf(out, "Output file name: %s\n",state.outputname);
+          ret = cache_fetch(&state, entry, out) ? 1 : 0;
+          if (!ret && depend_write(&state, &batch) != ASM_OK)
             {
-              if ((offset&15) == 0)
-                {
-                  printf("%08X: ", offset);
-                }
-              printf("%02X ", chunk->data[i]);
-              if ((offset&15) == 15)
-                {
-                  printf("\n");
-                }
+              ret = 1;
             }
-          if ((offset&15))
-            {
-              printf("\n");
-            }
-          chunk = chunk->next;
+          goto donefree;
+        }
+    }
+#endif
+
+#if CONFIG_ASM_LINES
+  if (batch.lines && lines_setup(&state, &batch) != ASM_OK)
+    {
+      ret = 1;
+      goto donefree;
+    }
+#endif
+
+  /* Parse each input file */
+
+  for(index=0;index<batch.nfiles;index++)
+    {
+      state.inputname = batch.files[index];
+      ret = parse(&state);
+      if (ret != 0)
+        {
+          goto donefree;
+        }
+    }
+
+#if CONFIG_ASM_PCH
+  /* the state left by the inputs is the output */
+
+  if (batch.emitpch)
+    {
+      if (pch_write(&state, batch.emitpch) != ASM_OK || depend_write(&state, &batch) != ASM_OK)
+        {
+          ret = 1;
+        }
+      goto donefree;
+    }
+#endif
+
+  /* linking stage : resolve symbols after all files have been parsed */
+
+  fprintf(out, "Output file name: %s\n",state.outputname);
+
+#if CONFIG_ASM_LINK
+  if (batch.link.format)
+    {
+      if (link_output(&state, &batch.link) != ASM_OK)
+        {
+          ret = 1;
+          goto donefree;
         }
     }
+  else
+#endif
+  output_dump(&state, out);
+
+  if (batch.report && state.current_backend->report &&
+      state.current_backend->report(state.current_backend, &state, out) != ASM_OK)
+    {
+      ret = 1;
+      goto donefree;
+    }
+
+#if CONFIG_ASM_CACHE
+  if (cached && !state.nwarnings)
+    {
+      cache_store(&state, batch.cachedir, batch.cachesize, key);
+    }
+#endif
+
+#if CONFIG_ASM_LINES
+  if (batch.lines && lines_save(&state) != ASM_OK)
+    {
+      ret = 1;
+    }
+#endif
+
+  if (depend_write(&state, &batch) != ASM_OK)
+    {
+      ret = 1;
+    }
 
   /* Cleanup */
 
 donefree:
-  free(state.outputname);
+  asm_release(&state);
+#if CONFIG_ASM_MEMBUDGET
+  if (batch.memreport && !batchmode)
+    {
+      mem_report(&state, err);
+    }
+#endif
+  free(region);
+  free(batch.defines);
+  free(batch.moptions);
   return ret;
 }
+
+/*****************************************************************************/
+
+int main(int argc, char **argv)
+{
+#if CONFIG_ASM_SERVER
+  /* server modes replace the whole command line */
+
+  if (argc >= 3 && !strcmp(argv[1], "--server"))
+    {
+      return server_run(argv[2]);
+    }
+  if (argc >= 3 && !strcmp(argv[1], "--client"))
+    {
+      return client_run(argv[2], argc - 2, argv + 2);
+    }
+#endif
+  return tcasm_run(argc, argv, stdout, stderr);
+}
@@ -0,0 +1,258 @@
+/* memory accounting and fixed budget allocator for tcasm
+ *
+ * All dynamic memory of an assembly goes through asm_malloc()/asm_free(),
+ * tagged with the subsystem that uses it. Current and peak usage are
+ * tracked per subsystem.
+ *
+ * In budget mode, memory comes from one region given by the caller, with a
+ * first-fit allocator. Blocks are contiguous and each has a small header,
+ * adjacent free blocks are merged while searching. Warnings are emitted
+ * when usage crosses the high-water marks, in percent of the region.
+ * Otherwise memory comes from malloc() and is only accounted.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "tcasm.h"
+
+#if CONFIG_ASM_MEMBUDGET
+
+/*****************************************************************************
+ * Definitions
+ *****************************************************************************/
+
+#define MEM_ALIGN 8
+
+/*****************************************************************************
+ * Types
+ *****************************************************************************/
+
+/* allocation header, also used with malloc() to remember sizes */
+
+struct mem_block_s
+{
+  uint32_t size;   /* block size, header included */
+  uint16_t used;   /* TRUE if allocated */
+  uint16_t subsys; /* MEM_xxx */
+};
+
+/*****************************************************************************
+ * Variables
+ *****************************************************************************/
+
+static const char * const mem_names[MEM_COUNT] =
+{
+  "state",
+  "chunk",
+  "include",
+  "preproc",
+  "pipeline",
+  "lines",
+  "symbols",
+  "backend",
+};
+
+/*****************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/* Give a region to a state. All further allocations are made from it. The
+ * budget is the region plus what is already accounted as MEM_STATE, since on
+ * target the state is allocated along with the region.
+ * Returns ASM_ERROR if the region is too small to be used.
+ */
+
+int mem_budget(struct asm_state_s *state, void *base, uint32_t size)
+{
+  struct asm_mem_s   *mem = &state->mem;
+  struct mem_block_s *block;
+  uintptr_t start = ((uintptr_t)base + MEM_ALIGN - 1) & ~(uintptr_t)(MEM_ALIGN - 1);
+
+  size -= start - (uintptr_t)base;
+  size &= ~(MEM_ALIGN - 1);
+  if (size < 2 * sizeof(struct mem_block_s))
+    {
+      return ASM_ERROR;
+    }
+
+  mem->base   = (uint8_t*)start;
+  mem->region = size;
+  mem->size   = size + mem->cur[MEM_STATE];
+  block = (struct mem_block_s*)mem->base;
+  block->size   = size;
+  block->used   = 0;
+  block->subsys = 0;
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* Account for memory not obtained from asm_malloc(), like the state */
+
+void mem_account(struct asm_state_s *state, int subsys, int32_t size)
+{
+  struct asm_mem_s *mem = &state->mem;
+  int i;
+
+  mem->cur[subsys] += size;
+  mem->used        += size;
+  if (mem->cur[subsys] > mem->max[subsys])
+    {
+      mem->max[subsys] = mem->cur[subsys];
+    }
+  if (mem->used <= mem->peak)
+    {
+      return;
+    }
+  mem->peak = mem->used;
+
+  /* high-water marks, each one is reported once */
+
+  for (i = 0; mem->size && i < CONFIG_ASM_MEM_MARKS; i++)
+    {
+      uint32_t limit = (uint64_t)mem->size * mem->marks[i] / 100;
+      if (mem->marks[i] && !(mem->warned & (1 << i)) && mem->used >= limit)
+        {
+          mem->warned |= 1 << i;
+          emit_message(state, ASM_WARN, "Memory use reached %d%% of the budget (%u of %u bytes)",
+                       mem->marks[i], mem->used, mem->size);
+        }
+    }
+}
+
+/*****************************************************************************/
+/* first fit in the region, merging free neighbours on the way */
+
+static struct mem_block_s *mem_region_alloc(struct asm_mem_s *mem, uint32_t size)
+{
+  uint8_t *end = mem->base + mem->region;
+  uint8_t *ptr = mem->base;
+  struct mem_block_s *block;
+  struct mem_block_s *next;
+
+  while (ptr < end)
+    {
+      block = (struct mem_block_s*)ptr;
+      if (!block->used)
+        {
+          while (ptr + block->size < end)
+            {
+              next = (struct mem_block_s*)(ptr + block->size);
+              if (next->used)
+                {
+                  break;
+                }
+              block->size += next->size;
+            }
+          if (block->size >= size)
+            {
+              /* split if the rest can hold an allocation */
+              if (block->size - size >= 2 * sizeof(struct mem_block_s))
+                {
+                  next = (struct mem_block_s*)(ptr + size);
+                  next->size   = block->size - size;
+                  next->used   = 0;
+                  next->subsys = 0;
+                  block->size  = size;
+                }
+              block->used = 1;
+              return block;
+            }
+        }
+      ptr += block->size;
+    }
+  return NULL;
+}
+
+/*****************************************************************************/
+
+void *asm_malloc(struct asm_state_s *state, int subsys, size_t len)
+{
+  struct asm_mem_s   *mem = &state->mem;
+  struct mem_block_s *block;
+  uint64_t size = (sizeof(struct mem_block_s) + (uint64_t)len + MEM_ALIGN - 1) & ~(uint64_t)(MEM_ALIGN - 1);
+
+  if (size > UINT32_MAX)
+    {
+      return NULL;
+    }
+
+  if (mem->base)
+    {
+      block = mem_region_alloc(mem, size);
+      if (!block)
+        {
+          emit_message(state, ASM_ERROR, "Memory budget of %u bytes exhausted, cannot allocate %u bytes for %s",
+                       mem->size, (uint32_t)size, mem_names[subsys]);
+          return NULL;
+        }
+    }
+  else
+    {
+      block = malloc(size);
+      if (!block)
+        {
+          return NULL;
+        }
+      block->size = size;
+      block->used = 1;
+    }
+
+  block->subsys = subsys;
+  mem_account(state, subsys, block->size);
+  return &block[1];
+}
+
+/*****************************************************************************/
+
+void asm_free(struct asm_state_s *state, void *ptr)
+{
+  struct mem_block_s *block;
+
+  if (!ptr)
+    {
+      return;
+    }
+  block = (struct mem_block_s*)ptr - 1;
+  mem_account(state, block->subsys, -(int32_t)block->size);
+
+  /* blocks allocated before the region was given come from malloc() */
+
+  if ((uint8_t*)block >= state->mem.base && (uint8_t*)block < state->mem.base + state->mem.region)
+    {
+      block->used = 0; /* merged with its neighbours by the next allocation */
+    }
+  else
+    {
+      free(block);
+    }
+}
+
+/*****************************************************************************/
+/* Print peak memory use per subsystem */
+
+void mem_report(struct asm_state_s *state, FILE *out)
+{
+  struct asm_mem_s *mem = &state->mem;
+  const char *name = state->inputname ? state->inputname : "tcasm";
+  int i;
+
+  if (mem->size)
+    {
+      fprintf(out, "%s: memory peak %u of %u bytes\n", name, mem->peak, mem->size);
+    }
+  else
+    {
+      fprintf(out, "%s: memory peak %u bytes\n", name, mem->peak);
+    }
+  for (i = 0; i < MEM_COUNT; i++)
+    {
+      fprintf(out, "  %-9s %u\n", mem_names[i], mem->max[i]);
+    }
+}
+
+#endif /* CONFIG_ASM_MEMBUDGET */
@@ -0,0 +1,184 @@
+#include "config.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "tcasm.h"
+
+/*****************************************************************************/
+/* dump one chunk of section contents, offset is the section offset. A
+ * chunk may start in the middle of a row, the row still gets its address.
+ */
+
+static void output_dump_chunk(FILE *out, const uint8_t *data, uint32_t len, uint32_t *offset)
+{
+  uint32_t i;
+
+  fprintf(out, "chunk len %u\n", len);
+  for (i = 0; i < len; i++, (*offset)++)
+    {
+      if ((*offset&15) == 0 || i == 0)
+        {
+          fprintf(out, "%08X: ", *offset);
+        }
+      fprintf(out, "%02X ", data[i]);
+      if ((*offset&15) == 15)
+        {
+          fprintf(out, "\n");
+        }
+    }
+  if ((*offset&15))
+    {
+      fprintf(out, "\n");
+    }
+}
+
+/*****************************************************************************/
+/* Write the output. For now we just dump the sections */
+
+int output_dump(struct asm_state_s *state, FILE *out)
+{
+  int index;
+
+  for (index = 0; index < CONFIG_ASM_SEC_MAX; index++)
+    {
+      struct asm_section_s *sec = &state->sections[index];
+      struct asm_chunk_s *chunk = sec->data.first;
+      struct asm_reloc_s *reloc;
+      uint32_t offset = 0;
+      if(!chunk)
+        {
+          continue;
+        }
+      fprintf(out, "Contents of section %s: %u bytes\n", sec->name, section_size(sec));
+
+      /* spilled contents first, they were full chunks */
+
+      if (sec->spill)
+        {
+          uint8_t buf[CONFIG_ASM_CHUNK];
+          size_t  len;
+
+          rewind(sec->spill);
+          while ((len = fread(buf, 1, sizeof(buf), sec->spill)) > 0)
+            {
+              output_dump_chunk(out, buf, len, &offset);
+            }
+          if (ferror(sec->spill) || offset != sec->spilled)
+            {
+              return emit_message(state, ASM_ERROR, "Cannot read spill file of section %s", sec->name);
+            }
+          fseek(sec->spill, 0, SEEK_END); /* ready for more contents */
+        }
+
+      while (chunk)
+        {
+          output_dump_chunk(out, chunk->data, chunk->len, &offset);
+          chunk = chunk->next;
+        }
+
+      /* symbol references, patched by the link stage */
+
+      for (reloc = sec->relocs; reloc; reloc = reloc->next)
+        {
+          fprintf(out, "reloc %08X %s%+d\n", reloc->offset, reloc->symbolname, reloc->addend);
+        }
+    }
+  return ferror(out) ? ASM_ERROR : ASM_OK;
+}
+
+/*****************************************************************************/
+/* Write the output to state->outputname */
+
+int output_file(struct asm_state_s *state)
+{
+  FILE *out;
+  int ret;
+
+  out = fopen(state->outputname, "w");
+  if (!out)
+    {
+      return emit_message(state, ASM_ERROR, "Cannot create '%s'", state->outputname);
+    }
+  ret = output_dump(state, out);
+  if (fclose(out) || ret != ASM_OK)
+    {
+      return emit_message(state, ASM_ERROR, "Cannot write '%s'", state->outputname);
+    }
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* write a path for make: spaces are escaped, $ is doubled */
+
+static void output_depend_path(FILE *out, const char *path)
+{
+  for (; *path; path++)
+    {
+      if (*path == ' ' || *path == '#')
+        {
+          fputc('\\', out);
+        }
+      else if (*path == '$')
+        {
+          fputc('$', out);
+        }
+      fputc(*path, out);
+    }
+}
+
+/*****************************************************************************/
+/* Write a make dependency file: target depends on all resolved files, in
+ * the order they were resolved. With phony, each file but the first also
+ * gets an empty rule, so that make does not fail when it is removed.
+ */
+
+int output_depend(struct asm_state_s *state, const char *name, const char *target, int phony)
+{
+  struct asm_file_s *file;
+  FILE *out;
+  int  col;
+
+  out = fopen(name, "w");
+  if (!out)
+    {
+      return emit_message(state, ASM_ERROR, "Cannot create '%s'", name);
+    }
+
+  output_depend_path(out, target);
+  fputc(':', out);
+  col = strlen(target) + 1;
+  for (file = state->incorder; file; file = file->order)
+    {
+      if (!file->path)
+        {
+          continue;
+        }
+      if (col + strlen(file->path) > 76)
+        {
+          fputs(" \\\n", out);
+          col = 0;
+        }
+      fputc(' ', out);
+      output_depend_path(out, file->path);
+      col += strlen(file->path) + 1;
+    }
+  fputc('\n', out);
+
+  for (file = state->incorder; phony && file; file = file->order)
+    {
+      if (file->path && file != state->incorder)
+        {
+          fputc('\n', out);
+          output_depend_path(out, file->path);
+          fputs(":\n", out);
+        }
+    }
+
+  if (fclose(out))
+    {
+      return emit_message(state, ASM_ERROR, "Cannot write '%s'", name);
+    }
+  return ASM_OK;
+}
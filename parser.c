@@ -3,7 +3,7 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
-#include <errno.h>
+#include <unistd.h>
 
 #include "tcasm.h"
 
@@ -11,12 +11,12 @@
 
 static int parse_label(struct asm_state_s *state, char *label)
 {
-  printf("label [%s]\n", label);
+  TRACE(state, DEBUG_PARSE, 1, "label [%s]\n", label);
   if (label[0] >= '0' && label[0]<='9')
     {
       return emit_message(state, ASM_ERROR, "invalid label '%s'",label);
     }
-  return ASM_OK;
+  return symbol_define(state, label);
 }
 
 /*****************************************************************************/
@@ -30,25 +30,18 @@ static int parse_inst(struct asm_state_s *state, char *inst)
 
 /*****************************************************************************/
 
-static int parse_directive(struct asm_state_s *state, char *dir)
+static int parse_directive(struct asm_state_s *state, char *dir, char *params)
 {
-  char *params;
   int  ret = ASM_ERROR;
 
-  /* split directive params */
-  params = dir;
-  while (*params && !(*params == ' ' || *params=='\t')) params++;
-  *params = 0;
-  params++;
-  while (*params && (*params == ' ' || *params=='\t')) params++;
-
-  printf("direc [%s]\n", dir);
-  if(*params) printf("params [%s]\n", params);
+  TRACE(state, DEBUG_PARSE, 1, "direc [%s]\n", dir);
+  if(*params) TRACE(state, DEBUG_PARSE, 2, "params [%s]\n", params);
 
   ret = directive(state, dir, params);
 
   if (ret == ASM_UNHANDLED)
     {
+      state->linevolatile = 1; /* may change the backend state */
       ret = state->current_backend->directive(state->current_backend, state, dir);
     }
 
@@ -61,164 +54,382 @@ static int parse_directive(struct asm_state_s *state, char *dir)
 
 /*****************************************************************************/
 
-static int parse_line(struct asm_state_s *state, int linelen)
+/* Parse the tokens of one line: state->tokens and state->ntokens describe
+ * the text in line, end is the end of its significant part. The label,
+ * directive and instruction handlers work on the tokens. Directives also get
+ * their parameters as text, from the first parameter token to end.
+ */
+
+int parse_tokens(struct asm_state_s *state, char *line, int end)
 {
-  char *line = state->inbuf;
-  char *label;
-  char *mnemo;
+  struct asm_token_s *tok = state->tokens;
+  char mnemo[CONFIG_ASM_MNEMO_SIZE];
+  char *label = NULL;
   int  ret = ASM_OK;
 
-  /* remove crlf */
+  state->tokline = line;
+  state->tokcur  = 0;
+
+  TRACE(state, DEBUG_PARSE, 3, "%d tokens\n", state->ntokens);
+
+  /* discard empty lines and LINE comments */
 
-  if(line[linelen-1]=='\n')
+  if (state->ntokens == 0 || line[tok[0].pos] == CONFIG_ASM_COMMENT_LINE)
     {
-      line[linelen-1] = 0;
-      linelen -= 1;
+      return ASM_OK;
+    }
+  if (state->ntokens > CONFIG_ASM_TOKENS)
+    {
+      return emit_message(state, ASM_ERROR, "Too many tokens in line");
     }
 
-  if(line[linelen-1]=='\r')
+#if CONFIG_ASM_LINES
+  /* lines seen before are replayed, before the line is modified below */
+
+  if (state->lines)
     {
-      line[linelen-1] = 0;
-      linelen -= 1;
+      ret = lines_lookup(state, line + tok[0].pos, end - tok[0].pos);
+      if (ret != ASM_UNHANDLED)
+        {
+          goto done;
+        }
+      ret = ASM_OK;
     }
+#endif
+
+  /* cut the line after the last token, this removes the end of line and
+   * the continuation comment */
 
-  /* trim start spaces */
+  line[end] = 0;
 
-  while ( (*line == ' ') || (*line == '\t') )
+  TRACE(state, DEBUG_PARSE, 2, "line  %s\n",line + tok[0].pos);
+
+  /* a word followed by a colon is a label */
+
+  if (state->ntokens >= 2 && tok[0].type == TOK_WORD && tok[1].type == TOK_COLON)
     {
-      line++;
-      linelen--;
+      label = line + tok[0].pos;
+      label[tok[0].len] = 0;
+      state->tokcur = 2;
+      state->linevolatile = 1;
+      ret = parse_label(state, label);
+      if (ret == ASM_ERROR)
+        {
+          return ret;
+        }
     }
 
-  if (linelen==0)
+  if (state->tokcur == state->ntokens)
     {
-      return ASM_OK;
+      return ret;
     }
 
-  /* discard LINE comments */
+  /* then comes the mnemonic */
 
-  if (*line==CONFIG_ASM_COMMENT_LINE)
+  tok = &state->tokens[state->tokcur];
+  if (tok->len >= sizeof(mnemo))
     {
-      return ASM_OK;
+      return emit_message(state, ASM_ERROR, "Mnemonic too long");
     }
+  memcpy(mnemo, line + tok->pos, tok->len);
+  mnemo[tok->len] = 0;
+  state->tokcur++;
 
-  /* get first token */
-
-printf("\nline  %s\n",line);
+  if (mnemo[0]=='.')
+    {
+      char *params = line + end;
+      if (state->tokcur < state->ntokens)
+        {
+          params = line + state->tokens[state->tokcur].pos;
+        }
+      ret = parse_directive(state, mnemo, params);
+    }
+  else
+    {
+      ret = parse_inst(state, mnemo);
+    }
 
-  label = line;
-  while ( *line && (*line != ':') )
+#if CONFIG_ASM_LINES
+  if (state->lines && ret == ASM_OK)
     {
-      line++;
+      lines_record(state);
     }
 
-  /* decide if that was a label */
+done:
+#endif
+
+  /* what this line completed will not change anymore */
 
-  if (*line != ':')
+  if (ret != ASM_ERROR && symbol_settle(state) != ASM_OK)
     {
-      /* Not a label */
-      mnemo = label;
-      label = NULL;
+      ret = ASM_ERROR;
     }
-  else
+  if (state->spill && state->current_section && ret != ASM_ERROR &&
+      section_spill(state, state->current_section) != ASM_OK)
     {
-      /* that was a label.
-       * skip spaces and find mnemo */
-      *line=0;
-      line++;
-      while ( *line && ((*line == ' ') || (*line == '\t')) )
-        {
-          line++;
-        }
-
-      mnemo = line;
+      ret = ASM_ERROR;
     }
 
+  return ret;
+}
 
-  /* if the line has a CONTINUATION comment, cut the mnemo before that */
+/*****************************************************************************/
 
-  line = mnemo;
-  while(*line && *line != CONFIG_ASM_COMMENT_CONT) line++;
-  *line = 0;
+static int parse_line(struct asm_state_s *state, char *line, int linelen)
+{
+  int end;
+
+  state->tokens = state->tokbuf;
+  end = tokenize(state->tokens, &state->ntokens, line, linelen);
+  return parse_tokens(state, line, end);
+}
+
+/*****************************************************************************/
+
+/* Parse a line of the current input, avail bytes at base with its end of
+ * line. It goes to the preprocessor, or to the line buffer cut if too long.
+ */
+
+static int parse_text(struct asm_state_s *state, const uint8_t *base, uint32_t avail)
+{
+  uint32_t l;
 
-  /* right trim spaces after mnemonic */
-  line--;
-  while (line != mnemo && (*line==' ' || *line=='\t') )
+#if CONFIG_ASM_PREPROC
+  if (state->ppactive)
     {
-      *line=0;
-      line--;
+      char *line;
+      int ret = pp_line(state, (const char*)base, avail, &line);
+      if (ret == ASM_OK && line)
+        {
+          ret = parse_line(state, line, strlen(line));
+        }
+      return ret;
     }
+#endif
 
-  /* parse elements */
-  if (label)
+  l = avail;
+  if (l > sizeof(state->inbuf) - 1)
     {
-      ret = parse_label(state, label);
+      l = sizeof(state->inbuf) - 1;
+      emit_message(state, ASM_WARN, "Long line truncated");
+    }
+  memcpy(state->inbuf, base, l);
+  state->inbuf[l] = 0;
+
+  return parse_line(state, state->inbuf, l);
+}
+
+/*****************************************************************************/
+
+/* Parse a file that is not loaded, reading its lines through a buffer of
+ * fixed size. With a memory budget, inputs do not have to fit in it. What a
+ * line has past the buffer is dropped, the line buffers would cut it.
+ */
+
+static int parse_stream(struct asm_state_s *state, struct asm_file_s *file)
+{
+  uint8_t  buf[CONFIG_ASM_STREAM_BUF];
+  const uint8_t *eol;
+  uint32_t fill  = 0;
+  uint32_t start = 0;
+  uint32_t avail;
+  int  skip = 0; /* TRUE in the part of a line past the buffer */
+  int  ret  = ASM_OK;
+  int  n;
+  int  fd;
+
+  fd = include_open(state, file);
+  if (fd < 0)
+    {
+      return ASM_ERROR;
     }
+  TRACE(state, DEBUG_INC, 1, "include streaming %s: %u bytes\n", file->path, file->len);
 
-  if (ret != ASM_ERROR)
+  while (ret != ASM_ERROR && state->inpos < file->len)
     {
-      if (mnemo && strlen(mnemo))
+      eol = memchr(buf + start, '\n', fill - start);
+      if (!eol && fill - start < sizeof(buf))
         {
-          if (mnemo[0]=='.')
+          /* no whole line, read more after what is left */
+
+          memmove(buf, buf + start, fill - start);
+          fill -= start;
+          start = 0;
+          n = read(fd, buf + fill, sizeof(buf) - fill);
+          if (n < 0)
             {
-              ret = parse_directive(state, mnemo);
+              ret = emit_message(state, ASM_ERROR, "Cannot read '%s'", file->path);
+              break;
             }
-          else
+          if (n > 0)
             {
-              ret = parse_inst(state, mnemo);
+              fill += n;
+              continue;
             }
+          if (!fill)
+            {
+              break;
+            }
+        }
+      avail = eol ? (eol - (buf + start) + 1) : (fill - start);
+
+      state->inpos += avail;
+      if (!skip)
+        {
+          state->curline += 1;
+          ret = parse_text(state, buf + start, avail);
         }
+      skip   = !eol;
+      start += avail;
     }
 
+  close(fd);
   return ret;
 }
 
 /*****************************************************************************/
 
-int parse(struct asm_state_s *state)
+/* Parse a file into the state. Lines are copied one by one from the file
+ * contents to the line buffer, or read from the file if it is not loaded.
+ * May be called recursively by .include.
+ */
+
+int parse_file(struct asm_state_s *state, struct asm_file_s *file)
 {
-  char *p;
-  int  l;
-  int  toolong; /* set to one if line was too long and end of line must be discarded */
+  struct asm_file_s *previnput = state->input;
+  uint32_t prevpos  = state->inpos;
+  int      prevline = state->curline;
+  char     *prevname = state->inputname;
+  int      prevlevel = state->pplevel;
+  const uint8_t *base;
+  const uint8_t *eol;
+  uint32_t avail;
   int  ret = ASM_OK;
-  printf("-> %s\n", state->inputname);
-  state->input = fopen(state->inputname, "rb");
-  if (state->input==NULL)
+
+  state->input     = file;
+  state->inpos     = 0;
+  state->curline   = 0;
+  state->inputname = file->path;
+
+  if (!file->data)
     {
-      printf("Cannot open '%s', errno=%d\n",state->inputname,errno);
-      return ASM_ERROR;
+      ret = parse_stream(state, file);
     }
-  state->curline = 0;
 
-  while(1)
+  while (file->data && state->inpos < file->len)
     {
-      toolong = 0;
-      p = fgets(state->inbuf, sizeof(state->inbuf), state->input);
-      if(!p) break;
+      base  = file->data + state->inpos;
+      avail = file->len - state->inpos;
+      eol   = memchr(base, '\n', avail);
+      avail = eol ? (eol - base + 1) : avail;
+
+      /* consume the line, even the part that does not fit the buffer */
+
+      state->inpos += avail;
       state->curline += 1;
-      l = strlen(p);
-      toolong = (p[l-1] != '\n');
-      if (toolong)
-        {
-          emit_message(state, ASM_WARN, "Long line truncated");
-        }
-      ret = parse_line(state,l);
+
+      ret = parse_text(state, base, avail);
       if (ret == ASM_ERROR)
         {
-          goto done;
-        }
-      /* if line was too long, eat the rest of the line until its end */
-      while (toolong)
-        {
-          p = fgets(state->inbuf, sizeof(state->inbuf), state->input);
-          if(!p) break;
-          l = strlen(p);
-          toolong = (p[l-1] != '\n');
+          break;
         }
     }
 
-done:
-  fclose(state->input);
-  return 0;
+#if CONFIG_ASM_PREPROC
+  if (state->ppactive && pp_file_end(state, prevlevel) == ASM_ERROR)
+    {
+      ret = ASM_ERROR;
+    }
+#endif
+
+  state->input     = previnput;
+  state->inpos     = prevpos;
+  state->curline   = prevline;
+  state->inputname = prevname;
+  return (ret == ASM_ERROR) ? ASM_ERROR : ASM_OK;
+}
+
+/*****************************************************************************/
+/* Let the backend complete an input, like dumping pending literals, then
+ * settle the references that waited for labels of the input.
+ */
+
+static int parse_finish(struct asm_state_s *state, int ret)
+{
+  const struct asm_backend_s *backend = state->current_backend;
+
+  if (ret == ASM_OK && backend->finish)
+    {
+      ret = backend->finish(backend, state);
+    }
+  if (ret == ASM_OK)
+    {
+      ret = symbol_finish(state);
+    }
+  return ret;
 }
 
+/*****************************************************************************/
+
+int parse(struct asm_state_s *state)
+{
+  struct asm_file_s *file;
+  int l;
+  TRACE(state, DEBUG_PARSE, 1, "-> %s\n", state->inputname);
+  file = include_find(state, state->inputname, 0);
+  if (!file)
+    {
+      return ASM_ERROR;
+    }
+  if (!file->path)
+    {
+      return emit_message(state, ASM_ERROR, "Cannot open '%s'", state->inputname);
+    }
+  state->unit++; /* a new scope for local labels */
+
+#if CONFIG_ASM_PREPROC
+  /* like cc, preprocess .S files */
+  l = strlen(state->inputname);
+  state->ppactive = state->ppenable || (l > 2 && !strcmp(state->inputname + l - 2, ".S"));
+#endif
+
+#if CONFIG_ASM_PIPELINE
+  /* the preprocessor works on whole files, it is not pipelined */
+  if (state->pipeline && !state->ppactive)
+    {
+      return parse_finish(state, pipe_parse(state, file));
+    }
+#endif
+
+  /* with a memory budget, the lines are read one by one */
+
+  if (!MEM_BUDGETED(state) && include_load(state, file) != ASM_OK)
+    {
+      return ASM_ERROR;
+    }
+
+  return parse_finish(state, parse_file(state, file));
+}
+
+/*****************************************************************************/
+/* Parse source text from memory. name is used in messages. */
+
+int parse_buffer(struct asm_state_s *state, const char *name, const uint8_t *data, uint32_t len)
+{
+  struct asm_file_s file;
+
+  memset(&file, 0, sizeof(file));
+  file.name = (char*)name;
+  file.path = (char*)name;
+  file.data = (uint8_t*)data; /* only read */
+  file.len  = len;
+
+  state->inputname = (char*)name;
+  state->unit++;
+#if CONFIG_ASM_PREPROC
+  state->ppactive = state->ppenable;
+#endif
+  TRACE(state, DEBUG_PARSE, 1, "-> %s (%u bytes in memory)\n", name, len);
+
+  return parse_finish(state, parse_file(state, &file));
+}
@@ -0,0 +1,728 @@
+/* precompiled preludes for tcasm
+ *
+ * --emit-pch parses a prelude, usually a header full of definitions, then
+ * saves what it left in the state instead of an output: preprocessor
+ * macros, the section table with its contents, the symbols, the current
+ * section, the mode and the state of the backend, and the files that were
+ * resolved.
+ * --use-pch restores them before the real input is parsed.
+ *
+ * The image is written by the same build that reads it. It only contains
+ * offsets, never pointers, so it can be mapped anywhere and used in place:
+ *
+ *   header
+ *   macro records      strings are offsets in the pool
+ *   section records    contents are offsets in the image
+ *   file records       offsets in the pool
+ *   symbol records     names are offsets in the pool
+ *   string pool        NUL terminated strings
+ *   backend state      bytes of the save hook
+ *   section contents
+ *
+ * Macro records are in hash order and restored macros point to the strings
+ * of the mapped image, so loading makes one allocation for all macros, no
+ * lookups, and copies only section contents. Symbols are few, they are
+ * created like labels.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#if CONFIG_ASM_MMAP
+#include <sys/mman.h>
+#endif
+
+#include "tcasm.h"
+
+#if CONFIG_ASM_PCH
+
+/*****************************************************************************
+ * Definitions
+ *****************************************************************************/
+
+#define PCH_MAGIC   "tcasmpch"
+#define PCH_VERSION 4
+#define PCH_ORDER   0x01020304 /* detects images of the other byte order */
+#define PCH_NONE    UINT32_MAX
+
+/*****************************************************************************
+ * Types
+ *****************************************************************************/
+
+struct pch_header_s
+{
+  char     magic[8];
+  uint32_t version;
+  uint32_t order;
+  uint32_t params;    /* CONFIG_ASM_PP_PARAMS */
+  uint32_t hash;      /* CONFIG_ASM_PP_HASH */
+  uint32_t size;      /* size of the image */
+  uint32_t backend;   /* pool offset of the backend name */
+  uint32_t current;   /* index of the current section record, or PCH_NONE */
+  uint32_t mode;      /* state->mode */
+  uint32_t nmacros;
+  uint32_t macros;    /* image offset of the macro records */
+  uint32_t nsections;
+  uint32_t sections;  /* image offset of the section records */
+  uint32_t nfiles;
+  uint32_t files;     /* image offset of the file records */
+  uint32_t nsymbols;
+  uint32_t symbols;   /* image offset of the symbol records */
+  uint32_t pool;      /* image offset of the string pool */
+  uint32_t poolsize;
+  uint32_t backenddata; /* image offset of the backend state, after the pool */
+  uint32_t backendlen;
+};
+
+struct pch_macro_s
+{
+  uint32_t bucket;    /* in state->macros */
+  uint32_t name;      /* pool offsets */
+  uint32_t body;
+  int32_t  nparams;   /* -1 for object-like macros */
+  uint32_t variadic;
+  uint32_t params[CONFIG_ASM_PP_PARAMS];
+};
+
+struct pch_section_s
+{
+  uint32_t name;      /* pool offset */
+  uint32_t data;      /* image offset of the contents */
+  uint32_t len;
+  uint32_t align;     /* largest .align */
+};
+
+struct pch_symbol_s
+{
+  uint32_t name;      /* pool offset */
+  uint32_t section;   /* index of the section record, PCH_NONE if undefined */
+  uint32_t value;     /* offset in the section */
+  uint8_t  global;
+  uint8_t  mode;
+  uint8_t  pad[2];
+};
+
+/* string pool being built */
+
+struct pch_pool_s
+{
+  char     *buf;
+  uint32_t len;
+  uint32_t size;
+  int      failed;  /* TRUE if an allocation failed */
+};
+
+/*****************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/* Add a string to the pool, returns its offset */
+
+static uint32_t pch_string(struct pch_pool_s *pool, const char *str)
+{
+  uint32_t len = strlen(str) + 1;
+  uint32_t off = pool->len;
+  char *buf;
+
+  if (pool->len + len > pool->size)
+    {
+      pool->size = (pool->size + len) * 2;
+      buf = realloc(pool->buf, pool->size);
+      if (!buf)
+        {
+          pool->failed = 1;
+          return 0;
+        }
+      pool->buf = buf;
+    }
+  memcpy(pool->buf + off, str, len);
+  pool->len += len;
+  return off;
+}
+
+/*****************************************************************************/
+/* Fill the records and the pool from the state */
+
+static int pch_collect(struct asm_state_s *state, struct pch_header_s *hdr, struct pch_pool_s *pool,
+                       struct pch_macro_s *macros, struct pch_section_s *sections, uint32_t *files,
+                       struct pch_symbol_s *symbols)
+{
+  uint32_t index[CONFIG_ASM_SEC_MAX]; /* section record of each section */
+  struct asm_symbol_s *sym;
+  struct asm_file_s *file;
+  uint32_t data;
+  int i;
+
+  hdr->backend = pch_string(pool, state->infos.name);
+
+#if CONFIG_ASM_PREPROC
+  {
+    struct asm_macro_s *m;
+    struct pch_macro_s *rec = macros;
+    int j;
+
+    for (i = 0; i < CONFIG_ASM_PP_HASH; i++)
+      {
+        for (m = state->macros[i]; m; m = m->next, rec++)
+          {
+            memset(rec, 0, sizeof(*rec));
+            rec->bucket   = i;
+            rec->name     = pch_string(pool, m->name);
+            rec->body     = pch_string(pool, m->body);
+            rec->nparams  = m->nparams;
+            rec->variadic = m->variadic;
+            for (j = 0; j < m->nparams; j++)
+              {
+                rec->params[j] = pch_string(pool, m->params[j]);
+              }
+          }
+      }
+  }
+#endif
+
+  /* contents follow the pool, in record order */
+
+  data = 0;
+  for (i = 0; i < CONFIG_ASM_SEC_MAX; i++)
+    {
+      struct asm_section_s *sec = &state->sections[i];
+      if (!sec->name[0])
+        {
+          continue;
+        }
+      if (sec->spill)
+        {
+          return emit_message(state, ASM_ERROR, "Cannot save spilled section %s in a pch", sec->name);
+        }
+      if (sec == state->current_section)
+        {
+          hdr->current = hdr->nsections;
+        }
+      index[i] = hdr->nsections;
+      sections[hdr->nsections].name  = pch_string(pool, sec->name);
+      sections[hdr->nsections].data  = data;
+      sections[hdr->nsections].len   = section_size(sec);
+      sections[hdr->nsections].align = sec->align;
+      data += sections[hdr->nsections].len;
+      hdr->nsections++;
+    }
+
+  for (file = state->incorder; file; file = file->order)
+    {
+      if (file->path)
+        {
+          files[hdr->nfiles] = pch_string(pool, file->path);
+          hdr->nfiles++;
+        }
+    }
+
+  for (i = 0; i < CONFIG_ASM_SYM_HASH; i++)
+    {
+      for (sym = state->symbols[i]; sym; sym = sym->next, symbols++)
+        {
+          memset(symbols, 0, sizeof(*symbols));
+          symbols->name    = pch_string(pool, sym->name);
+          symbols->section = sym->section ? index[sym->section - state->sections] : PCH_NONE;
+          symbols->value   = sym->value;
+          symbols->global  = sym->global;
+          symbols->mode    = sym->mode;
+        }
+    }
+
+  if (pool->failed)
+    {
+      return emit_message(state, ASM_ERROR, "malloc() failed");
+    }
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* Save the state left by the parsed prelude to a pch file. The file is
+ * written under a temporary name then renamed, so that concurrent builds
+ * never read a partial image.
+ */
+
+int pch_write(struct asm_state_s *state, const char *name)
+{
+  const struct asm_backend_s *backend = state->current_backend;
+  struct pch_header_s  hdr;
+  struct pch_pool_s    pool;
+  struct pch_macro_s   *macros = NULL;
+  struct pch_section_s sections[CONFIG_ASM_SEC_MAX];
+  struct pch_symbol_s  *symbols = NULL;
+  struct asm_symbol_s  *sym;
+  struct asm_chunk_s   *chunk;
+  struct asm_file_s    *file;
+  uint32_t *files = NULL;
+  uint8_t  *bdata = NULL;
+  uint32_t nmacros = 0;
+  uint32_t nfiles = 0;
+  uint32_t nsymbols = 0;
+  uint32_t i;
+  char *tmp = NULL;
+  FILE *out = NULL;
+  int fd;
+  int ret = ASM_ERROR;
+
+  /* symbols are saved, the references left to the link stage are not */
+
+  for (i = 0; i < CONFIG_ASM_SEC_MAX; i++)
+    {
+      if (state->sections[i].relocs)
+        {
+          return emit_message(state, ASM_ERROR, "A precompiled prelude cannot reference symbols");
+        }
+    }
+
+  memset(&hdr, 0, sizeof(hdr));
+  memset(&pool, 0, sizeof(pool));
+  memcpy(hdr.magic, PCH_MAGIC, sizeof(hdr.magic));
+  hdr.version = PCH_VERSION;
+  hdr.order   = PCH_ORDER;
+  hdr.params  = CONFIG_ASM_PP_PARAMS;
+  hdr.hash    = CONFIG_ASM_PP_HASH;
+  hdr.current = PCH_NONE;
+  hdr.mode    = state->mode;
+
+  /* records are allocated for the worst case, they are small */
+
+#if CONFIG_ASM_PREPROC
+  for (i = 0; i < CONFIG_ASM_PP_HASH; i++)
+    {
+      struct asm_macro_s *m;
+      for (m = state->macros[i]; m; m = m->next)
+        {
+          nmacros++;
+        }
+    }
+#endif
+  for (file = state->incorder; file; file = file->order)
+    {
+      nfiles++;
+    }
+  for (i = 0; i < CONFIG_ASM_SYM_HASH; i++)
+    {
+      for (sym = state->symbols[i]; sym; sym = sym->next)
+        {
+          nsymbols++;
+        }
+    }
+  if (backend->save)
+    {
+      hdr.backendlen = backend->save(backend, state, NULL);
+    }
+  macros = malloc(nmacros * sizeof(struct pch_macro_s) + 1);
+  files  = malloc(nfiles * sizeof(uint32_t) + 1);
+  bdata  = malloc(hdr.backendlen + 1);
+  symbols = malloc(nsymbols * sizeof(struct pch_symbol_s) + 1);
+  if (!macros || !files || !bdata || !symbols)
+    {
+      emit_message(state, ASM_ERROR, "malloc() failed");
+      goto done;
+    }
+  hdr.nmacros  = nmacros;
+  hdr.nsymbols = nsymbols;
+  if (pch_collect(state, &hdr, &pool, macros, sections, files, symbols) != ASM_OK)
+    {
+      goto done;
+    }
+
+  /* layout */
+
+  hdr.macros   = sizeof(hdr);
+  hdr.sections = hdr.macros + hdr.nmacros * sizeof(struct pch_macro_s);
+  hdr.files    = hdr.sections + hdr.nsections * sizeof(struct pch_section_s);
+  hdr.symbols  = hdr.files + hdr.nfiles * sizeof(uint32_t);
+  hdr.pool     = hdr.symbols + hdr.nsymbols * sizeof(struct pch_symbol_s);
+  hdr.poolsize = pool.len;
+  hdr.backenddata = hdr.pool + pool.len;
+  hdr.size     = hdr.backenddata + hdr.backendlen;
+  if (hdr.backendlen)
+    {
+      backend->save(backend, state, bdata);
+    }
+  for (i = 0; i < hdr.nsections; i++)
+    {
+      sections[i].data += hdr.backenddata + hdr.backendlen;
+      hdr.size += sections[i].len;
+    }
+
+  tmp = malloc(strlen(name) + 8);
+  if (!tmp)
+    {
+      emit_message(state, ASM_ERROR, "malloc() failed");
+      goto done;
+    }
+  sprintf(tmp, "%s.XXXXXX", name);
+  fd = mkstemp(tmp);
+  if (fd < 0)
+    {
+      emit_message(state, ASM_ERROR, "Cannot create '%s'", name);
+      goto done;
+    }
+  fchmod(fd, 0644); /* mkstemp() makes it private */
+  out = fdopen(fd, "wb");
+  if (!out)
+    {
+      close(fd);
+      unlink(tmp);
+      emit_message(state, ASM_ERROR, "Cannot create '%s'", name);
+      goto done;
+    }
+
+  fwrite(&hdr, sizeof(hdr), 1, out);
+  fwrite(macros, sizeof(struct pch_macro_s), hdr.nmacros, out);
+  fwrite(sections, sizeof(struct pch_section_s), hdr.nsections, out);
+  fwrite(files, sizeof(uint32_t), hdr.nfiles, out);
+  fwrite(symbols, sizeof(struct pch_symbol_s), hdr.nsymbols, out);
+  fwrite(pool.buf, 1, pool.len, out);
+  fwrite(bdata, 1, hdr.backendlen, out);
+  for (i = 0; i < CONFIG_ASM_SEC_MAX; i++)
+    {
+      for (chunk = state->sections[i].data.first; chunk; chunk = chunk->next)
+        {
+          fwrite(chunk->data, 1, chunk->len, out);
+        }
+    }
+
+  if (ferror(out) | fclose(out) || rename(tmp, name))
+    {
+      unlink(tmp);
+      emit_message(state, ASM_ERROR, "Cannot write '%s'", name);
+      goto done;
+    }
+
+  TRACE(state, DEBUG_PP, 1, "pch %s: %u macros, %u sections, %u files, %u symbols, %u bytes\n",
+        name, hdr.nmacros, hdr.nsections, hdr.nfiles, hdr.nsymbols, hdr.size);
+  ret = ASM_OK;
+
+done:
+  free(tmp);
+  free(pool.buf);
+  free(bdata);
+  free(symbols);
+  free(files);
+  free(macros);
+  return ret;
+}
+
+/*****************************************************************************/
+/* Check that all offsets of an image are within it */
+
+static int pch_check(const uint8_t *image, uint32_t len)
+{
+  const struct pch_header_s  *hdr = (const struct pch_header_s*)image;
+  const struct pch_macro_s   *macros;
+  const struct pch_section_s *sections;
+  const struct pch_symbol_s  *symbols;
+  const uint32_t *files;
+  uint32_t i;
+  int j;
+
+  if (len < sizeof(*hdr) || memcmp(hdr->magic, PCH_MAGIC, sizeof(hdr->magic)) ||
+      hdr->version != PCH_VERSION || hdr->order != PCH_ORDER ||
+      hdr->params != CONFIG_ASM_PP_PARAMS || hdr->hash != CONFIG_ASM_PP_HASH || hdr->size != len)
+    {
+      return ASM_ERROR;
+    }
+  if (hdr->macros != sizeof(*hdr) ||
+      hdr->sections != hdr->macros + (uint64_t)hdr->nmacros * sizeof(struct pch_macro_s) ||
+      hdr->files != hdr->sections + (uint64_t)hdr->nsections * sizeof(struct pch_section_s) ||
+      hdr->symbols != hdr->files + (uint64_t)hdr->nfiles * sizeof(uint32_t) ||
+      hdr->pool != hdr->symbols + (uint64_t)hdr->nsymbols * sizeof(struct pch_symbol_s) ||
+      (uint64_t)hdr->pool + hdr->poolsize > len || hdr->poolsize == 0 ||
+      hdr->backenddata != hdr->pool + hdr->poolsize || (uint64_t)hdr->backenddata + hdr->backendlen > len ||
+      image[hdr->pool + hdr->poolsize - 1] != 0 || hdr->nsections > CONFIG_ASM_SEC_MAX ||
+      (hdr->current != PCH_NONE && hdr->current >= hdr->nsections) ||
+      hdr->backend >= hdr->poolsize)
+    {
+      return ASM_ERROR;
+    }
+
+  /* the pool ends with a NUL, so any offset in it is a valid string */
+
+  macros = (const struct pch_macro_s*)(image + hdr->macros);
+  for (i = 0; i < hdr->nmacros; i++)
+    {
+      if (macros[i].bucket >= CONFIG_ASM_PP_HASH ||
+          macros[i].name >= hdr->poolsize || macros[i].body >= hdr->poolsize ||
+          macros[i].nparams < -1 || macros[i].nparams > CONFIG_ASM_PP_PARAMS)
+        {
+          return ASM_ERROR;
+        }
+      for (j = 0; j < macros[i].nparams; j++)
+        {
+          if (macros[i].params[j] >= hdr->poolsize)
+            {
+              return ASM_ERROR;
+            }
+        }
+    }
+  sections = (const struct pch_section_s*)(image + hdr->sections);
+  for (i = 0; i < hdr->nsections; i++)
+    {
+      if (sections[i].name >= hdr->poolsize || (uint64_t)sections[i].data + sections[i].len > len)
+        {
+          return ASM_ERROR;
+        }
+    }
+  files = (const uint32_t*)(image + hdr->files);
+  for (i = 0; i < hdr->nfiles; i++)
+    {
+      if (files[i] >= hdr->poolsize)
+        {
+          return ASM_ERROR;
+        }
+    }
+  symbols = (const struct pch_symbol_s*)(image + hdr->symbols);
+  for (i = 0; i < hdr->nsymbols; i++)
+    {
+      if (symbols[i].name >= hdr->poolsize ||
+          (symbols[i].section != PCH_NONE && (symbols[i].section >= hdr->nsections ||
+                                              symbols[i].value > sections[symbols[i].section].len)))
+        {
+          return ASM_ERROR;
+        }
+    }
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* Map or read a pch image */
+
+static int pch_map(struct asm_state_s *state, const char *name)
+{
+  struct stat st;
+  uint32_t done;
+  int fd;
+  int ret;
+
+  fd = open(name, O_RDONLY);
+  if (fd < 0)
+    {
+      return emit_message(state, ASM_ERROR, "Cannot open '%s'", name);
+    }
+  if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct pch_header_s) || st.st_size > UINT32_MAX)
+    {
+      close(fd);
+      return emit_message(state, ASM_ERROR, "'%s' is not a pch", name);
+    }
+  state->pchlen = st.st_size;
+
+#if CONFIG_ASM_MMAP
+  if (!MEM_BUDGETED(state))
+    {
+      void *map = mmap(NULL, state->pchlen, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map != MAP_FAILED)
+        {
+          close(fd);
+          state->pch       = map;
+          state->pchmapped = 1;
+          return ASM_OK;
+        }
+    }
+#endif
+
+  state->pch = asm_malloc(state, MEM_PP, state->pchlen);
+  if (!state->pch)
+    {
+      close(fd);
+      return emit_message(state, ASM_ERROR, "malloc() failed");
+    }
+  for (done = 0; done < state->pchlen; done += ret)
+    {
+      ret = read(fd, state->pch + done, state->pchlen - done);
+      if (ret <= 0)
+        {
+          close(fd);
+          return emit_message(state, ASM_ERROR, "Cannot read '%s'", name);
+        }
+    }
+  close(fd);
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* Restore the state saved by pch_write(), before parsing. The macros of the
+ * pch replace all those already defined. Symbols are restored as if the
+ * prelude was at the start of the next input: it sees those of the prelude
+ * that are not .global, the other inputs do not.
+ */
+
+int pch_load(struct asm_state_s *state, const char *name)
+{
+  const struct asm_backend_s *backend = state->current_backend;
+  const struct pch_header_s  *hdr;
+  const struct pch_section_s *sections;
+  const struct pch_symbol_s  *symbols;
+  const uint32_t *files;
+  const char *pool;
+  struct asm_section_s *secs[CONFIG_ASM_SEC_MAX];
+  uint32_t base[CONFIG_ASM_SEC_MAX];
+  struct asm_section_s *sec;
+  struct asm_symbol_s *sym;
+  uint32_t i;
+
+  if (state->pch)
+    {
+      return emit_message(state, ASM_ERROR, "Only one pch can be used");
+    }
+
+  /* the pch is a dependency, along with the files of the prelude */
+
+  if (!include_find(state, name, 0))
+    {
+      return ASM_ERROR;
+    }
+  if (pch_map(state, name) != ASM_OK)
+    {
+      return ASM_ERROR;
+    }
+  if (pch_check(state->pch, state->pchlen) != ASM_OK)
+    {
+      return emit_message(state, ASM_ERROR, "'%s' is not a pch of this tcasm", name);
+    }
+  hdr  = (const struct pch_header_s*)state->pch;
+  pool = (const char*)state->pch + hdr->pool;
+  if (strcmp(pool + hdr->backend, state->infos.name))
+    {
+      return emit_message(state, ASM_ERROR, "'%s' was made for backend %s", name, pool + hdr->backend);
+    }
+  if (hdr->backendlen && !backend->restore)
+    {
+      return emit_message(state, ASM_ERROR, "'%s' has a backend state that cannot be restored", name);
+    }
+  if (hdr->backendlen && backend->restore(backend, state, state->pch + hdr->backenddata, hdr->backendlen) != ASM_OK)
+    {
+      return ASM_ERROR;
+    }
+  state->mode = hdr->mode;
+
+#if CONFIG_ASM_PREPROC
+  if (hdr->nmacros)
+    {
+      const struct pch_macro_s *rec = (const struct pch_macro_s*)(state->pch + hdr->macros);
+      struct asm_macro_s *m;
+      int j;
+
+      state->pchmacros = asm_malloc(state, MEM_PP, hdr->nmacros * sizeof(struct asm_macro_s));
+      if (!state->pchmacros)
+        {
+          return emit_message(state, ASM_ERROR, "malloc() failed");
+        }
+
+      /* records of a bucket are in chain order, build the chains backwards */
+
+      pp_release(state);
+      rec += hdr->nmacros - 1;
+      for (i = hdr->nmacros; i-- > 0; rec--)
+        {
+          m = &state->pchmacros[i];
+          m->name     = (char*)pool + rec->name;
+          m->body     = (char*)pool + rec->body;
+          m->nparams  = rec->nparams;
+          m->variadic = rec->variadic;
+          m->active   = 0;
+          m->pch      = 1;
+          for (j = 0; j < m->nparams; j++)
+            {
+              m->params[j] = (char*)pool + rec->params[j];
+            }
+          m->next = state->macros[rec->bucket];
+          state->macros[rec->bucket] = m;
+        }
+    }
+#endif
+
+  sections = (const struct pch_section_s*)(state->pch + hdr->sections);
+  for (i = 0; i < hdr->nsections; i++)
+    {
+      sec = section_find_create(state, pool + sections[i].name);
+      if (!sec)
+        {
+          return ASM_ERROR;
+        }
+      secs[i] = sec;
+      base[i] = section_size(sec);
+      if (sections[i].len && chunk_append(state, &sec->data, state->pch + sections[i].data, sections[i].len) != ASM_OK)
+        {
+          return ASM_ERROR;
+        }
+      if (sections[i].align > sec->align)
+        {
+          sec->align = sections[i].align;
+        }
+      if (i == hdr->current)
+        {
+          state->current_section = sec;
+        }
+    }
+
+  symbols = (const struct pch_symbol_s*)(state->pch + hdr->symbols);
+  for (i = 0; i < hdr->nsymbols; i++)
+    {
+      sym = symbol_find(state, pool + symbols[i].name, state->unit + 1, 1);
+      if (!sym)
+        {
+          return ASM_ERROR;
+        }
+      if (sym->section)
+        {
+          return emit_message(state, ASM_ERROR, "Symbol '%s' of '%s' is already defined",
+                              sym->name, name);
+        }
+      if (symbols[i].section != PCH_NONE)
+        {
+          sym->section = secs[symbols[i].section];
+          sym->value   = base[symbols[i].section] + symbols[i].value;
+        }
+      sym->global |= symbols[i].global;
+      sym->mode    = symbols[i].mode;
+    }
+
+  files = (const uint32_t*)(state->pch + hdr->files);
+  for (i = 0; i < hdr->nfiles; i++)
+    {
+      if (!include_find(state, pool + files[i], 0))
+        {
+          return ASM_ERROR;
+        }
+    }
+
+  TRACE(state, DEBUG_PP, 1, "pch %s: %u macros, %u sections, %u files, %u symbols restored\n",
+        name, hdr->nmacros, hdr->nsections, hdr->nfiles, hdr->nsymbols);
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* Free the pch image, its macros must have been released */
+
+void pch_release(struct asm_state_s *state)
+{
+  asm_free(state, state->pchmacros);
+  state->pchmacros = NULL;
+  if (!state->pch)
+    {
+      return;
+    }
+#if CONFIG_ASM_MMAP
+  if (state->pchmapped)
+    {
+      munmap(state->pch, state->pchlen);
+    }
+  else
+#endif
+    {
+      asm_free(state, state->pch);
+    }
+  state->pch       = NULL;
+  state->pchmapped = 0;
+}
+
+#endif /* CONFIG_ASM_PCH */
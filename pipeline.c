@@ -0,0 +1,422 @@
+/* pipelined input for tcasm
+ *
+ * With -p, the top level input file is handled by three threads:
+ * - a reader thread reads the file in large blocks,
+ * - a tokenizer thread splits the blocks in lines and tokenizes them,
+ * - the main thread parses the tokens and encodes into the sections.
+ * Stages are connected by single producer / single consumer rings of
+ * preallocated slots, so nothing is allocated per line. Each ring only has
+ * two atomic counters: the producer owns head, the consumer owns tail.
+ *
+ * Lines are cut and truncated exactly like parse_file() does, and all
+ * messages are emitted by the main thread, so the results are the same as
+ * in serial mode. Preprocessed files and included files are parsed serially.
+ */
+
+#include "config.h"
+
+#if CONFIG_ASM_PIPELINE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "tcasm.h"
+
+/*****************************************************************************
+ * Definitions
+ *****************************************************************************/
+
+#define PIPE_LINE_EOF   0x01 /* no more lines */
+#define PIPE_LINE_TRUNC 0x02 /* line was longer than the line buffer */
+#define PIPE_LINE_ERROR 0x04 /* read error, no more lines */
+
+#define PIPE_SPINS 64 /* busy waits before yielding the cpu */
+
+#if (CONFIG_ASM_PIPE_BLOCKS & (CONFIG_ASM_PIPE_BLOCKS - 1)) || \
+    (CONFIG_ASM_PIPE_LINES & (CONFIG_ASM_PIPE_LINES - 1))
+#error CONFIG_ASM_PIPE_BLOCKS and CONFIG_ASM_PIPE_LINES must be powers of two
+#endif
+
+/*****************************************************************************
+ * Types
+ *****************************************************************************/
+
+/* single producer / single consumer ring indices. Slots are stored apart */
+
+struct pipe_ring_s
+{
+  _Atomic uint32_t head; /* next slot to fill, written by the producer */
+  _Atomic uint32_t tail; /* next slot to use, written by the consumer */
+  uint32_t         size; /* number of slots, power of two */
+};
+
+/* input block, from the reader to the tokenizer. A short block is the last */
+
+struct pipe_block_s
+{
+  int      len;
+  int      error;
+  uint8_t  data[CONFIG_ASM_PIPE_BLOCK];
+};
+
+/* tokenized line, from the tokenizer to the main thread */
+
+struct pipe_line_s
+{
+  int      line;   /* line number */
+  int      flags;  /* PIPE_LINE_xxx */
+  int      end;    /* end of significant text */
+  int      ntokens;
+  struct asm_token_s tokens[CONFIG_ASM_TOKENS];
+  char     text[CONFIG_ASM_INBUF_SIZE];
+};
+
+/* everything shared by the three threads */
+
+struct pipe_s
+{
+  int                 fd;
+  atomic_int          stop;  /* set by the main thread to abort */
+  struct pipe_ring_s  blockring;
+  struct pipe_ring_s  linering;
+  struct pipe_block_s blocks[CONFIG_ASM_PIPE_BLOCKS];
+  struct pipe_line_s  lines[CONFIG_ASM_PIPE_LINES];
+};
+
+/*****************************************************************************
+ * Functions
+ *****************************************************************************/
+
+static void pipe_ring_init(struct pipe_ring_s *ring, uint32_t size)
+{
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  ring->size = size;
+}
+
+/*****************************************************************************/
+/* Wait until a slot is free, return its index or -1 if stopped */
+
+static int pipe_ring_reserve(struct pipe_s *pipe, struct pipe_ring_s *ring)
+{
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  int spins = 0;
+
+  while (head - atomic_load_explicit(&ring->tail, memory_order_acquire) == ring->size)
+    {
+      if (atomic_load_explicit(&pipe->stop, memory_order_relaxed))
+        {
+          return -1;
+        }
+      if (++spins > PIPE_SPINS)
+        {
+          sched_yield();
+        }
+    }
+  return head & (ring->size - 1);
+}
+
+/*****************************************************************************/
+/* Make the reserved slot visible to the consumer */
+
+static void pipe_ring_publish(struct pipe_ring_s *ring)
+{
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/*****************************************************************************/
+/* Wait until a slot is filled, return its index or -1 if stopped */
+
+static int pipe_ring_peek(struct pipe_s *pipe, struct pipe_ring_s *ring)
+{
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  int spins = 0;
+
+  while (atomic_load_explicit(&ring->head, memory_order_acquire) == tail)
+    {
+      if (atomic_load_explicit(&pipe->stop, memory_order_relaxed))
+        {
+          return -1;
+        }
+      if (++spins > PIPE_SPINS)
+        {
+          sched_yield();
+        }
+    }
+  return tail & (ring->size - 1);
+}
+
+/*****************************************************************************/
+/* Give the consumed slot back to the producer */
+
+static void pipe_ring_release(struct pipe_ring_s *ring)
+{
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+/*****************************************************************************/
+/* reader thread: fill blocks until end of file */
+
+static void *pipe_reader(void *arg)
+{
+  struct pipe_s *pipe = arg;
+  struct pipe_block_s *block;
+  int slot;
+  int ret;
+
+  do
+    {
+      slot = pipe_ring_reserve(pipe, &pipe->blockring);
+      if (slot < 0)
+        {
+          break;
+        }
+      block = &pipe->blocks[slot];
+      block->len   = 0;
+      block->error = 0;
+      while (block->len < CONFIG_ASM_PIPE_BLOCK)
+        {
+          ret = read(pipe->fd, block->data + block->len, CONFIG_ASM_PIPE_BLOCK - block->len);
+          if (ret <= 0)
+            {
+              block->error = (ret < 0);
+              break;
+            }
+          block->len += ret;
+        }
+      pipe_ring_publish(&pipe->blockring);
+    }
+  while (block->len == CONFIG_ASM_PIPE_BLOCK);
+
+  return NULL;
+}
+
+/*****************************************************************************/
+/* tokenize a complete line and send it to the main thread */
+
+static int pipe_send_line(struct pipe_s *pipe, struct pipe_line_s *line, int len)
+{
+  line->text[len] = 0;
+  line->end = tokenize(line->tokens, &line->ntokens, line->text, len);
+  pipe_ring_publish(&pipe->linering);
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* tokenizer thread: cut blocks in lines. Only the beginning of long lines is
+ * kept, like parse_file() does.
+ */
+
+static void *pipe_tokenizer(void *arg)
+{
+  struct pipe_s *pipe = arg;
+  struct pipe_block_s *block;
+  struct pipe_line_s  *line = NULL;
+  const uint8_t *base;
+  const uint8_t *eol;
+  int linenum = 0;
+  int linelen = 0; /* bytes kept in the current line */
+  int flags = 0;
+  int last;
+  int slot;
+  int avail;
+  int keep;
+  int pos;
+
+  while (1)
+    {
+      slot = pipe_ring_peek(pipe, &pipe->blockring);
+      if (slot < 0)
+        {
+          return NULL;
+        }
+      block = &pipe->blocks[slot];
+
+      if (block->error)
+        {
+          flags = PIPE_LINE_ERROR;
+          pipe_ring_release(&pipe->blockring);
+          break;
+        }
+
+      for (pos = 0; pos < block->len; pos += avail)
+        {
+          base  = block->data + pos;
+          avail = block->len - pos;
+          eol   = memchr(base, '\n', avail);
+          avail = eol ? (eol - base + 1) : avail;
+
+          if (!line)
+            {
+              slot = pipe_ring_reserve(pipe, &pipe->linering);
+              if (slot < 0)
+                {
+                  return NULL;
+                }
+              line = &pipe->lines[slot];
+              line->line  = ++linenum;
+              line->flags = 0;
+              linelen = 0;
+            }
+
+          keep = avail;
+          if (keep > sizeof(line->text) - 1 - linelen)
+            {
+              keep = sizeof(line->text) - 1 - linelen;
+              line->flags |= PIPE_LINE_TRUNC;
+            }
+          memcpy(line->text + linelen, base, keep);
+          linelen += keep;
+
+          if (eol)
+            {
+              pipe_send_line(pipe, line, linelen);
+              line = NULL;
+            }
+        }
+
+      /* a short block is the last one */
+
+      last = (block->len < CONFIG_ASM_PIPE_BLOCK);
+      pipe_ring_release(&pipe->blockring);
+      if (last)
+        {
+          flags = PIPE_LINE_EOF;
+          break;
+        }
+    }
+
+  /* last line without end of line */
+
+  if (line)
+    {
+      pipe_send_line(pipe, line, linelen);
+    }
+
+  slot = pipe_ring_reserve(pipe, &pipe->linering);
+  if (slot >= 0)
+    {
+      pipe->lines[slot].line  = linenum;
+      pipe->lines[slot].flags = flags;
+      pipe_ring_publish(&pipe->linering);
+    }
+  return NULL;
+}
+
+/*****************************************************************************/
+/* Parse the top level input file with the reader and tokenizer threads */
+
+int pipe_parse(struct asm_state_s *state, struct asm_file_s *file)
+{
+  struct asm_file_s input;
+  struct asm_file_s *previnput = state->input;
+  uint32_t prevpos  = state->inpos;
+  int      prevline = state->curline;
+  char     *prevname = state->inputname;
+  struct pipe_line_s *line;
+  struct pipe_s *pipe;
+  pthread_t reader;
+  pthread_t tokenizer;
+  int ret = ASM_OK;
+  int slot;
+
+  pipe = asm_malloc(state, MEM_PIPE, sizeof(struct pipe_s));
+  if (!pipe)
+    {
+      return emit_message(state, ASM_ERROR, "malloc() failed");
+    }
+
+  pipe->fd = open(file->path, O_RDONLY);
+  if (pipe->fd < 0)
+    {
+      asm_free(state, pipe);
+      return emit_message(state, ASM_ERROR, "Cannot open '%s'", file->path);
+    }
+
+  atomic_init(&pipe->stop, 0);
+  pipe_ring_init(&pipe->blockring, CONFIG_ASM_PIPE_BLOCKS);
+  pipe_ring_init(&pipe->linering, CONFIG_ASM_PIPE_LINES);
+
+  if (pthread_create(&reader, NULL, pipe_reader, pipe))
+    {
+      close(pipe->fd);
+      asm_free(state, pipe);
+      return emit_message(state, ASM_ERROR, "Cannot create reader thread");
+    }
+  if (pthread_create(&tokenizer, NULL, pipe_tokenizer, pipe))
+    {
+      atomic_store(&pipe->stop, 1);
+      pthread_join(reader, NULL);
+      close(pipe->fd);
+      asm_free(state, pipe);
+      return emit_message(state, ASM_ERROR, "Cannot create tokenizer thread");
+    }
+
+  TRACE(state, DEBUG_PARSE, 1, "pipelined parse of %s\n", file->path);
+
+  /* .end works by moving the read position to the end of the input */
+
+  input      = *file;
+  input.len  = UINT32_MAX;
+  state->input     = &input;
+  state->inpos     = 0;
+  state->curline   = 0;
+  state->inputname = file->path;
+
+  while (state->inpos < input.len)
+    {
+      slot = pipe_ring_peek(pipe, &pipe->linering);
+      line = &pipe->lines[slot];
+      state->curline = line->line;
+
+      if (line->flags & (PIPE_LINE_EOF | PIPE_LINE_ERROR))
+        {
+          if (line->flags & PIPE_LINE_ERROR)
+            {
+              ret = emit_message(state, ASM_ERROR, "Cannot read '%s'", file->path);
+            }
+          pipe_ring_release(&pipe->linering);
+          break;
+        }
+
+      if (line->flags & PIPE_LINE_TRUNC)
+        {
+          emit_message(state, ASM_WARN, "Long line truncated");
+        }
+
+      state->tokens  = line->tokens;
+      state->ntokens = line->ntokens;
+      ret = parse_tokens(state, line->text, line->end);
+      pipe_ring_release(&pipe->linering);
+      if (ret == ASM_ERROR)
+        {
+          break;
+        }
+    }
+
+  /* stop the other threads if the input was not read until the end */
+
+  atomic_store(&pipe->stop, 1);
+  pthread_join(tokenizer, NULL);
+  pthread_join(reader, NULL);
+  close(pipe->fd);
+  asm_free(state, pipe);
+
+  state->input     = previnput;
+  state->inpos     = prevpos;
+  state->curline   = prevline;
+  state->inputname = prevname;
+  state->tokens    = state->tokbuf;
+  return (ret == ASM_ERROR) ? ASM_ERROR : ASM_OK;
+}
+
+#endif /* CONFIG_ASM_PIPELINE */
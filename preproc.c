@@ -0,0 +1,1187 @@
+/* lightweight C preprocessor for tcasm
+ *
+ * This is a subset of cpp that is enough for the .S files of NuttX, without
+ * spawning an external compiler: #define (object and function-like), #undef,
+ * #include, #if/#ifdef/#ifndef/#elif/#else/#endif with defined(), #error and
+ * #warning. C comments are removed. Lines are expanded one by one and given
+ * directly to the line parser.
+ *
+ * A line starting with # is a preprocessor directive only if the word after
+ * the # is a known directive name. Other # lines stay line comments.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "tcasm.h"
+
+#if CONFIG_ASM_PREPROC
+
+/*****************************************************************************
+ * Definitions
+ *****************************************************************************/
+
+/* conditional stack flags */
+
+#define PP_ACTIVE 0x01 /* lines at this level are assembled */
+#define PP_TAKEN  0x02 /* a branch at this level was already taken */
+#define PP_ELSE   0x04 /* #else was seen at this level */
+
+/* maximum recursion of macro expansion */
+
+#define PP_NEST   32
+
+/*****************************************************************************
+ * Types
+ *****************************************************************************/
+
+/* expansion output buffer */
+
+struct pp_out_s
+{
+  char *buf;
+  int  len;
+  int  size;
+  int  overflow;
+};
+
+/* #if expression evaluation state */
+
+struct pp_expr_s
+{
+  const char *pos;
+  int  noeval; /* TRUE in the unevaluated side of && || ?: */
+  const char *error;
+};
+
+/*****************************************************************************
+ * Functions
+ *****************************************************************************/
+
+static int pp_isidstart(int c)
+{
+  return isalpha(c) || c == '_';
+}
+
+static int pp_isident(int c)
+{
+  return isalnum(c) || c == '_';
+}
+
+/*****************************************************************************/
+
+static uint32_t pp_hash(const char *name, int len)
+{
+  uint32_t h = 2166136261U; /* FNV-1a */
+  while (len--)
+    {
+      h ^= (uint8_t)*name++;
+      h *= 16777619U;
+    }
+  return h % CONFIG_ASM_PP_HASH;
+}
+
+/*****************************************************************************/
+
+static struct asm_macro_s **pp_find(struct asm_state_s *state, const char *name, int len)
+{
+  struct asm_macro_s **m = &state->macros[pp_hash(name, len)];
+  while (*m)
+    {
+      if (!strncmp((*m)->name, name, len) && !(*m)->name[len])
+        {
+          break;
+        }
+      m = &(*m)->next;
+    }
+  return m;
+}
+
+/*****************************************************************************/
+/* Free a macro, unless it belongs to a loaded pch */
+
+static void pp_free(struct asm_state_s *state, struct asm_macro_s *m)
+{
+  if (!m->pch)
+    {
+      asm_free(state, m);
+    }
+}
+
+/*****************************************************************************/
+
+static void pp_put(struct pp_out_s *out, const char *str, int len)
+{
+  if (out->len + len >= out->size)
+    {
+      out->overflow = 1;
+      len = out->size - 1 - out->len;
+    }
+  memcpy(out->buf + out->len, str, len);
+  out->len += len;
+  out->buf[out->len] = 0;
+}
+
+/*****************************************************************************/
+/* length of a string or char literal starting at str, quotes included */
+
+static int pp_literal(const char *str, int len)
+{
+  int i = 1;
+  while (i < len && str[i] != str[0])
+    {
+      if (str[i] == '\\' && i + 1 < len)
+        {
+          i++;
+        }
+      i++;
+    }
+  return (i < len) ? i + 1 : len;
+}
+
+/*****************************************************************************/
+
+static int pp_expand(struct asm_state_s *state, const char *src, int len, struct pp_out_s *out, int depth);
+
+/*****************************************************************************/
+/* Substitute the arguments of a function-like macro in its body, then rescan.
+ * args[] are the raw arguments, as pointer/length pairs.
+ */
+
+static int pp_expand_function(struct asm_state_s *state, struct asm_macro_s *m,
+                              const char **args, int *arglens, struct pp_out_s *out, int depth)
+{
+  char buf[CONFIG_ASM_PPBUF_SIZE];
+  char argbuf[CONFIG_ASM_PPBUF_SIZE];
+  struct pp_out_s tmp = {buf, 0, sizeof(buf), 0};
+  struct pp_out_s arg;
+  const char *body = m->body;
+  const char *id;
+  int  pasting = 0;
+  int  stringify;
+  int  i, k, idlen;
+  int  ret;
+
+  buf[0] = 0;
+  while (*body)
+    {
+      if (body[0] == '#' && body[1] == '#')
+        {
+          /* token pasting: remove spaces around ## */
+          while (tmp.len && (buf[tmp.len - 1] == ' ' || buf[tmp.len - 1] == '\t'))
+            {
+              buf[--tmp.len] = 0;
+            }
+          body += 2;
+          while (*body == ' ' || *body == '\t') body++;
+          pasting = 1;
+          continue;
+        }
+
+      stringify = 0;
+      id = body;
+      if (*body == '#')
+        {
+          id = body + 1;
+          while (*id == ' ' || *id == '\t') id++;
+          stringify = 1;
+        }
+
+      if (!pp_isidstart(*id))
+        {
+          if (stringify)
+            {
+              pp_put(&tmp, body, 1); /* lone # is kept, it is an immediate */
+              body++;
+            }
+          else if (*body == '"' || *body == '\'')
+            {
+              k = pp_literal(body, strlen(body));
+              pp_put(&tmp, body, k);
+              body += k;
+            }
+          else
+            {
+              pp_put(&tmp, body, 1);
+              body++;
+            }
+          pasting = 0;
+          continue;
+        }
+
+      /* identifier, check if it is a parameter */
+
+      for (idlen = 0; pp_isident(id[idlen]); idlen++);
+      for (i = 0; i < m->nparams; i++)
+        {
+          if (!strncmp(m->params[i], id, idlen) && !m->params[i][idlen])
+            {
+              break;
+            }
+        }
+
+      if (i == m->nparams)
+        {
+          pp_put(&tmp, body, id + idlen - body);
+          body = id + idlen;
+          pasting = 0;
+          continue;
+        }
+
+      body = id + idlen;
+      if (stringify)
+        {
+          pp_put(&tmp, "\"", 1);
+          for (k = 0; k < arglens[i]; k++)
+            {
+              if (args[i][k] == '"' || args[i][k] == '\\')
+                {
+                  pp_put(&tmp, "\\", 1);
+                }
+              pp_put(&tmp, args[i] + k, 1);
+            }
+          pp_put(&tmp, "\"", 1);
+        }
+      else
+        {
+          /* arguments next to ## are not expanded */
+          for (k = 0; body[k] == ' ' || body[k] == '\t'; k++);
+          if (pasting || (body[k] == '#' && body[k + 1] == '#'))
+            {
+              pp_put(&tmp, args[i], arglens[i]);
+            }
+          else
+            {
+              arg.buf = argbuf;
+              arg.len = 0;
+              arg.size = sizeof(argbuf);
+              arg.overflow = 0;
+              argbuf[0] = 0;
+              ret = pp_expand(state, args[i], arglens[i], &arg, depth + 1);
+              if (ret != ASM_OK)
+                {
+                  return ret;
+                }
+              pp_put(&tmp, argbuf, arg.len);
+              tmp.overflow |= arg.overflow;
+            }
+        }
+      pasting = 0;
+    }
+
+  out->overflow |= tmp.overflow;
+
+  /* rescan, the macro cannot expand itself */
+
+  m->active = 1;
+  ret = pp_expand(state, buf, tmp.len, out, depth + 1);
+  m->active = 0;
+  return ret;
+}
+
+/*****************************************************************************/
+/* Expand all macros found in src into out */
+
+static int pp_expand(struct asm_state_s *state, const char *src, int len, struct pp_out_s *out, int depth)
+{
+  const char *args[CONFIG_ASM_PP_PARAMS];
+  int  arglens[CONFIG_ASM_PP_PARAMS];
+  struct asm_macro_s *m;
+  int  nargs, level;
+  int  i, j, k;
+  int  ret;
+
+  if (depth > PP_NEST)
+    {
+      return emit_message(state, ASM_ERROR, "Macro expansion too deep");
+    }
+
+  i = 0;
+  while (i < len)
+    {
+      if (src[i] == '"' || src[i] == '\'')
+        {
+          k = pp_literal(src + i, len - i);
+          pp_put(out, src + i, k);
+          i += k;
+          continue;
+        }
+
+      if (isdigit((uint8_t)src[i]))
+        {
+          /* numbers, including local label references like 1f */
+          for (k = i + 1; k < len && (pp_isident(src[k]) || src[k] == '.'); k++);
+          pp_put(out, src + i, k - i);
+          i = k;
+          continue;
+        }
+
+      if (!pp_isidstart(src[i]))
+        {
+          pp_put(out, src + i, 1);
+          i++;
+          continue;
+        }
+
+      for (k = i + 1; k < len && pp_isident(src[k]); k++);
+      m = *pp_find(state, src + i, k - i);
+      if (!m || m->active)
+        {
+          pp_put(out, src + i, k - i);
+          i = k;
+          continue;
+        }
+
+      if (m->nparams < 0)
+        {
+          TRACE(state, DEBUG_PP, 2, "expand %s -> %s\n", m->name, m->body);
+          m->active = 1;
+          ret = pp_expand(state, m->body, strlen(m->body), out, depth + 1);
+          m->active = 0;
+          if (ret != ASM_OK)
+            {
+              return ret;
+            }
+          i = k;
+          continue;
+        }
+
+      /* function-like macro: only expanded when followed by arguments */
+
+      for (j = k; j < len && (src[j] == ' ' || src[j] == '\t'); j++);
+      if (j == len || src[j] != '(')
+        {
+          pp_put(out, src + i, k - i);
+          i = k;
+          continue;
+        }
+
+      j++;
+      nargs = 0;
+      level = 0;
+      args[0] = src + j;
+      while (1)
+        {
+          if (j == len)
+            {
+              return emit_message(state, ASM_ERROR, "Unterminated call to macro '%s'", m->name);
+            }
+          if (src[j] == '"' || src[j] == '\'')
+            {
+              j += pp_literal(src + j, len - j);
+              continue;
+            }
+          if (src[j] == '(')
+            {
+              level++;
+            }
+          else if ((src[j] == ')' && level == 0) ||
+                   (src[j] == ',' && level == 0 && !(m->variadic && nargs == m->nparams - 1)))
+            {
+              if (nargs == CONFIG_ASM_PP_PARAMS)
+                {
+                  return emit_message(state, ASM_ERROR, "Too many arguments for macro '%s'", m->name);
+                }
+              /* trim the argument */
+              while (*args[nargs] == ' ' || *args[nargs] == '\t') args[nargs]++;
+              arglens[nargs] = src + j - args[nargs];
+              while (arglens[nargs] && (args[nargs][arglens[nargs] - 1] == ' ' || args[nargs][arglens[nargs] - 1] == '\t'))
+                {
+                  arglens[nargs]--;
+                }
+              nargs++;
+              if (src[j] == ')')
+                {
+                  break;
+                }
+              args[nargs] = src + j + 1;
+            }
+          else if (src[j] == ')')
+            {
+              level--;
+            }
+          j++;
+        }
+
+      /* a macro without parameters is called with one empty argument */
+
+      if (m->nparams == 0 && nargs == 1 && arglens[0] == 0)
+        {
+          nargs = 0;
+        }
+      if (m->variadic && nargs == m->nparams - 1)
+        {
+          args[nargs] = "";
+          arglens[nargs++] = 0;
+        }
+      if (nargs != m->nparams)
+        {
+          return emit_message(state, ASM_ERROR, "Macro '%s' requires %d arguments, %d given", m->name, m->nparams, nargs);
+        }
+
+      ret = pp_expand_function(state, m, args, arglens, out, depth);
+      if (ret != ASM_OK)
+        {
+          return ret;
+        }
+      i = j + 1;
+    }
+
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* #define name[(params)] body */
+
+static int pp_define_macro(struct asm_state_s *state, const char *def)
+{
+  const char *params[CONFIG_ASM_PP_PARAMS];
+  int  plens[CONFIG_ASM_PP_PARAMS];
+  struct asm_macro_s **pm;
+  struct asm_macro_s *m;
+  const char *name = def;
+  const char *body;
+  int  namelen, bodylen;
+  int  nparams = -1;
+  int  variadic = 0;
+  int  size, i;
+  char *ptr;
+
+  if (!pp_isidstart(*def))
+    {
+      return emit_message(state, ASM_ERROR, "Macro name expected");
+    }
+  while (pp_isident(*def)) def++;
+  namelen = def - name;
+
+  if (*def == '(')
+    {
+      /* function-like macro, the parenthesis follows the name */
+      nparams = 0;
+      def++;
+      while (1)
+        {
+          while (*def == ' ' || *def == '\t') def++;
+          if (*def == ')' && nparams == 0)
+            {
+              break;
+            }
+          if (nparams == CONFIG_ASM_PP_PARAMS || variadic)
+            {
+              return emit_message(state, ASM_ERROR, "Invalid parameter list for macro '%.*s'", namelen, name);
+            }
+          params[nparams] = def;
+          if (!strncmp(def, "...", 3))
+            {
+              params[nparams] = "__VA_ARGS__";
+              plens[nparams] = 11;
+              variadic = 1;
+              def += 3;
+            }
+          else if (pp_isidstart(*def))
+            {
+              while (pp_isident(*def)) def++;
+              plens[nparams] = def - params[nparams];
+            }
+          else
+            {
+              return emit_message(state, ASM_ERROR, "Invalid parameter list for macro '%.*s'", namelen, name);
+            }
+          nparams++;
+          while (*def == ' ' || *def == '\t') def++;
+          if (*def == ')')
+            {
+              break;
+            }
+          if (*def != ',')
+            {
+              return emit_message(state, ASM_ERROR, "Invalid parameter list for macro '%.*s'", namelen, name);
+            }
+          def++;
+        }
+      def++;
+    }
+
+  body = def;
+  while (*body == ' ' || *body == '\t') body++;
+  bodylen = strlen(body);
+  while (bodylen && (body[bodylen - 1] == ' ' || body[bodylen - 1] == '\t'))
+    {
+      bodylen--;
+    }
+
+  /* allocate everything in one block */
+
+  size = sizeof(struct asm_macro_s) + namelen + 1 + bodylen + 1;
+  for (i = 0; i < nparams; i++)
+    {
+      size += plens[i] + 1;
+    }
+  m = asm_malloc(state, MEM_PP, size);
+  if (!m)
+    {
+      return emit_message(state, ASM_ERROR, "malloc() failed");
+    }
+  ptr = (char*)&m[1];
+
+  m->name = ptr;
+  memcpy(ptr, name, namelen);
+  ptr[namelen] = 0;
+  ptr += namelen + 1;
+
+  m->body = ptr;
+  memcpy(ptr, body, bodylen);
+  ptr[bodylen] = 0;
+  ptr += bodylen + 1;
+
+  for (i = 0; i < nparams; i++)
+    {
+      m->params[i] = ptr;
+      memcpy(ptr, params[i], plens[i]);
+      ptr[plens[i]] = 0;
+      ptr += plens[i] + 1;
+    }
+  m->nparams  = nparams;
+  m->variadic = variadic;
+  m->active   = 0;
+  m->pch      = 0;
+
+  TRACE(state, DEBUG_PP, 1, "define %s(%d) [%s]\n", m->name, m->nparams, m->body);
+
+  /* replace any previous definition */
+
+  pm = pp_find(state, name, namelen);
+  if (*pm)
+    {
+      m->next = (*pm)->next;
+      pp_free(state, *pm);
+    }
+  else
+    {
+      m->next = NULL;
+    }
+  *pm = m;
+
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* #if expressions */
+
+static long pp_eval_cond(struct pp_expr_s *e);
+
+static void pp_eval_spaces(struct pp_expr_s *e)
+{
+  while (*e->pos == ' ' || *e->pos == '\t') e->pos++;
+}
+
+static long pp_eval_primary(struct pp_expr_s *e)
+{
+  char *rest;
+  long val;
+
+  pp_eval_spaces(e);
+  switch (*e->pos)
+    {
+      case '!': e->pos++; return !pp_eval_primary(e);
+      case '~': e->pos++; return ~pp_eval_primary(e);
+      case '-': e->pos++; return -pp_eval_primary(e);
+      case '+': e->pos++; return pp_eval_primary(e);
+      case '(':
+        e->pos++;
+        val = pp_eval_cond(e);
+        pp_eval_spaces(e);
+        if (*e->pos != ')')
+          {
+            e->error = "missing ')'";
+            return 0;
+          }
+        e->pos++;
+        return val;
+      case '\'':
+        val = (uint8_t)e->pos[1];
+        if (val == '\\')
+          {
+            e->error = "unsupported character constant";
+            return 0;
+          }
+        e->pos += (e->pos[1] && e->pos[2] == '\'') ? 3 : 2;
+        return val;
+    }
+
+  if (isdigit((uint8_t)*e->pos))
+    {
+      val = strtoul(e->pos, &rest, 0);
+      while (*rest == 'u' || *rest == 'U' || *rest == 'l' || *rest == 'L') rest++;
+      e->pos = rest;
+      return val;
+    }
+
+  if (pp_isidstart(*e->pos))
+    {
+      /* identifiers that remain after expansion are zero */
+      while (pp_isident(*e->pos)) e->pos++;
+      return 0;
+    }
+
+  e->error = "syntax error";
+  return 0;
+}
+
+/* binary operators, two-char ones first */
+
+static const struct
+{
+  char op[3];
+  int  prec;
+} pp_ops[] =
+{
+  {"||", 1}, {"&&", 2}, {"==", 6}, {"!=", 6}, {"<=", 7}, {">=", 7},
+  {"<<", 8}, {">>", 8}, {"|", 3}, {"^", 4}, {"&", 5}, {"<", 7}, {">", 7},
+  {"+", 9}, {"-", 9}, {"*", 10}, {"/", 10}, {"%", 10},
+};
+
+static long pp_eval_binary(struct pp_expr_s *e, int minprec)
+{
+  long lhs = pp_eval_primary(e);
+  long rhs;
+  int  i, oplen;
+  char op0, op1;
+
+  while (!e->error)
+    {
+      pp_eval_spaces(e);
+      for (i = 0; i < sizeof(pp_ops) / sizeof(pp_ops[0]); i++)
+        {
+          oplen = strlen(pp_ops[i].op);
+          if (!strncmp(e->pos, pp_ops[i].op, oplen))
+            {
+              break;
+            }
+        }
+      if (i == sizeof(pp_ops) / sizeof(pp_ops[0]) || pp_ops[i].prec < minprec)
+        {
+          break;
+        }
+      e->pos += oplen;
+      op0 = pp_ops[i].op[0];
+      op1 = pp_ops[i].op[1];
+
+      /* do not complain about the side of && || that is not evaluated */
+
+      if ((op0 == '&' && op1 == '&' && !lhs) || (op0 == '|' && op1 == '|' && lhs))
+        {
+          e->noeval++;
+          rhs = pp_eval_binary(e, pp_ops[i].prec + 1);
+          e->noeval--;
+        }
+      else
+        {
+          rhs = pp_eval_binary(e, pp_ops[i].prec + 1);
+        }
+
+      switch (op0)
+        {
+          case '|': lhs = op1 ? (lhs || rhs) : (lhs | rhs); break;
+          case '&': lhs = op1 ? (lhs && rhs) : (lhs & rhs); break;
+          case '^': lhs = lhs ^ rhs; break;
+          case '=': lhs = lhs == rhs; break;
+          case '!': lhs = lhs != rhs; break;
+          case '<': lhs = (op1 == '<') ? (lhs << rhs) : (op1 == '=') ? (lhs <= rhs) : (lhs < rhs); break;
+          case '>': lhs = (op1 == '>') ? (lhs >> rhs) : (op1 == '=') ? (lhs >= rhs) : (lhs > rhs); break;
+          case '+': lhs = lhs + rhs; break;
+          case '-': lhs = lhs - rhs; break;
+          case '*': lhs = lhs * rhs; break;
+          case '/':
+          case '%':
+            if (!rhs)
+              {
+                if (!e->noeval)
+                  {
+                    e->error = "division by zero";
+                  }
+                lhs = 0;
+              }
+            else
+              {
+                lhs = (op0 == '/') ? (lhs / rhs) : (lhs % rhs);
+              }
+            break;
+        }
+    }
+  return lhs;
+}
+
+static long pp_eval_cond(struct pp_expr_s *e)
+{
+  long cond = pp_eval_binary(e, 1);
+  long a, b;
+
+  pp_eval_spaces(e);
+  if (*e->pos != '?')
+    {
+      return cond;
+    }
+  e->pos++;
+  a = pp_eval_cond(e);
+  pp_eval_spaces(e);
+  if (*e->pos != ':')
+    {
+      e->error = "missing ':'";
+      return 0;
+    }
+  e->pos++;
+  b = pp_eval_cond(e);
+  return cond ? a : b;
+}
+
+/*****************************************************************************/
+/* Evaluate the expression of #if/#elif. defined() is replaced first, then
+ * macros are expanded.
+ */
+
+static int pp_eval(struct asm_state_s *state, const char *expr, int *result)
+{
+  char dbuf[CONFIG_ASM_PPBUF_SIZE];
+  char xbuf[CONFIG_ASM_PPBUF_SIZE];
+  struct pp_out_s defs = {dbuf, 0, sizeof(dbuf), 0};
+  struct pp_out_s out  = {xbuf, 0, sizeof(xbuf), 0};
+  struct pp_expr_s e;
+  const char *id;
+  int  paren, len;
+  int  ret;
+
+  dbuf[0] = 0;
+  xbuf[0] = 0;
+  while (*expr)
+    {
+      if (!pp_isidstart(*expr))
+        {
+          pp_put(&defs, expr, 1);
+          expr++;
+          continue;
+        }
+      for (id = expr; pp_isident(*expr); expr++);
+      if (expr - id != 7 || strncmp(id, "defined", 7))
+        {
+          pp_put(&defs, id, expr - id);
+          continue;
+        }
+
+      /* defined NAME or defined(NAME) */
+
+      while (*expr == ' ' || *expr == '\t') expr++;
+      paren = (*expr == '(');
+      if (paren)
+        {
+          expr++;
+          while (*expr == ' ' || *expr == '\t') expr++;
+        }
+      for (id = expr; pp_isident(*expr); expr++);
+      len = expr - id;
+      if (paren)
+        {
+          while (*expr == ' ' || *expr == '\t') expr++;
+          if (*expr != ')')
+            {
+              return emit_message(state, ASM_ERROR, "missing ')' after defined");
+            }
+          expr++;
+        }
+      if (!len)
+        {
+          return emit_message(state, ASM_ERROR, "macro name expected after defined");
+        }
+      pp_put(&defs, *pp_find(state, id, len) ? "1" : "0", 1);
+    }
+
+  ret = pp_expand(state, dbuf, defs.len, &out, 0);
+  if (ret != ASM_OK)
+    {
+      return ret;
+    }
+  if (defs.overflow || out.overflow)
+    {
+      return emit_message(state, ASM_ERROR, "Expression too long");
+    }
+
+  e.pos    = xbuf;
+  e.noeval = 0;
+  e.error  = NULL;
+  *result  = pp_eval_cond(&e) != 0;
+  pp_eval_spaces(&e);
+  if (!e.error && *e.pos)
+    {
+      e.error = "garbage at end of expression";
+    }
+  if (e.error)
+    {
+      return emit_message(state, ASM_ERROR, "Invalid #if expression: %s", e.error);
+    }
+
+  TRACE(state, DEBUG_PP, 1, "#if [%s] -> %d\n", xbuf, *result);
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* Handle a directive line, line points after the #.
+ * Returns ASM_UNHANDLED if the line is not a directive, but a comment.
+ */
+
+static int pp_directive(struct asm_state_s *state, char *line)
+{
+  uint8_t *cond;
+  char *dir;
+  char *arg;
+  char *end;
+  int  active;
+  int  dirlen;
+  int  result;
+  int  ret;
+
+  while (*line == ' ' || *line == '\t') line++;
+  dir = line;
+  while (pp_isident(*line)) line++;
+  dirlen = line - dir;
+  while (*line == ' ' || *line == '\t') line++;
+  arg = line;
+
+  /* right trim argument */
+
+  end = arg + strlen(arg);
+  while (end > arg && (end[-1] == ' ' || end[-1] == '\t'))
+    {
+      *--end = 0;
+    }
+
+#define PP_IS(name) (dirlen == sizeof(name) - 1 && !strncmp(dir, name, dirlen))
+
+  active = !state->pplevel || (state->ppcond[state->pplevel - 1] & PP_ACTIVE);
+
+  if (PP_IS("if") || PP_IS("ifdef") || PP_IS("ifndef"))
+    {
+      if (state->pplevel == CONFIG_ASM_PP_DEPTH)
+        {
+          return emit_message(state, ASM_ERROR, "Too many nested conditionals");
+        }
+      result = 0;
+      if (active)
+        {
+          if (PP_IS("if"))
+            {
+              ret = pp_eval(state, arg, &result);
+              if (ret != ASM_OK)
+                {
+                  return ret;
+                }
+            }
+          else
+            {
+              for (end = arg; pp_isident(*end); end++);
+              if (end == arg)
+                {
+                  return emit_message(state, ASM_ERROR, "Macro name expected");
+                }
+              result = (*pp_find(state, arg, end - arg) != NULL) == PP_IS("ifdef");
+            }
+        }
+      /* inside an inactive block, nothing can be taken */
+      state->ppcond[state->pplevel++] = !active ? PP_TAKEN : result ? (PP_ACTIVE | PP_TAKEN) : 0;
+      return ASM_OK;
+    }
+
+  if (PP_IS("elif") || PP_IS("else") || PP_IS("endif"))
+    {
+      if (!state->pplevel)
+        {
+          return emit_message(state, ASM_ERROR, "#%.*s without #if", dirlen, dir);
+        }
+      if (PP_IS("endif"))
+        {
+          state->pplevel--;
+          return ASM_OK;
+        }
+      cond = &state->ppcond[state->pplevel - 1];
+      if (*cond & PP_ELSE)
+        {
+          return emit_message(state, ASM_ERROR, "#%.*s after #else", dirlen, dir);
+        }
+      if (*cond & PP_TAKEN)
+        {
+          *cond &= ~PP_ACTIVE;
+        }
+      else if (PP_IS("else"))
+        {
+          *cond |= PP_ACTIVE | PP_TAKEN;
+        }
+      else
+        {
+          ret = pp_eval(state, arg, &result);
+          if (ret != ASM_OK)
+            {
+              return ret;
+            }
+          if (result)
+            {
+              *cond |= PP_ACTIVE | PP_TAKEN;
+            }
+        }
+      if (PP_IS("else"))
+        {
+          *cond |= PP_ELSE;
+        }
+      return ASM_OK;
+    }
+
+  if (!PP_IS("define") && !PP_IS("undef") && !PP_IS("include") && !PP_IS("error") &&
+      !PP_IS("warning") && !PP_IS("line") && !PP_IS("pragma") && !PP_IS("ident"))
+    {
+      return ASM_UNHANDLED; /* not a directive, this is a comment */
+    }
+
+  if (!active)
+    {
+      return ASM_OK;
+    }
+
+  if (PP_IS("define"))
+    {
+      return pp_define_macro(state, arg);
+    }
+  else if (PP_IS("undef"))
+    {
+      struct asm_macro_s **pm;
+      struct asm_macro_s *m;
+      for (end = arg; pp_isident(*end); end++);
+      pm = pp_find(state, arg, end - arg);
+      if (*pm)
+        {
+          m = *pm;
+          *pm = m->next;
+          pp_free(state, m);
+        }
+      return ASM_OK;
+    }
+  else if (PP_IS("include"))
+    {
+      if ((*arg != '"' && *arg != '<') || end == arg + 1 || end[-1] != ((*arg == '<') ? '>' : '"'))
+        {
+          return emit_message(state, ASM_ERROR, "#include expects \"file\" or <file>");
+        }
+      end[-1] = 0;
+      return include_source(state, arg + 1);
+    }
+  else if (PP_IS("error"))
+    {
+      return emit_message(state, ASM_ERROR, "#error %s", arg);
+    }
+  else if (PP_IS("warning"))
+    {
+      return emit_message(state, ASM_WARN, "#warning %s", arg);
+    }
+
+  /* #line #pragma #ident are ignored */
+
+  return ASM_OK;
+#undef PP_IS
+}
+
+/*****************************************************************************/
+/* Remove C comments from the logical line, in place. Multi-line comments are
+ * tracked across lines.
+ */
+
+static void pp_strip_comments(struct asm_state_s *state, char *line)
+{
+  char *out = line;
+  int  k;
+
+  while (*line)
+    {
+      if (state->ppcomment)
+        {
+          if (line[0] == '*' && line[1] == '/')
+            {
+              state->ppcomment = 0;
+              *out++ = ' ';
+              line += 2;
+            }
+          else
+            {
+              line++;
+            }
+        }
+      else if (line[0] == '/' && line[1] == '*')
+        {
+          state->ppcomment = 1;
+          line += 2;
+        }
+      else if (line[0] == '/' && line[1] == '/')
+        {
+          break;
+        }
+      else if (*line == '"')
+        {
+          k = pp_literal(line, strlen(line));
+          memmove(out, line, k);
+          out  += k;
+          line += k;
+        }
+      else
+        {
+          *out++ = *line++;
+        }
+    }
+  *out = 0;
+}
+
+/*****************************************************************************/
+/* Preprocess one raw source line. On return, *out is the line to assemble,
+ * or NULL if there is nothing to assemble.
+ */
+
+int pp_line(struct asm_state_s *state, const char *line, int len, char **out)
+{
+  struct pp_out_s exp;
+  char *buf = state->ppbuf;
+  int  room;
+  int  ret;
+
+  *out = NULL;
+
+  /* remove crlf */
+
+  if (len > 0 && line[len - 1] == '\n')
+    {
+      len--;
+    }
+  if (len > 0 && line[len - 1] == '\r')
+    {
+      len--;
+    }
+
+  /* join continued lines */
+
+  room = sizeof(state->ppbuf) - 1 - state->pplen;
+  if (len > room)
+    {
+      emit_message(state, ASM_WARN, "Long line truncated");
+      len = room;
+    }
+  memcpy(buf + state->pplen, line, len);
+  state->pplen += len;
+  buf[state->pplen] = 0;
+
+  if (state->pplen > 0 && buf[state->pplen - 1] == '\\')
+    {
+      buf[--state->pplen] = 0;
+      return ASM_OK;
+    }
+  state->pplen = 0;
+
+  pp_strip_comments(state, buf);
+
+  while (*buf == ' ' || *buf == '\t') buf++;
+
+  if (*buf == '#')
+    {
+      ret = pp_directive(state, buf + 1);
+      if (ret != ASM_UNHANDLED)
+        {
+          return ret;
+        }
+      return ASM_OK; /* line comment */
+    }
+
+  if (state->pplevel && !(state->ppcond[state->pplevel - 1] & PP_ACTIVE))
+    {
+      return ASM_OK; /* skipped */
+    }
+
+  exp.buf  = state->ppout;
+  exp.len  = 0;
+  exp.size = sizeof(state->ppout);
+  exp.overflow = 0;
+  state->ppout[0] = 0;
+
+  ret = pp_expand(state, buf, strlen(buf), &exp, 0);
+  if (ret != ASM_OK)
+    {
+      return ret;
+    }
+  if (exp.overflow)
+    {
+      emit_message(state, ASM_WARN, "Line truncated after macro expansion");
+    }
+
+  *out = state->ppout;
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* Check that conditionals opened in a file are closed at its end */
+
+int pp_file_end(struct asm_state_s *state, int level)
+{
+  int ret = ASM_OK;
+
+  if (state->pplevel > level)
+    {
+      ret = emit_message(state, ASM_ERROR, "Unterminated #if");
+      state->pplevel = level;
+    }
+  state->pplen     = 0;
+  state->ppcomment = 0;
+  return ret;
+}
+
+/*****************************************************************************/
+/* Define a macro from the command line: NAME or NAME=VALUE */
+
+int pp_define(struct asm_state_s *state, const char *def)
+{
+  char buf[CONFIG_ASM_PPBUF_SIZE];
+  char *eq;
+
+  if (strlen(def) >= sizeof(buf) - 2)
+    {
+      return emit_message(state, ASM_ERROR, "Definition too long");
+    }
+  strcpy(buf, def);
+  eq = strchr(buf, '=');
+  if (eq)
+    {
+      *eq = ' ';
+    }
+  else
+    {
+      strcat(buf, " 1");
+    }
+  return pp_define_macro(state, buf);
+}
+
+/*****************************************************************************/
+/* Release all macros */
+
+void pp_release(struct asm_state_s *state)
+{
+  struct asm_macro_s *m;
+  int i;
+
+  for (i = 0; i < CONFIG_ASM_PP_HASH; i++)
+    {
+      while (state->macros[i])
+        {
+          m = state->macros[i];
+          state->macros[i] = m->next;
+          pp_free(state, m);
+        }
+    }
+}
+
+#endif /* CONFIG_ASM_PREPROC */
@@ -1,5 +1,8 @@
 #include "config.h"
 
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "tcasm.h"
@@ -38,7 +41,7 @@ struct asm_section_s *section_find_create(struct asm_state_s *asmstate, const ch
     {
       if (!strcmp(asmstate->sections[i].name, secname) )
         {
-          printf("section '%s' found\n", secname);
+          TRACE(asmstate, DEBUG_SECTION, 2, "section '%s' found\n", secname);
           return &asmstate->sections[i];
         }
     }
@@ -48,10 +51,28 @@ struct asm_section_s *section_find_create(struct asm_state_s *asmstate, const ch
     {
       if (!asmstate->sections[i].name[0])
         {
-          printf("section '%s' initialized\n", secname);
+          TRACE(asmstate, DEBUG_SECTION, 1, "section '%s' initialized\n", secname);
           strncpy(asmstate->sections[i].name, secname, 16);
           asmstate->sections[i].id   = section_find_id(secname);
-          asmstate->sections[i].data = NULL;
+          asmstate->sections[i].data.first = NULL;
+          asmstate->sections[i].data.last  = NULL;
+          asmstate->sections[i].data.size  = 0;
+          asmstate->sections[i].cursor     = NULL;
+          asmstate->sections[i].relocs    = NULL;
+          asmstate->sections[i].lastreloc = NULL;
+          asmstate->sections[i].address   = 0;
+          asmstate->sections[i].spill   = NULL;
+          asmstate->sections[i].spilled = 0;
+          asmstate->sections[i].fixup   = UINT32_MAX;
+          asmstate->sections[i].nrelax  = 0;
+          asmstate->sections[i].nwait   = 0;
+          asmstate->sections[i].window  = NULL;
+          asmstate->sections[i].lastwindow = NULL;
+          asmstate->sections[i].settled = NULL;
+          asmstate->sections[i].labels  = NULL;
+          asmstate->sections[i].aligns  = NULL;
+          asmstate->sections[i].align   = 1;
+          asmstate->sections[i].unit    = asmstate->unit;
           return &asmstate->sections[i];
         }
     }
@@ -62,3 +83,384 @@ struct asm_section_s *section_find_create(struct asm_state_s *asmstate, const ch
   return NULL;
 }
 
+/* free the contents of all sections */
+
+void section_release(struct asm_state_s *asmstate)
+{
+  int i;
+
+  for (i = 0; i<CONFIG_ASM_SEC_MAX; i++)
+    {
+      chunk_release(asmstate, &asmstate->sections[i].data);
+      asmstate->sections[i].cursor = NULL;
+      while (asmstate->sections[i].aligns)
+        {
+          struct asm_align_s *a = asmstate->sections[i].aligns;
+          asmstate->sections[i].aligns = a->next;
+          asm_free(asmstate, a);
+        }
+      if (asmstate->sections[i].spill)
+        {
+          fclose(asmstate->sections[i].spill);
+          asmstate->sections[i].spill   = NULL;
+          asmstate->sections[i].spilled = 0;
+        }
+    }
+}
+
+/* return the size of a section, spilled contents included */
+
+uint32_t section_size(struct asm_section_s *sec)
+{
+  return sec->spilled + sec->data.size;
+}
+
+/* Move the chunks of a section that cannot change anymore to its spill
+ * file, to keep only the last chunk and those after sec->fixup in memory.
+ * The last chunk is never spilled since it is still being filled.
+ */
+
+int section_spill(struct asm_state_s *asmstate, struct asm_section_s *sec)
+{
+  struct asm_chunk_s *ch;
+
+  while (sec->data.first && sec->data.first->next && sec->spilled + sec->data.first->len <= sec->fixup)
+    {
+      ch = sec->data.first;
+      if (!sec->spill)
+        {
+          sec->spill = tmpfile();
+          if (!sec->spill)
+            {
+              return emit_message(asmstate, ASM_ERROR, "Cannot create spill file for section %s", sec->name);
+            }
+          if (MEM_BUDGETED(asmstate))
+            {
+              setvbuf(sec->spill, NULL, _IONBF, 0); /* stdio buffers are not in the budget */
+            }
+        }
+      if (fwrite(ch->data, 1, ch->len, sec->spill) != ch->len)
+        {
+          return emit_message(asmstate, ASM_ERROR, "Cannot spill section %s", sec->name);
+        }
+      TRACE(asmstate, DEBUG_SECTION, 2, "section '%s' spilled %d bytes at %u\n", sec->name, ch->len, sec->spilled);
+      if (sec->cursor == ch)
+        {
+          sec->cursor = NULL;
+        }
+      sec->spilled   += ch->len;
+      sec->data.size -= ch->len;
+      sec->data.first = ch->next;
+      asm_free(asmstate, ch);
+    }
+  return ASM_OK;
+}
+
+/* The chunk in memory that holds offset of a section, or ends at offset,
+ * and its offset in pos. NULL if there is no chunk. The search starts from
+ * the one found last if it is not after offset: patches come in order.
+ */
+
+static struct asm_chunk_s *section_chunk(struct asm_section_s *sec, uint32_t offset, uint32_t *pos)
+{
+  struct asm_chunk_s *ch = sec->data.first;
+
+  *pos = sec->spilled;
+  if (sec->cursor && sec->cursorpos <= offset)
+    {
+      ch   = sec->cursor;
+      *pos = sec->cursorpos;
+    }
+  while (ch && ch->next && offset > *pos + ch->len)
+    {
+      *pos += ch->len;
+      ch    = ch->next;
+    }
+  sec->cursor    = ch;
+  sec->cursorpos = *pos;
+  return ch;
+}
+
+/* Copy bytes of a section from (write = 0) or to (write = 1) buf. Spilled
+ * bytes are read or written in the spill file, left at its end for the next
+ * spill.
+ */
+
+int section_bytes(struct asm_section_s *sec, uint32_t offset, uint8_t *buf, uint32_t len, int write)
+{
+  struct asm_chunk_s *chunk;
+  uint32_t pos = sec->spilled;
+  uint32_t n;
+  uint32_t i;
+
+  if (offset < pos)
+    {
+      n = (len < pos - offset) ? len : pos - offset;
+      if (fseek(sec->spill, offset, SEEK_SET) ||
+          (write ? fwrite(buf, 1, n, sec->spill) : fread(buf, 1, n, sec->spill)) != n ||
+          fseek(sec->spill, 0, SEEK_END))
+        {
+          return -1;
+        }
+      offset += n;
+      buf    += n;
+      len    -= n;
+    }
+  chunk = len ? section_chunk(sec, offset, &pos) : NULL;
+  for (i = 0; i < len; i++)
+    {
+      while (chunk && offset + i >= pos + chunk->len)
+        {
+          pos  += chunk->len;
+          chunk = chunk->next;
+        }
+      if (!chunk)
+        {
+          return -1;
+        }
+      if (write)
+        {
+          chunk->data[offset + i - pos] = buf[i];
+        }
+      else
+        {
+          buf[i] = chunk->data[offset + i - pos];
+        }
+    }
+  return 0;
+}
+
+/* Write size bytes of padding that start at offset: fill, or NOPs of the
+ * backend in mode if fill is negative.
+ */
+
+static int section_padding(struct asm_state_s *asmstate, uint32_t offset, uint8_t *buf, uint32_t size, int fill,
+                           int mode)
+{
+  const struct asm_backend_s *backend = asmstate->current_backend;
+  int prev = asmstate->mode;
+  int ret  = ASM_UNHANDLED;
+
+  if (fill < 0 && backend && backend->nop)
+    {
+      asmstate->mode = mode;
+      ret = backend->nop(backend, asmstate, offset, buf, size);
+      asmstate->mode = prev;
+    }
+  if (ret == ASM_UNHANDLED)
+    {
+      memset(buf, (fill < 0) ? 0 : fill, size);
+      ret = ASM_OK;
+    }
+  return ret;
+}
+
+/* Pad a section to a multiple of align, with fill or NOPs of the backend if
+ * fill is negative. While an instruction before may still get longer, the
+ * alignment is recorded to be redone by section_realign().
+ */
+
+int section_pad(struct asm_state_s *asmstate, struct asm_section_s *sec, uint32_t align, int fill)
+{
+  struct asm_align_s **pa;
+  struct asm_align_s *a;
+  uint32_t offset = section_size(sec);
+  uint32_t size;
+  uint8_t *buf;
+  int ret = ASM_OK;
+
+  if (align < 2)
+    {
+      return ASM_OK;
+    }
+  size = (align - offset % align) % align;
+  if (size)
+    {
+      buf = asm_malloc(asmstate, MEM_CHUNK, size);
+      if (!buf)
+        {
+          return emit_message(asmstate, ASM_ERROR, "malloc() failed");
+        }
+      ret = section_padding(asmstate, offset, buf, size, fill, asmstate->mode);
+      if (ret == ASM_OK)
+        {
+          ret = chunk_append(asmstate, &sec->data, buf, size);
+        }
+      asm_free(asmstate, buf);
+    }
+  if (ret != ASM_OK || !sec->nrelax)
+    {
+      return ret;
+    }
+
+  a = asm_malloc(asmstate, MEM_SYMBOL, sizeof(struct asm_align_s));
+  if (!a)
+    {
+      return emit_message(asmstate, ASM_ERROR, "malloc() failed");
+    }
+  a->next   = NULL;
+  a->offset = offset;
+  a->size   = size;
+  a->align  = align;
+  a->fill   = fill;
+  a->mode   = asmstate->mode;
+  for (pa = &sec->aligns; *pa; pa = &(*pa)->next);
+  *pa = a;
+  return ASM_OK;
+}
+
+/* Insert delta zero bytes at offset of a section, or remove -delta bytes
+ * there, in the relax window. What was after them moves: the labels and
+ * relocations of the window, the alignments from first on and the records
+ * of the backend. A label at the end of the bytes moves, it is after them.
+ */
+
+static int section_move(struct asm_state_s *asmstate, struct asm_section_s *sec, uint32_t offset, int32_t delta,
+                        struct asm_align_s *first)
+{
+  const struct asm_backend_s *backend = asmstate->current_backend;
+  uint32_t from = (delta > 0) ? offset : offset - delta;
+  struct asm_chunk_s **link;
+  struct asm_chunk_s *ch;
+  struct asm_chunks_s ins = { NULL, NULL, 0 };
+  struct asm_symbol_s *sym;
+  struct asm_reloc_s *reloc;
+  uint32_t pos = sec->spilled;
+  uint32_t left;
+  uint32_t n;
+  uint8_t zero = 0;
+
+  if (offset < sec->spilled || from > section_size(sec))
+    {
+      return emit_message(asmstate, ASM_ERROR, "Cannot resize section %s at 0x%X", sec->name, offset);
+    }
+  TRACE(asmstate, DEBUG_SECTION, 2, "section '%s' resized by %d at %u\n", sec->name, delta, offset);
+
+  ch   = section_chunk(sec, offset, &pos);
+  link = &sec->data.first; /* the section is empty if ch is NULL */
+
+  if (delta > 0 && ch && ch->len + delta <= CONFIG_ASM_CHUNK)
+    {
+      memmove(ch->data + offset - pos + delta, ch->data + offset - pos, ch->len - (offset - pos));
+      memset(ch->data + offset - pos, 0, delta);
+      ch->len += delta;
+    }
+  else if (delta > 0)
+    {
+      /* new chunks with the bytes and the end of the split one */
+
+      if (chunk_fill(asmstate, &ins, &zero, 1, delta) != ASM_OK ||
+          (ch && chunk_append(asmstate, &ins, ch->data + offset - pos, ch->len - (offset - pos)) != ASM_OK))
+        {
+          chunk_release(asmstate, &ins);
+          return ASM_ERROR;
+        }
+      if (ch)
+        {
+          ch->len = offset - pos;
+          link = &ch->next;
+        }
+      ins.last->next = *link;
+      *link = ins.first;
+      if (!ins.last->next)
+        {
+          sec->data.last = ins.last;
+        }
+    }
+  else
+    {
+      for (left = -delta; left; ch = ch->next)
+        {
+          n = ch->len - (offset - pos);
+          n = (n > left) ? left : n;
+          memmove(ch->data + offset - pos, ch->data + offset - pos + n, ch->len - (offset - pos) - n);
+          ch->len -= n;
+          left    -= n;
+          pos     += ch->len;
+          offset   = pos;
+        }
+      offset = from + delta;
+    }
+  sec->data.size += delta;
+
+  for (sym = sec->labels; sym; sym = sym->wnext)
+    {
+      if (sym->value >= offset)
+        {
+          sym->value = (sym->value >= from) ? sym->value + delta : offset;
+        }
+    }
+  for (reloc = sec->window; reloc; reloc = reloc->wnext)
+    {
+      if (reloc->offset >= from)
+        {
+          reloc->offset += delta;
+        }
+    }
+  for (; first; first = first->next)
+    {
+      if (first->offset >= from)
+        {
+          first->offset += delta;
+        }
+    }
+  if (backend && backend->move)
+    {
+      backend->move(backend, asmstate, sec, from, delta);
+    }
+  return ASM_OK;
+}
+
+/* Insert or remove bytes in the part of a section still in memory */
+
+int section_resize(struct asm_state_s *asmstate, struct asm_section_s *sec, uint32_t offset, int32_t delta)
+{
+  return section_move(asmstate, sec, offset, delta, sec->aligns);
+}
+
+/* Redo the recorded alignments of a section after an instruction got
+ * longer. Each one takes the padding it needs at its new offset.
+ */
+
+int section_realign(struct asm_state_s *asmstate, struct asm_section_s *sec)
+{
+  struct asm_align_s *a;
+  uint32_t size;
+  uint8_t *buf;
+  int ret;
+
+  for (a = sec->aligns; a; a = a->next)
+    {
+      size = (a->align - a->offset % a->align) % a->align;
+      if (size == a->size)
+        {
+          continue;
+        }
+      ret = section_move(asmstate, sec, a->offset + ((size > a->size) ? a->size : size), size - a->size, a->next);
+      a->size = size;
+      if (ret != ASM_OK)
+        {
+          return ret;
+        }
+      if (!size)
+        {
+          continue;
+        }
+      buf = asm_malloc(asmstate, MEM_CHUNK, size);
+      if (!buf)
+        {
+          return emit_message(asmstate, ASM_ERROR, "malloc() failed");
+        }
+      ret = section_padding(asmstate, a->offset, buf, size, a->fill, a->mode);
+      if (ret == ASM_OK)
+        {
+          section_bytes(sec, a->offset, buf, size, 1);
+        }
+      asm_free(asmstate, buf);
+      if (ret != ASM_OK)
+        {
+          return ret;
+        }
+    }
+  return ASM_OK;
+}
@@ -0,0 +1,376 @@
+/* persistent assembler server for tcasm
+ *
+ * tcasm --server <socket> listens on a local socket and runs the command
+ * lines sent by tcasm --client <socket> in its own process, one thread per
+ * request. Requests are independent assemblies with their own state, but the
+ * contents of the files they include are shared, so they are read once for
+ * all requests as long as they do not change.
+ *
+ * A request is a header giving the number of arguments and their total size,
+ * followed by the NUL terminated arguments. The header carries the stdout and
+ * stderr of the client and its current directory, as file descriptors. The
+ * server answers with the exit code once both streams are flushed.
+ */
+
+#define _GNU_SOURCE
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "tcasm.h"
+
+#if CONFIG_ASM_SERVER
+
+/*****************************************************************************
+ * Definitions
+ *****************************************************************************/
+
+#define SERVER_FDS     3       /* stdout, stderr, cwd */
+#define SERVER_MAXARGS 65536   /* total size of the arguments */
+
+/*****************************************************************************
+ * Types
+ *****************************************************************************/
+
+struct server_header_s
+{
+  uint32_t argc;
+  uint32_t len;  /* size of the arguments that follow */
+};
+
+/*****************************************************************************
+ * Variables
+ *****************************************************************************/
+
+#ifndef CLONE_FS
+/* the current directory is per process, requests must take turns */
+
+static pthread_mutex_t server_cwd_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/*****************************************************************************
+ * Functions
+ *****************************************************************************/
+
+static int server_address(struct sockaddr_un *addr, const char *path)
+{
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr->sun_path))
+    {
+      fprintf(stderr, "tcasm: socket path too long: %s\n", path);
+      return -1;
+    }
+  strcpy(addr->sun_path, path);
+  return 0;
+}
+
+/*****************************************************************************/
+/* Read or write all of a buffer, or fail */
+
+static int server_io(int sock, void *buf, size_t len, int wr)
+{
+  uint8_t *ptr = buf;
+  ssize_t ret;
+
+  while (len > 0)
+    {
+      ret = wr ? write(sock, ptr, len) : read(sock, ptr, len);
+      if (ret < 0 && errno == EINTR)
+        {
+          continue;
+        }
+      if (ret <= 0)
+        {
+          return -1;
+        }
+      ptr += ret;
+      len -= ret;
+    }
+  return 0;
+}
+
+/*****************************************************************************/
+/* Run one request, the connection is closed at the end */
+
+static void *server_request(void *arg)
+{
+  int sock = (int)(intptr_t)arg;
+  struct server_header_s hdr;
+  int fds[SERVER_FDS] = { -1, -1, -1 };
+  char cbuf[CMSG_SPACE(sizeof(fds))];
+  struct cmsghdr *cmsg;
+  struct msghdr msg;
+  struct iovec iov;
+  char **argv = NULL;
+  char *args = NULL;
+  FILE *out = NULL;
+  FILE *err = NULL;
+  int32_t code = 1;
+  uint32_t i;
+  uint32_t pos;
+
+  /* header with the descriptors */
+
+  iov.iov_base = &hdr;
+  iov.iov_len  = sizeof(hdr);
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+  if (recvmsg(sock, &msg, MSG_WAITALL) != sizeof(hdr))
+    {
+      goto done;
+    }
+  cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+      cmsg->cmsg_len == CMSG_LEN(sizeof(fds)))
+    {
+      memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    }
+  if (fds[0] < 0 || hdr.argc == 0 || hdr.len > SERVER_MAXARGS || hdr.argc > hdr.len)
+    {
+      goto done;
+    }
+
+  /* arguments, argv[0] is the program name */
+
+  args = malloc(hdr.len + 1);
+  argv = malloc((hdr.argc + 1) * sizeof(char*));
+  if (!args || !argv || server_io(sock, args, hdr.len, 0))
+    {
+      goto done;
+    }
+  args[hdr.len] = 0;
+  for (i = 0, pos = 0; i < hdr.argc; i++)
+    {
+      if (pos >= hdr.len)
+        {
+          goto done;
+        }
+      argv[i] = args + pos;
+      pos += strlen(args + pos) + 1;
+    }
+  argv[i] = NULL;
+
+  /* each descriptor belongs to its stream as soon as it has one */
+
+  out = fdopen(fds[0], "w");
+  if (!out)
+    {
+      goto done;
+    }
+  fds[0] = -1;
+  err = fdopen(fds[1], "w");
+  if (!err)
+    {
+      goto done;
+    }
+  fds[1] = -1;
+
+  /* relative paths are resolved from the client directory */
+
+#ifdef CLONE_FS
+  if (unshare(CLONE_FS) || fchdir(fds[2]))
+    {
+      fprintf(err, "tcasm: cannot change directory: %s\n", strerror(errno));
+      goto done;
+    }
+  code = tcasm_run(hdr.argc, argv, out, err);
+#else
+  pthread_mutex_lock(&server_cwd_lock);
+  if (fchdir(fds[2]))
+    {
+      fprintf(err, "tcasm: cannot change directory: %s\n", strerror(errno));
+    }
+  else
+    {
+      code = tcasm_run(hdr.argc, argv, out, err);
+    }
+  pthread_mutex_unlock(&server_cwd_lock);
+#endif
+
+done:
+  if (out)
+    {
+      fclose(out);
+    }
+  if (err)
+    {
+      fclose(err);
+    }
+  for (i = 0; i < SERVER_FDS; i++)
+    {
+      if (fds[i] >= 0)
+        {
+          close(fds[i]);
+        }
+    }
+  server_io(sock, &code, sizeof(code), 1);
+  close(sock);
+  free(argv);
+  free(args);
+  return NULL;
+}
+
+/*****************************************************************************/
+/* Serve requests on a local socket, forever */
+
+int server_run(const char *path)
+{
+  struct sockaddr_un addr;
+  pthread_attr_t attr;
+  pthread_t thread;
+  int lsock;
+  int sock;
+
+  if (server_address(&addr, path))
+    {
+      return 1;
+    }
+
+  lsock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (lsock < 0)
+    {
+      fprintf(stderr, "tcasm: socket() failed: %s\n", strerror(errno));
+      return 1;
+    }
+  unlink(path);
+  if (bind(lsock, (struct sockaddr*)&addr, sizeof(addr)) || listen(lsock, 16))
+    {
+      fprintf(stderr, "tcasm: cannot listen on %s: %s\n", path, strerror(errno));
+      close(lsock);
+      return 1;
+    }
+
+  include_share(1);
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  for (;;)
+    {
+      sock = accept4(lsock, NULL, NULL, SOCK_CLOEXEC);
+      if (sock < 0)
+        {
+          if (errno == EINTR || errno == ECONNABORTED)
+            {
+              continue;
+            }
+          fprintf(stderr, "tcasm: accept() failed: %s\n", strerror(errno));
+          break;
+        }
+      if (pthread_create(&thread, &attr, server_request, (void*)(intptr_t)sock))
+        {
+          close(sock);
+        }
+    }
+
+  pthread_attr_destroy(&attr);
+  close(lsock);
+  return 1;
+}
+
+/*****************************************************************************/
+/* Send a command line to a server and wait for its exit code */
+
+int client_run(const char *path, int argc, char **argv)
+{
+  struct sockaddr_un addr;
+  struct server_header_s hdr;
+  int fds[SERVER_FDS];
+  char cbuf[CMSG_SPACE(sizeof(fds))];
+  struct cmsghdr *cmsg;
+  struct msghdr msg;
+  struct iovec iov;
+  char *args;
+  int32_t code;
+  uint32_t pos;
+  int sock;
+  int i;
+
+  if (server_address(&addr, path))
+    {
+      return 1;
+    }
+
+  /* argv[0] is the socket path, it becomes the program name */
+
+  for (i = 1, hdr.len = sizeof("tcasm"); i < argc; i++)
+    {
+      hdr.len += strlen(argv[i]) + 1;
+    }
+  hdr.argc = argc;
+  if (hdr.len > SERVER_MAXARGS)
+    {
+      fprintf(stderr, "tcasm: command line too long\n");
+      return 1;
+    }
+  args = malloc(hdr.len);
+  if (!args)
+    {
+      return 1;
+    }
+  strcpy(args, "tcasm");
+  for (i = 1, pos = sizeof("tcasm"); i < argc; i++)
+    {
+      strcpy(args + pos, argv[i]);
+      pos += strlen(argv[i]) + 1;
+    }
+
+  fds[0] = STDOUT_FILENO;
+  fds[1] = STDERR_FILENO;
+  fds[2] = open(".", O_RDONLY | O_DIRECTORY);
+  sock   = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fds[2] < 0 || sock < 0 || connect(sock, (struct sockaddr*)&addr, sizeof(addr)))
+    {
+      fprintf(stderr, "tcasm: cannot connect to %s: %s\n", path, strerror(errno));
+      code = 1;
+      goto done;
+    }
+
+  iov.iov_base = &hdr;
+  iov.iov_len  = sizeof(hdr);
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type  = SCM_RIGHTS;
+  cmsg->cmsg_len   = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  fflush(stdout);
+  if (sendmsg(sock, &msg, 0) != sizeof(hdr) || server_io(sock, args, hdr.len, 1) ||
+      server_io(sock, &code, sizeof(code), 0))
+    {
+      fprintf(stderr, "tcasm: request to %s failed\n", path);
+      code = 1;
+    }
+
+done:
+  if (sock >= 0)
+    {
+      close(sock);
+    }
+  if (fds[2] >= 0)
+    {
+      close(fds[2]);
+    }
+  free(args);
+  return code;
+}
+
+#endif /* CONFIG_ASM_SERVER */
@@ -0,0 +1,572 @@
+/* symbol table for tcasm
+ *
+ * Symbols are hashed by name. Each input is a unit: labels are local to the
+ * unit that defines them, unless declared with .global, so that inputs
+ * assembled together can reuse names. A reference is resolved in its own
+ * unit first, then among global symbols.
+ *
+ * References are relocations of the current section, applied by the link
+ * stage once all inputs are parsed and addresses are known. pc relative
+ * references wait on the symbol of their input instead, to be applied when
+ * it is defined in their section. Those left at the end of the input join
+ * the others.
+ *
+ * A short reference that the backend may still lengthen opens the relax
+ * window of its section: what follows may move, so the references to its
+ * labels are patched when it closes. It closes once all its short
+ * references know their label, or after CONFIG_ASM_RELAX_WINDOW bytes, the
+ * labels still to come being out of reach.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tcasm.h"
+
+/*****************************************************************************
+ * Functions
+ *****************************************************************************/
+
+static uint32_t symbol_hash(const char *name)
+{
+  uint32_t h = 5381;
+
+  while (*name)
+    {
+      h = h * 33 + (uint8_t)*name++;
+    }
+  return h % CONFIG_ASM_SYM_HASH;
+}
+
+/*****************************************************************************/
+/* Find the symbol of a unit, and create it undefined if asked */
+
+struct asm_symbol_s *symbol_find(struct asm_state_s *state, const char *name, int unit, int create)
+{
+  struct asm_symbol_s **head = &state->symbols[symbol_hash(name)];
+  struct asm_symbol_s *sym;
+
+  for (sym = *head; sym; sym = sym->next)
+    {
+      if (sym->unit == unit && !strcmp(sym->name, name))
+        {
+          return sym;
+        }
+    }
+  if (!create)
+    {
+      return NULL;
+    }
+
+  sym = asm_malloc(state, MEM_SYMBOL, sizeof(struct asm_symbol_s) + strlen(name) + 1);
+  if (!sym)
+    {
+      emit_message(state, ASM_ERROR, "malloc() failed");
+      return NULL;
+    }
+  sym->name = (char*)&sym[1];
+  strcpy(sym->name, name);
+  sym->section = NULL;
+  sym->value   = 0;
+  sym->waiting = NULL;
+  sym->wnext   = NULL;
+  sym->unit    = unit;
+  sym->global  = 0;
+  sym->mode    = 0;
+  sym->next    = *head;
+  *head        = sym;
+  return sym;
+}
+
+/*****************************************************************************/
+/* Patch a pc relative reference of sec to target, a label of sec, and free
+ * it. Neither of them can move anymore.
+ */
+
+static int symbol_apply(struct asm_state_s *state, struct asm_section_s *sec, struct asm_reloc_s *reloc,
+                        struct asm_symbol_s *target)
+{
+  const struct asm_backend_s *backend = state->current_backend;
+  uint8_t  buf[ASM_RELOC_MAX];
+  uint32_t size;
+  int      ret;
+
+  /* both offsets are in the section, as good as addresses */
+
+  size = section_size(sec) - reloc->offset;
+  size = (size > ASM_RELOC_MAX) ? ASM_RELOC_MAX : size;
+  if (reloc->offset >= section_size(sec) || section_bytes(sec, reloc->offset, buf, size, 0))
+    {
+      ret = emit_message(state, ASM_ERROR, "Relocation outside of section %s", sec->name);
+    }
+  else if (!backend || !backend->relocate ||
+           (ret = backend->relocate(backend, state, reloc, target, target->value + reloc->addend, reloc->offset,
+                                    buf)) == ASM_UNHANDLED)
+    {
+      ret = emit_message(state, ASM_ERROR, "Unknown relocation type 0x%X", reloc->type);
+    }
+  else if (ret == ASM_OK && section_bytes(sec, reloc->offset, buf, size, 1))
+    {
+      ret = emit_message(state, ASM_ERROR, "Cannot patch section %s", sec->name);
+    }
+  else if (ret == ASM_OK)
+    {
+      TRACE(state, DEBUG_PARSE, 2, "reloc %s+0x%X -> %s applied\n", sec->name, reloc->offset, target->name);
+    }
+  asm_free(state, reloc);
+  return ret;
+}
+
+/*****************************************************************************/
+/* Give a reference to the link stage. Appended in the order they are made,
+ * the relocations of a section are in offset order.
+ */
+
+static void symbol_link(struct asm_section_s *sec, struct asm_reloc_s *reloc)
+{
+  if (!sec->lastreloc)
+    {
+      sec->lastreloc = &sec->relocs;
+    }
+  reloc->next     = NULL;
+  *sec->lastreloc = reloc;
+  sec->lastreloc  = &reloc->next;
+}
+
+/*****************************************************************************/
+/* Sort a list of relocations in offset order */
+
+static struct asm_reloc_s *symbol_sort(struct asm_reloc_s *list)
+{
+  struct asm_reloc_s *half[2] = { NULL, NULL };
+  struct asm_reloc_s **link = &list;
+  struct asm_reloc_s *reloc;
+  int i = 0;
+
+  if (!list || !list->next)
+    {
+      return list;
+    }
+  while ((reloc = list) != NULL)
+    {
+      list        = reloc->next;
+      reloc->next = half[i];
+      half[i]     = reloc;
+      i ^= 1;
+    }
+  half[0] = symbol_sort(half[0]);
+  half[1] = symbol_sort(half[1]);
+  while (half[0] && half[1])
+    {
+      i       = (half[1]->offset < half[0]->offset);
+      *link   = half[i];
+      link    = &half[i]->next;
+      half[i] = half[i]->next;
+    }
+  *link = half[0] ? half[0] : half[1];
+  return list;
+}
+
+/*****************************************************************************/
+/* Merge references left at the end of an input, in offset order, into the
+ * relocations of the link stage.
+ */
+
+static void symbol_unpend(struct asm_section_s *sec, struct asm_reloc_s *list)
+{
+  struct asm_reloc_s **link = &sec->relocs;
+  struct asm_reloc_s *reloc;
+
+  if (!list)
+    {
+      return;
+    }
+  while ((reloc = list) != NULL)
+    {
+      while (*link && (*link)->offset <= reloc->offset)
+        {
+          link = &(*link)->next;
+        }
+      list        = reloc->next;
+      reloc->next = *link;
+      *link       = reloc;
+      link        = &reloc->next;
+    }
+  for (sec->lastreloc = link; *sec->lastreloc; sec->lastreloc = &(*sec->lastreloc)->next);
+}
+
+/*****************************************************************************/
+/* Make the short references of a section that do not reach their label
+ * longer, until all the others do. Each one that grows moves what follows
+ * and may push another one out of reach. The target of a reference is out
+ * of reach if it is not in the section.
+ */
+
+static int symbol_relax(struct asm_state_s *state, struct asm_section_s *sec)
+{
+  const struct asm_backend_s *backend = state->current_backend;
+  struct asm_symbol_s *target;
+  struct asm_reloc_s *reloc;
+  uint32_t grow;
+  int changed = 1;
+  int ret;
+
+  while (changed)
+    {
+      changed = 0;
+      for (reloc = sec->window; reloc; reloc = reloc->wnext)
+        {
+          if (!reloc->relax)
+            {
+              continue;
+            }
+          target = symbol_find(state, reloc->symbolname, reloc->unit, 0);
+          target = (target && target->section == sec) ? target : NULL;
+          ret = backend->relax(backend, state, sec, reloc, target, target ? target->value + reloc->addend : 0, &grow);
+          if (ret != ASM_OK)
+            {
+              return ret;
+            }
+          if (!grow)
+            {
+              continue;
+            }
+          TRACE(state, DEBUG_PARSE, 2, "reloc %s+0x%X -> %s grows by %u\n", sec->name, reloc->offset,
+                reloc->symbolname, grow);
+          reloc->relax = 0;
+          sec->nrelax--;
+          changed = 1;
+          if (section_realign(state, sec) != ASM_OK)
+            {
+              return ASM_ERROR;
+            }
+        }
+    }
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* Close the relax window of a section: its short references take their
+ * final size, then nothing in it moves anymore and the references to its
+ * labels are patched.
+ */
+
+static int symbol_close(struct asm_state_s *state, struct asm_section_s *sec)
+{
+  struct asm_symbol_s *target;
+  struct asm_reloc_s *reloc;
+  struct asm_align_s *a;
+
+  TRACE(state, DEBUG_PARSE, 2, "relax window %s+0x%X closed at 0x%X\n", sec->name, sec->fixup, section_size(sec));
+  if (symbol_relax(state, sec) != ASM_OK)
+    {
+      return ASM_ERROR;
+    }
+  for (reloc = sec->window; reloc; reloc = reloc->wnext)
+    {
+      reloc->relax = 0;
+    }
+  sec->nrelax     = 0;
+  sec->nwait      = 0;
+  sec->window     = NULL;
+  sec->lastwindow = NULL;
+  sec->labels     = NULL;
+  sec->fixup      = UINT32_MAX;
+  while (sec->aligns)
+    {
+      a = sec->aligns;
+      sec->aligns = a->next;
+      asm_free(state, a);
+    }
+
+  while ((reloc = sec->settled) != NULL)
+    {
+      sec->settled = reloc->next;
+      target = symbol_find(state, reloc->symbolname, reloc->unit, 0);
+      if (symbol_apply(state, sec, reloc, target) != ASM_OK)
+        {
+          return ASM_ERROR;
+        }
+    }
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* After each line, close the relax windows that can be. Until then, nothing
+ * is patched in a window since making a reference longer would move the
+ * labels after it.
+ */
+
+int symbol_settle(struct asm_state_s *state)
+{
+  struct asm_section_s *sec;
+  int i;
+
+  for (i = 0; i < CONFIG_ASM_SEC_MAX; i++)
+    {
+      sec = &state->sections[i];
+      if (sec->nrelax && (!sec->nwait || section_size(sec) - sec->fixup > CONFIG_ASM_RELAX_WINDOW) &&
+          symbol_close(state, sec) != ASM_OK)
+        {
+          return ASM_ERROR;
+        }
+    }
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* End of an input: the short references to labels it did not define in
+ * their section get longer, and the others are patched. What is left goes
+ * to the link stage.
+ */
+
+int symbol_finish(struct asm_state_s *state)
+{
+  struct asm_reloc_s *left[CONFIG_ASM_SEC_MAX];
+  struct asm_symbol_s *sym;
+  struct asm_reloc_s *reloc;
+  int i;
+
+  for (i = 0; i < CONFIG_ASM_SEC_MAX; i++)
+    {
+      left[i] = NULL;
+      if (state->sections[i].nrelax && symbol_close(state, &state->sections[i]) != ASM_OK)
+        {
+          return ASM_ERROR;
+        }
+    }
+  for (i = 0; i < CONFIG_ASM_SYM_HASH; i++)
+    {
+      for (sym = state->symbols[i]; sym; sym = sym->next)
+        {
+          while ((reloc = sym->waiting) != NULL)
+            {
+              sym->waiting = reloc->next;
+              reloc->next  = left[reloc->section - state->sections];
+              left[reloc->section - state->sections] = reloc;
+            }
+        }
+    }
+  for (i = 0; i < CONFIG_ASM_SEC_MAX; i++)
+    {
+      symbol_unpend(&state->sections[i], symbol_sort(left[i]));
+    }
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* Define a label at the current position. The references that wait for it
+ * in its section are patched, or settled until the relax window closes.
+ */
+
+int symbol_define(struct asm_state_s *state, const char *name)
+{
+  struct asm_section_s *sec = state->current_section;
+  struct asm_symbol_s *sym;
+  struct asm_reloc_s **prev;
+  struct asm_reloc_s *reloc;
+
+  if (!sec)
+    {
+      return emit_message(state, ASM_ERROR, "No current section for label '%s'", name);
+    }
+  sym = symbol_find(state, name, state->unit, 1);
+  if (!sym)
+    {
+      return ASM_ERROR;
+    }
+  if (sym->section)
+    {
+      return emit_message(state, ASM_ERROR, "Symbol '%s' is already defined", name);
+    }
+  sym->section = sec;
+  sym->value   = section_size(sec);
+  sym->mode    = state->mode;
+  TRACE(state, DEBUG_PARSE, 2, "symbol %s = %s+0x%X\n", name, sec->name, sym->value);
+  if (sec->nrelax)
+    {
+      sym->wnext  = sec->labels;
+      sec->labels = sym;
+    }
+
+  /* those of other sections wait for the link stage */
+
+  prev = &sym->waiting;
+  while ((reloc = *prev) != NULL)
+    {
+      reloc->section->nwait -= reloc->relax;
+      if (reloc->section != sec)
+        {
+          prev = &reloc->next;
+          continue;
+        }
+      *prev = reloc->next;
+      if (sec->nrelax)
+        {
+          reloc->next  = sec->settled;
+          sec->settled = reloc;
+        }
+      else if (symbol_apply(state, sec, reloc, sym) != ASM_OK)
+        {
+          return ASM_ERROR;
+        }
+    }
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* .global: make a symbol of this unit visible to the others */
+
+int symbol_global(struct asm_state_s *state, const char *name)
+{
+  struct asm_symbol_s *sym = symbol_find(state, name, state->unit, 1);
+
+  if (!sym)
+    {
+      return ASM_ERROR;
+    }
+  sym->global = 1;
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* Find the definition seen from a unit, or NULL */
+
+struct asm_symbol_s *symbol_resolve(struct asm_state_s *state, const char *name, int unit)
+{
+  struct asm_symbol_s *sym = symbol_find(state, name, unit, 0);
+
+  if (sym && sym->section)
+    {
+      return sym;
+    }
+  for (sym = state->symbols[symbol_hash(name)]; sym; sym = sym->next)
+    {
+      if (sym->global && sym->section && !strcmp(sym->name, name))
+        {
+          return sym;
+        }
+    }
+  return NULL;
+}
+
+/*****************************************************************************/
+/* Record a reference to name at offset of the current section. The bytes
+ * there stay in memory only while the backend may make them longer.
+ */
+
+int symbol_reference(struct asm_state_s *state, const char *name, int32_t addend, uint32_t type, uint32_t offset,
+                     int relax)
+{
+  struct asm_section_s *sec = state->current_section;
+  struct asm_symbol_s *target = NULL;
+  struct asm_reloc_s *reloc;
+
+  if (type >= ASM_RELOC_BACKEND)
+    {
+      target = symbol_find(state, name, state->unit, 1);
+      if (!target)
+        {
+          return ASM_ERROR;
+        }
+    }
+
+  reloc = asm_malloc(state, MEM_SYMBOL, sizeof(struct asm_reloc_s) + strlen(name) + 1);
+  if (!reloc)
+    {
+      return emit_message(state, ASM_ERROR, "malloc() failed");
+    }
+  reloc->symbolname = (char*)&reloc[1];
+  strcpy(reloc->symbolname, name);
+  reloc->next    = NULL;
+  reloc->wnext   = NULL;
+  reloc->section = sec;
+  reloc->offset  = offset;
+  reloc->type    = type;
+  reloc->addend  = addend;
+  reloc->unit    = state->unit;
+  reloc->relax   = relax;
+
+  if (relax && !sec->nrelax)
+    {
+      TRACE(state, DEBUG_PARSE, 2, "relax window %s+0x%X opened\n", sec->name, offset);
+      sec->fixup      = offset;
+      sec->lastwindow = &sec->window;
+    }
+  sec->nrelax += relax;
+  if (sec->nrelax)
+    {
+      *sec->lastwindow = reloc;
+      sec->lastwindow  = &reloc->wnext;
+    }
+
+  if (target && !target->section)
+    {
+      sec->nwait     += relax;
+      reloc->next     = target->waiting;
+      target->waiting = reloc;
+    }
+  else if (target && target->section == sec && sec->nrelax)
+    {
+      reloc->next  = sec->settled;
+      sec->settled = reloc;
+    }
+  else
+    {
+      symbol_link(sec, reloc);
+    }
+  state->linevolatile = 1;
+
+  TRACE(state, DEBUG_PARSE, 2, "reloc %s+0x%X -> %s%+d\n", sec->name, offset, name, addend);
+  return ASM_OK;
+}
+
+/*****************************************************************************/
+/* free all symbols and relocations */
+
+void symbol_release(struct asm_state_s *state)
+{
+  struct asm_symbol_s *sym;
+  struct asm_reloc_s *reloc;
+  int i;
+
+  for (i = 0; i < CONFIG_ASM_SYM_HASH; i++)
+    {
+      while (state->symbols[i])
+        {
+          sym = state->symbols[i];
+          state->symbols[i] = sym->next;
+          while ((reloc = sym->waiting) != NULL)
+            {
+              sym->waiting = reloc->next;
+              asm_free(state, reloc);
+            }
+          asm_free(state, sym);
+        }
+    }
+  for (i = 0; i < CONFIG_ASM_SEC_MAX; i++)
+    {
+      while (state->sections[i].relocs)
+        {
+          reloc = state->sections[i].relocs;
+          state->sections[i].relocs = reloc->next;
+          asm_free(state, reloc);
+        }
+      while (state->sections[i].settled)
+        {
+          reloc = state->sections[i].settled;
+          state->sections[i].settled = reloc->next;
+          asm_free(state, reloc);
+        }
+      state->sections[i].lastreloc  = NULL;
+      state->sections[i].window     = NULL;
+      state->sections[i].lastwindow = NULL;
+      state->sections[i].labels     = NULL;
+      state->sections[i].nrelax     = 0;
+      state->sections[i].nwait      = 0;
+    }
+}
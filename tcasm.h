@@ -30,6 +30,59 @@ enum asm_endian_e
   ASM_ENDIAN_BIG
 };
 
+/* relocation types, backends number theirs from ASM_RELOC_BACKEND */
+
+enum asm_reloc_e
+{
+  ASM_RELOC_ABS8,
+  ASM_RELOC_ABS16,
+  ASM_RELOC_ABS32,
+  ASM_RELOC_BACKEND = 0x100
+};
+
+#define ASM_RELOC_MAX 4 /* bytes patched by a relocation */
+
+/* linker output formats */
+
+enum asm_link_e
+{
+  LINK_NONE,
+  LINK_BIN, /* flat binary image */
+  LINK_ELF  /* ELF executable */
+};
+
+/*****************************************************************************
+ * Traces
+ *****************************************************************************/
+
+/* Trace categories, selected at runtime with -d. Only the categories that are
+ * part of CONFIG_ASM_DEBUG are compiled in, the others cost nothing.
+ * Level 1 shows the main events, higher levels add details.
+ */
+
+#define DEBUG_CHUNK   0x0001 /* chunk allocation */
+#define DEBUG_DIR     0x0002 /* generic directives */
+#define DEBUG_INC     0x0004 /* include path and file cache */
+#define DEBUG_PP      0x0008 /* preprocessor */
+#define DEBUG_PARSE   0x0010 /* line parser */
+#define DEBUG_SECTION 0x0020 /* sections */
+#define DEBUG_ARM     0x0040 /* arm backend */
+#define DEBUG_CACHE   0x0080 /* assembly cache */
+#define DEBUG_ALL     0x00FF
+
+#define TRACE_ON(state, cat, level) \
+  ((CONFIG_ASM_DEBUG & (cat)) && ((state)->debug & (cat)) && (state)->debuglevel >= (level))
+
+#define TRACE(state, cat, level, ...) \
+  do \
+    { \
+      if (TRACE_ON(state, cat, level)) \
+        { \
+          asm_trace(state, __VA_ARGS__); \
+        } \
+    } \
+  while (0)
+
 /*****************************************************************************
  * Types
  *****************************************************************************/
@@ -45,15 +98,46 @@ struct asm_chunk_s
   uint8_t *data;
 };
 
+/* A chunk list keeps its last chunk and its size, appending does not walk
+ * the chain.
+ */
+
+struct asm_chunks_s
+{
+  struct asm_chunk_s *first; /* NULL if the list is empty */
+  struct asm_chunk_s *last;  /* the chunk being filled */
+  uint32_t size;             /* bytes in all chunks */
+};
+
 /*****************************************************************************/
 /* This structure is a relocation, a symbol reference. Each section has relocs.*/
 
 struct asm_reloc_s
 {
   struct asm_reloc_s   *next;   /*these are chained */
+  struct asm_reloc_s   *wnext;  /* next one made in the relax window of the section */
+  struct asm_section_s *section; /* section of offset */
   uint32_t             offset;  /* section offset where the relocation must be set */
   uint32_t             type;    /* type (PC relative, absolute, etc */
   char                 *symbolname; /* symbol reference */
+  int32_t              addend;  /* added to the symbol address */
+  int                  unit;    /* input that made the reference */
+  uint8_t              relax;   /* TRUE while the backend may lengthen the instruction */
+};
+
+/*****************************************************************************/
+/* An alignment done while an instruction before it may still get longer. It
+ * is redone if so.
+ */
+
+struct asm_align_s
+{
+  struct asm_align_s *next;     /* in offset order */
+  uint32_t offset;              /* start of the padding */
+  uint32_t size;                /* bytes of padding */
+  uint32_t align;
+  int      fill;                /* fill byte, -1 for NOPs of the backend */
+  int      mode;                /* backend mode of the NOPs */
 };
 
 /*****************************************************************************/
@@ -63,17 +147,170 @@ struct asm_section_s
 {
   int  id; /* fast section identification */
   char name[CONFIG_ASM_SEC_NAME]; /* section name */
-  struct asm_chunk_s *data; /* section contents */
+  struct asm_chunks_s data; /* section contents */
+  struct asm_chunk_s *cursor; /* chunk found last by offset, NULL if none */
+  uint32_t cursorpos;         /* offset of cursor */
   struct asm_reloc_s *relocs; /*undefined symbols*/
+  struct asm_reloc_s **lastreloc; /* end of relocs, they are kept in order */
+  FILE     *spill;   /* contents moved out of memory, NULL if none */
+  uint32_t spilled;  /* number of bytes in spill, data starts after them */
+  uint32_t fixup;    /* offset of the oldest data that may still be resized */
+  uint32_t nrelax;   /* relocations with relax set, the relax window is open */
+  uint32_t nwait;    /* relocations with relax set to labels still to come */
+  struct asm_reloc_s *window; /* relocations made in the window, in order */
+  struct asm_reloc_s **lastwindow; /* end of window */
+  struct asm_reloc_s *settled; /* to labels defined, patched when it closes */
+  struct asm_symbol_s *labels; /* labels defined in the window */
+  struct asm_align_s *aligns; /* alignments done while nrelax is not 0 */
+  uint32_t align;    /* largest .align of the contents, 1 if none */
+  int      unit;     /* input that selected it last */
+  uint32_t address;  /* assigned by the linker */
+};
+
+/*****************************************************************************/
+/* This structure is a file resolved through the include path. Resolutions,
+ * including failures, are cached for the whole run, and contents are loaded
+ * only once whatever the number of inclusions.
+ */
+
+struct asm_file_s
+{
+  struct asm_file_s *next;  /* hash chain */
+  struct asm_file_s *order; /* all files, in resolution order */
+  char     *name;           /* name as requested */
+  char     *path;           /* resolved path, NULL if not found */
+  uint8_t  *data;           /* file contents, NULL until loaded */
+  uint32_t len;             /* size of contents */
+  uint8_t  search;          /* TRUE if resolved through the include path */
+  uint8_t  mapped;          /* TRUE if data was obtained with mmap() */
+  struct include_shared_s *shared; /* contents shared by a server, or NULL */
+};
+
+/*****************************************************************************/
+/* This structure is a token of the current line. Punctuation tokens have the
+ * character itself as type.
+ */
+
+enum asm_token_e
+{
+  TOK_WORD   = 'w', /* anything delimited by spaces and punctuation */
+  TOK_STRING = '"', /* quoted string, quotes included */
+  TOK_COLON  = ':',
+  TOK_COMMA  = ',',
+  TOK_HASH   = '#',
+  TOK_LBRACK = '[',
+  TOK_RBRACK = ']',
+  TOK_LBRACE = '{',
+  TOK_RBRACE = '}'
+};
+
+struct asm_token_s
+{
+  uint16_t pos;  /* offset in the line */
+  uint16_t len;  /* length in bytes */
+  uint8_t  type; /* from asm_token_e */
 };
 
 /*****************************************************************************/
-/* This structure is a DEFINED symbol (label). */
+/* Memory use, per subsystem. With a budget, all allocations are made from
+ * one region given by the caller, otherwise they are only accounted.
+ */
+
+enum asm_mem_e
+{
+  MEM_STATE,   /* the state itself, and library copies of options */
+  MEM_CHUNK,   /* section contents */
+  MEM_INCLUDE, /* include cache and file contents */
+  MEM_PP,      /* preprocessor macros */
+  MEM_PIPE,    /* pipelined input buffers */
+  MEM_LINES,   /* incremental line cache */
+  MEM_SYMBOL,  /* symbols and relocations */
+  MEM_BACKEND, /* backend state, tables, records of the reports */
+  MEM_COUNT
+};
+
+struct asm_mem_s
+{
+  uint8_t  *base;                 /* budget region, NULL to use malloc() */
+  uint32_t region;                /* size of the region */
+  uint32_t size;                  /* budget, state included, 0 if none */
+  uint32_t used;                  /* bytes in use */
+  uint32_t peak;                  /* highest value of used */
+  uint32_t cur[MEM_COUNT];        /* bytes in use per subsystem */
+  uint32_t max[MEM_COUNT];        /* peak per subsystem */
+  uint8_t  marks[CONFIG_ASM_MEM_MARKS]; /* warning thresholds in %, 0 if unused */
+  uint32_t warned;                /* marks already reported, one bit each */
+};
+
+/*****************************************************************************/
+/* SHA-256 context, for the keys of the assembly cache */
+
+#define CACHE_HASH_SIZE 32
+
+struct cache_hash_s
+{
+  uint32_t h[8];
+  uint64_t len;
+  uint8_t  buf[64];
+};
+
+/*****************************************************************************/
+/* A preprocessor macro. Name, parameters and body are stored after the
+ * struct, or in the string pool of a loaded pch.
+ */
+
+struct asm_macro_s
+{
+  struct asm_macro_s *next; /* hash chain */
+  char *name;
+  char *body;
+  int  nparams;  /* -1 for object-like macros */
+  int  variadic; /* TRUE if the last parameter is ... */
+  int  active;   /* TRUE while being expanded, prevents recursion */
+  int  pch;      /* TRUE if restored from a pch, freed with it */
+  char *params[CONFIG_ASM_PP_PARAMS];
+};
+
+/*****************************************************************************/
+/* This structure is a symbol (label). Labels are local to the input that
+ * defines them, unless declared with .global. The name is stored after it.
+ */
 
 struct asm_symbol_s
 {
-  char     *name; /* pointer to an entry in the string table section */
-  uint32_t value; /* memory offset of the symbol within its section */
+  struct asm_symbol_s *next; /* hash chain */
+  char     *name;
+  struct asm_section_s *section; /* NULL while undefined */
+  uint32_t value;  /* memory offset of the symbol within its section */
+  struct asm_reloc_s  *waiting; /* pc relative references of its unit made before its definition */
+  struct asm_symbol_s *wnext;   /* next label defined in the relax window of its section */
+  int      unit;   /* input that declared or defined it */
+  uint8_t  global; /* TRUE if declared with .global */
+  uint8_t  mode;   /* backend mode where it was defined */
+};
+
+/*****************************************************************************/
+/* Options of the link stage */
+
+struct asm_link_s
+{
+  int      format; /* from asm_link_e */
+  uint32_t base;   /* address of the first section, without script */
+  char     *script; /* memory regions and placement, NULL if none */
+};
+
+/*****************************************************************************/
+
+/* this structure describes the properties of a target backend */
+
+struct asm_backend_infos_s
+{
+  char *name;
+  int endianess;
+  int wordsize; /* word size in bytes, for .long, .int, .word */
+  int align_p2; /* TRUE if align aligns to a power of two */
+  uint16_t elf_machine; /* ELF e_machine of executables */
+  uint32_t elf_flags;   /* ELF e_flags of executables */
 };
 
 /*****************************************************************************/
@@ -84,42 +321,130 @@ struct asm_state_s
 {
   /* options */
   char *outputname; /* output file name */
+  uint32_t debug; /* enabled trace categories */
+  int  debuglevel; /* trace verbosity */
+  int  pipeline; /* TRUE to read and tokenize the input in other threads */
+  int  spill; /* TRUE to move finished section data to temporary files */
+  int  nwarnings; /* number of warnings emitted */
+  void (*diag)(void *arg, const char *file, int line, int type, const char *msg);
+  void *diagarg; /* diagnostic callback, messages go to stderr if NULL */
 
   /* input status */
   char *includes[CONFIG_ASM_INC_COUNT]; /* pointers to include dir arguments */
   char *inputname; /* name of the current input file */
-  FILE *input; /* currently managed input file */
+  struct asm_file_s *input; /* currently managed input file */
+  uint32_t inpos; /* read position in the current input file */
+  int  incdepth; /* current .include nesting level */
+  struct asm_file_s *incfiles[CONFIG_ASM_INC_HASH]; /* include cache */
+  struct asm_file_s *incorder; /* include cache, in resolution order */
+
+  /* preprocessor state */
+  int  ppenable; /* TRUE to preprocess all input files, not only .S */
+  int  ppactive; /* TRUE if the current input file is preprocessed */
+  int  pplevel; /* conditional nesting level */
+  int  ppcomment; /* TRUE inside a multi-line C comment */
+  int  pplen; /* length of the pending continued line */
+  uint8_t ppcond[CONFIG_ASM_PP_DEPTH]; /* conditional stack */
+  char ppbuf[CONFIG_ASM_PPBUF_SIZE]; /* logical line, continuations joined */
+  char ppout[CONFIG_ASM_PPBUF_SIZE]; /* logical line after macro expansion */
+  struct asm_macro_s *macros[CONFIG_ASM_PP_HASH]; /* defined macros */
   char inbuf[CONFIG_ASM_INBUF_SIZE]; /*buffer for reading input file */
   int  curline; /* current source line being read */
 
+  /* current line tokens */
+  char *tokline; /* text of the tokenized line */
+  int  ntokens; /* number of tokens in the line */
+  int  tokcur; /* first token not consumed yet */
+  struct asm_token_s *tokens; /* tokens of the line, tokbuf or pipeline record */
+  struct asm_token_s tokbuf[CONFIG_ASM_TOKENS];
+
   /* intermediate state */
   struct asm_section_s sections[CONFIG_ASM_SEC_MAX]; /* storage for sections */
   struct asm_section_s *current_section;
+  struct asm_symbol_s *symbols[CONFIG_ASM_SYM_HASH]; /* symbol table */
+  int  unit; /* number of the current input, for local symbols */
   struct asm_backend_s *current_backend;
+  struct asm_backend_infos_s infos; /* of current_backend */
+  uint32_t mode; /* backend encoding mode, like arm or thumb */
+  void *backenddata; /* private to the backend, NULL until it needs some */
+  int  linevolatile; /* TRUE if the current line depends on more than its text */
 
   /* output status */
   FILE *output; /* output file */
 
+#if CONFIG_ASM_MEMBUDGET
+  struct asm_mem_s mem; /* memory accounting and budget */
+#endif
+
+#if CONFIG_ASM_LINES
+  struct asm_lines_s *lines; /* incremental line cache, NULL if unused */
+#endif
+
+#if CONFIG_ASM_PCH
+  uint8_t  *pch;       /* loaded pch image, NULL if none */
+  uint32_t pchlen;     /* size of the image */
+  uint8_t  pchmapped;  /* TRUE if the image was obtained with mmap() */
+  struct asm_macro_s *pchmacros; /* macros restored from the image */
+#endif
+
 };
 
 /*****************************************************************************/
 
 /* this structure describes a target backend */
 
-struct asm_backend_infos_s
-{
-  char *name;
-  int endianess;
-  int wordsize; /* word size in bytes, for .long, .int, .word */
-  int align_p2; /* TRUE if align aligns to a power of two */
-};
-
 struct asm_backend_s
 {
   int (*getinfos)   (struct asm_backend_infos_s *infos);
   int (*directive)  (const struct asm_backend_s *backend, struct asm_state_s *state, char *buf);
   int (*instruction)(const struct asm_backend_s *backend, struct asm_state_s *state, char *buf);
   int (*option)     (const struct asm_backend_s *backend, struct asm_state_s *state, char *buf);
+
+  /* apply a backend relocation: value is the address of sym plus addend, pc
+   * the address of the patched bytes, at data. Returns ASM_UNHANDLED for
+   * unknown types.
+   */
+  int (*relocate)   (const struct asm_backend_s *backend, struct asm_state_s *state, const struct asm_reloc_s *reloc,
+                     const struct asm_symbol_s *sym, uint32_t value, uint32_t pc, uint8_t *data);
+
+  /* end of an input file, while its local symbols are still in scope */
+  int (*finish)     (const struct asm_backend_s *backend, struct asm_state_s *state);
+
+  /* free state->backenddata */
+  void (*release)   (const struct asm_backend_s *backend, struct asm_state_s *state);
+
+  /* padding of .align in code sections: write to buf the size bytes of NOPs
+   * that start at offset of a section, in state->mode. Returns ASM_UNHANDLED
+   * to pad with zeros.
+   */
+  int (*nop)        (const struct asm_backend_s *backend, struct asm_state_s *state,
+                     uint32_t offset, uint8_t *buf, uint32_t size);
+
+  /* write the analyses asked by backend options, after the output */
+  int (*report)     (const struct asm_backend_s *backend, struct asm_state_s *state, FILE *out);
+
+  /* a relocation of sec with relax set, to sym at value, or to a symbol
+   * outside of sec if sym is NULL. If the instruction cannot reach it,
+   * rewrite it in its long form with section_resize, change reloc->type and
+   * set *grow to the bytes added, else set *grow to 0.
+   */
+  int (*relax)      (const struct asm_backend_s *backend, struct asm_state_s *state, struct asm_section_s *sec,
+                     struct asm_reloc_s *reloc, const struct asm_symbol_s *sym, uint32_t value, uint32_t *grow);
+
+  /* the contents of sec from offset moved by delta bytes */
+  void (*move)      (const struct asm_backend_s *backend, struct asm_state_s *state, struct asm_section_s *sec,
+                     uint32_t offset, int32_t delta);
+
+  /* the state a precompiled prelude leaves to the inputs, like register
+   * aliases: write it to buf unless buf is NULL, and return its size
+   */
+  uint32_t (*save)  (const struct asm_backend_s *backend, struct asm_state_s *state, uint8_t *buf);
+
+  /* restore the len bytes written by save, after the -m options. Returns
+   * ASM_ERROR with a message if they do not apply
+   */
+  int (*restore)    (const struct asm_backend_s *backend, struct asm_state_s *state,
+                     const uint8_t *buf, uint32_t len);
 };
 
 /*****************************************************************************/
@@ -129,16 +454,114 @@ struct asm_backend_s
 /* parse a source file into the state */
 
 int emit_message(struct asm_state_s *asmstate, int type, const char *msg, ...);
+void asm_trace(struct asm_state_s *asmstate, const char *msg, ...);
+
+void asm_init(struct asm_state_s *asmstate);
+void asm_release(struct asm_state_s *asmstate);
+void asm_set_backend(struct asm_state_s *asmstate, struct asm_backend_s *backend);
+struct asm_backend_s *backend_get(int index);
+struct asm_backend_s *backend_find(const char *name);
 
 int parse(struct asm_state_s *state);
+int parse_file(struct asm_state_s *state, struct asm_file_s *file);
+int parse_buffer(struct asm_state_s *state, const char *name, const uint8_t *data, uint32_t len);
 
 int directive(struct asm_state_s *state, char *dir, char *params);
 
 struct asm_section_s *section_find_create(struct asm_state_s *asmstate, const char *secname);
-
-int chunk_append(struct asm_state_s *state, struct asm_chunk_s **chlist, void *base, int len);
-int chunk_append_block(struct asm_state_s *state, struct asm_chunk_s **chlist, void *base, int len);
-uint32_t chunk_totalsize(struct asm_chunk_s *chlist);
+void section_release(struct asm_state_s *asmstate);
+uint32_t section_size(struct asm_section_s *sec);
+int section_spill(struct asm_state_s *asmstate, struct asm_section_s *sec);
+int section_bytes(struct asm_section_s *sec, uint32_t offset, uint8_t *buf, uint32_t len, int write);
+int section_pad(struct asm_state_s *state, struct asm_section_s *sec, uint32_t align, int fill);
+int section_resize(struct asm_state_s *state, struct asm_section_s *sec, uint32_t offset, int32_t delta);
+int section_realign(struct asm_state_s *state, struct asm_section_s *sec);
+
+int chunk_append(struct asm_state_s *state, struct asm_chunks_s *chlist, void *base, int len);
+int chunk_fill(struct asm_state_s *state, struct asm_chunks_s *chlist, const void *pattern, int len, uint32_t size);
+int chunk_append_block(struct asm_state_s *state, struct asm_chunks_s *chlist, void *base, int len);
+uint32_t chunk_totalsize(const struct asm_chunks_s *chlist);
+void chunk_release(struct asm_state_s *state, struct asm_chunks_s *chlist);
+
+int output_dump(struct asm_state_s *state, FILE *out);
+int output_file(struct asm_state_s *state);
+int output_depend(struct asm_state_s *state, const char *name, const char *target, int phony);
+
+struct asm_symbol_s *symbol_find(struct asm_state_s *state, const char *name, int unit, int create);
+int symbol_define(struct asm_state_s *state, const char *name);
+int symbol_global(struct asm_state_s *state, const char *name);
+struct asm_symbol_s *symbol_resolve(struct asm_state_s *state, const char *name, int unit);
+int symbol_reference(struct asm_state_s *state, const char *name, int32_t addend, uint32_t type, uint32_t offset,
+                     int relax);
+int symbol_settle(struct asm_state_s *state);
+int symbol_finish(struct asm_state_s *state);
+void symbol_release(struct asm_state_s *state);
+
+int link_output(struct asm_state_s *state, const struct asm_link_s *link);
+
+int batch_run(int count, int (*job)(void *arg, int index), void *arg);
+
+int tcasm_run(int argc, char **argv, FILE *out, FILE *err);
+int server_run(const char *path);
+int client_run(const char *path, int argc, char **argv);
+
+int parse_tokens(struct asm_state_s *state, char *line, int end);
+
+int tokenize(struct asm_token_s *tokens, int *ntokens, const char *line, int len);
+
+char *float_parse(char *str, int size, uint64_t *result);
+
+struct asm_file_s *include_find(struct asm_state_s *state, const char *name, int search);
+int include_open(struct asm_state_s *state, struct asm_file_s *file);
+int include_load(struct asm_state_s *state, struct asm_file_s *file);
+void include_release(struct asm_state_s *state);
+void include_share(int enable);
+int include_source(struct asm_state_s *state, const char *name);
+
+int pipe_parse(struct asm_state_s *state, struct asm_file_s *file);
+
+#if CONFIG_ASM_CACHE
+void cache_hash_init(struct cache_hash_s *ctx);
+void cache_hash_update(struct cache_hash_s *ctx, const void *data, size_t len);
+void cache_hash_string(struct cache_hash_s *ctx, const char *str);
+void cache_hash_final(struct cache_hash_s *ctx, uint8_t digest[CACHE_HASH_SIZE]);
+int  cache_hash_file(struct cache_hash_s *ctx, const char *path);
+FILE *cache_lookup(struct asm_state_s *state, const char *dir, const uint8_t *key);
+int  cache_fetch(struct asm_state_s *state, FILE *entry, FILE *out);
+int  cache_store(struct asm_state_s *state, const char *dir, uint64_t maxsize, const uint8_t *key);
+#endif
+
+#if CONFIG_ASM_MEMBUDGET
+void *asm_malloc(struct asm_state_s *state, int subsys, size_t len);
+void asm_free(struct asm_state_s *state, void *ptr);
+void mem_account(struct asm_state_s *state, int subsys, int32_t size);
+int  mem_budget(struct asm_state_s *state, void *base, uint32_t size);
+void mem_report(struct asm_state_s *state, FILE *out);
+#define MEM_BUDGETED(state) ((state)->mem.base != NULL)
+#else
+#define asm_malloc(state, subsys, len) malloc(len)
+#define asm_free(state, ptr) free(ptr)
+#define MEM_BUDGETED(state) 0
+#endif
+
+int pp_line(struct asm_state_s *state, const char *line, int len, char **out);
+int pp_file_end(struct asm_state_s *state, int level);
+int pp_define(struct asm_state_s *state, const char *def);
+void pp_release(struct asm_state_s *state);
+
+#if CONFIG_ASM_LINES
+int  lines_open(struct asm_state_s *state, const char *path, const char *ctx);
+int  lines_lookup(struct asm_state_s *state, const char *text, int len);
+void lines_record(struct asm_state_s *state);
+int  lines_save(struct asm_state_s *state);
+void lines_release(struct asm_state_s *state);
+#endif
+
+#if CONFIG_ASM_PCH
+int  pch_write(struct asm_state_s *state, const char *name);
+int  pch_load(struct asm_state_s *state, const char *name);
+void pch_release(struct asm_state_s *state);
+#endif
 
 #endif /* __TCASM__H__ */
 
@@ -15,3 +15,14 @@
 .align
 .db 0xFF
 
+
+#code is padded with nops, 0xBF00 or nop.w in Thumb, 0xE320F000 in ARM
+.text
+.thumb
+movs r0, #1
+.balign 8
+movs r0, #1
+.balign 16
+.arm
+mov r0, r1
+.balign 16
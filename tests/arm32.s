@@ -0,0 +1,106 @@
+# ARM encodings, compare with: llvm-mc -triple armv7 --show-encoding
+
+.syntax unified
+.text
+.arm
+start:
+mov r0, #1
+mov r0, #0x3FC
+mov r0, #0xF000000F
+mov r0, #0x104
+mov r1, r2
+mov r1, r2, lsl #3
+mov r1, r2, asr r3
+mvn r0, #0
+mov r0, #-2
+mov r0, #0x1234
+movs r0, r1
+add r0, r1, r2
+add r0, r1, #4
+add r0, #4
+add r0, r0, #-4
+adds r0, r1, r2, lsr #32
+sub sp, sp, #16
+rsb r0, r1, #0
+and r0, r1, #0xFFFFFF00
+orr r0, r1, r2, ror #8
+eor r0, r0, r1
+bic r0, r0, #0xFF
+cmp r0, #5
+cmp r0, #-5
+cmn r1, r2
+tst r0, #0x80000000
+teq r0, r1
+addeq r0, r1, r2
+movne r0, #1
+addseq r0, r1, r2
+lsl r0, r1, #3
+lsls r0, r1, r2
+asr r0, r1, #32
+ror r0, r1, #1
+mul r0, r1, r2
+mla r0, r1, r2, r3
+umull r0, r1, r2, r3
+smlal r0, r1, r2, r3
+clz r0, r1
+rev r0, r1
+uxtb r0, r1
+ldr r0, [r1]
+ldr r0, [r1, #4]
+ldr r0, [r1, #-4]
+ldr r0, [r1, #4]!
+ldr r0, [r1], #4
+ldr r0, [r1], #-4
+ldr r0, [r1, r2]
+ldr r0, [r1, r2, lsl #2]
+ldr r0, [r1, r2]!
+ldr r0, [r1], r2
+strb r0, [r1, #4095]
+ldrh r0, [r1, #2]
+ldrh r0, [r1, #-2]
+strh r0, [r1, r2]
+ldrsb r0, [r1, #255]
+ldrsh r0, [r1], #2
+push {r4-r11, lr}
+pop {r4-r11, pc}
+push {lr}
+pop {pc}
+ldm r0!, {r1, r2}
+stmdb sp!, {r0, r1}
+ldmib r0, {r1-r3}
+movw r0, #0xBEEF
+movt r0, #0xDEAD
+bx lr
+blx r3
+svc #0
+bkpt #0x1234
+nop
+wfi
+loop:
+b loop
+bne loop
+bl loop
+bleq loop
+ldr r0, back
+back:
+adr r1, back
+ldr r2, fwd
+adr r3, fwd
+b fwd
+fwd:
+nop
+
+ldr r0, =1
+ldr r0, =0xFFFFFFFE
+ldr r0, =0x1234
+ldr r0, =0x12345678
+ldr r1, =data
+ldr r2, =data+4
+ldr r3, =data
+.ltorg
+ldr r4, =0x12345678
+ldreq r5, =0xCAFEBABE
+.data
+data: .word 7
+.text
+ldr r6, =data
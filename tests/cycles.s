@@ -0,0 +1,26 @@
+# Timing sample: tcasm --cycles=cortex-m3 tests/cycles.s
+.syntax unified
+.text
+.thumb
+.global handler
+handler:
+  push {r4, r5, lr}
+  ldr r0, [r1]
+  adds r0, r0, #1
+  ldr r2, [r1, #4]
+  str r0, [r1]
+  movs r3, #8
+loop:
+  ldr r4, [r2]
+  ldr r5, [r4]
+  subs r3, #1
+  bne loop
+  bl helper
+  cmp r0, #0
+  beq done
+  muls r0, r1
+done:
+  pop {r4, r5, pc}
+helper:
+  mov r0, r1
+  bx lr
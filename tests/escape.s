@@ -0,0 +1,6 @@
+.data
+
+.ascii "tab\tnl\ncr\r", "quote\"bs\\"
+.asciz "oct\101\0\12hex\x41\x7e end"
+.string "it's \'fine\'"
+.asciz "a long line without any escape to exercise the bulk copy path"
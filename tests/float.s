@@ -0,0 +1,8 @@
+.data
+
+.float 1.5, -0.1, 3.4028235e38
+.single 0.70710678, 1e-45
+.double 0.7071067811865476, 2.2250738585072014e-308
+.double 1e400, -inf, 4.9406564584124654e-324
+
+.float 1.5x
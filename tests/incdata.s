@@ -0,0 +1,3 @@
+#included from include.s
+.ascii "inc"
+.incbin "inc.bin"
@@ -0,0 +1,7 @@
+#source inclusion, the same file is included twice
+.data
+
+.byte 1
+.include "incdata.s"
+.byte 2
+.include "incdata.s"
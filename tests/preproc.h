@@ -0,0 +1,3 @@
+// header for preproc.S
+#define HEADER_CONST \
+	0x1234
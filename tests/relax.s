@@ -0,0 +1,30 @@
+# Relaxation of forward Thumb references, compare with:
+# llvm-mc -triple thumbv7m -filetype=obj
+# Each reference starts narrow and only grows if its label is out of reach.
+
+.syntax unified
+.text
+.thumb
+
+start:
+    beq near            @ stays 16-bit
+    beq edge            @ reaches, until b far grows before its label
+    b far               @ grows to b.w
+    ldr r0, data        @ grows to ldr.w
+    adr r1, data        @ grows to adr.w
+    .space 244
+edge:
+    nop
+near:
+    .align 3            @ padding redone when the code before grows
+    nop
+    .space 2046
+    .align 2
+data:
+    .word 0x11223344
+    cbz r0, done
+    nop
+far:
+    b start
+done:
+    bx lr
@@ -0,0 +1,22 @@
+# Register aliases, compare with: llvm-mc -triple armv7 --show-encoding
+
+.syntax unified
+.text
+.thumb
+acc .req r4
+ptr .req r1
+cnt .req r2
+tmp .req acc
+loop:
+  ldr tmp, [ptr], #4
+  add acc, acc, tmp
+  subs cnt, #1
+  push {acc-r7, lr}
+  bne loop
+.unreq acc
+acc .req r5
+  add acc, acc, tmp
+  mov r0, acc
+.arm
+  mla acc, ptr, cnt, tmp
+  stmdb sp!, {ptr, cnt}
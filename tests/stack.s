@@ -0,0 +1,36 @@
+# Stack usage sample: tcasm --stack-usage tests/stack.s
+.syntax unified
+.text
+.thumb
+.global main
+main:
+  push {r4, r5, r6, lr}
+  sub sp, #16
+  movs r0, #1
+  bl leaf
+  cmp r0, #0
+  beq again
+  add sp, #16
+  pop {r4, r5, r6, pc}
+again:
+  bl mid
+  add sp, #16
+  pop {r4, r5, r6, pc}
+mid:
+  push {r7, lr}
+  sub sp, sp, #64
+  bl leaf
+  bl ext
+  add sp, sp, #64
+  pop {r7, pc}
+leaf:
+  str lr, [sp, #-8]!
+  ldr lr, [sp], #8
+  bx lr
+.global rec
+rec:
+  push {lr}
+  bl rec
+  blx r3
+  mov sp, r0
+  pop {pc}
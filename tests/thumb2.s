@@ -0,0 +1,89 @@
+# Thumb-2 encodings, compare with: llvm-mc -triple thumbv7m --show-encoding
+
+.syntax unified
+.text
+.thumb
+movs r0, #1
+movs r1, r2
+mov r8, r1
+mov.w r0, #0x12000000
+mov r0, #0x00AB00AB
+mvn r3, #0
+mov r0, #-2
+adds r0, r1, r2
+adds r0, r1, #3
+adds r3, #200
+add r0, r1, #4000
+subs r2, #1
+sub sp, #16
+add sp, #16
+add r0, sp, #8
+add r9, r9, r1
+lsls r0, r1, #3
+lsrs r0, r1, #32
+asrs r0, r0, r1
+lsl.w r0, r1, #3
+ands r0, r1
+and r0, r1, #0xFF00
+orr r0, r1, r2, lsl #4
+bic r0, r0, #0xFFFFFF00
+cmp r0, #5
+cmp r8, r1
+cmp.w r0, #-1
+tst r0, r1
+muls r0, r1, r0
+mul r0, r1, r2
+mla r0, r1, r2, r3
+umull r0, r1, r2, r3
+sdiv r0, r1, r2
+ldr r0, [r1]
+ldr r0, [r1, #124]
+ldr r0, [r1, #128]
+ldr r0, [r1, #-4]
+ldr r0, [r1, #4]!
+ldr r0, [r1], #4
+ldrb r0, [r1, #31]
+ldrh r0, [r1, #62]
+ldr r0, [sp, #8]
+str r0, [sp, #1020]
+ldr r0, [r1, r2]
+ldr r0, [r1, r2, lsl #2]
+strb r0, [r1, r2]
+push {r4-r7, lr}
+pop {r4-r7, pc}
+push {r4-r11, lr}
+pop.w {r8}
+ldmia r0!, {r1, r2}
+stmia r0!, {r1, r2}
+ldm r0, {r1, r2}
+ldm.w r0!, {r1, r8}
+movw r0, #0x1234
+movt r0, #0x5678
+bx lr
+blx r3
+nop
+nop.w
+svc #3
+bkpt #1
+cpsid i
+sxth r0, r1
+rev r0, r1
+loop:
+b loop
+beq loop
+bne.w loop
+bl loop
+cbz r0, fwd
+nop
+fwd:
+b.n fwd2
+nop
+fwd2:
+ldr r0, lit
+adr r1, lit
+ldr.w r2, lit
+adr.w r3, back
+back:
+nop
+.align 2
+lit: .word 0x12345678
@@ -0,0 +1,12 @@
+#tokenizer corner cases
+
+.data
+lbl :	.ascii "a@b\"c"  @ comment "x
+.byte 1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,0x18
+x:.byte 0x55@comment
+
+.text
+	push {r0, r1, lr}
+
+#incorrect
+	ldr r0, [r1
@@ -0,0 +1,251 @@
+/* line tokenizer for tcasm
+ *
+ * Each line is classified once: character class bitmasks (whitespace, and
+ * the special characters : , # [ ] { } " and the continuation comment char)
+ * are computed 16 bytes at a time with SSE2 or NEON, or with a lookup table
+ * elsewhere. Tokens are then extracted by jumping from one set bit to the
+ * next. The label, directive and instruction handlers use the resulting
+ * token array instead of scanning the text again.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "tcasm.h"
+
+/*****************************************************************************
+ * Definitions
+ *****************************************************************************/
+
+/* longest line: raw lines come from inbuf, preprocessed ones from ppout */
+
+#if CONFIG_ASM_PPBUF_SIZE > CONFIG_ASM_INBUF_SIZE
+#define TOKEN_LINE_MAX CONFIG_ASM_PPBUF_SIZE
+#else
+#define TOKEN_LINE_MAX CONFIG_ASM_INBUF_SIZE
+#endif
+
+#define TOKEN_MASKS ((TOKEN_LINE_MAX + 63) / 64)
+
+/*****************************************************************************
+ * Variables
+ *****************************************************************************/
+
+#if !defined(__SSE2__) && !defined(__ARM_NEON)
+
+/* character classes for the scalar classifier */
+
+#define CLS_WS      1
+#define CLS_SPECIAL 2
+
+static const uint8_t token_class[256] =
+{
+  [' ']  = CLS_WS,      ['\t'] = CLS_WS,      ['\r'] = CLS_WS,      ['\n'] = CLS_WS,
+  [':']  = CLS_SPECIAL, [',']  = CLS_SPECIAL, ['#']  = CLS_SPECIAL, ['"']  = CLS_SPECIAL,
+  ['[']  = CLS_SPECIAL, [']']  = CLS_SPECIAL, ['{']  = CLS_SPECIAL, ['}']  = CLS_SPECIAL,
+  [(uint8_t)CONFIG_ASM_COMMENT_CONT] = CLS_SPECIAL,
+};
+
+#endif
+
+/*****************************************************************************
+ * Functions
+ *****************************************************************************/
+
+#if defined(__ARM_NEON)
+static inline uint32_t token_movemask(uint8x16_t v)
+{
+  static const uint8_t weights[16] = {1,2,4,8,16,32,64,128,1,2,4,8,16,32,64,128};
+  uint8x16_t m = vandq_u8(v, vld1q_u8(weights));
+  uint8x8_t  p = vpadd_u8(vget_low_u8(m), vget_high_u8(m));
+  p = vpadd_u8(p, p);
+  p = vpadd_u8(p, p);
+  return vget_lane_u16(vreinterpret_u16_u8(p), 0);
+}
+#endif
+
+/*****************************************************************************/
+/* Compute the whitespace and special character masks of 16 bytes */
+
+static inline void token_classify16(const uint8_t *p, uint32_t *ws, uint32_t *special)
+{
+#if defined(__SSE2__)
+  __m128i v = _mm_loadu_si128((const __m128i *)p);
+  __m128i w = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                                        _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+                           _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')),
+                                        _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))));
+  __m128i s = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(':')),
+                                        _mm_cmpeq_epi8(v, _mm_set1_epi8(','))),
+                           _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('#')),
+                                        _mm_cmpeq_epi8(v, _mm_set1_epi8('"'))));
+  s = _mm_or_si128(s, _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('[')),
+                                                 _mm_cmpeq_epi8(v, _mm_set1_epi8(']'))),
+                                    _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('{')),
+                                                 _mm_cmpeq_epi8(v, _mm_set1_epi8('}')))));
+  s = _mm_or_si128(s, _mm_cmpeq_epi8(v, _mm_set1_epi8(CONFIG_ASM_COMMENT_CONT)));
+  *ws      = _mm_movemask_epi8(w);
+  *special = _mm_movemask_epi8(s);
+#elif defined(__ARM_NEON)
+  uint8x16_t v = vld1q_u8(p);
+  uint8x16_t w = vorrq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8(' ')), vceqq_u8(v, vdupq_n_u8('\t'))),
+                          vorrq_u8(vceqq_u8(v, vdupq_n_u8('\r')), vceqq_u8(v, vdupq_n_u8('\n'))));
+  uint8x16_t s = vorrq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8(':')), vceqq_u8(v, vdupq_n_u8(','))),
+                          vorrq_u8(vceqq_u8(v, vdupq_n_u8('#')), vceqq_u8(v, vdupq_n_u8('"'))));
+  s = vorrq_u8(s, vorrq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8('[')), vceqq_u8(v, vdupq_n_u8(']'))),
+                           vorrq_u8(vceqq_u8(v, vdupq_n_u8('{')), vceqq_u8(v, vdupq_n_u8('}')))));
+  s = vorrq_u8(s, vceqq_u8(v, vdupq_n_u8(CONFIG_ASM_COMMENT_CONT)));
+  *ws      = token_movemask(w);
+  *special = token_movemask(s);
+#else
+  int i;
+  *ws = 0;
+  *special = 0;
+  for (i = 0; i < 16; i++)
+    {
+      *ws      |= (uint32_t)(token_class[p[i]] & CLS_WS) << i;
+      *special |= (uint32_t)(token_class[p[i]] >> 1) << i;
+    }
+#endif
+}
+
+/*****************************************************************************/
+/* find the first set bit at or after pos in a mask array, or len */
+
+static inline int token_next(const uint64_t *mask, int pos, int len)
+{
+  uint64_t m;
+  int i = pos >> 6;
+
+  if (pos >= len)
+    {
+      return len;
+    }
+  m = mask[i] & (~0ULL << (pos & 63));
+  while (!m)
+    {
+      if (++i >= TOKEN_MASKS || (i << 6) >= len)
+        {
+          return len;
+        }
+      m = mask[i];
+    }
+  pos = (i << 6) + __builtin_ctzll(m);
+  return pos < len ? pos : len;
+}
+
+/*****************************************************************************/
+
+static inline void token_add(struct asm_token_s *tokens, int *ntokens, int type, int pos, int len)
+{
+  if (*ntokens < CONFIG_ASM_TOKENS)
+    {
+      struct asm_token_s *tok = &tokens[*ntokens];
+      tok->type = type;
+      tok->pos  = pos;
+      tok->len  = len;
+    }
+  (*ntokens)++;
+}
+
+/*****************************************************************************/
+/* Split a line in tokens. The line is not modified. Returns the offset of the
+ * end of the significant text, before the continuation comment and trailing
+ * spaces. *ntokens may be larger than CONFIG_ASM_TOKENS, in that case the
+ * extra tokens are counted but not stored.
+ * This does not use the assembler state and can run in any thread.
+ */
+
+int tokenize(struct asm_token_s *tokens, int *ntokens, const char *line, int len)
+{
+  uint64_t ws[TOKEN_MASKS];
+  uint64_t special[TOKEN_MASKS];
+  uint64_t boundary[TOKEN_MASKS];
+  uint8_t  tail[16];
+  uint32_t w, s;
+  int      pos, next, end, i;
+
+  if (len > TOKEN_LINE_MAX)
+    {
+      len = TOKEN_LINE_MAX;
+    }
+
+  /* classify, one pass */
+
+  memset(ws, 0, sizeof(ws));
+  memset(special, 0, sizeof(special));
+  for (i = 0; i < len; i += 16)
+    {
+      if (len - i >= 16)
+        {
+          token_classify16((const uint8_t *)line + i, &w, &s);
+        }
+      else
+        {
+          memset(tail, 0, sizeof(tail));
+          memcpy(tail, line + i, len - i);
+          token_classify16(tail, &w, &s);
+        }
+      ws[i >> 6]      |= (uint64_t)w << (i & 63);
+      special[i >> 6] |= (uint64_t)s << (i & 63);
+    }
+  for (i = 0; i < TOKEN_MASKS; i++)
+    {
+      boundary[i] = ws[i] | special[i];
+    }
+
+  /* extract tokens */
+
+  *ntokens = 0;
+  end = 0;
+  pos = 0;
+  while (pos < len)
+    {
+      next = token_next(boundary, pos, len);
+      if (next > pos)
+        {
+          /* a word: everything up to the next boundary */
+          token_add(tokens, ntokens, TOK_WORD, pos, next - pos);
+          pos = end = next;
+          continue;
+        }
+
+      if (ws[pos >> 6] & (1ULL << (pos & 63)))
+        {
+          pos++;
+          continue;
+        }
+
+      if (line[pos] == CONFIG_ASM_COMMENT_CONT)
+        {
+          break;
+        }
+
+      if (line[pos] == '"')
+        {
+          /* find the closing quote, skipping escaped ones */
+          next = pos + 1;
+          while (next < len && line[next] != '"')
+            {
+              next += (line[next] == '\\') ? 2 : 1;
+            }
+          next = (next < len) ? next + 1 : len;
+          token_add(tokens, ntokens, TOK_STRING, pos, next - pos);
+          pos = end = next;
+          continue;
+        }
+
+      token_add(tokens, ntokens, (uint8_t)line[pos], pos, 1);
+      pos = end = pos + 1;
+    }
+
+  return end;
+}